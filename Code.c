@@ -2,723 +2,8858 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-// Structure for a production
+// Building with -DCFG_METRICS counts work in the hot paths and writes a JSON
+// report next to the log. Otherwise COUNT expands to nothing and costs nothing.
+#ifdef CFG_METRICS
 typedef struct {
-    char* lhs;
-    char** rhs;
+    long arena_allocs;
+    long arena_bytes;
+    long arena_blocks;
+    long symbol_lookups;
+    long symbol_probes;
+    long symbols_added;
+    long productions_built;
+    long alternatives_built;
+    long bitset_unions;
+} Metrics;
+
+_Thread_local Metrics metrics;
+#define COUNT(counter, n) (metrics.counter += (n))
+#else
+#define COUNT(counter, n) ((void)0)
+#endif
+
+// Stage warnings, conflicts and summaries: stdout, or in batch mode the log of
+// the grammar a worker thread is processing
+_Thread_local FILE* messages;
+
+// Bump allocator. Memory comes from a chain of blocks and is only given back all
+// at once, so a pass allocates with a pointer bump and tears down in time
+// proportional to the number of blocks. used/peak count the bytes handed out.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char* data;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+    size_t block_size;
+    size_t used;
+    size_t peak;
+} Arena;
+
+#define ARENA_ALIGN 16
+
+void arena_init(Arena* a, size_t block_size) {
+    a->head = NULL;
+    a->block_size = block_size;
+    a->used = 0;
+    a->peak = 0;
+}
+
+ArenaBlock* arena_new_block(size_t size) {
+    ArenaBlock* b = malloc(sizeof(ArenaBlock) + size + ARENA_ALIGN);
+    if (!b) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    b->data = (char*)(((uintptr_t)(b + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+    COUNT(arena_blocks, 1);
+    return b;
+}
+
+void* arena_alloc(Arena* a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    COUNT(arena_allocs, 1);
+    COUNT(arena_bytes, size);
+    ArenaBlock* b = a->head;
+    if (!b || b->used + size > b->size) {
+        b = arena_new_block(size > a->block_size ? size : a->block_size);
+        b->next = a->head;
+        a->head = b;
+    }
+    void* p = b->data + b->used;
+    b->used += size;
+    a->used += size;
+    if (a->used > a->peak) a->peak = a->used;
+    return p;
+}
+
+void* arena_calloc(Arena* a, size_t count, size_t size) {
+    void* p = arena_alloc(a, count * size);
+    memset(p, 0, count * size);
+    return p;
+}
+
+// Grows the most recent allocation in place when there is room, otherwise copies
+void* arena_realloc(Arena* a, void* p, size_t old_size, size_t new_size) {
+    ArenaBlock* b = a->head;
+    size_t old_rounded = (old_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t new_rounded = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (p && b && (char*)p + old_rounded == b->data + b->used && b->used - old_rounded + new_rounded <= b->size) {
+        b->used = b->used - old_rounded + new_rounded;
+        a->used = a->used - old_rounded + new_rounded;
+        if (a->used > a->peak) a->peak = a->used;
+        return p;
+    }
+    void* q = arena_alloc(a, new_size);
+    if (p) memcpy(q, p, old_size < new_size ? old_size : new_size);
+    return q;
+}
+
+char* arena_strndup(Arena* a, const char* s, size_t len) {
+    char* p = arena_alloc(a, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+// Drops everything, peak included; a pass that needed several blocks gets one
+// block of the combined size, so a similar next pass allocates no blocks at all
+void arena_reset(Arena* a) {
+    if (a->head && a->head->next) {
+        size_t total = 0;
+        for (ArenaBlock* b = a->head; b;) {
+            ArenaBlock* next = b->next;
+            total += b->size;
+            free(b);
+            b = next;
+        }
+        a->head = arena_new_block(total);
+    }
+    if (a->head) a->head->used = 0;
+    a->used = 0;
+    a->peak = 0;
+}
+
+void arena_free(Arena* a) {
+    for (ArenaBlock* b = a->head; b;) {
+        ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->used = 0;
+}
+
+// Hash slots keep the full hash so that probes rarely touch the name strings
+typedef struct {
+    int id;
+    unsigned int hash;
+} SymbolBucket;
+
+// Symbol table: every grammar symbol name is interned once and referred to by id.
+// A terminal declared with %token carries the regular expression it is scanned by.
+// Names, patterns, productions and sets of a run live in the table's arena.
+typedef struct {
+    Arena* arena;
+    char** names;
+    char** patterns;
+    int* nt_index;
+    int* derived;
+    int count;
+    int capacity;
+    SymbolBucket* buckets;
+    int bucket_count;
+    int* nts;
+    int nt_count;
+    int nt_capacity;
+} SymbolTable;
+
+// Structure for a production; all alternatives are stored back to back in syms,
+// alternative j occupies syms[alt_start[j]] .. syms[alt_start[j + 1] - 1]
+typedef struct {
+    int lhs;
+    int* syms;
+    int* alt_start;
     int rhs_count;
 } Production;
 
-// Helper Functions
+// Growable buffer used to assemble the alternatives of a production. It lives in
+// a scratch arena and is reused: make_production copies it out and clears it.
+typedef struct {
+    Arena* arena;
+    int* syms;
+    int sym_count;
+    int sym_capacity;
+    int* alt_start;
+    int alt_count;
+    int alt_capacity;
+} AltBuffer;
+
+// Helper Functions
+
+
+unsigned int hash_symbol(const char* name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint64_t hash_bytes64(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void symtab_init(SymbolTable* st, Arena* arena) {
+    st->arena = arena;
+    st->capacity = 64;
+    st->count = 0;
+    st->names = malloc(st->capacity * sizeof(char*));
+    st->patterns = malloc(st->capacity * sizeof(char*));
+    st->nt_index = malloc(st->capacity * sizeof(int));
+    st->derived = malloc(st->capacity * sizeof(int));
+    st->bucket_count = 128;
+    st->buckets = malloc(st->bucket_count * sizeof(SymbolBucket));
+    memset(st->buckets, -1, st->bucket_count * sizeof(SymbolBucket));
+    st->nt_capacity = 64;
+    st->nt_count = 0;
+    st->nts = malloc(st->nt_capacity * sizeof(int));
+}
+
+void symtab_free(SymbolTable* st) {
+    free(st->names);
+    free(st->patterns);
+    free(st->nt_index);
+    free(st->derived);
+    free(st->buckets);
+    free(st->nts);
+}
+
+int find_symbol_n(const SymbolTable* st, const char* name, size_t len) {
+    unsigned int mask = st->bucket_count - 1;
+    unsigned int h = hash_symbol(name, len);
+    unsigned int b = h & mask;
+    COUNT(symbol_lookups, 1);
+    while (st->buckets[b].id != -1) {
+        COUNT(symbol_probes, 1);
+        int id = st->buckets[b].id;
+        if (st->buckets[b].hash == h && strncmp(st->names[id], name, len) == 0 && st->names[id][len] == '\0') return id;
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+int find_symbol(const SymbolTable* st, const char* name) {
+    return find_symbol_n(st, name, strlen(name));
+}
+
+void symtab_rehash(SymbolTable* st) {
+    SymbolBucket* old = st->buckets;
+    int old_count = st->bucket_count;
+    st->bucket_count *= 2;
+    st->buckets = malloc(st->bucket_count * sizeof(SymbolBucket));
+    memset(st->buckets, -1, st->bucket_count * sizeof(SymbolBucket));
+    unsigned int mask = st->bucket_count - 1;
+    for (int i = 0; i < old_count; i++) {
+        if (old[i].id == -1) continue;
+        unsigned int b = old[i].hash & mask;
+        while (st->buckets[b].id != -1) b = (b + 1) & mask;
+        st->buckets[b] = old[i];
+    }
+    free(old);
+}
+
+// Registers a name that already lives in the table's arena
+int add_symbol(SymbolTable* st, char* name, size_t len) {
+    if (st->count >= st->capacity) {
+        st->capacity *= 2;
+        st->names = realloc(st->names, st->capacity * sizeof(char*));
+        st->patterns = realloc(st->patterns, st->capacity * sizeof(char*));
+        st->nt_index = realloc(st->nt_index, st->capacity * sizeof(int));
+        st->derived = realloc(st->derived, st->capacity * sizeof(int));
+    }
+    int id = st->count++;
+    COUNT(symbols_added, 1);
+    st->names[id] = name;
+    st->patterns[id] = NULL;
+    st->nt_index[id] = -1;
+    st->derived[id] = 0;
+    unsigned int h = hash_symbol(name, len);
+    unsigned int mask = st->bucket_count - 1;
+    unsigned int b = h & mask;
+    while (st->buckets[b].id != -1) b = (b + 1) & mask;
+    st->buckets[b].id = id;
+    st->buckets[b].hash = h;
+    if (st->count * 2 > st->bucket_count) symtab_rehash(st);
+    return id;
+}
+
+int intern_symbol_n(SymbolTable* st, const char* name, size_t len) {
+    int id = find_symbol_n(st, name, len);
+    if (id != -1) return id;
+    return add_symbol(st, arena_strndup(st->arena, name, len), len);
+}
+
+int intern_symbol(SymbolTable* st, const char* name) {
+    return intern_symbol_n(st, name, strlen(name));
+}
+
+int add_nonterminal(SymbolTable* st, int sym) {
+    if (st->nt_index[sym] != -1) return st->nt_index[sym];
+    if (st->nt_count >= st->nt_capacity) {
+        st->nt_capacity *= 2;
+        st->nts = realloc(st->nts, st->nt_capacity * sizeof(int));
+    }
+    st->nts[st->nt_count] = sym;
+    st->nt_index[sym] = st->nt_count;
+    return st->nt_count++;
+}
+
+int is_terminal(int sym, const SymbolTable* st) {
+    return st->nt_index[sym] == -1;
+}
+
+// Fresh names are A', A'', A''' and then A'4, A'5, ...; derived[] remembers how
+// many were taken from each base so a new name costs one probe in the common case
+int generate_new_nt(SymbolTable* st, int base) {
+    const char* name = st->names[base];
+    size_t len = strlen(name);
+    char* candidate = arena_alloc(st->arena, len + 16);
+    memcpy(candidate, name, len);
+    size_t n;
+    do {
+        int k = ++st->derived[base];
+        n = len;
+        if (k <= 3) {
+            for (int i = 0; i < k; i++) candidate[n++] = '\'';
+        } else {
+            n += sprintf(candidate + n, "'%d", k);
+        }
+    } while (find_symbol_n(st, candidate, n) != -1);
+    candidate[n] = '\0';
+    int sym = add_symbol(st, candidate, n);
+    add_nonterminal(st, sym);
+    return sym;
+}
+
+int* alt_syms(const Production* p, int j) {
+    return p->syms + p->alt_start[j];
+}
+
+int alt_len(const Production* p, int j) {
+    return p->alt_start[j + 1] - p->alt_start[j];
+}
+
+void alt_buffer_init(AltBuffer* b, Arena* arena) {
+    b->arena = arena;
+    b->sym_capacity = 16;
+    b->sym_count = 0;
+    b->syms = arena_alloc(arena, b->sym_capacity * sizeof(int));
+    b->alt_capacity = 8;
+    b->alt_count = 0;
+    b->alt_start = arena_alloc(arena, (b->alt_capacity + 1) * sizeof(int));
+    b->alt_start[0] = 0;
+}
+
+void push_symbol(AltBuffer* b, int sym) {
+    if (b->sym_count >= b->sym_capacity) {
+        b->syms = arena_realloc(b->arena, b->syms, b->sym_capacity * sizeof(int), b->sym_capacity * 2 * sizeof(int));
+        b->sym_capacity *= 2;
+    }
+    b->syms[b->sym_count++] = sym;
+}
+
+void end_alternative(AltBuffer* b) {
+    if (b->alt_count >= b->alt_capacity) {
+        b->alt_start = arena_realloc(b->arena, b->alt_start, (b->alt_capacity + 1) * sizeof(int), (b->alt_capacity * 2 + 1) * sizeof(int));
+        b->alt_capacity *= 2;
+    }
+    b->alt_start[++b->alt_count] = b->sym_count;
+}
+
+void add_alternative(AltBuffer* b, const int* head, int head_len, const int* tail, int tail_len) {
+    for (int i = 0; i < head_len; i++) push_symbol(b, head[i]);
+    for (int i = 0; i < tail_len; i++) push_symbol(b, tail[i]);
+    end_alternative(b);
+}
+
+Production make_production(Arena* arena, int lhs, AltBuffer* b) {
+    Production p;
+    COUNT(productions_built, 1);
+    COUNT(alternatives_built, b->alt_count);
+    p.lhs = lhs;
+    p.rhs_count = b->alt_count;
+    p.syms = arena_alloc(arena, b->sym_count * sizeof(int));
+    memcpy(p.syms, b->syms, b->sym_count * sizeof(int));
+    p.alt_start = arena_alloc(arena, (b->alt_count + 1) * sizeof(int));
+    memcpy(p.alt_start, b->alt_start, (b->alt_count + 1) * sizeof(int));
+    b->sym_count = 0;
+    b->alt_count = 0;
+    return p;
+}
+
+// Grammar files are mapped and scanned in one pass. Symbols are runs of
+// non-blank characters, with '|' and '->' always standing alone; '#' at the
+// start of a symbol comments out the rest of the line. A production runs from
+// "NAME ->" to the next "NAME ->" or %token line, so its alternatives may be
+// spread over several lines.
+typedef struct {
+    const char* text;
+    size_t len;
+    int line;
+    int line_start;
+} GrammarWord;
+
+typedef struct {
+    const char* p;
+    const char* end;
+    int line;
+    int line_start;
+} GrammarScanner;
+
+GrammarWord next_grammar_word(GrammarScanner* gs) {
+    GrammarWord w;
+    const char* p = gs->p;
+    const char* end = gs->end;
+    while (p < end) {
+        if (*p == '\n') {
+            gs->line++;
+            gs->line_start = 1;
+            p++;
+        } else if (isspace((unsigned char)*p)) {
+            p++;
+        } else if (*p == '#') {
+            while (p < end && *p != '\n') p++;
+        } else {
+            break;
+        }
+    }
+    w.text = p;
+    w.line = gs->line;
+    w.line_start = gs->line_start;
+    gs->line_start = 0;
+    if (p < end && (*p == '|' || (*p == '-' && p + 1 < end && p[1] == '>'))) {
+        p += *p == '|' ? 1 : 2;
+    } else {
+        while (p < end && !isspace((unsigned char)*p) && *p != '|' && !(*p == '-' && p + 1 < end && p[1] == '>')) p++;
+    }
+    w.len = p - w.text;
+    gs->p = p;
+    return w;
+}
+
+int word_is(GrammarWord w, const char* s) {
+    return w.len == strlen(s) && memcmp(w.text, s, w.len) == 0;
+}
+
+void finish_production(Production** productions, int* prod_count, int* capacity, Arena* arena, int lhs, AltBuffer* rhs, int explicit_eps) {
+    if (rhs->sym_count > rhs->alt_start[rhs->alt_count] || explicit_eps) end_alternative(rhs);
+    if (*prod_count >= *capacity) {
+        *capacity *= 2;
+        *productions = realloc(*productions, *capacity * sizeof(Production));
+    }
+    (*productions)[*prod_count] = make_production(arena, lhs, rhs);
+    (*prod_count)++;
+}
+
+#define GRAMMAR_ERROR_SIZE 512
+
+// Parses size bytes of grammar text. Returns NULL, with the message in
+// error[GRAMMAR_ERROR_SIZE], on a syntax error.
+Production* parse_grammar_text(const char* text, size_t size, int* prod_count, SymbolTable* st, Arena* scratch, char* error) {
+    Production* productions = malloc(100 * sizeof(Production));
+    int capacity = 100;
+    *prod_count = 0;
+    GrammarScanner gs = {text, text + size, 1, 1};
+    GrammarWord cur = next_grammar_word(&gs);
+    GrammarWord next = next_grammar_word(&gs);
+    int lhs = -1;
+    int explicit_eps = 0;
+    AltBuffer rhs;
+    alt_buffer_init(&rhs, scratch);
+    while (cur.len > 0) {
+        // "%token NAME PATTERN" declares the regular expression a terminal is scanned by;
+        // the pattern is the rest of the line
+        if (cur.line_start && word_is(cur, "%token")) {
+            if (lhs != -1) finish_production(&productions, prod_count, &capacity, st->arena, lhs, &rhs, explicit_eps);
+            lhs = -1;
+            const char* pattern = gs.p;
+            const char* line_end = pattern;
+            while (line_end < gs.end && *line_end != '\n') line_end++;
+            while (pattern < line_end && isspace((unsigned char)*pattern)) pattern++;
+            const char* pattern_end = line_end;
+            while (pattern_end > pattern && isspace((unsigned char)pattern_end[-1])) pattern_end--;
+            if (next.len == 0 || next.line != cur.line || pattern == pattern_end) {
+                snprintf(error, GRAMMAR_ERROR_SIZE, "Error at line %d: %%token needs a name and a pattern", cur.line);
+                break;
+            }
+            int sym = intern_symbol_n(st, next.text, next.len);
+            st->patterns[sym] = arena_strndup(st->arena, pattern, pattern_end - pattern);
+            gs.p = line_end;
+            cur = next_grammar_word(&gs);
+            next = next_grammar_word(&gs);
+            continue;
+        }
+        if (word_is(next, "->") && !word_is(cur, "->") && !word_is(cur, "|")) {
+            if (lhs != -1) finish_production(&productions, prod_count, &capacity, st->arena, lhs, &rhs, explicit_eps);
+            lhs = intern_symbol_n(st, cur.text, cur.len);
+            add_nonterminal(st, lhs);
+            explicit_eps = 0;
+            cur = next_grammar_word(&gs);
+            next = next_grammar_word(&gs);
+            continue;
+        }
+        if (lhs == -1 || word_is(cur, "->")) {
+            snprintf(error, GRAMMAR_ERROR_SIZE, "Error at line %d: unexpected '%.*s'", cur.line, (int)cur.len, cur.text);
+            break;
+        }
+        if (word_is(cur, "|")) {
+            if (rhs.sym_count > rhs.alt_start[rhs.alt_count] || explicit_eps) end_alternative(&rhs);
+            explicit_eps = 0;
+        } else if (word_is(cur, "ε")) {
+            explicit_eps = 1;
+        } else {
+            push_symbol(&rhs, intern_symbol_n(st, cur.text, cur.len));
+        }
+        cur = next;
+        next = next_grammar_word(&gs);
+    }
+    if (cur.len > 0) {
+        free(productions);
+        return NULL;
+    }
+    if (lhs != -1) finish_production(&productions, prod_count, &capacity, st->arena, lhs, &rhs, explicit_eps);
+    return productions;
+}
+
+// Returns NULL, with the message in error[GRAMMAR_ERROR_SIZE], when the file
+// cannot be read or has a syntax error
+Production* parse_grammar(const char* filename, int* prod_count, SymbolTable* st, Arena* scratch, char* error) {
+    int fd = open(filename, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        if (fd >= 0) close(fd);
+        snprintf(error, GRAMMAR_ERROR_SIZE, "Error opening %s", filename);
+        return NULL;
+    }
+    size_t size = sb.st_size;
+    void* map = NULL;
+    const char* text = "";
+    if (size > 0) {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            snprintf(error, GRAMMAR_ERROR_SIZE, "Error mapping %s", filename);
+            return NULL;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        text = map;
+    }
+    close(fd);
+    Production* productions = parse_grammar_text(text, size, prod_count, st, scratch, error);
+    if (map) munmap(map, size);
+    return productions;
+}
+
+// Reads a whole file into a NUL-terminated buffer. A file that another process
+// truncates while it is mapped would fault, so the server copies the bytes
+// instead of mapping them.
+char* read_grammar_file(const char* filename, size_t* size, char* error) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        snprintf(error, GRAMMAR_ERROR_SIZE, "Error opening %s", filename);
+        return NULL;
+    }
+    size_t len = 0, capacity = 1 << 16;
+    char* text = malloc(capacity);
+    ssize_t n;
+    while ((n = read(fd, text + len, capacity - len - 1)) > 0) {
+        len += n;
+        if (capacity - len - 1 == 0) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        free(text);
+        snprintf(error, GRAMMAR_ERROR_SIZE, "Error reading %s", filename);
+        return NULL;
+    }
+    text[len] = '\0';
+    *size = len;
+    return text;
+}
+
+// For the modes that stop at the first grammar that does not parse
+Production* parse_grammar_or_exit(const char* filename, int* prod_count, SymbolTable* st, Arena* scratch) {
+    char error[GRAMMAR_ERROR_SIZE];
+    Production* productions = parse_grammar(filename, prod_count, st, scratch, error);
+    if (!productions) {
+        printf("%s\n", error);
+        exit(1);
+    }
+    return productions;
+}
+
+unsigned int hash_ints(const int* v, int n) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < n; i++) {
+        h ^= (unsigned int)v[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Interning table for integer vectors, used for DFA state sets, for the
+// transition signatures during minimization and by grammar reduction
+typedef struct {
+    int* data;
+    int data_count;
+    int data_capacity;
+    int* start;
+    int* length;
+    int count;
+    int capacity;
+    int* buckets;
+    int bucket_count;
+} VectorSet;
+
+void vector_set_init(VectorSet* vs) {
+    memset(vs, 0, sizeof(*vs));
+    vs->bucket_count = 64;
+    vs->buckets = malloc(vs->bucket_count * sizeof(int));
+    memset(vs->buckets, -1, vs->bucket_count * sizeof(int));
+}
+
+void vector_set_free(VectorSet* vs) {
+    free(vs->data);
+    free(vs->start);
+    free(vs->length);
+    free(vs->buckets);
+}
+
+int vector_set_find(const VectorSet* vs, const int* v, int n, unsigned int* slot) {
+    unsigned int mask = vs->bucket_count - 1;
+    unsigned int b = hash_ints(v, n) & mask;
+    while (vs->buckets[b] != -1) {
+        int id = vs->buckets[b];
+        if (vs->length[id] == n && (n == 0 || memcmp(vs->data + vs->start[id], v, n * sizeof(int)) == 0)) break;
+        b = (b + 1) & mask;
+    }
+    *slot = b;
+    return vs->buckets[b];
+}
+
+// Returns the id of v, adding it when new; *added tells which happened
+int vector_set_intern(VectorSet* vs, const int* v, int n, int* added) {
+    unsigned int slot;
+    int id = vector_set_find(vs, v, n, &slot);
+    *added = id == -1;
+    if (id != -1) return id;
+    if (vs->count >= vs->capacity) {
+        vs->capacity = vs->capacity ? vs->capacity * 2 : 64;
+        vs->start = realloc(vs->start, vs->capacity * sizeof(int));
+        vs->length = realloc(vs->length, vs->capacity * sizeof(int));
+    }
+    while (vs->data_count + n > vs->data_capacity) {
+        vs->data_capacity = vs->data_capacity ? vs->data_capacity * 2 : 256;
+        vs->data = realloc(vs->data, vs->data_capacity * sizeof(int));
+    }
+    id = vs->count++;
+    vs->start[id] = vs->data_count;
+    vs->length[id] = n;
+    if (n > 0) memcpy(vs->data + vs->data_count, v, n * sizeof(int));
+    vs->data_count += n;
+    vs->buckets[slot] = id;
+    if (vs->count * 2 > vs->bucket_count) {
+        free(vs->buckets);
+        vs->bucket_count *= 2;
+        vs->buckets = malloc(vs->bucket_count * sizeof(int));
+        memset(vs->buckets, -1, vs->bucket_count * sizeof(int));
+        for (int i = 0; i < vs->count; i++) {
+            vector_set_find(vs, vs->data + vs->start[i], vs->length[i], &slot);
+            vs->buckets[slot] = i;
+        }
+    }
+    return id;
+}
+
+// Grammar reduction (--reduce). A nonterminal is productive when one of its
+// alternatives uses only productive nonterminals, and reachable when the start
+// symbol leads to it through such alternatives. Anything else can never occur
+// in the derivation of a sentence, so it is removed with every alternative
+// that uses it. Productivity is found by counting each alternative's
+// occurrences of nonterminals not yet known to be productive, reachability by
+// a BFS; both are linear in the grammar size.
+//
+// Nonterminals are then merged when their sets of alternatives are the same up
+// to merged nonterminals. Classes start as one and are split by their members'
+// alternative sets until no class splits, so recursive pairs such as
+// A -> a A | b and B -> a B | b are merged too. A class keeps its lowest
+// nonterminal, so the start symbol stays, and alternatives that became equal
+// are kept once.
+typedef struct {
+    int unproductive;
+    int unreachable;
+    int merged;
+    int duplicates;
+    int alts_before;
+    int alts_after;
+} ReductionReport;
+
+// Encoded alternatives being sorted: a length followed by the symbols
+_Thread_local const int* sort_codes;
+
+int compare_encoded_alts(const void* a, const void* b) {
+    const int* x = sort_codes + *(const int*)a;
+    const int* y = sort_codes + *(const int*)b;
+    int len = x[0] < y[0] ? x[0] : y[0];
+    for (int k = 1; k <= len; k++) {
+        if (x[k] != y[k]) return x[k] < y[k] ? -1 : 1;
+    }
+    return x[0] - y[0];
+}
+
+// Table size the grammar would have: nonterminals by terminals plus the end marker
+long table_cells(const Production* productions, int prod_count, const SymbolTable* st, int* term_count, char* seen) {
+    int end_marker = find_symbol(st, "$");
+    memset(seen, 0, st->count);
+    *term_count = 0;
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        for (int k = 0; k < p->alt_start[p->rhs_count]; k++) {
+            int sym = p->syms[k];
+            if (is_terminal(sym, st) && !seen[sym]) {
+                seen[sym] = 1;
+                (*term_count)++;
+            }
+        }
+    }
+    if (end_marker == -1 || !seen[end_marker]) (*term_count)++;
+    return (long)st->nt_count * *term_count;
+}
+
+void reduce_grammar(Production** productions, int* prod_count, SymbolTable* st, Arena* scratch) {
+    int nt_count = st->nt_count;
+    ReductionReport report = {0};
+    int term_before, term_after;
+    char* seen = arena_alloc(scratch, st->count);
+    long cells_before = table_cells(*productions, *prod_count, st, &term_before, seen);
+
+    // Alternatives of all productions, grouped by nonterminal (a nonterminal
+    // may head several productions), with the nonterminals each one uses
+    int alt_count = 0;
+    for (int i = 0; i < *prod_count; i++) alt_count += (*productions)[i].rhs_count;
+    report.alts_before = alt_count;
+    int* nt_alt_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    int* occ_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    for (int i = 0; i < *prod_count; i++) {
+        const Production* p = &(*productions)[i];
+        nt_alt_start[st->nt_index[p->lhs] + 1] += p->rhs_count;
+        for (int k = 0; k < p->alt_start[p->rhs_count]; k++) {
+            if (!is_terminal(p->syms[k], st)) occ_start[st->nt_index[p->syms[k]] + 1]++;
+        }
+    }
+    for (int a = 0; a < nt_count; a++) {
+        nt_alt_start[a + 1] += nt_alt_start[a];
+        occ_start[a + 1] += occ_start[a];
+    }
+    int* alt_lhs = arena_alloc(scratch, (alt_count + 1) * sizeof(int));
+    const int** alt_sym = arena_alloc(scratch, (alt_count + 1) * sizeof(int*));
+    int* alt_length = arena_alloc(scratch, (alt_count + 1) * sizeof(int));
+    int* pending = arena_calloc(scratch, alt_count + 1, sizeof(int));
+    int* occ_alt = arena_alloc(scratch, (occ_start[nt_count] + 1) * sizeof(int));
+    int* alt_fill = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* occ_fill = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    memcpy(alt_fill, nt_alt_start, nt_count * sizeof(int));
+    memcpy(occ_fill, occ_start, nt_count * sizeof(int));
+    for (int i = 0; i < *prod_count; i++) {
+        const Production* p = &(*productions)[i];
+        int a = st->nt_index[p->lhs];
+        for (int j = 0; j < p->rhs_count; j++) {
+            int id = alt_fill[a]++;
+            alt_lhs[id] = a;
+            alt_sym[id] = alt_syms(p, j);
+            alt_length[id] = alt_len(p, j);
+            for (int k = 0; k < alt_length[id]; k++) {
+                if (is_terminal(alt_sym[id][k], st)) continue;
+                occ_alt[occ_fill[st->nt_index[alt_sym[id][k]]]++] = id;
+                pending[id]++;
+            }
+        }
+    }
+
+    // Productive: an alternative whose count drops to zero makes its lhs productive
+    char* productive = arena_calloc(scratch, nt_count + 1, 1);
+    char* reachable = arena_calloc(scratch, nt_count + 1, 1);
+    int* queue = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int head = 0, tail = 0;
+    for (int id = 0; id < alt_count; id++) {
+        if (pending[id] == 0 && !productive[alt_lhs[id]]) {
+            productive[alt_lhs[id]] = 1;
+            queue[tail++] = alt_lhs[id];
+        }
+    }
+    while (head < tail) {
+        int a = queue[head++];
+        for (int o = occ_start[a]; o < occ_start[a + 1]; o++) {
+            int id = occ_alt[o];
+            if (--pending[id] == 0 && !productive[alt_lhs[id]]) {
+                productive[alt_lhs[id]] = 1;
+                queue[tail++] = alt_lhs[id];
+            }
+        }
+    }
+    if (nt_count == 0 || !productive[0]) {
+        if (nt_count > 0) fprintf(messages, "Warning: %s derives no terminal string; the grammar is left as written\n", st->names[st->nts[0]]);
+        return;
+    }
+
+    // Reachable through alternatives that keep no unproductive nonterminal
+    head = tail = 0;
+    reachable[0] = 1;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int a = queue[head++];
+        for (int id = nt_alt_start[a]; id < nt_alt_start[a + 1]; id++) {
+            if (pending[id] != 0) continue;
+            for (int k = 0; k < alt_length[id]; k++) {
+                int sym = alt_sym[id][k];
+                if (is_terminal(sym, st) || reachable[st->nt_index[sym]]) continue;
+                reachable[st->nt_index[sym]] = 1;
+                queue[tail++] = st->nt_index[sym];
+            }
+        }
+    }
+    for (int a = 0; a < nt_count; a++) {
+        if (!productive[a]) report.unproductive++;
+        else if (!reachable[a]) report.unreachable++;
+    }
+
+    // Merging: refine classes of the kept nonterminals by their alternative
+    // sets, each alternative written with its nonterminals replaced by classes.
+    // Class ids are stable, so a round only recomputes the nonterminals that
+    // use one whose class changed. When a class splits, the part that still
+    // has the class's signature keeps the id, or else the largest part does;
+    // only the others move and wake their users.
+    int* cls = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* class_size = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* class_sig = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* class_dirty = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* class_keeper = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* group_of = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* group_size = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* group_class = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* group_sig = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* group_target = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* dirty = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* next_dirty = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int* queued = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    int class_count = 1;
+    int dirty_count = 0;
+    for (int a = 0; a < nt_count; a++) {
+        cls[a] = reachable[a] ? 0 : -1;
+        if (reachable[a]) dirty[dirty_count++] = a;
+    }
+    class_size[0] = dirty_count;
+    class_sig[0] = -1;
+    int code_size = 0;
+    for (int id = 0; id < alt_count; id++) code_size += alt_length[id] + 1;
+    int* codes = arena_alloc(scratch, (code_size + 1) * sizeof(int));
+    int* offsets = arena_alloc(scratch, (alt_count + 1) * sizeof(int));
+    int* signature = arena_alloc(scratch, (code_size + 1) * sizeof(int));
+    VectorSet sigs;
+    vector_set_init(&sigs);
+    for (int round = 1; dirty_count > 0; round++) {
+        VectorSet groups;
+        vector_set_init(&groups);
+        for (int i = 0; i < dirty_count; i++) {
+            class_dirty[cls[dirty[i]]] = 0;
+            class_keeper[cls[dirty[i]]] = -1;
+        }
+        for (int i = 0; i < dirty_count; i++) {
+            int a = dirty[i];
+            int n = 0, c = 0;
+            for (int id = nt_alt_start[a]; id < nt_alt_start[a + 1]; id++) {
+                if (pending[id] != 0) continue;
+                offsets[n++] = c;
+                codes[c++] = alt_length[id];
+                for (int k = 0; k < alt_length[id]; k++) {
+                    int sym = alt_sym[id][k];
+                    codes[c++] = is_terminal(sym, st) ? sym : -(cls[st->nt_index[sym]] + 1);
+                }
+            }
+            sort_codes = codes;
+            if (n > 1) qsort(offsets, n, sizeof(int), compare_encoded_alts);
+            int sig_len = 0;
+            for (int j = 0; j < n; j++) {
+                if (j > 0 && compare_encoded_alts(&offsets[j - 1], &offsets[j]) == 0) continue;
+                memcpy(signature + sig_len, codes + offsets[j], (codes[offsets[j]] + 1) * sizeof(int));
+                sig_len += codes[offsets[j]] + 1;
+            }
+            int added;
+            int key[2] = {cls[a], vector_set_intern(&sigs, signature, sig_len, &added)};
+            int g = vector_set_intern(&groups, key, 2, &added);
+            if (added) {
+                group_size[g] = 0;
+                group_class[g] = key[0];
+                group_sig[g] = key[1];
+            }
+            group_size[g]++;
+            group_of[i] = g;
+            class_dirty[key[0]]++;
+        }
+        for (int g = 0; g < groups.count; g++) {
+            if (group_sig[g] == class_sig[group_class[g]]) class_keeper[group_class[g]] = g;
+        }
+        for (int g = 0; g < groups.count; g++) {
+            int c = group_class[g], k = class_keeper[c];
+            if (class_dirty[c] == class_size[c] && (k == -1 || (group_sig[k] != class_sig[c] && group_size[g] > group_size[k]))) class_keeper[c] = g;
+        }
+        for (int g = 0; g < groups.count; g++) {
+            int c = group_class[g];
+            group_target[g] = class_keeper[c] == g ? c : class_count++;
+            class_sig[group_target[g]] = group_sig[g];
+            if (group_target[g] != c) class_size[group_target[g]] = 0;
+        }
+        int next_count = 0;
+        for (int i = 0; i < dirty_count; i++) {
+            int a = dirty[i], target = group_target[group_of[i]];
+            if (target == cls[a]) continue;
+            class_size[cls[a]]--;
+            class_size[target]++;
+            cls[a] = target;
+            for (int o = occ_start[a]; o < occ_start[a + 1]; o++) {
+                int user = alt_lhs[occ_alt[o]];
+                if (pending[occ_alt[o]] != 0 || cls[user] == -1 || queued[user] == round) continue;
+                queued[user] = round;
+                next_dirty[next_count++] = user;
+            }
+        }
+        vector_set_free(&groups);
+        int* swap = dirty;
+        dirty = next_dirty;
+        next_dirty = swap;
+        dirty_count = next_count;
+    }
+    vector_set_free(&sigs);
+    int* rep = arena_alloc(scratch, (class_count + 1) * sizeof(int));
+    memset(rep, -1, (class_count + 1) * sizeof(int));
+    for (int a = 0; a < nt_count; a++) {
+        if (cls[a] != -1 && rep[cls[a]] == -1) rep[cls[a]] = a;
+    }
+    report.merged = tail - class_count;
+
+    // One production per class, the nonterminals renumbered in their old order
+    int* old_nts = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    memcpy(old_nts, st->nts, nt_count * sizeof(int));
+    Production* reduced = malloc((class_count > 0 ? class_count : 1) * sizeof(Production));
+    AltBuffer rhs;
+    alt_buffer_init(&rhs, scratch);
+    // Alternatives are interned with their lhs in front, so a repeat is a duplicate
+    VectorSet alts;
+    vector_set_init(&alts);
+    int* mapped = arena_alloc(scratch, (code_size + 2) * sizeof(int));
+    int count = 0;
+    for (int a = 0; a < nt_count; a++) {
+        if (cls[a] == -1 || rep[cls[a]] != a) continue;
+        for (int id = nt_alt_start[a]; id < nt_alt_start[a + 1]; id++) {
+            if (pending[id] != 0) continue;
+            mapped[0] = a;
+            for (int k = 0; k < alt_length[id]; k++) {
+                int sym = alt_sym[id][k];
+                mapped[k + 1] = is_terminal(sym, st) ? sym : old_nts[rep[cls[st->nt_index[sym]]]];
+            }
+            int added;
+            vector_set_intern(&alts, mapped, alt_length[id] + 1, &added);
+            if (!added) {
+                report.duplicates++;
+                continue;
+            }
+            add_alternative(&rhs, mapped + 1, alt_length[id], NULL, 0);
+            report.alts_after++;
+        }
+        reduced[count++] = make_production(st->arena, old_nts[a], &rhs);
+    }
+    vector_set_free(&alts);
+    for (int a = 0; a < nt_count; a++) st->nt_index[old_nts[a]] = -1;
+    st->nt_count = 0;
+    for (int i = 0; i < count; i++) add_nonterminal(st, reduced[i].lhs);
+    free(*productions);
+    *productions = reduced;
+    *prod_count = count;
+
+    long cells_after = table_cells(*productions, *prod_count, st, &term_after, seen);
+    fprintf(messages, "Reduction: removed %d unproductive, %d unreachable and %d merged nonterminals and %d duplicate alternatives (%d -> %d alternatives)\n",
+            report.unproductive, report.unreachable, report.merged, report.duplicates, report.alts_before, report.alts_after);
+    fprintf(messages, "Reduction: table %d x %d -> %d x %d (%ld -> %ld cells, %.1f%% smaller)\n", nt_count, term_before, st->nt_count, term_after, cells_before,
+            cells_after, cells_before > 0 ? 100.0 * (cells_before - cells_after) / cells_before : 0.0);
+}
+
+// Prefix trie over the alternatives of one production. Children keep the order
+// in which alternatives first reach them, and the end of an alternative is a
+// child with symbol -1, so every path from the root ends in such a leaf.
+// Children are found through a hash on (parent, symbol).
+typedef struct {
+    int symbol;
+    int parent;
+    int first_child;
+    int last_child;
+    int next_sibling;
+    int child_count;
+} TrieNode;
+
+typedef struct {
+    TrieNode* nodes;
+    int node_count;
+    int* slots;
+    unsigned int slot_mask;
+} AltTrie;
+
+void trie_init(AltTrie* t, Arena* arena, int max_nodes) {
+    unsigned int slot_count = 16;
+    while (slot_count < (unsigned int)max_nodes * 2) slot_count *= 2;
+    t->nodes = arena_alloc(arena, max_nodes * sizeof(TrieNode));
+    t->slots = arena_alloc(arena, slot_count * sizeof(int));
+    memset(t->slots, -1, slot_count * sizeof(int));
+    t->slot_mask = slot_count - 1;
+    t->node_count = 1;
+    t->nodes[0] = (TrieNode){-1, -1, -1, -1, -1, 0};
+}
+
+int trie_child(AltTrie* t, int parent, int symbol) {
+    unsigned int h = (unsigned int)parent * 2654435761u ^ (unsigned int)(symbol + 1) * 2246822519u;
+    unsigned int b = (h ^ (h >> 15)) & t->slot_mask;
+    while (t->slots[b] != -1) {
+        const TrieNode* n = &t->nodes[t->slots[b]];
+        if (n->parent == parent && n->symbol == symbol) return t->slots[b];
+        b = (b + 1) & t->slot_mask;
+    }
+    int id = t->node_count++;
+    t->nodes[id] = (TrieNode){symbol, parent, -1, -1, -1, 0};
+    TrieNode* p = &t->nodes[parent];
+    if (p->last_child == -1) p->first_child = id;
+    else t->nodes[p->last_child].next_sibling = id;
+    p->last_child = id;
+    p->child_count++;
+    t->slots[b] = id;
+    return id;
+}
+
+// Factors each production through its trie: an edge chain without branches is
+// one shared prefix, and every branching node below the root becomes a fresh
+// nonterminal whose alternatives are that node's children. Nested factoring is
+// thus a walk over the trie, with the fresh nonterminals handled in FIFO order.
+// When selected is set, only the productions it flags are factored.
+void factor_productions(Production** productions, int* prod_count, const char* selected, SymbolTable* st, Arena* scratch) {
+    int original_count = *prod_count;
+    int added_count = 0, added_capacity = 16;
+    Production* added = arena_alloc(scratch, added_capacity * sizeof(Production));
+    AltBuffer rhs;
+    alt_buffer_init(&rhs, scratch);
+    for (int i = 0; i < original_count; i++) {
+        if (selected && !selected[i]) continue;
+        Production* p = &(*productions)[i];
+        int A = p->lhs;
+        int sym_total = p->alt_start[p->rhs_count];
+        AltTrie trie;
+        trie_init(&trie, scratch, 1 + sym_total + p->rhs_count);
+        for (int j = 0; j < p->rhs_count; j++) {
+            int node = 0;
+            const int* syms = alt_syms(p, j);
+            for (int k = 0; k < alt_len(p, j); k++) node = trie_child(&trie, node, syms[k]);
+            trie_child(&trie, node, -1);
+        }
+
+        // pending[] holds (trie node, nonterminal) pairs still to be emitted
+        int* pending = arena_alloc(scratch, 2 * trie.node_count * sizeof(int));
+        int* path = arena_alloc(scratch, (sym_total + 1) * sizeof(int));
+        int head = 0, tail = 0;
+        pending[tail++] = 0;
+        pending[tail++] = A;
+        while (head < tail) {
+            int node = pending[head++];
+            int X = pending[head++];
+            for (int c = trie.nodes[node].first_child; c != -1; c = trie.nodes[c].next_sibling) {
+                int n = c;
+                int path_len = 0;
+                while (trie.nodes[n].symbol != -1) {
+                    path[path_len++] = trie.nodes[n].symbol;
+                    if (trie.nodes[n].child_count != 1) break;
+                    n = trie.nodes[n].first_child;
+                }
+                if (trie.nodes[n].symbol != -1) {
+                    int X_prime = generate_new_nt(st, A);
+                    path[path_len++] = X_prime;
+                    pending[tail++] = n;
+                    pending[tail++] = X_prime;
+                }
+                add_alternative(&rhs, path, path_len, NULL, 0);
+            }
+            if (X == A) {
+                (*productions)[i] = make_production(st->arena, A, &rhs);
+                continue;
+            }
+            if (added_count >= added_capacity) {
+                added = arena_realloc(scratch, added, added_capacity * sizeof(Production), added_capacity * 2 * sizeof(Production));
+                added_capacity *= 2;
+            }
+            added[added_count++] = make_production(st->arena, X, &rhs);
+        }
+    }
+    if (added_count > 0) {
+        *productions = realloc(*productions, (*prod_count + added_count) * sizeof(Production));
+        memcpy(*productions + *prod_count, added, added_count * sizeof(Production));
+        *prod_count += added_count;
+    }
+}
+
+void left_factoring(Production** productions, int* prod_count, SymbolTable* st, Arena* scratch) {
+    factor_productions(productions, prod_count, NULL, st, scratch);
+}
+
+// Dense terminal-indexed bitsets. Rows are padded to a multiple of four words so
+// the vector loops in bitset_union never need a scalar tail.
+typedef struct {
+    uint64_t* bits;
+    int rows;
+    int words;
+} BitMatrix;
+
+int bitset_words(int bit_count) {
+    int words = (bit_count + 63) / 64;
+    return (words + 3) & ~3;
+}
+
+BitMatrix bitmatrix_new(Arena* arena, int rows, int bit_count) {
+    BitMatrix m;
+    m.rows = rows;
+    m.words = bitset_words(bit_count);
+    m.bits = arena_calloc(arena, (size_t)(rows > 0 ? rows : 1) * m.words, sizeof(uint64_t));
+    return m;
+}
+
+uint64_t* bitset_row(const BitMatrix* m, int row) {
+    return m->bits + (size_t)row * m->words;
+}
+
+int bitset_test(const uint64_t* set, int bit) {
+    return (set[bit >> 6] >> (bit & 63)) & 1;
+}
+
+int bitset_add(uint64_t* set, int bit) {
+    uint64_t mask = 1ULL << (bit & 63);
+    if (set[bit >> 6] & mask) return 0;
+    set[bit >> 6] |= mask;
+    return 1;
+}
+
+// Unions src into dst and reports whether dst gained any element
+int bitset_union(uint64_t* dst, const uint64_t* src, int words) {
+    COUNT(bitset_unions, 1);
+#if defined(__AVX2__)
+    __m256i gained = _mm256_setzero_si256();
+    for (int w = 0; w < words; w += 4) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + w));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + w));
+        gained = _mm256_or_si256(gained, _mm256_andnot_si256(d, s));
+        _mm256_storeu_si256((__m256i*)(dst + w), _mm256_or_si256(d, s));
+    }
+    return !_mm256_testz_si256(gained, gained);
+#elif defined(__SSE2__)
+    __m128i gained = _mm_setzero_si128();
+    for (int w = 0; w < words; w += 2) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + w));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + w));
+        gained = _mm_or_si128(gained, _mm_andnot_si128(d, s));
+        _mm_storeu_si128((__m128i*)(dst + w), _mm_or_si128(d, s));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(gained, _mm_setzero_si128())) != 0xFFFF;
+#else
+    uint64_t gained = 0;
+    for (int w = 0; w < words; w++) {
+        gained |= src[w] & ~dst[w];
+        dst[w] |= src[w];
+    }
+    return gained != 0;
+#endif
+}
+
+// Returns the first element >= from, or -1 when there is none
+int bitset_next(const uint64_t* set, int words, int from) {
+    int w = from >> 6;
+    if (w >= words) return -1;
+    uint64_t x = set[w] & (~0ULL << (from & 63));
+    while (!x) {
+        if (++w >= words) return -1;
+        x = set[w];
+    }
+    return w * 64 + __builtin_ctzll(x);
+}
+
+int bitset_count(const uint64_t* set, int words) {
+    int count = 0;
+    for (int w = 0; w < words; w++) count += __builtin_popcountll(set[w]);
+    return count;
+}
+
+// Adjacency lists in compressed form: the successors of node v are
+// edges[edge_start[v]] .. edges[edge_start[v + 1] - 1]
+typedef struct {
+    int node_count;
+    int* edge_start;
+    int* edges;
+} DepGraph;
+
+typedef struct {
+    Arena* arena;
+    int* src;
+    int* dst;
+    int count;
+    int capacity;
+} EdgeList;
+
+void add_edge(EdgeList* list, int src, int dst) {
+    if (list->count >= list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        list->src = arena_realloc(list->arena, list->src, list->capacity * sizeof(int), capacity * sizeof(int));
+        list->dst = arena_realloc(list->arena, list->dst, list->capacity * sizeof(int), capacity * sizeof(int));
+        list->capacity = capacity;
+    }
+    list->src[list->count] = src;
+    list->dst[list->count] = dst;
+    list->count++;
+}
+
+// The graph is allocated from the edge list's arena
+DepGraph build_graph(int node_count, EdgeList* list) {
+    Arena* arena = list->arena;
+    DepGraph g;
+    g.node_count = node_count;
+    g.edge_start = arena_calloc(arena, node_count + 1, sizeof(int));
+    g.edges = arena_alloc(arena, (list->count > 0 ? list->count : 1) * sizeof(int));
+    for (int e = 0; e < list->count; e++) g.edge_start[list->src[e] + 1]++;
+    for (int v = 0; v < node_count; v++) g.edge_start[v + 1] += g.edge_start[v];
+    int* fill = arena_alloc(arena, (node_count > 0 ? node_count : 1) * sizeof(int));
+    memcpy(fill, g.edge_start, node_count * sizeof(int));
+    for (int e = 0; e < list->count; e++) g.edges[fill[list->src[e]]++] = list->dst[e];
+    return g;
+}
+
+// Strongly connected components, listed so that every component comes after
+// all components it has edges into (reverse topological order)
+typedef struct {
+    int count;
+    int* scc_start;
+    int* members;
+    int* scc_of;
+} SccList;
+
+SccList find_sccs(const DepGraph* g, Arena* arena) {
+    int n = g->node_count;
+    int size = n > 0 ? n : 1;
+    SccList s;
+    s.count = 0;
+    s.scc_start = arena_alloc(arena, (n + 1) * sizeof(int));
+    s.members = arena_alloc(arena, size * sizeof(int));
+    s.scc_of = arena_alloc(arena, size * sizeof(int));
+    int* index = arena_alloc(arena, size * sizeof(int));
+    int* low = arena_alloc(arena, size * sizeof(int));
+    int* stack = arena_alloc(arena, size * sizeof(int));
+    int* call = arena_alloc(arena, size * sizeof(int));
+    int* next_edge = arena_alloc(arena, size * sizeof(int));
+    for (int v = 0; v < n; v++) index[v] = -1;
+    int counter = 0, sp = 0, emitted = 0;
+    s.scc_start[0] = 0;
+    // Iterative Tarjan; call[] is the DFS path and next_edge[] its resume points
+    for (int root = 0; root < n; root++) {
+        if (index[root] != -1) continue;
+        int depth = 0;
+        call[depth++] = root;
+        index[root] = low[root] = counter++;
+        next_edge[root] = g->edge_start[root];
+        stack[sp++] = root;
+        s.scc_of[root] = -1;
+        while (depth > 0) {
+            int v = call[depth - 1];
+            if (next_edge[v] < g->edge_start[v + 1]) {
+                int w = g->edges[next_edge[v]++];
+                if (index[w] == -1) {
+                    index[w] = low[w] = counter++;
+                    next_edge[w] = g->edge_start[w];
+                    stack[sp++] = w;
+                    s.scc_of[w] = -1;
+                    call[depth++] = w;
+                } else if (s.scc_of[w] == -1 && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+            depth--;
+            if (depth > 0 && low[v] < low[call[depth - 1]]) low[call[depth - 1]] = low[v];
+            if (low[v] == index[v]) {
+                int w;
+                do {
+                    w = stack[--sp];
+                    s.scc_of[w] = s.count;
+                    s.members[emitted++] = w;
+                } while (w != v);
+                s.scc_start[++s.count] = emitted;
+            }
+        }
+    }
+    return s;
+}
+
+// Work counters of the set solvers; a visit is one node or edge examined
+typedef struct {
+    long nullable_visits;
+    int first_sccs;
+    long first_visits;
+    int follow_sccs;
+    long follow_visits;
+} SolverStats;
+
+// Threads used inside the stages of one grammar (--threads): the FIRST/FOLLOW
+// solver runs independent components concurrently, and the LL(1) table is
+// filled in row ranges. Small grammars stay on one thread either way.
+int stage_threads = 1;
+
+typedef struct {
+    void (*fn)(void*);
+    void* arg;
+#ifdef CFG_METRICS
+    Metrics counters;
+#endif
+} ThreadTask;
+
+void* run_thread_task(void* arg) {
+    ThreadTask* task = arg;
+    task->fn(task->arg);
+#ifdef CFG_METRICS
+    task->counters = metrics;
+#endif
+    return NULL;
+}
+
+// Calls fn on each of count arguments laid out arg_size bytes apart, one
+// thread per argument with the first on the calling thread. Hot-path counters
+// of the other threads are added to the caller's.
+void run_threads(int count, void (*fn)(void*), void* args, size_t arg_size) {
+    pthread_t threads[count > 1 ? count - 1 : 1];
+    ThreadTask tasks[count > 1 ? count - 1 : 1];
+    for (int i = 1; i < count; i++) {
+        tasks[i - 1] = (ThreadTask){0};
+        tasks[i - 1].fn = fn;
+        tasks[i - 1].arg = (char*)args + i * arg_size;
+        if (pthread_create(&threads[i - 1], NULL, run_thread_task, &tasks[i - 1]) != 0) {
+            printf("Error starting worker thread\n");
+            exit(1);
+        }
+    }
+    fn(args);
+    for (int i = 1; i < count; i++) {
+        pthread_join(threads[i - 1], NULL);
+#ifdef CFG_METRICS
+        long* total = (long*)&metrics;
+        const long* part = (const long*)&tasks[i - 1].counters;
+        for (size_t k = 0; k < sizeof(Metrics) / sizeof(long); k++) total[k] += part[k];
+#endif
+    }
+}
+
+// Unions the sets of a component's members and of everything they point to
+// outside it, and gives every member the result
+void settle_component(const DepGraph* g, const SccList* sccs, BitMatrix* sets, int c, uint64_t* acc, long* visits) {
+    memset(acc, 0, sets->words * sizeof(uint64_t));
+    for (int m = sccs->scc_start[c]; m < sccs->scc_start[c + 1]; m++) {
+        int v = sccs->members[m];
+        bitset_union(acc, bitset_row(sets, v), sets->words);
+        (*visits)++;
+        for (int e = g->edge_start[v]; e < g->edge_start[v + 1]; e++) {
+            int w = g->edges[e];
+            if (sccs->scc_of[w] != c) bitset_union(acc, bitset_row(sets, w), sets->words);
+            (*visits)++;
+        }
+    }
+    for (int m = sccs->scc_start[c]; m < sccs->scc_start[c + 1]; m++) {
+        memcpy(bitset_row(sets, sccs->members[m]), acc, sets->words * sizeof(uint64_t));
+    }
+}
+
+// Components at one level (one more than the highest level they point to) only
+// read settled sets and write their own rows, so a level is settled by all
+// threads at once, claiming chunks of components with an atomic counter. Runs
+// of levels too narrow to share are settled by thread 0 alone, and a barrier
+// separates one step from the next.
+#define LEVEL_CHUNK 16
+#define PARALLEL_MIN_COMPONENTS 1024
+
+typedef struct {
+    const DepGraph* g;
+    const SccList* sccs;
+    BitMatrix* sets;
+    const int* order;
+    const int* step_start;
+    const char* step_shared;
+    int* claimed;
+    int step_count;
+    pthread_barrier_t barrier;
+} LevelSolve;
+
+typedef struct {
+    LevelSolve* solve;
+    int id;
+    uint64_t* acc;
+    long visits;
+} LevelWorker;
+
+void solve_levels(void* arg) {
+    LevelWorker* w = arg;
+    LevelSolve* s = w->solve;
+    for (int k = 0; k < s->step_count; k++) {
+        if (s->step_shared[k]) {
+            int i;
+            while ((i = __atomic_fetch_add(&s->claimed[k], LEVEL_CHUNK, __ATOMIC_RELAXED)) < s->step_start[k + 1]) {
+                int end = i + LEVEL_CHUNK < s->step_start[k + 1] ? i + LEVEL_CHUNK : s->step_start[k + 1];
+                for (; i < end; i++) settle_component(s->g, s->sccs, s->sets, s->order[i], w->acc, &w->visits);
+            }
+        } else if (w->id == 0) {
+            for (int i = s->step_start[k]; i < s->step_start[k + 1]; i++) {
+                settle_component(s->g, s->sccs, s->sets, s->order[i], w->acc, &w->visits);
+            }
+        }
+        pthread_barrier_wait(&s->barrier);
+    }
+}
+
+void solve_components_in_parallel(const DepGraph* g, const SccList* sccs, BitMatrix* sets, int thread_count, Arena* scratch, long* visits) {
+    int count = sccs->count;
+    int* level = arena_alloc(scratch, count * sizeof(int));
+    int level_count = 0;
+    for (int c = 0; c < count; c++) {
+        level[c] = 0;
+        for (int m = sccs->scc_start[c]; m < sccs->scc_start[c + 1]; m++) {
+            int v = sccs->members[m];
+            for (int e = g->edge_start[v]; e < g->edge_start[v + 1]; e++) {
+                int d = sccs->scc_of[g->edges[e]];
+                if (d != c && level[d] + 1 > level[c]) level[c] = level[d] + 1;
+            }
+        }
+        if (level[c] + 1 > level_count) level_count = level[c] + 1;
+    }
+    int* level_start = arena_calloc(scratch, level_count + 1, sizeof(int));
+    for (int c = 0; c < count; c++) level_start[level[c] + 1]++;
+    for (int l = 0; l < level_count; l++) level_start[l + 1] += level_start[l];
+    int* order = arena_alloc(scratch, count * sizeof(int));
+    int* fill = arena_alloc(scratch, level_count * sizeof(int));
+    memcpy(fill, level_start, level_count * sizeof(int));
+    for (int c = 0; c < count; c++) order[fill[level[c]]++] = c;
+
+    LevelSolve s;
+    s.g = g;
+    s.sccs = sccs;
+    s.sets = sets;
+    s.order = order;
+    int* step_start = arena_alloc(scratch, (level_count + 1) * sizeof(int));
+    char* step_shared = arena_alloc(scratch, level_count);
+    s.step_count = 0;
+    for (int l = 0; l < level_count; l++) {
+        int shared = level_start[l + 1] - level_start[l] >= LEVEL_CHUNK * thread_count;
+        if (shared || s.step_count == 0 || step_shared[s.step_count - 1]) {
+            step_start[s.step_count] = level_start[l];
+            step_shared[s.step_count++] = shared;
+        }
+    }
+    step_start[s.step_count] = count;
+    s.step_start = step_start;
+    s.step_shared = step_shared;
+    s.claimed = arena_alloc(scratch, (s.step_count > 0 ? s.step_count : 1) * sizeof(int));
+    memcpy(s.claimed, step_start, s.step_count * sizeof(int));
+    pthread_barrier_init(&s.barrier, NULL, thread_count);
+
+    // Accumulators are a cache line apart so workers never share one
+    int acc_words = (sets->words + 7) & ~7;
+    LevelWorker* workers = arena_alloc(scratch, thread_count * sizeof(LevelWorker));
+    for (int t = 0; t < thread_count; t++) {
+        workers[t].solve = &s;
+        workers[t].id = t;
+        workers[t].acc = arena_alloc(scratch, (acc_words + 8) * sizeof(uint64_t));
+        workers[t].visits = 0;
+    }
+    run_threads(thread_count, solve_levels, workers, sizeof(LevelWorker));
+    pthread_barrier_destroy(&s.barrier);
+    for (int t = 0; t < thread_count; t++) *visits += workers[t].visits;
+}
+
+// Solves sets[v] = sets[v] U sets[w] for every edge v -> w in a single pass over
+// the condensed graph. Members of one component always end up with equal sets,
+// so each component is settled once its successors are, with no re-sweeps.
+void solve_set_equations(const DepGraph* g, BitMatrix* sets, Arena* scratch, int* scc_count, long* visits) {
+    SccList sccs = find_sccs(g, scratch);
+    *scc_count = sccs.count;
+    if (stage_threads > 1 && sccs.count >= PARALLEL_MIN_COMPONENTS) {
+        solve_components_in_parallel(g, &sccs, sets, stage_threads, scratch, visits);
+        return;
+    }
+    uint64_t* acc = arena_alloc(scratch, sets->words * sizeof(uint64_t));
+    for (int c = 0; c < sccs.count; c++) settle_component(g, &sccs, sets, c, acc, visits);
+}
+
+int is_alpha_nullable(const int* syms, int len, const SymbolTable* st, const int* nullable) {
+    for (int k = 0; k < len; k++) {
+        if (is_terminal(syms[k], st) || !nullable[st->nt_index[syms[k]]]) return 0;
+    }
+    return 1;
+}
+
+// Worklist nullable: each alternative counts its symbols not yet known to be
+// nullable, and a nonterminal becoming nullable only touches its occurrences
+int* compute_nullable(Production* productions, int prod_count, const SymbolTable* st, Arena* scratch, SolverStats* stats) {
+    int nt_count = st->nt_count;
+    int* nullable = arena_calloc(st->arena, nt_count > 0 ? nt_count : 1, sizeof(int));
+    int alt_count = 0;
+    for (int i = 0; i < prod_count; i++) alt_count += productions[i].rhs_count;
+    int* remaining = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    int* alt_lhs = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    int* worklist = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * sizeof(int));
+    int head = 0, tail = 0;
+    EdgeList occurrences = {scratch, NULL, NULL, 0, 0};
+    int a = 0;
+    for (int i = 0; i < prod_count; i++) {
+        Production* p = &productions[i];
+        int A_idx = st->nt_index[p->lhs];
+        for (int j = 0; j < p->rhs_count; j++, a++) {
+            int* syms = alt_syms(p, j);
+            int len = alt_len(p, j);
+            alt_lhs[a] = A_idx;
+            remaining[a] = len;
+            for (int k = 0; k < len; k++) {
+                if (is_terminal(syms[k], st)) remaining[a] = -1;
+            }
+            if (remaining[a] > 0) {
+                for (int k = 0; k < len; k++) add_edge(&occurrences, st->nt_index[syms[k]], a);
+            } else if (remaining[a] == 0 && !nullable[A_idx]) {
+                nullable[A_idx] = 1;
+                worklist[tail++] = A_idx;
+            }
+            stats->nullable_visits++;
+        }
+    }
+    DepGraph occ = build_graph(nt_count, &occurrences);
+    while (head < tail) {
+        int B_idx = worklist[head++];
+        for (int e = occ.edge_start[B_idx]; e < occ.edge_start[B_idx + 1]; e++) {
+            int alt = occ.edges[e];
+            stats->nullable_visits++;
+            if (--remaining[alt] == 0 && !nullable[alt_lhs[alt]]) {
+                nullable[alt_lhs[alt]] = 1;
+                worklist[tail++] = alt_lhs[alt];
+            }
+        }
+    }
+    return nullable;
+}
+
+// Edge A -> B when B can begin an alternative of A, i.e. follows only nullable symbols
+DepGraph left_corner_graph(const Production* productions, int prod_count, const SymbolTable* st, const int* nullable, Arena* scratch) {
+    EdgeList corners = {scratch, NULL, NULL, 0, 0};
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        int A_idx = st->nt_index[p->lhs];
+        for (int j = 0; j < p->rhs_count; j++) {
+            const int* syms = alt_syms(p, j);
+            for (int k = 0; k < alt_len(p, j) && !is_terminal(syms[k], st); k++) {
+                add_edge(&corners, A_idx, st->nt_index[syms[k]]);
+                if (!nullable[st->nt_index[syms[k]]]) break;
+            }
+        }
+    }
+    return build_graph(st->nt_count, &corners);
+}
+
+// A component is cyclic if it has several members or a self edge
+int* cyclic_components(const DepGraph* g, const SccList* sccs, Arena* arena) {
+    int* cyclic = arena_calloc(arena, sccs->count > 0 ? sccs->count : 1, sizeof(int));
+    for (int c = 0; c < sccs->count; c++) {
+        int v = sccs->members[sccs->scc_start[c]];
+        cyclic[c] = sccs->scc_start[c + 1] - sccs->scc_start[c] > 1;
+        for (int e = g->edge_start[v]; e < g->edge_start[v + 1]; e++) {
+            if (g->edges[e] == v) cyclic[c] = 1;
+        }
+    }
+    return cyclic;
+}
+
+// Copies the alternatives of every production of nonterminal index a into b;
+// next_prod chains the productions that share a left-hand side
+void gather_alternatives(AltBuffer* b, const Production* productions, const int* first_prod, const int* next_prod, int a) {
+    for (int i = first_prod[a]; i != -1; i = next_prod[i]) {
+        const Production* p = &productions[i];
+        for (int j = 0; j < p->rhs_count; j++) add_alternative(b, alt_syms(p, j), alt_len(p, j), NULL, 0);
+    }
+}
+
+// Bounds the alternatives one nonterminal may grow to during substitution
+#define MAX_SUBSTITUTED_SYMBOLS (1 << 22)
+
+// Left recursion is found on the left-corner graph (A -> B when B follows a
+// nullable prefix in an alternative of A). Only nonterminals in a strongly
+// connected component with a cycle take part: within such a component, ordered
+// by production, each member has alternatives starting with an earlier member
+// substituted away (Paull's algorithm) and then loses its direct recursion to a
+// fresh A'. Substituting an ε alternative exposes the next symbol, which is why
+// the graph looks through nullable prefixes. Recursion that stays hidden behind
+// a nullable symbol cannot always be removed this way and is reported instead.
+// Entries (the start symbol and members used outside the component) come last,
+// so their tails only see the context the rest of the grammar gives them; inner
+// members nothing refers to afterwards are dropped, and the rewritten members
+// are factored again since substitution can line up common prefixes.
+void remove_left_recursion(Production** productions, int* prod_count, SymbolTable* st, Arena* scratch) {
+    int nt_count = st->nt_count;
+    int size = nt_count > 0 ? nt_count : 1;
+    SolverStats stats = {0};
+    int* nullable = compute_nullable(*productions, *prod_count, st, scratch, &stats);
+    int* first_prod = arena_alloc(scratch, size * sizeof(int));
+    int* last_prod = arena_alloc(scratch, size * sizeof(int));
+    int* next_prod = arena_alloc(scratch, (*prod_count > 0 ? *prod_count : 1) * sizeof(int));
+    for (int a = 0; a < nt_count; a++) first_prod[a] = last_prod[a] = -1;
+    for (int i = 0; i < *prod_count; i++) {
+        Production* p = &(*productions)[i];
+        int A_idx = st->nt_index[p->lhs];
+        next_prod[i] = -1;
+        if (last_prod[A_idx] == -1) first_prod[A_idx] = i;
+        else next_prod[last_prod[A_idx]] = i;
+        last_prod[A_idx] = i;
+    }
+    DepGraph graph = left_corner_graph(*productions, *prod_count, st, nullable, scratch);
+    SccList sccs = find_sccs(&graph, scratch);
+    int* recursive = cyclic_components(&graph, &sccs, scratch);
+    char* entry = arena_calloc(scratch, size, sizeof(char));
+    if (nt_count > 0) entry[0] = 1;
+    for (int i = 0; i < *prod_count; i++) {
+        const Production* p = &(*productions)[i];
+        int c = sccs.scc_of[st->nt_index[p->lhs]];
+        for (int j = 0; j < p->alt_start[p->rhs_count]; j++) {
+            int sym = p->syms[j];
+            if (!is_terminal(sym, st) && sccs.scc_of[st->nt_index[sym]] != c) entry[st->nt_index[sym]] = 1;
+        }
+    }
+
+    // order[] lists a component's inner members, then its entries, each by first
+    // production; rank is the position there
+    int* order = arena_alloc(scratch, size * sizeof(int));
+    int* rank = arena_alloc(scratch, size * sizeof(int));
+    char* rewritten = arena_calloc(scratch, size, sizeof(char));
+    char* inner = arena_calloc(scratch, size, sizeof(char));
+    int* prime_of = arena_alloc(scratch, size * sizeof(int));
+    char* removed = arena_calloc(scratch, *prod_count > 0 ? *prod_count : 1, sizeof(char));
+    int* done = arena_calloc(scratch, sccs.count > 0 ? sccs.count : 1, sizeof(int));
+    int added_count = 0, added_capacity = 16;
+    Production* added = arena_alloc(scratch, added_capacity * sizeof(Production));
+    AltBuffer cur, next, alpha;
+    alt_buffer_init(&cur, scratch);
+    alt_buffer_init(&next, scratch);
+    alt_buffer_init(&alpha, scratch);
+    int original_count = *prod_count;
+    for (int i = 0; i < original_count; i++) {
+        int c = sccs.scc_of[st->nt_index[(*productions)[i].lhs]];
+        if (!recursive[c] || done[c]) continue;
+        done[c] = 1;
+        int k = 0;
+        for (int e = 0; e < 2; e++) {
+            for (int n = i; n < original_count; n++) {
+                int a = st->nt_index[(*productions)[n].lhs];
+                if (sccs.scc_of[a] == c && first_prod[a] == n && entry[a] == e) order[k++] = a;
+            }
+        }
+        for (int r = 0; r < k; r++) {
+            rank[order[r]] = r;
+            rewritten[order[r]] = 1;
+            inner[order[r]] = !entry[order[r]] && entry[order[k - 1]];
+        }
+
+        for (int r = 0; r < k; r++) {
+            int a = order[r];
+            int A = st->nts[a];
+            gather_alternatives(&cur, *productions, first_prod, next_prod, a);
+            // Substitute alternatives that start with an earlier member until none is left
+            // With ε in the component the rewriting may cycle; the caps keep the
+            // language intact and the leftover recursion is reported afterwards
+            int substituted = 1;
+            for (int pass = 0; substituted && pass < k && cur.sym_count <= MAX_SUBSTITUTED_SYMBOLS; pass++) {
+                substituted = 0;
+                Production view = {A, cur.syms, cur.alt_start, cur.alt_count};
+                for (int j = 0; j < view.rhs_count; j++) {
+                    int* syms = alt_syms(&view, j);
+                    int len = alt_len(&view, j);
+                    int b = len > 0 && !is_terminal(syms[0], st) ? st->nt_index[syms[0]] : -1;
+                    if (b == -1 || b >= nt_count || sccs.scc_of[b] != c || rank[b] >= r) {
+                        add_alternative(&next, syms, len, NULL, 0);
+                        continue;
+                    }
+                    const Production* q = &(*productions)[first_prod[b]];
+                    for (int m = 0; m < q->rhs_count; m++) add_alternative(&next, alt_syms(q, m), alt_len(q, m), syms + 1, len - 1);
+                    substituted = 1;
+                }
+                AltBuffer swap = cur;
+                cur = next;
+                next = swap;
+                next.sym_count = 0;
+                next.alt_count = 0;
+            }
+
+            // Direct recursion: A -> A alpha | beta becomes A -> beta A', A' -> alpha A' | ε.
+            // A -> A alone derives nothing new and is dropped.
+            Production view = {A, cur.syms, cur.alt_start, cur.alt_count};
+            int alpha_count = 0;
+            for (int j = 0; j < view.rhs_count; j++) {
+                if (alt_len(&view, j) > 1 && alt_syms(&view, j)[0] == A) alpha_count++;
+            }
+            int A_prime = alpha_count > 0 ? generate_new_nt(st, A) : -1;
+            prime_of[a] = A_prime;
+            for (int j = 0; j < view.rhs_count; j++) {
+                int* syms = alt_syms(&view, j);
+                int len = alt_len(&view, j);
+                if (len > 0 && syms[0] == A) {
+                    if (len > 1) add_alternative(&alpha, syms + 1, len - 1, &A_prime, 1);
+                } else {
+                    add_alternative(&next, syms, len, &A_prime, alpha_count > 0);
+                }
+            }
+            cur.sym_count = 0;
+            cur.alt_count = 0;
+            (*productions)[first_prod[a]] = make_production(st->arena, A, &next);
+            for (int n = next_prod[first_prod[a]]; n != -1; n = next_prod[n]) removed[n] = 1;
+            next_prod[first_prod[a]] = -1;
+            if (alpha_count == 0) continue;
+            end_alternative(&alpha);
+            if (added_count >= added_capacity) {
+                added = arena_realloc(scratch, added, added_capacity * sizeof(Production), added_capacity * 2 * sizeof(Production));
+                added_capacity *= 2;
+            }
+            added[added_count++] = make_production(st->arena, A_prime, &alpha);
+        }
+    }
+
+    // Merged duplicates leave gaps; close them and append the fresh productions
+    int kept = 0;
+    for (int i = 0; i < original_count; i++) {
+        if (!removed[i]) (*productions)[kept++] = (*productions)[i];
+    }
+    if (added_count > 0) *productions = realloc(*productions, (kept + added_count) * sizeof(Production));
+    memcpy(*productions + kept, added, added_count * sizeof(Production));
+    *prod_count = kept + added_count;
+
+    // Drop inner members, and then their tails, once no other production refers to them
+    int sym_count = st->count;
+    char* candidate = arena_calloc(scratch, sym_count, sizeof(char));
+    char* refactor = arena_calloc(scratch, sym_count, sizeof(char));
+    for (int a = 0; a < nt_count; a++) {
+        if (!rewritten[a]) continue;
+        int syms[2] = {st->nts[a], prime_of[a]};
+        for (int m = 0; m < 2 && syms[m] != -1; m++) {
+            refactor[syms[m]] = 1;
+            candidate[syms[m]] = inner[a];
+        }
+    }
+    int* refs = arena_calloc(scratch, sym_count, sizeof(int));
+    int* prod_of = arena_alloc(scratch, sym_count * sizeof(int));
+    int* worklist = arena_alloc(scratch, sym_count * sizeof(int));
+    char* dropped = arena_calloc(scratch, sym_count, sizeof(char));
+    for (int i = 0; i < *prod_count; i++) {
+        const Production* p = &(*productions)[i];
+        prod_of[p->lhs] = i;
+        for (int j = 0; j < p->alt_start[p->rhs_count]; j++) {
+            if (candidate[p->syms[j]] && p->syms[j] != p->lhs) refs[p->syms[j]]++;
+        }
+    }
+    int head = 0, tail = 0;
+    for (int sym = 0; sym < sym_count; sym++) {
+        if (candidate[sym] && refs[sym] == 0) worklist[tail++] = sym;
+    }
+    while (head < tail) {
+        int X = worklist[head++];
+        const Production* p = &(*productions)[prod_of[X]];
+        dropped[X] = 1;
+        for (int j = 0; j < p->alt_start[p->rhs_count]; j++) {
+            if (candidate[p->syms[j]] && p->syms[j] != X && --refs[p->syms[j]] == 0) worklist[tail++] = p->syms[j];
+        }
+    }
+    if (tail > 0) {
+        kept = 0;
+        for (int i = 0; i < *prod_count; i++) {
+            if (!dropped[(*productions)[i].lhs]) (*productions)[kept++] = (*productions)[i];
+        }
+        *prod_count = kept;
+        int nt_kept = 0;
+        for (int a = 0; a < st->nt_count; a++) {
+            int sym = st->nts[a];
+            if (dropped[sym]) {
+                st->nt_index[sym] = -1;
+                continue;
+            }
+            st->nts[nt_kept] = sym;
+            st->nt_index[sym] = nt_kept++;
+        }
+        st->nt_count = nt_kept;
+    }
+    char* selected = arena_alloc(scratch, *prod_count > 0 ? *prod_count : 1);
+    for (int i = 0; i < *prod_count; i++) selected[i] = refactor[(*productions)[i].lhs];
+    factor_productions(productions, prod_count, selected, st, scratch);
+
+    // Recursion hidden behind nullable symbols can survive; name what is left
+    nullable = compute_nullable(*productions, *prod_count, st, scratch, &stats);
+    graph = left_corner_graph(*productions, *prod_count, st, nullable, scratch);
+    sccs = find_sccs(&graph, scratch);
+    recursive = cyclic_components(&graph, &sccs, scratch);
+    for (int c = 0; c < sccs.count; c++) {
+        if (!recursive[c]) continue;
+        fprintf(messages, "Warning: left recursion through nullable symbols remains among");
+        for (int m = sccs.scc_start[c]; m < sccs.scc_start[c + 1]; m++) fprintf(messages, " %s", st->names[st->nts[sccs.members[m]]]);
+        fprintf(messages, "\n");
+    }
+}
+
+// FIRST(A) holds the terminals that can start A directly and depends on FIRST(B)
+// for every B reachable through a nullable prefix of one of A's alternatives
+void compute_first_sets(Production* productions, int prod_count, const SymbolTable* st, const int* term_column, int* nullable, BitMatrix* first_sets, Arena* scratch, SolverStats* stats) {
+    EdgeList deps = {scratch, NULL, NULL, 0, 0};
+    for (int i = 0; i < prod_count; i++) {
+        Production* p = &productions[i];
+        int A_idx = st->nt_index[p->lhs];
+        uint64_t* first_A = bitset_row(first_sets, A_idx);
+        for (int j = 0; j < p->rhs_count; j++) {
+            int* symbols = alt_syms(p, j);
+            int sym_count = alt_len(p, j);
+            for (int k = 0; k < sym_count; k++) {
+                int symbol = symbols[k];
+                if (is_terminal(symbol, st)) {
+                    bitset_add(first_A, term_column[symbol]);
+                    break;
+                }
+                int sym_idx = st->nt_index[symbol];
+                if (sym_idx != A_idx) add_edge(&deps, A_idx, sym_idx);
+                if (!nullable[sym_idx]) break;
+            }
+        }
+    }
+    DepGraph graph = build_graph(st->nt_count, &deps);
+    solve_set_equations(&graph, first_sets, scratch, &stats->first_sccs, &stats->first_visits);
+}
+
+// FOLLOW(A) collects FIRST of whatever follows A in each occurrence, and depends
+// on FOLLOW(B) when A ends an alternative of B up to a nullable suffix
+void compute_follow_sets(Production* productions, int prod_count, const SymbolTable* st, const int* term_column, int* nullable, BitMatrix* first_sets, BitMatrix* follow_sets, Arena* scratch, SolverStats* stats) {
+    int words = follow_sets->words;
+    int start_idx = 0;
+    bitset_add(bitset_row(follow_sets, start_idx), term_column[find_symbol(st, "$")]);
+
+    EdgeList deps = {scratch, NULL, NULL, 0, 0};
+    for (int i = 0; i < prod_count; i++) {
+        Production* p = &productions[i];
+        int B_idx = st->nt_index[p->lhs];
+        for (int j = 0; j < p->rhs_count; j++) {
+            int* symbols = alt_syms(p, j);
+            int sym_count = alt_len(p, j);
+            for (int k = 0; k < sym_count; k++) {
+                if (is_terminal(symbols[k], st)) continue;
+                int A_idx = st->nt_index[symbols[k]];
+                uint64_t* follow_A = bitset_row(follow_sets, A_idx);
+                int beta_nullable = 1;
+                for (int m = k + 1; m < sym_count; m++) {
+                    int beta_symbol = symbols[m];
+                    if (is_terminal(beta_symbol, st)) {
+                        bitset_add(follow_A, term_column[beta_symbol]);
+                        beta_nullable = 0;
+                        break;
+                    }
+                    int beta_idx = st->nt_index[beta_symbol];
+                    bitset_union(follow_A, bitset_row(first_sets, beta_idx), words);
+                    if (!nullable[beta_idx]) {
+                        beta_nullable = 0;
+                        break;
+                    }
+                }
+                if (beta_nullable && A_idx != B_idx) add_edge(&deps, A_idx, B_idx);
+            }
+        }
+    }
+    DepGraph graph = build_graph(st->nt_count, &deps);
+    solve_set_equations(&graph, follow_sets, scratch, &stats->follow_sccs, &stats->follow_visits);
+}
+// Collects the terminal columns of the parsing table; term_column maps a symbol id to its column
+int* collect_terminals(Production* productions, int prod_count, SymbolTable* st, int* term_count, int** term_column) {
+    int end_marker = intern_symbol(st, "$");
+    int* columns = arena_alloc(st->arena, st->count * sizeof(int));
+    for (int i = 0; i < st->count; i++) columns[i] = -1;
+    int* terminals = arena_alloc(st->arena, st->count * sizeof(int));
+    *term_count = 0;
+    for (int i = 0; i < prod_count; i++) {
+        Production* p = &productions[i];
+        for (int k = 0; k < p->alt_start[p->rhs_count]; k++) {
+            int symbol = p->syms[k];
+            if (is_terminal(symbol, st) && columns[symbol] == -1) {
+                columns[symbol] = *term_count;
+                terminals[(*term_count)++] = symbol;
+            }
+        }
+    }
+    if (columns[end_marker] == -1) {
+        columns[end_marker] = *term_count;
+        terminals[(*term_count)++] = end_marker;
+    }
+    *term_column = columns;
+    return terminals;
+}
+
+// Compact LL(1) table. Everything lives in one block whose layout is also the
+// on-disk format, so a saved table can be mapped and used without the grammar.
+// Rows are packed by row displacement: cell (A, t) is value[base[A] + t] when
+// check[base[A] + t] == A and empty otherwise. Cells hold global alternative ids.
+// A conflicted cell holds its first alternative; the others are listed by row,
+// conflict_start[A] .. conflict_start[A + 1] - 1, as columns in ascending order
+// with their alternatives, for the general parser.
+#define LL1_TABLE_MAGIC "LL1T"
+#define LL1_TABLE_VERSION 4
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t nt_count;
+    uint32_t term_count;
+    uint32_t alt_count;
+    uint32_t start;
+    uint32_t end_column;
+    uint32_t slot_count;
+    uint32_t code_count;
+    uint32_t hash_size;
+    uint32_t name_bytes;
+    uint32_t base_off;
+    uint32_t check_off;
+    uint32_t value_off;
+    uint32_t code_start_off;
+    uint32_t code_off;
+    uint32_t alt_lhs_off;
+    uint32_t name_start_off;
+    uint32_t hash_off;
+    uint32_t pattern_start_off;
+    uint32_t conflict_count;
+    uint32_t conflict_start_off;
+    uint32_t conflict_col_off;
+    uint32_t conflict_alt_off;
+    uint32_t names_off;
+    // FNV-1a of the block after the header
+    uint64_t checksum;
+} LL1TableHeader;
+
+typedef struct {
+    const LL1TableHeader* header;
+    const int32_t* base;
+    const int32_t* check;
+    const int32_t* value;
+    const int32_t* code_start;
+    const int32_t* code;
+    const int32_t* alt_lhs;
+    const int32_t* name_start;
+    const int32_t* term_hash;
+    const int32_t* pattern_start;
+    const int32_t* conflict_start;
+    const int32_t* conflict_col;
+    const int32_t* conflict_alt;
+    const char* names;
+    int mapped;
+    int conflicts;
+} LL1Table;
+
+void ll1_table_bind(LL1Table* t, const void* block, int mapped) {
+    const char* b = block;
+    const LL1TableHeader* h = block;
+    t->header = h;
+    t->base = (const int32_t*)(b + h->base_off);
+    t->check = (const int32_t*)(b + h->check_off);
+    t->value = (const int32_t*)(b + h->value_off);
+    t->code_start = (const int32_t*)(b + h->code_start_off);
+    t->code = (const int32_t*)(b + h->code_off);
+    t->alt_lhs = (const int32_t*)(b + h->alt_lhs_off);
+    t->name_start = (const int32_t*)(b + h->name_start_off);
+    t->term_hash = (const int32_t*)(b + h->hash_off);
+    t->pattern_start = (const int32_t*)(b + h->pattern_start_off);
+    t->conflict_start = (const int32_t*)(b + h->conflict_start_off);
+    t->conflict_col = (const int32_t*)(b + h->conflict_col_off);
+    t->conflict_alt = (const int32_t*)(b + h->conflict_alt_off);
+    t->names = b + h->names_off;
+    t->mapped = mapped;
+    t->conflicts = h->conflict_count;
+}
+
+int ll1_table_lookup(const LL1Table* t, int nt, int column) {
+    int idx = t->base[nt] + column;
+    return t->check[idx] == nt ? t->value[idx] : -1;
+}
+
+// The alternatives a conflicted cell holds besides ll1_table_lookup's; sets
+// *count and returns where they start in conflict_alt
+int ll1_table_conflicts(const LL1Table* t, int nt, int column, int* count) {
+    int lo = t->conflict_start[nt], hi = t->conflict_start[nt + 1];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (t->conflict_col[mid] < column) lo = mid + 1;
+        else hi = mid;
+    }
+    int end = lo;
+    while (end < t->conflict_start[nt + 1] && t->conflict_col[end] == column) end++;
+    *count = end - lo;
+    return lo;
+}
+
+// Names are stored terminals first (by column), then nonterminals (by index)
+const char* ll1_table_name(const LL1Table* t, int i) {
+    return t->names + t->name_start[i];
+}
+
+// The %token pattern of a terminal column, or NULL when it is scanned literally
+const char* ll1_table_pattern(const LL1Table* t, int column) {
+    return t->pattern_start[column] == -1 ? NULL : t->names + t->pattern_start[column];
+}
+
+// Maps a token spelling to its column, or -1 when it is not a terminal
+int ll1_table_column(const LL1Table* t, const char* name, size_t len) {
+    unsigned int mask = t->header->hash_size - 1;
+    unsigned int b = hash_symbol(name, len) & mask;
+    while (t->term_hash[b] != -1) {
+        const char* candidate = ll1_table_name(t, t->term_hash[b]);
+        if (strncmp(candidate, name, len) == 0 && candidate[len] == '\0') return t->term_hash[b];
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+void free_ll1_table(LL1Table* t) {
+    if (t->mapped) {
+        munmap((void*)t->header, t->header->total_size);
+    } else {
+        free((void*)t->header);
+    }
+}
+
+int compare_row_fill(const void* a, const void* b) {
+    const int* x = a;
+    const int* y = b;
+    if (x[1] != y[1]) return y[1] - x[1];
+    return x[0] - y[0];
+}
+
+// Places the sparse rows by first fit, densest rows first
+int pack_rows(int nt_count, int term_count, const int* row_start, const int* entry_col, const int* entry_alt, int* base, int** check_out, int** value_out, Arena* scratch) {
+    int capacity = term_count * 2 + 64;
+    int* check = arena_alloc(scratch, capacity * sizeof(int));
+    int* value = arena_alloc(scratch, capacity * sizeof(int));
+    for (int s = 0; s < capacity; s++) check[s] = value[s] = -1;
+    int* order = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * 2 * sizeof(int));
+    for (int a = 0; a < nt_count; a++) {
+        order[2 * a] = a;
+        order[2 * a + 1] = row_start[a + 1] - row_start[a];
+    }
+    qsort(order, nt_count, 2 * sizeof(int), compare_row_fill);
+    int slot_count = term_count;
+    int first_free = 0;
+    for (int r = 0; r < nt_count; r++) {
+        int a = order[2 * r];
+        base[a] = 0;
+        if (order[2 * r + 1] == 0) continue;
+        int min_col = entry_col[row_start[a]];
+        for (int e = row_start[a]; e < row_start[a + 1]; e++) {
+            if (entry_col[e] < min_col) min_col = entry_col[e];
+        }
+        while (first_free < capacity && check[first_free] != -1) first_free++;
+        int b = first_free > min_col ? first_free - min_col : 0;
+        while (1) {
+            if (b + term_count > capacity) {
+                int old = capacity;
+                while (b + term_count > capacity) capacity *= 2;
+                check = arena_realloc(scratch, check, old * sizeof(int), capacity * sizeof(int));
+                value = arena_realloc(scratch, value, old * sizeof(int), capacity * sizeof(int));
+                for (int s = old; s < capacity; s++) check[s] = value[s] = -1;
+            }
+            int fits = 1;
+            for (int e = row_start[a]; e < row_start[a + 1]; e++) {
+                if (check[b + entry_col[e]] != -1) {
+                    fits = 0;
+                    break;
+                }
+            }
+            if (fits) break;
+            b++;
+        }
+        base[a] = b;
+        for (int e = row_start[a]; e < row_start[a + 1]; e++) {
+            check[b + entry_col[e]] = a;
+            value[b + entry_col[e]] = entry_alt[e];
+        }
+        if (b + term_count > slot_count) slot_count = b + term_count;
+    }
+    *check_out = check;
+    *value_out = value;
+    return slot_count;
+}
+
+void compute_first_alpha(const int* symbols, int sym_count, const SymbolTable* st, const int* term_column, int* nullable, BitMatrix* first_sets, uint64_t* first_alpha) {
+    memset(first_alpha, 0, first_sets->words * sizeof(uint64_t));
+    for (int k = 0; k < sym_count; k++) {
+        int symbol = symbols[k];
+        if (is_terminal(symbol, st)) {
+            bitset_add(first_alpha, term_column[symbol]);
+            break;
+        } else {
+            int sym_idx = st->nt_index[symbol];
+            bitset_union(first_alpha, bitset_row(first_sets, sym_idx), first_sets->words);
+            if (!nullable[sym_idx]) break;
+        }
+    }
+}
+
+int compare_int_pairs(const void* a, const void* b) {
+    const int* x = a;
+    const int* y = b;
+    if (x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+    return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+// Packs filled rows into the table block. Row a holds the entries row_start[a]
+// .. row_start[a + 1] - 1, each a column and a global alternative id, and the
+// conflicts conflict_start[a] .. conflict_start[a + 1] - 1, each a (column,
+// alternative) pair of conflict_pairs in any order.
+LL1Table pack_ll1_table(Production* productions, int prod_count, const SymbolTable* st, const int* terminals, const int* term_column, int term_count, const int* row_start, const int* entry_col, const int* entry_alt, const int* conflict_start, int* conflict_pairs, Arena* scratch) {
+    int nt_count = st->nt_count;
+    int alt_count = 0, code_count = 0;
+    for (int i = 0; i < prod_count; i++) {
+        alt_count += productions[i].rhs_count;
+        code_count += productions[i].alt_start[productions[i].rhs_count];
+    }
+    int* alt_prod = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    int* alt_index = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    for (int i = 0, g = 0; i < prod_count; i++) {
+        for (int j = 0; j < productions[i].rhs_count; j++, g++) {
+            alt_prod[g] = i;
+            alt_index[g] = j;
+        }
+    }
+
+    int* base = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * sizeof(int));
+    int *check, *value;
+    int slot_count = pack_rows(nt_count, term_count, row_start, entry_col, entry_alt, base, &check, &value, scratch);
+
+    int hash_size = 16;
+    while (hash_size < term_count * 2) hash_size *= 2;
+    int name_bytes = 0;
+    for (int t = 0; t < term_count; t++) name_bytes += strlen(st->names[terminals[t]]) + 1;
+    for (int a = 0; a < nt_count; a++) name_bytes += strlen(st->names[st->nts[a]]) + 1;
+    for (int t = 0; t < term_count; t++) {
+        if (st->patterns[terminals[t]]) name_bytes += strlen(st->patterns[terminals[t]]) + 1;
+    }
+
+    LL1TableHeader h = {0};
+    memcpy(h.magic, LL1_TABLE_MAGIC, 4);
+    h.version = LL1_TABLE_VERSION;
+    h.nt_count = nt_count;
+    h.term_count = term_count;
+    h.alt_count = alt_count;
+    h.start = 0;
+    h.end_column = term_column[find_symbol(st, "$")];
+    h.slot_count = slot_count;
+    h.code_count = code_count;
+    h.hash_size = hash_size;
+    h.name_bytes = name_bytes;
+    h.conflict_count = conflict_start[nt_count];
+    uint32_t off = sizeof(LL1TableHeader);
+    h.base_off = off;
+    off += nt_count * sizeof(int32_t);
+    h.check_off = off;
+    off += slot_count * sizeof(int32_t);
+    h.value_off = off;
+    off += slot_count * sizeof(int32_t);
+    h.code_start_off = off;
+    off += (alt_count + 1) * sizeof(int32_t);
+    h.code_off = off;
+    off += code_count * sizeof(int32_t);
+    h.alt_lhs_off = off;
+    off += alt_count * sizeof(int32_t);
+    h.name_start_off = off;
+    off += (term_count + nt_count + 1) * sizeof(int32_t);
+    h.hash_off = off;
+    off += hash_size * sizeof(int32_t);
+    h.pattern_start_off = off;
+    off += term_count * sizeof(int32_t);
+    h.conflict_start_off = off;
+    off += (nt_count + 1) * sizeof(int32_t);
+    h.conflict_col_off = off;
+    off += h.conflict_count * sizeof(int32_t);
+    h.conflict_alt_off = off;
+    off += h.conflict_count * sizeof(int32_t);
+    h.names_off = off;
+    off += name_bytes;
+    h.total_size = (off + 7) & ~7u;
+
+    char* block = calloc(1, h.total_size);
+    memcpy(block, &h, sizeof(h));
+    int32_t* out_base = (int32_t*)(block + h.base_off);
+    int32_t* out_check = (int32_t*)(block + h.check_off);
+    int32_t* out_value = (int32_t*)(block + h.value_off);
+    int32_t* out_code_start = (int32_t*)(block + h.code_start_off);
+    int32_t* out_code = (int32_t*)(block + h.code_off);
+    int32_t* out_alt_lhs = (int32_t*)(block + h.alt_lhs_off);
+    int32_t* out_name_start = (int32_t*)(block + h.name_start_off);
+    int32_t* out_hash = (int32_t*)(block + h.hash_off);
+    int32_t* out_pattern_start = (int32_t*)(block + h.pattern_start_off);
+    int32_t* out_conflict_start = (int32_t*)(block + h.conflict_start_off);
+    int32_t* out_conflict_col = (int32_t*)(block + h.conflict_col_off);
+    int32_t* out_conflict_alt = (int32_t*)(block + h.conflict_alt_off);
+    char* out_names = block + h.names_off;
+    for (int a = 0; a < nt_count; a++) out_base[a] = base[a];
+    for (int s = 0; s < slot_count; s++) {
+        out_check[s] = check[s];
+        out_value[s] = value[s];
+    }
+    // Alternatives are stored encoded (nonterminal index, or -(column + 1) for a
+    // terminal) and reversed, so a parser expands one with a single copy
+    int c = 0;
+    for (int g = 0; g < alt_count; g++) {
+        Production* p = &productions[alt_prod[g]];
+        int j = alt_index[g];
+        int* syms = alt_syms(p, j);
+        out_code_start[g] = c;
+        out_alt_lhs[g] = st->nt_index[p->lhs];
+        for (int k = alt_len(p, j) - 1; k >= 0; k--) {
+            int sym = syms[k];
+            out_code[c++] = is_terminal(sym, st) ? -(term_column[sym] + 1) : st->nt_index[sym];
+        }
+    }
+    out_code_start[alt_count] = c;
+    for (int a = 0; a <= nt_count; a++) out_conflict_start[a] = conflict_start[a];
+    for (int a = 0; a < nt_count; a++) {
+        int from = conflict_start[a], count = conflict_start[a + 1] - from;
+        qsort(conflict_pairs + 2 * from, count, 2 * sizeof(int), compare_int_pairs);
+        for (int e = from; e < from + count; e++) {
+            out_conflict_col[e] = conflict_pairs[2 * e];
+            out_conflict_alt[e] = conflict_pairs[2 * e + 1];
+        }
+    }
+    int n = 0;
+    for (int i = 0; i < term_count + nt_count; i++) {
+        const char* name = i < term_count ? st->names[terminals[i]] : st->names[st->nts[i - term_count]];
+        out_name_start[i] = n;
+        strcpy(out_names + n, name);
+        n += strlen(name) + 1;
+    }
+    out_name_start[term_count + nt_count] = n;
+    for (int t = 0; t < term_count; t++) {
+        const char* pattern = st->patterns[terminals[t]];
+        out_pattern_start[t] = pattern ? n : -1;
+        if (!pattern) continue;
+        strcpy(out_names + n, pattern);
+        n += strlen(pattern) + 1;
+    }
+    for (int b = 0; b < hash_size; b++) out_hash[b] = -1;
+    for (int t = 0; t < term_count; t++) {
+        const char* name = st->names[terminals[t]];
+        unsigned int b = hash_symbol(name, strlen(name)) & (hash_size - 1);
+        while (out_hash[b] != -1) b = (b + 1) & (hash_size - 1);
+        out_hash[b] = t;
+    }
+
+    ((LL1TableHeader*)block)->checksum = hash_bytes64(14695981039346656037ULL, block + sizeof(LL1TableHeader), h.total_size - sizeof(LL1TableHeader));
+
+    LL1Table table;
+    ll1_table_bind(&table, block, 0);
+    return table;
+}
+
+// Rows lo..hi - 1 of the LL(1) table. A part keeps its entries and conflicts
+// (column, earlier alternative, alternative) in its own arena, so the parts can
+// be filled on separate threads and joined in row order
+typedef struct {
+    Production* productions;
+    const SymbolTable* st;
+    const int* term_column;
+    int* nullable;
+    BitMatrix* first_sets;
+    BitMatrix* follow_sets;
+    const int* nt_alt_start;
+    const int* nt_alts;
+    const int* alt_prod;
+    const int* alt_index;
+    int term_count;
+    int lo;
+    int hi;
+    Arena* arena;
+    int* row_start;
+    int* entry_col;
+    int* entry_alt;
+    int entry_count;
+    int* conflict;
+    int conflict_count;
+} LL1RowPart;
+
+#define PARALLEL_MIN_ALTERNATIVES 4096
+
+void fill_ll1_rows(void* arg) {
+    LL1RowPart* part = arg;
+    const SymbolTable* st = part->st;
+    int words = part->first_sets->words;
+    // Fill one row at a time; the scratch row is cleared through the filled columns only
+    int* row = arena_alloc(part->arena, (part->term_count > 0 ? part->term_count : 1) * sizeof(int));
+    for (int t = 0; t < part->term_count; t++) row[t] = -1;
+    int entry_capacity = 64, conflict_capacity = 16;
+    part->entry_col = arena_alloc(part->arena, entry_capacity * sizeof(int));
+    part->entry_alt = arena_alloc(part->arena, entry_capacity * sizeof(int));
+    part->conflict = arena_alloc(part->arena, conflict_capacity * 3 * sizeof(int));
+    part->entry_count = part->conflict_count = 0;
+    uint64_t* predict = arena_calloc(part->arena, words, sizeof(uint64_t));
+    for (int a = part->lo; a < part->hi; a++) {
+        part->row_start[a] = part->entry_count;
+        for (int n = part->nt_alt_start[a]; n < part->nt_alt_start[a + 1]; n++) {
+            int g = part->nt_alts[n];
+            Production* p = &part->productions[part->alt_prod[g]];
+            int j = part->alt_index[g];
+            // predict = FIRST(alpha), plus FOLLOW(A) when alpha is nullable
+            compute_first_alpha(alt_syms(p, j), alt_len(p, j), st, part->term_column, part->nullable, part->first_sets, predict);
+            if (is_alpha_nullable(alt_syms(p, j), alt_len(p, j), st, part->nullable)) {
+                bitset_union(predict, bitset_row(part->follow_sets, a), words);
+            }
+            for (int t_idx = bitset_next(predict, words, 0); t_idx != -1; t_idx = bitset_next(predict, words, t_idx + 1)) {
+                if (row[t_idx] != -1) {
+                    if (part->conflict_count >= conflict_capacity) {
+                        part->conflict = arena_realloc(part->arena, part->conflict, conflict_capacity * 3 * sizeof(int), conflict_capacity * 6 * sizeof(int));
+                        conflict_capacity *= 2;
+                    }
+                    int* c = part->conflict + 3 * part->conflict_count++;
+                    c[0] = t_idx;
+                    c[1] = row[t_idx];
+                    c[2] = g;
+                    continue;
+                }
+                row[t_idx] = g;
+                if (part->entry_count >= entry_capacity) {
+                    part->entry_col = arena_realloc(part->arena, part->entry_col, entry_capacity * sizeof(int), entry_capacity * 2 * sizeof(int));
+                    part->entry_alt = arena_realloc(part->arena, part->entry_alt, entry_capacity * sizeof(int), entry_capacity * 2 * sizeof(int));
+                    entry_capacity *= 2;
+                }
+                part->entry_col[part->entry_count] = t_idx;
+                part->entry_alt[part->entry_count] = g;
+                part->entry_count++;
+            }
+        }
+        for (int e = part->row_start[a]; e < part->entry_count; e++) row[part->entry_col[e]] = -1;
+    }
+}
+
+// Works in the scratch arena; the finished table is one heap block of its own
+LL1Table construct_ll1_table(Production* productions, int prod_count, const SymbolTable* st, const int* terminals, const int* term_column, int term_count, int* nullable, BitMatrix* first_sets, BitMatrix* follow_sets, Arena* scratch) {
+    int nt_count = st->nt_count;
+
+    // Alternatives are numbered globally, production by production
+    int alt_count = 0;
+    for (int i = 0; i < prod_count; i++) alt_count += productions[i].rhs_count;
+    int* nt_alt_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    int* nt_alts = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    int* alt_prod = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    int* alt_index = arena_alloc(scratch, (alt_count > 0 ? alt_count : 1) * sizeof(int));
+    for (int i = 0, g = 0; i < prod_count; i++) {
+        nt_alt_start[st->nt_index[productions[i].lhs] + 1] += productions[i].rhs_count;
+        for (int j = 0; j < productions[i].rhs_count; j++, g++) {
+            alt_prod[g] = i;
+            alt_index[g] = j;
+        }
+    }
+    for (int a = 0; a < nt_count; a++) nt_alt_start[a + 1] += nt_alt_start[a];
+    int* fill = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * sizeof(int));
+    memcpy(fill, nt_alt_start, nt_count * sizeof(int));
+    for (int g = 0; g < alt_count; g++) nt_alts[fill[st->nt_index[productions[alt_prod[g]].lhs]]++] = g;
+
+    // Rows are filled in parts of about equal numbers of alternatives, one per
+    // thread, and joined in order so entries and messages match a serial fill
+    int part_count = stage_threads > 1 && alt_count >= PARALLEL_MIN_ALTERNATIVES ? stage_threads : 1;
+    if (part_count > nt_count) part_count = nt_count > 0 ? nt_count : 1;
+    int* row_start = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    LL1RowPart* parts = arena_alloc(scratch, part_count * sizeof(LL1RowPart));
+    Arena* part_arenas = arena_alloc(scratch, part_count * sizeof(Arena));
+    for (int k = 0, a = 0; k < part_count; k++) {
+        LL1RowPart* part = &parts[k];
+        part->productions = productions;
+        part->st = st;
+        part->term_column = term_column;
+        part->nullable = nullable;
+        part->first_sets = first_sets;
+        part->follow_sets = follow_sets;
+        part->nt_alt_start = nt_alt_start;
+        part->nt_alts = nt_alts;
+        part->alt_prod = alt_prod;
+        part->alt_index = alt_index;
+        part->term_count = term_count;
+        part->row_start = row_start;
+        part->lo = a;
+        while (a < nt_count && (k == part_count - 1 || nt_alt_start[a] < (long)alt_count * (k + 1) / part_count)) a++;
+        part->hi = a;
+        if (k == 0) {
+            part->arena = scratch;
+        } else {
+            arena_init(&part_arenas[k], 1 << 16);
+            part->arena = &part_arenas[k];
+        }
+    }
+    run_threads(part_count, fill_ll1_rows, parts, sizeof(LL1RowPart));
+
+    int entry_count = 0;
+    for (int k = 0; k < part_count; k++) entry_count += parts[k].entry_count;
+    int* entry_col = parts[0].entry_col;
+    int* entry_alt = parts[0].entry_alt;
+    if (part_count > 1) {
+        entry_col = arena_alloc(scratch, (entry_count > 0 ? entry_count : 1) * sizeof(int));
+        entry_alt = arena_alloc(scratch, (entry_count > 0 ? entry_count : 1) * sizeof(int));
+    }
+    int conflicts = 0;
+    for (int k = 0; k < part_count; k++) conflicts += parts[k].conflict_count;
+    int* conflict_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    int* conflict_pairs = arena_alloc(scratch, (conflicts > 0 ? 2 * conflicts : 1) * sizeof(int));
+    for (int k = 0, offset = 0, n = 0; k < part_count; k++) {
+        LL1RowPart* part = &parts[k];
+        for (int i = 0; i < part->conflict_count; i++, n++) {
+            const int* c = part->conflict + 3 * i;
+            int lhs = productions[alt_prod[c[2]]].lhs;
+            fprintf(messages, "Conflict at [%s, %s]: Multiple productions (%d and %d)\n", st->names[lhs], st->names[terminals[c[0]]], c[1], c[2]);
+            conflict_start[st->nt_index[lhs] + 1]++;
+            conflict_pairs[2 * n] = c[0];
+            conflict_pairs[2 * n + 1] = c[2];
+        }
+        if (k == 0) {
+            offset = part->entry_count;
+            if (part_count > 1) {
+                memcpy(entry_col, part->entry_col, part->entry_count * sizeof(int));
+                memcpy(entry_alt, part->entry_alt, part->entry_count * sizeof(int));
+            }
+            continue;
+        }
+        for (int a = part->lo; a < part->hi; a++) row_start[a] += offset;
+        memcpy(entry_col + offset, part->entry_col, part->entry_count * sizeof(int));
+        memcpy(entry_alt + offset, part->entry_alt, part->entry_count * sizeof(int));
+        offset += part->entry_count;
+        arena_free(&part_arenas[k]);
+    }
+    row_start[nt_count] = entry_count;
+    for (int a = 0; a < nt_count; a++) conflict_start[a + 1] += conflict_start[a];
+    if (conflicts) {
+        fprintf(messages, "Warning: Grammar is not LL(1) due to conflicts.\n");
+    }
+    return pack_ll1_table(productions, prod_count, st, terminals, term_column, term_count, row_start, entry_col, entry_alt, conflict_start, conflict_pairs, scratch);
+}
+
+int save_ll1_table(const LL1Table* t, const char* filename) {
+    FILE* out = fopen(filename, "wb");
+    if (!out) return -1;
+    size_t written = fwrite(t->header, 1, t->header->total_size, out);
+    if (fclose(out) != 0 || written != t->header->total_size) return -1;
+    return 0;
+}
+
+// A saved table comes from outside the process, so nothing in it is trusted:
+// the checksum must match, every section must lie inside the block, and every
+// id, column and offset it holds must be in range. Sizes are computed in 64 bits
+// so no count can wrap. Returns 1 when the block is safe to bind.
+int ll1_table_valid(const void* block, uint64_t size) {
+    const LL1TableHeader* h = block;
+    if (size < sizeof(LL1TableHeader) || memcmp(h->magic, LL1_TABLE_MAGIC, 4) != 0 || h->version != LL1_TABLE_VERSION || h->total_size != size) return 0;
+    if (h->checksum != hash_bytes64(14695981039346656037ULL, (const char*)block + sizeof(LL1TableHeader), size - sizeof(LL1TableHeader))) return 0;
+    int64_t nt = h->nt_count, term = h->term_count, alts = h->alt_count, slots = h->slot_count, codes = h->code_count, conflicts = h->conflict_count;
+    int64_t hash_size = h->hash_size, name_bytes = h->name_bytes;
+    const struct {
+        uint64_t off;
+        uint64_t count;
+    } sections[] = {
+        {h->base_off, nt},           {h->check_off, slots},           {h->value_off, slots},          {h->code_start_off, alts + 1},
+        {h->code_off, codes},        {h->alt_lhs_off, alts},          {h->name_start_off, term + nt + 1}, {h->hash_off, hash_size},
+        {h->pattern_start_off, term}, {h->conflict_start_off, nt + 1}, {h->conflict_col_off, conflicts}, {h->conflict_alt_off, conflicts},
+    };
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) {
+        if (sections[s].off % 4 != 0 || sections[s].off < sizeof(LL1TableHeader) || sections[s].off + sections[s].count * 4 > size) return 0;
+    }
+    if (h->names_off < sizeof(LL1TableHeader) || (uint64_t)h->names_off + h->name_bytes > size) return 0;
+    // A grammar without productions has no rows, and its start is 0
+    if ((nt > 0 ? (int64_t)h->start >= nt : h->start != 0) || (int64_t)h->end_column >= term) return 0;
+    // Lookups probe until an empty slot, so the hash needs at least one
+    if (hash_size <= term || (hash_size & (hash_size - 1)) != 0) return 0;
+
+    LL1Table t;
+    ll1_table_bind(&t, block, 0);
+    for (int64_t a = 0; a < nt; a++) {
+        if (t.base[a] < 0 || t.base[a] + term > slots) return 0;
+    }
+    for (int64_t s = 0; s < slots; s++) {
+        if (t.check[s] < -1 || t.check[s] >= nt) return 0;
+        if (t.check[s] != -1 && (t.value[s] < 0 || t.value[s] >= alts)) return 0;
+    }
+    if (t.code_start[0] != 0 || t.code_start[alts] != codes) return 0;
+    for (int64_t g = 0; g < alts; g++) {
+        if (t.code_start[g] > t.code_start[g + 1] || t.alt_lhs[g] < 0 || t.alt_lhs[g] >= nt) return 0;
+    }
+    for (int64_t k = 0; k < codes; k++) {
+        int64_t sym = t.code[k];
+        if (sym >= 0 ? sym >= nt : -sym - 1 >= term) return 0;
+    }
+    // Every name ends with its own NUL, and so does the whole string area
+    if (t.name_start[0] != 0) return 0;
+    for (int64_t i = 0; i < term + nt; i++) {
+        if (t.name_start[i] >= t.name_start[i + 1] || t.name_start[i + 1] > name_bytes || t.names[t.name_start[i + 1] - 1] != '\0') return 0;
+    }
+    if (name_bytes > 0 && t.names[name_bytes - 1] != '\0') return 0;
+    for (int64_t c = 0; c < term; c++) {
+        if (t.pattern_start[c] < -1 || t.pattern_start[c] >= name_bytes) return 0;
+    }
+    int64_t empty = 0;
+    for (int64_t b = 0; b < hash_size; b++) {
+        if (t.term_hash[b] < -1 || t.term_hash[b] >= term) return 0;
+        empty += t.term_hash[b] == -1;
+    }
+    if (empty == 0) return 0;
+    if (t.conflict_start[0] != 0 || t.conflict_start[nt] != conflicts) return 0;
+    for (int64_t a = 0; a < nt; a++) {
+        if (t.conflict_start[a] > t.conflict_start[a + 1]) return 0;
+    }
+    for (int64_t e = 0; e < conflicts; e++) {
+        if (t.conflict_col[e] < 0 || t.conflict_col[e] >= term || t.conflict_alt[e] < 0 || t.conflict_alt[e] >= alts) return 0;
+    }
+    return 1;
+}
+
+// Maps a saved table read-only; returns -1 when the file is missing or not a
+// valid table of this version
+int load_ll1_table(LL1Table* t, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(LL1TableHeader)) {
+        close(fd);
+        return -1;
+    }
+    void* block = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) return -1;
+    if (!ll1_table_valid(block, sb.st_size)) {
+        munmap(block, sb.st_size);
+        return -1;
+    }
+    ll1_table_bind(t, block, 1);
+    return 0;
+}
+
+// Log writers. A run's grammars, sets and table go through a LogWriter: a
+// large buffer written out with fwrite, and a format whose callbacks lay out
+// each section. Names are copied in with memcpy and numbers converted by hand,
+// so no symbol or cell costs a formatted write. The buffer is flushed after
+// every section, so lines written to the log file directly (batch messages)
+// stay in order with it. JSON and binary logs take those messages as a
+// section of their own at the end instead.
+#define LOG_BUFFER_SIZE (1 << 20)
+#define LOG_DENSE_TABLE_LIMIT (64L << 20)
+#define LOG_BINARY_MAGIC "CFGL"
+#define LOG_BINARY_VERSION 1
+
+typedef struct LogWriter LogWriter;
+typedef struct LalrTable LalrTable;
+
+// lalr is NULL for the formats that cannot log --lalr's tables
+typedef struct {
+    const char* name;
+    void (*begin)(LogWriter* w);
+    void (*grammar)(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st, const char* stage);
+    void (*sets)(LogWriter* w, const char* label, const BitMatrix* sets, const int* terminals, int term_count, const SymbolTable* st);
+    void (*table)(LogWriter* w, const LL1Table* table);
+    void (*lalr)(LogWriter* w, const LalrTable* table, const Production* productions, int prod_count, const SymbolTable* st);
+    void (*messages)(LogWriter* w, const char* text, size_t len);
+    void (*end)(LogWriter* w);
+} LogFormat;
+
+struct LogWriter {
+    FILE* fp;
+    char* buf;
+    size_t len;
+    const LogFormat* format;
+    int sections;
+    FILE* captured;
+    char* captured_text;
+    size_t captured_len;
+};
+
+void log_flush(LogWriter* w) {
+    if (w->len) fwrite(w->buf, 1, w->len, w->fp);
+    w->len = 0;
+}
+
+void log_bytes(LogWriter* w, const void* data, size_t n) {
+    if (w->len + n > LOG_BUFFER_SIZE) {
+        log_flush(w);
+        if (n > LOG_BUFFER_SIZE) {
+            fwrite(data, 1, n, w->fp);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+}
+
+void log_str(LogWriter* w, const char* s) {
+    log_bytes(w, s, strlen(s));
+}
+
+void log_char(LogWriter* w, char c) {
+    if (w->len == LOG_BUFFER_SIZE) log_flush(w);
+    w->buf[w->len++] = c;
+}
+
+void log_spaces(LogWriter* w, int n) {
+    while (n > 0) {
+        if (w->len == LOG_BUFFER_SIZE) log_flush(w);
+        int k = LOG_BUFFER_SIZE - (int)w->len < n ? LOG_BUFFER_SIZE - (int)w->len : n;
+        memset(w->buf + w->len, ' ', k);
+        w->len += k;
+        n -= k;
+    }
+}
+
+void log_int(LogWriter* w, long v) {
+    char digits[24];
+    int n = 0;
+    unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+    do {
+        digits[sizeof(digits) - 1 - n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0) digits[sizeof(digits) - 1 - n++] = '-';
+    log_bytes(w, digits + sizeof(digits) - n, n);
+}
+
+void log_u32(LogWriter* w, uint32_t v) {
+    log_bytes(w, &v, sizeof(v));
+}
+
+void log_json_string(LogWriter* w, const char* s) {
+    log_char(w, '"');
+    const char* run = s;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+        log_bytes(w, run, s - run);
+        run = s + 1;
+        if (c == '"' || c == '\\') {
+            log_char(w, '\\');
+            log_char(w, c);
+        } else {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            log_str(w, escape);
+        }
+    }
+    log_bytes(w, run, s - run);
+    log_char(w, '"');
+}
+
+// Terminal columns as they print: ε, the one non-ASCII name, is one column wide
+int display_width(const char* s) {
+    int width = 0;
+    for (; *s; s++) width += ((unsigned char)*s & 0xC0) != 0x80;
+    return width;
+}
+
+void log_alternative(LogWriter* w, const Production* p, int j, const SymbolTable* st) {
+    int len = alt_len(p, j);
+    if (len == 0) log_str(w, "ε");
+    int* syms = alt_syms(p, j);
+    for (int k = 0; k < len; k++) {
+        if (k) log_char(w, ' ');
+        log_str(w, st->names[syms[k]]);
+    }
+}
+
+// An alternative of the table, from its reversed encoding
+void log_table_alternative(LogWriter* w, const LL1Table* t, int alt) {
+    int term_count = t->header->term_count;
+    int from = t->code_start[alt];
+    int to = t->code_start[alt + 1];
+    if (from == to) log_str(w, "ε");
+    for (int k = to - 1; k >= from; k--) {
+        int sym = t->code[k];
+        if (k != to - 1) log_char(w, ' ');
+        log_str(w, ll1_table_name(t, sym < 0 ? -sym - 1 : term_count + sym));
+    }
+}
+
+int table_alternative_width(const LL1Table* t, int alt, const int* name_width) {
+    int term_count = t->header->term_count;
+    int from = t->code_start[alt];
+    int to = t->code_start[alt + 1];
+    if (from == to) return 1;
+    int width = to - from - 1;
+    for (int k = from; k < to; k++) width += name_width[t->code[k] < 0 ? -t->code[k] - 1 : term_count + t->code[k]];
+    return width;
+}
+
+void text_grammar(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st, const char* stage) {
+    log_str(w, stage);
+    log_str(w, ":\n");
+    for (int i = 0; i < prod_count; i++) {
+        log_str(w, st->names[productions[i].lhs]);
+        log_str(w, " -> ");
+        for (int j = 0; j < productions[i].rhs_count; j++) {
+            if (j) log_str(w, " | ");
+            log_alternative(w, &productions[i], j, st);
+        }
+        log_char(w, '\n');
+    }
+    log_char(w, '\n');
+}
+
+void text_sets(LogWriter* w, const char* label, const BitMatrix* sets, const int* terminals, int term_count, const SymbolTable* st) {
+    (void)term_count;
+    log_str(w, label);
+    log_str(w, " Sets:\n");
+    for (int i = 0; i < sets->rows; i++) {
+        const uint64_t* set = bitset_row(sets, i);
+        log_str(w, label);
+        log_char(w, '(');
+        log_str(w, st->names[st->nts[i]]);
+        log_str(w, ") = { ");
+        for (int t = bitset_next(set, sets->words, 0), first = 1; t != -1; t = bitset_next(set, sets->words, t + 1), first = 0) {
+            if (!first) log_str(w, ", ");
+            log_str(w, st->names[terminals[t]]);
+        }
+        log_str(w, " }\n");
+    }
+    log_char(w, '\n');
+}
+
+// Only the filled cells, one per line
+void sparse_table(LogWriter* w, const LL1Table* t) {
+    int nt_count = t->header->nt_count;
+    int term_count = t->header->term_count;
+    long cells = 0;
+    for (int a = 0; a < nt_count; a++) {
+        for (int c = 0; c < term_count; c++) cells += ll1_table_lookup(t, a, c) != -1;
+    }
+    log_str(w, "LL(1) Parsing Table (");
+    log_int(w, cells);
+    log_str(w, " cells):\n");
+    for (int a = 0; a < nt_count; a++) {
+        const char* name = ll1_table_name(t, term_count + a);
+        for (int c = 0; c < term_count; c++) {
+            int g = ll1_table_lookup(t, a, c);
+            if (g == -1) continue;
+            log_char(w, '[');
+            log_str(w, name);
+            log_str(w, ", ");
+            log_str(w, ll1_table_name(t, c));
+            log_str(w, "] ");
+            log_str(w, name);
+            log_str(w, " -> ");
+            log_table_alternative(w, t, g);
+            log_char(w, '\n');
+        }
+    }
+    log_char(w, '\n');
+}
+
+// The dense table, each column as wide as its widest entry. A table that
+// would take more than LOG_DENSE_TABLE_LIMIT bytes that way is listed sparsely
+void human_table(LogWriter* w, const LL1Table* t) {
+    int nt_count = t->header->nt_count;
+    int term_count = t->header->term_count;
+    int alt_count = t->header->alt_count;
+    int* name_width = malloc((term_count + nt_count + 1) * sizeof(int));
+    int* alt_width = malloc((alt_count + 1) * sizeof(int));
+    int* column_width = malloc((term_count + 1) * sizeof(int));
+    for (int i = 0; i < term_count + nt_count; i++) name_width[i] = display_width(ll1_table_name(t, i));
+    for (int g = 0; g < alt_count; g++) alt_width[g] = name_width[term_count + t->alt_lhs[g]] + 2 + table_alternative_width(t, g, name_width);
+    int label_width = 4;
+    for (int a = 0; a < nt_count; a++) {
+        if (name_width[term_count + a] > label_width) label_width = name_width[term_count + a];
+    }
+    for (int c = 0; c < term_count; c++) column_width[c] = name_width[c];
+    for (int a = 0; a < nt_count; a++) {
+        for (int c = 0; c < term_count; c++) {
+            int g = ll1_table_lookup(t, a, c);
+            if (g != -1 && alt_width[g] > column_width[c]) column_width[c] = alt_width[g];
+        }
+    }
+    long line_width = label_width + 1;
+    for (int c = 0; c < term_count; c++) line_width += column_width[c] + 2;
+    if (line_width * (nt_count + 1) > LOG_DENSE_TABLE_LIMIT) {
+        free(name_width);
+        free(alt_width);
+        free(column_width);
+        sparse_table(w, t);
+        return;
+    }
+
+    log_str(w, "LL(1) Parsing Table:\nNT\\T");
+    int pending = label_width - 4 + 2;
+    for (int c = 0; c < term_count; c++) {
+        log_spaces(w, pending);
+        log_str(w, ll1_table_name(t, c));
+        pending = column_width[c] - name_width[c] + 2;
+    }
+    log_char(w, '\n');
+    for (int a = 0; a < nt_count; a++) {
+        log_str(w, ll1_table_name(t, term_count + a));
+        pending = label_width - name_width[term_count + a] + 2;
+        for (int c = 0; c < term_count; c++) {
+            int g = ll1_table_lookup(t, a, c);
+            if (g == -1) {
+                pending += column_width[c] + 2;
+                continue;
+            }
+            log_spaces(w, pending);
+            log_str(w, ll1_table_name(t, term_count + a));
+            log_str(w, "->");
+            log_table_alternative(w, t, g);
+            pending = column_width[c] - alt_width[g] + 2;
+        }
+        log_char(w, '\n');
+    }
+    log_char(w, '\n');
+    free(name_width);
+    free(alt_width);
+    free(column_width);
+}
+
+// JSON: {"sections": [...]} with one object per section, in log order
+void json_begin(LogWriter* w) {
+    log_str(w, "{\"sections\": [");
+}
+
+void json_section(LogWriter* w, const char* type) {
+    log_str(w, w->sections++ ? ",\n{\"type\": \"" : "\n{\"type\": \"");
+    log_str(w, type);
+    log_char(w, '"');
+}
+
+void json_grammar(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st, const char* stage) {
+    json_section(w, "grammar");
+    log_str(w, ", \"stage\": ");
+    log_json_string(w, stage);
+    log_str(w, ", \"productions\": [");
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        log_str(w, i ? ",\n  {\"lhs\": " : "\n  {\"lhs\": ");
+        log_json_string(w, st->names[p->lhs]);
+        log_str(w, ", \"alternatives\": [");
+        for (int j = 0; j < p->rhs_count; j++) {
+            log_str(w, j ? ", [" : "[");
+            int* syms = alt_syms(p, j);
+            for (int k = 0; k < alt_len(p, j); k++) {
+                if (k) log_str(w, ", ");
+                log_json_string(w, st->names[syms[k]]);
+            }
+            log_char(w, ']');
+        }
+        log_str(w, "]}");
+    }
+    log_str(w, "]}");
+}
+
+void json_sets(LogWriter* w, const char* label, const BitMatrix* sets, const int* terminals, int term_count, const SymbolTable* st) {
+    (void)term_count;
+    json_section(w, "sets");
+    log_str(w, ", \"label\": ");
+    log_json_string(w, label);
+    log_str(w, ", \"sets\": {");
+    for (int i = 0; i < sets->rows; i++) {
+        const uint64_t* set = bitset_row(sets, i);
+        log_str(w, i ? ",\n  " : "\n  ");
+        log_json_string(w, st->names[st->nts[i]]);
+        log_str(w, ": [");
+        for (int t = bitset_next(set, sets->words, 0), first = 1; t != -1; t = bitset_next(set, sets->words, t + 1), first = 0) {
+            if (!first) log_str(w, ", ");
+            log_json_string(w, st->names[terminals[t]]);
+        }
+        log_char(w, ']');
+    }
+    log_str(w, "}}");
+}
+
+void json_table(LogWriter* w, const LL1Table* t) {
+    int nt_count = t->header->nt_count;
+    int term_count = t->header->term_count;
+    json_section(w, "table");
+    log_str(w, ", \"conflicts\": ");
+    log_int(w, t->conflicts);
+    log_str(w, ", \"terminals\": [");
+    for (int c = 0; c < term_count; c++) {
+        if (c) log_str(w, ", ");
+        log_json_string(w, ll1_table_name(t, c));
+    }
+    log_str(w, "], \"nonterminals\": [");
+    for (int a = 0; a < nt_count; a++) {
+        if (a) log_str(w, ", ");
+        log_json_string(w, ll1_table_name(t, term_count + a));
+    }
+    log_str(w, "], \"cells\": [");
+    int first = 1;
+    for (int a = 0; a < nt_count; a++) {
+        for (int c = 0; c < term_count; c++) {
+            int g = ll1_table_lookup(t, a, c);
+            if (g == -1) continue;
+            log_str(w, first ? "\n  {\"nonterminal\": " : ",\n  {\"nonterminal\": ");
+            first = 0;
+            log_json_string(w, ll1_table_name(t, term_count + a));
+            log_str(w, ", \"terminal\": ");
+            log_json_string(w, ll1_table_name(t, c));
+            log_str(w, ", \"rhs\": [");
+            for (int k = t->code_start[g + 1] - 1; k >= t->code_start[g]; k--) {
+                int sym = t->code[k];
+                if (k != t->code_start[g + 1] - 1) log_str(w, ", ");
+                log_json_string(w, ll1_table_name(t, sym < 0 ? -sym - 1 : term_count + sym));
+            }
+            log_str(w, "]}");
+        }
+    }
+    log_str(w, "]}");
+}
+
+void json_messages(LogWriter* w, const char* text, size_t len) {
+    (void)len;
+    json_section(w, "messages");
+    log_str(w, ", \"text\": ");
+    log_json_string(w, text);
+    log_char(w, '}');
+}
+
+void json_end(LogWriter* w) {
+    log_str(w, "\n]}\n");
+}
+
+// Binary: "CFGL", a version, then sections of a four-byte tag, a byte size
+// and the payload, all in native byte order:
+//   GRAM  stage name, symbols (nonterminal index or -1, then the names, each
+//         ending in NUL), productions (lhs, alternative count, then each
+//         alternative as a length and its symbols)
+//   SETS  label, rows, columns, words per row, the symbol of each column, then
+//         the rows as 64-bit words
+//   TABL  the table block, as --emit-table writes it
+//   MSGS  the messages of a batch run, as text
+void binary_begin(LogWriter* w) {
+    log_bytes(w, LOG_BINARY_MAGIC, 4);
+    log_u32(w, LOG_BINARY_VERSION);
+}
+
+// The symbols listed are those up to the highest one the productions use, so a
+// grammar read back from the cache logs the same as when it was built
+void binary_grammar(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st, const char* stage) {
+    int symbol_count = 0;
+    uint32_t size = 4 + strlen(stage) + 12;
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        int sym_count = p->alt_start[p->rhs_count] - p->alt_start[0];
+        if (p->lhs >= symbol_count) symbol_count = p->lhs + 1;
+        for (int k = 0; k < sym_count; k++) {
+            if (p->syms[p->alt_start[0] + k] >= symbol_count) symbol_count = p->syms[p->alt_start[0] + k] + 1;
+        }
+        size += 8 + 4 * p->rhs_count + 4 * sym_count;
+    }
+    uint32_t name_bytes = 0;
+    for (int s = 0; s < symbol_count; s++) name_bytes += strlen(st->names[s]) + 1;
+    size += 4 * symbol_count + name_bytes;
+    log_bytes(w, "GRAM", 4);
+    log_u32(w, size);
+    log_u32(w, strlen(stage));
+    log_str(w, stage);
+    log_u32(w, symbol_count);
+    log_bytes(w, st->nt_index, 4 * symbol_count);
+    log_u32(w, name_bytes);
+    for (int s = 0; s < symbol_count; s++) log_bytes(w, st->names[s], strlen(st->names[s]) + 1);
+    log_u32(w, prod_count);
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        log_u32(w, p->lhs);
+        log_u32(w, p->rhs_count);
+        for (int j = 0; j < p->rhs_count; j++) {
+            log_u32(w, alt_len(p, j));
+            log_bytes(w, alt_syms(p, j), 4 * alt_len(p, j));
+        }
+    }
+}
+
+void binary_sets(LogWriter* w, const char* label, const BitMatrix* sets, const int* terminals, int term_count, const SymbolTable* st) {
+    (void)st;
+    uint32_t size = 4 + strlen(label) + 12 + 4 * term_count + 8 * (size_t)sets->rows * sets->words;
+    log_bytes(w, "SETS", 4);
+    log_u32(w, size);
+    log_u32(w, strlen(label));
+    log_str(w, label);
+    log_u32(w, sets->rows);
+    log_u32(w, term_count);
+    log_u32(w, sets->words);
+    log_bytes(w, terminals, 4 * term_count);
+    for (int i = 0; i < sets->rows; i++) log_bytes(w, bitset_row(sets, i), 8 * sets->words);
+}
+
+void binary_table(LogWriter* w, const LL1Table* t) {
+    log_bytes(w, "TABL", 4);
+    log_u32(w, t->header->total_size);
+    log_bytes(w, t->header, t->header->total_size);
+}
+
+void binary_messages(LogWriter* w, const char* text, size_t len) {
+    log_bytes(w, "MSGS", 4);
+    log_u32(w, len);
+    log_bytes(w, text, len);
+}
+
+void no_section(LogWriter* w) {
+    (void)w;
+}
+
+// The LALR(1) writers follow the LALR(1) construction
+void human_lalr(LogWriter* w, const LalrTable* t, const Production* productions, int prod_count, const SymbolTable* st);
+void sparse_lalr(LogWriter* w, const LalrTable* t, const Production* productions, int prod_count, const SymbolTable* st);
+
+const LogFormat log_formats[] = {
+    {"human", no_section, text_grammar, text_sets, human_table, human_lalr, NULL, no_section},
+    {"sparse", no_section, text_grammar, text_sets, sparse_table, sparse_lalr, NULL, no_section},
+    {"json", json_begin, json_grammar, json_sets, json_table, NULL, json_messages, json_end},
+    {"binary", binary_begin, binary_grammar, binary_sets, binary_table, NULL, binary_messages, no_section},
+};
+
+const LogFormat* find_log_format(const char* name) {
+    for (size_t i = 0; i < sizeof(log_formats) / sizeof(log_formats[0]); i++) {
+        if (strcmp(log_formats[i].name, name) == 0) return &log_formats[i];
+    }
+    return NULL;
+}
+
+void log_open(LogWriter* w, FILE* fp, const LogFormat* format) {
+    w->fp = fp;
+    w->buf = malloc(LOG_BUFFER_SIZE);
+    w->len = 0;
+    w->format = format;
+    w->sections = 0;
+    w->captured = NULL;
+    format->begin(w);
+}
+
+// Where a batch run's messages go: the log itself, or a buffer that becomes
+// the log's last section
+FILE* log_messages_stream(LogWriter* w) {
+    if (!w->format->messages) return w->fp;
+    w->captured = open_memstream(&w->captured_text, &w->captured_len);
+    return w->captured;
+}
+
+void log_grammar(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st, const char* stage) {
+    w->format->grammar(w, productions, prod_count, st, stage);
+    log_flush(w);
+}
+
+void log_sets(LogWriter* w, const char* label, const BitMatrix* sets, const int* terminals, int term_count, const SymbolTable* st) {
+    w->format->sets(w, label, sets, terminals, term_count, st);
+    log_flush(w);
+}
+
+void log_table(LogWriter* w, const LL1Table* table) {
+    w->format->table(w, table);
+    log_flush(w);
+}
+
+void log_lalr(LogWriter* w, const LalrTable* table, const Production* productions, int prod_count, const SymbolTable* st) {
+    w->format->lalr(w, table, productions, prod_count, st);
+    log_flush(w);
+}
+
+// Ends the log and closes its file
+void log_close(LogWriter* w) {
+    if (w->captured) {
+        fclose(w->captured);
+        w->format->messages(w, w->captured_text, w->captured_len);
+        free(w->captured_text);
+    }
+    w->format->end(w);
+    log_flush(w);
+    free(w->buf);
+    fclose(w->fp);
+}
+
+// Lexer generated from the table's terminal columns. Literal terminals match
+// their spelling and %token terminals their pattern. The combined NFA is turned
+// into a DFA over byte classes and minimized; scanning takes the longest match,
+// and ties go to literals, then to the lower column.
+typedef struct {
+    uint64_t set[4];
+    int to;
+    int eps[2];
+    int accept;
+} NfaState;
+
+typedef struct {
+    NfaState* states;
+    int count;
+    int capacity;
+} Nfa;
+
+typedef struct {
+    int start;
+    int end;
+} NfaFragment;
+
+typedef struct {
+    Nfa* nfa;
+    const char* p;
+    const char* pattern;
+    const char* terminal;
+    // The first error, or an empty string
+    char* error;
+} RegexParser;
+
+typedef struct {
+    int state_count;
+    int class_count;
+    int start;
+    unsigned char byte_class[256];
+    int* next;
+    int* accept;
+    uint64_t* loop;
+} Lexer;
+
+enum { LEX_TOKEN, LEX_END, LEX_NEED_MORE, LEX_ERROR };
+
+int nfa_add(Nfa* nfa) {
+    if (nfa->count >= nfa->capacity) {
+        nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+        nfa->states = realloc(nfa->states, nfa->capacity * sizeof(NfaState));
+    }
+    NfaState* s = &nfa->states[nfa->count];
+    memset(s->set, 0, sizeof(s->set));
+    s->to = -1;
+    s->eps[0] = s->eps[1] = -1;
+    s->accept = -1;
+    return nfa->count++;
+}
+
+void nfa_eps(Nfa* nfa, int from, int to) {
+    NfaState* s = &nfa->states[from];
+    s->eps[s->eps[0] == -1 ? 0 : 1] = to;
+}
+
+NfaFragment nfa_set_fragment(Nfa* nfa, const uint64_t set[4]) {
+    NfaFragment f;
+    f.start = nfa_add(nfa);
+    f.end = nfa_add(nfa);
+    memcpy(nfa->states[f.start].set, set, sizeof(nfa->states[f.start].set));
+    nfa->states[f.start].to = f.end;
+    return f;
+}
+
+NfaFragment nfa_empty_fragment(Nfa* nfa) {
+    NfaFragment f;
+    f.start = nfa_add(nfa);
+    f.end = nfa_add(nfa);
+    nfa_eps(nfa, f.start, f.end);
+    return f;
+}
+
+// Keeps the first error and moves to the end of the pattern, so every loop of
+// the parser stops there and the parse unwinds
+void regex_error(RegexParser* rp, const char* what) {
+    if (!rp->error[0]) snprintf(rp->error, GRAMMAR_ERROR_SIZE, "Error in %%token pattern for %s: %s at offset %d", rp->terminal, what, (int)(rp->p - rp->pattern));
+    rp->p = rp->pattern + strlen(rp->pattern);
+}
+
+void set_range(uint64_t set[4], int lo, int hi) {
+    for (int b = lo; b <= hi; b++) set[b >> 6] |= 1ULL << (b & 63);
+}
+
+// Reads one possibly escaped character; shorthand classes (\d \w \s) go into set
+// and return -1
+int regex_escape(RegexParser* rp, uint64_t set[4]) {
+    char c = *rp->p++;
+    if (c == '\0') {
+        rp->p--;
+        regex_error(rp, "dangling backslash");
+        return -1;
+    }
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'd':
+        set_range(set, '0', '9');
+        return -1;
+    case 'w':
+        set_range(set, '0', '9');
+        set_range(set, 'A', 'Z');
+        set_range(set, 'a', 'z');
+        set_range(set, '_', '_');
+        return -1;
+    case 's':
+        set_range(set, ' ', ' ');
+        set_range(set, '\t', '\r');
+        return -1;
+    default: return (unsigned char)c;
+    }
+}
+
+NfaFragment regex_alternation(RegexParser* rp);
+
+NfaFragment regex_atom(RegexParser* rp) {
+    uint64_t set[4] = {0, 0, 0, 0};
+    char c = *rp->p++;
+    if (c == '(') {
+        NfaFragment f = regex_alternation(rp);
+        if (*rp->p != ')') regex_error(rp, "missing ')'");
+        else rp->p++;
+        return f;
+    }
+    if (c == '[') {
+        int negate = *rp->p == '^';
+        if (negate) rp->p++;
+        int first = 1;
+        while (*rp->p && (*rp->p != ']' || first)) {
+            first = 0;
+            int lo = *rp->p == '\\' ? (rp->p++, regex_escape(rp, set)) : (unsigned char)*rp->p++;
+            if (lo < 0) continue;
+            int hi = lo;
+            if (rp->p[0] == '-' && rp->p[1] && rp->p[1] != ']') {
+                rp->p++;
+                hi = *rp->p == '\\' ? (rp->p++, regex_escape(rp, set)) : (unsigned char)*rp->p++;
+                if (hi < lo) regex_error(rp, "bad range");
+            }
+            set_range(set, lo, hi);
+        }
+        if (*rp->p != ']') regex_error(rp, "missing ']'");
+        else rp->p++;
+        if (negate) {
+            for (int w = 0; w < 4; w++) set[w] = ~set[w];
+        }
+    } else if (c == '.') {
+        set_range(set, 0, 255);
+        set[0] &= ~(1ULL << '\n');
+    } else if (c == '\\') {
+        int ch = regex_escape(rp, set);
+        if (ch >= 0) set_range(set, ch, ch);
+    } else if (c == '*' || c == '+' || c == '?' || c == ')' || c == '\0') {
+        rp->p--;
+        regex_error(rp, "unexpected operator");
+    } else {
+        set_range(set, (unsigned char)c, (unsigned char)c);
+    }
+    return nfa_set_fragment(rp->nfa, set);
+}
+
+NfaFragment regex_repeat(RegexParser* rp) {
+    NfaFragment f = regex_atom(rp);
+    while (*rp->p == '*' || *rp->p == '+' || *rp->p == '?') {
+        char op = *rp->p++;
+        NfaFragment r;
+        r.start = nfa_add(rp->nfa);
+        r.end = nfa_add(rp->nfa);
+        nfa_eps(rp->nfa, r.start, f.start);
+        if (op != '+') nfa_eps(rp->nfa, r.start, r.end);
+        if (op != '?') nfa_eps(rp->nfa, f.end, f.start);
+        nfa_eps(rp->nfa, f.end, r.end);
+        f = r;
+    }
+    return f;
+}
+
+NfaFragment regex_concatenation(RegexParser* rp) {
+    if (*rp->p == '\0' || *rp->p == '|' || *rp->p == ')') return nfa_empty_fragment(rp->nfa);
+    NfaFragment f = regex_repeat(rp);
+    while (*rp->p && *rp->p != '|' && *rp->p != ')') {
+        NfaFragment g = regex_repeat(rp);
+        nfa_eps(rp->nfa, f.end, g.start);
+        f.end = g.end;
+    }
+    return f;
+}
+
+NfaFragment regex_alternation(RegexParser* rp) {
+    NfaFragment f = regex_concatenation(rp);
+    while (*rp->p == '|') {
+        rp->p++;
+        NfaFragment g = regex_concatenation(rp);
+        NfaFragment r;
+        r.start = nfa_add(rp->nfa);
+        r.end = nfa_add(rp->nfa);
+        nfa_eps(rp->nfa, r.start, f.start);
+        nfa_eps(rp->nfa, r.start, g.start);
+        nfa_eps(rp->nfa, f.end, r.end);
+        nfa_eps(rp->nfa, g.end, r.end);
+        f = r;
+    }
+    return f;
+}
+
+// Epsilon closure of set[0..*count) in place; mark[] holds the stamp of the current closure
+void nfa_closure(const Nfa* nfa, int* set, int* count, int* mark, int stamp) {
+    int top = *count;
+    for (int i = 0; i < top; i++) mark[set[i]] = stamp;
+    for (int i = 0; i < *count; i++) {
+        const NfaState* s = &nfa->states[set[i]];
+        for (int e = 0; e < 2; e++) {
+            int t = s->eps[e];
+            if (t != -1 && mark[t] != stamp) {
+                mark[t] = stamp;
+                set[(*count)++] = t;
+            }
+        }
+    }
+}
+
+int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Moore partition refinement: states are split by their accepted column, then
+// repeatedly by the blocks their transitions lead to, until nothing splits
+int minimize_dfa(int state_count, int class_count, const int* next, const int* accept, int* block) {
+    int* signature = malloc((class_count + 1) * sizeof(int));
+    int* new_block = malloc((state_count > 0 ? state_count : 1) * sizeof(int));
+    int block_count = 0;
+    VectorSet vs;
+    vector_set_init(&vs);
+    int added;
+    for (int s = 0; s < state_count; s++) block[s] = vector_set_intern(&vs, &accept[s], 1, &added);
+    block_count = vs.count;
+    vector_set_free(&vs);
+    while (1) {
+        vector_set_init(&vs);
+        for (int s = 0; s < state_count; s++) {
+            signature[0] = block[s];
+            for (int c = 0; c < class_count; c++) {
+                int t = next[s * class_count + c];
+                signature[c + 1] = t < 0 ? -1 : block[t];
+            }
+            new_block[s] = vector_set_intern(&vs, signature, class_count + 1, &added);
+        }
+        int new_count = vs.count;
+        vector_set_free(&vs);
+        memcpy(block, new_block, state_count * sizeof(int));
+        if (new_count == block_count) break;
+        block_count = new_count;
+    }
+    free(signature);
+    free(new_block);
+    return block_count;
+}
+
+// names and patterns are indexed by terminal column; a NULL pattern means the
+// terminal is scanned literally. Returns 0, with the message in
+// error[GRAMMAR_ERROR_SIZE], when a pattern does not parse.
+int build_lexer(Lexer* lx, int term_count, int end_column, const char* const* names, const char* const* patterns, char* error) {
+    Nfa nfa = {0};
+    int* starts = malloc((term_count > 0 ? term_count : 1) * sizeof(int));
+    int start_count = 0;
+    error[0] = '\0';
+    for (int c = 0; c < term_count; c++) {
+        if (c == end_column) continue;
+        const char* pattern = patterns[c];
+        NfaFragment f;
+        if (pattern) {
+            RegexParser rp = {&nfa, pattern, pattern, names[c], error};
+            f = regex_alternation(&rp);
+            if (*rp.p != '\0') regex_error(&rp, "unbalanced ')'");
+        } else {
+            const char* name = names[c];
+            f = nfa_empty_fragment(&nfa);
+            for (const char* q = name; *q; q++) {
+                uint64_t set[4] = {0, 0, 0, 0};
+                set_range(set, (unsigned char)*q, (unsigned char)*q);
+                NfaFragment g = nfa_set_fragment(&nfa, set);
+                nfa_eps(&nfa, f.end, g.start);
+                f.end = g.end;
+            }
+        }
+        nfa.states[f.end].accept = c;
+        starts[start_count++] = f.start;
+    }
+    if (error[0]) {
+        free(starts);
+        free(nfa.states);
+        return 0;
+    }
+
+    // Bytes that no edge set tells apart share a class
+    memset(lx->byte_class, 0, sizeof(lx->byte_class));
+    int class_count = 1;
+    int remap[512];
+    for (int s = 0; s < nfa.count; s++) {
+        if (nfa.states[s].to == -1) continue;
+        for (int i = 0; i < 512; i++) remap[i] = -1;
+        int n = 0;
+        for (int b = 0; b < 256; b++) {
+            int key = lx->byte_class[b] * 2 + bitset_test(nfa.states[s].set, b);
+            if (remap[key] == -1) remap[key] = n++;
+            lx->byte_class[b] = remap[key];
+        }
+        class_count = n;
+    }
+    int representative[256];
+    for (int b = 255; b >= 0; b--) representative[lx->byte_class[b]] = b;
+
+    // A literal wins a tie against a pattern, then the lower column wins
+    int* priority = malloc((term_count > 0 ? term_count : 1) * sizeof(int));
+    for (int c = 0; c < term_count; c++) priority[c] = (patterns[c] ? term_count : 0) + c;
+
+    // Subset construction; DFA states are interned sorted NFA state sets
+    int* mark = calloc(nfa.count > 0 ? nfa.count : 1, sizeof(int));
+    int* work = malloc((nfa.count > 0 ? nfa.count : 1) * sizeof(int));
+    int stamp = 0;
+    VectorSet states;
+    vector_set_init(&states);
+    int next_capacity = 64;
+    int* next = malloc(next_capacity * class_count * sizeof(int));
+    int* accept = malloc(next_capacity * sizeof(int));
+    int added;
+    int n = start_count;
+    memcpy(work, starts, n * sizeof(int));
+    nfa_closure(&nfa, work, &n, mark, ++stamp);
+    qsort(work, n, sizeof(int), compare_ints);
+    vector_set_intern(&states, work, n, &added);
+    for (int d = 0; d < states.count; d++) {
+        if (states.count > next_capacity) {
+            while (states.count > next_capacity) next_capacity *= 2;
+            next = realloc(next, next_capacity * class_count * sizeof(int));
+            accept = realloc(accept, next_capacity * sizeof(int));
+        }
+        accept[d] = -1;
+        for (int i = 0; i < states.length[d]; i++) {
+            int a = nfa.states[states.data[states.start[d] + i]].accept;
+            if (a != -1 && (accept[d] == -1 || priority[a] < priority[accept[d]])) accept[d] = a;
+        }
+        for (int c = 0; c < class_count; c++) {
+            int b = representative[c];
+            n = 0;
+            ++stamp;
+            for (int i = 0; i < states.length[d]; i++) {
+                const NfaState* s = &nfa.states[states.data[states.start[d] + i]];
+                if (s->to != -1 && bitset_test(s->set, b) && mark[s->to] != stamp) {
+                    mark[s->to] = stamp;
+                    work[n++] = s->to;
+                }
+            }
+            if (n == 0) {
+                next[d * class_count + c] = -1;
+                continue;
+            }
+            nfa_closure(&nfa, work, &n, mark, ++stamp);
+            qsort(work, n, sizeof(int), compare_ints);
+            next[d * class_count + c] = vector_set_intern(&states, work, n, &added);
+        }
+    }
+    int dfa_count = states.count;
+    vector_set_free(&states);
+
+    int* block = malloc((dfa_count > 0 ? dfa_count : 1) * sizeof(int));
+    int block_count = minimize_dfa(dfa_count, class_count, next, accept, block);
+    lx->state_count = block_count;
+    lx->class_count = class_count;
+    lx->start = block[0];
+    lx->next = malloc((size_t)block_count * class_count * sizeof(int));
+    lx->accept = malloc(block_count * sizeof(int));
+    lx->loop = calloc((size_t)block_count * 4, sizeof(uint64_t));
+    for (int d = 0; d < dfa_count; d++) {
+        int s = block[d];
+        lx->accept[s] = accept[d];
+        for (int c = 0; c < class_count; c++) {
+            int to = next[d * class_count + c];
+            lx->next[s * class_count + c] = to < 0 ? -1 : block[to];
+        }
+    }
+    // Bytes that keep the DFA in the same state are skipped in a tight loop
+    for (int s = 0; s < block_count; s++) {
+        for (int b = 0; b < 256; b++) {
+            if (lx->next[s * class_count + lx->byte_class[b]] == s) bitset_add(lx->loop + 4 * s, b);
+        }
+    }
+    free(block);
+    free(next);
+    free(accept);
+    free(mark);
+    free(work);
+    free(priority);
+    free(starts);
+    free(nfa.states);
+    return 1;
+}
+
+// Lexer for an LL(1) table, which may be mapped without its grammar
+int build_table_lexer(Lexer* lx, const LL1Table* t, char* error) {
+    int term_count = t->header->term_count;
+    const char** names = malloc((term_count > 0 ? term_count : 1) * sizeof(char*));
+    const char** patterns = malloc((term_count > 0 ? term_count : 1) * sizeof(char*));
+    for (int c = 0; c < term_count; c++) {
+        names[c] = ll1_table_name(t, c);
+        patterns[c] = ll1_table_pattern(t, c);
+    }
+    int built = build_lexer(lx, term_count, t->header->end_column, names, patterns, error);
+    free(names);
+    free(patterns);
+    return built;
+}
+
+// For the modes that stop at the first error
+void build_lexer_or_exit(Lexer* lx, int term_count, int end_column, const char* const* names, const char* const* patterns) {
+    char error[GRAMMAR_ERROR_SIZE];
+    if (!build_lexer(lx, term_count, end_column, names, patterns, error)) {
+        printf("%s\n", error);
+        exit(1);
+    }
+}
+
+void build_table_lexer_or_exit(Lexer* lx, const LL1Table* t) {
+    char error[GRAMMAR_ERROR_SIZE];
+    if (!build_table_lexer(lx, t, error)) {
+        printf("%s\n", error);
+        exit(1);
+    }
+}
+
+void free_lexer(Lexer* lx) {
+    free(lx->next);
+    free(lx->accept);
+    free(lx->loop);
+}
+
+const char* skip_whitespace(const char* p, const char* end) {
+#if defined(__SSE2__)
+    // Sixteen bytes at a time: a byte is blank if it is ' ' or in '\t'..'\r'
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+        __m128i control = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(8)), _mm_cmplt_epi8(v, _mm_set1_epi8(14)));
+        int blank = _mm_movemask_epi8(_mm_or_si128(space, control));
+        if (blank != 0xFFFF) return p + __builtin_ctz(~blank);
+        p += 16;
+    }
+#endif
+    while (p < end && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+// Scans the next token of [p, end). LEX_NEED_MORE means the buffer ended while a
+// token could still grow (or before any token); the caller refills from *tok_start.
+int lexer_next(const Lexer* lx, const char* p, const char* end, int eof, const char** tok_start, const char** tok_end, int* column) {
+    p = skip_whitespace(p, end);
+    *tok_start = p;
+    if (p == end) return eof ? LEX_END : LEX_NEED_MORE;
+    const int* next = lx->next;
+    int class_count = lx->class_count;
+    int s = lx->start;
+    int last = -1;
+    const char* last_end = p;
+    const char* q = p;
+    while (q < end) {
+        int to = next[s * class_count + lx->byte_class[(unsigned char)*q]];
+        if (to < 0) break;
+        s = to;
+        q++;
+        const uint64_t* loop = lx->loop + 4 * s;
+        while (q < end && ((loop[(unsigned char)*q >> 6] >> ((unsigned char)*q & 63)) & 1)) q++;
+        if (lx->accept[s] >= 0) {
+            last = lx->accept[s];
+            last_end = q;
+        }
+    }
+    if (q == end && !eof) return LEX_NEED_MORE;
+    if (last < 0) {
+        *tok_end = p + 1;
+        return LEX_ERROR;
+    }
+    *tok_end = last_end;
+    *column = last;
+    return LEX_TOKEN;
+}
+
+enum { PARSE_RUNNING, PARSE_ACCEPT, PARSE_ERROR };
+
+// LALR(1) tables built from the grammar as written, with no rewriting. States are
+// the LR(0) item sets, and lookaheads follow DeRemer and Pennello: on the
+// nonterminal transitions (p, A), Read(p, A) is what the goto state shifts plus
+// Read of every transition it makes over a nullable nonterminal, and Follow(p, A)
+// adds Follow(p', B) for each B -> beta A gamma with nullable gamma and
+// p' -beta-> p. A reduction's lookahead is the union of Follow over the
+// transitions it looks back to. Both relations are solved with
+// solve_set_equations, one pass over their components.
+// ACTION rows are packed like the LL(1) rows: a value v >= 0 shifts to state v,
+// v < 0 reduces rule -v - 1, and reducing rule 0 (S' -> S) accepts. The most
+// common reduction of a state is its default and stays out of the row, and a
+// GOTO column only keeps the targets that differ from its most common one.
+struct LalrTable {
+    int state_count;
+    int term_count;
+    int nt_count;
+    int rule_count;
+    int end_column;
+    int action_slots;
+    int goto_slots;
+    int conflicts;
+    int* action_base;
+    int* action_check;
+    int* action_value;
+    int* default_reduce;
+    int* goto_base;
+    int* goto_check;
+    int* goto_value;
+    int* default_goto;
+    int* rule_lhs;
+    int* rule_len;
+    const char** names;
+    const char** patterns;
+};
+
+// Transitions of a state are sorted by symbol; returns the transition on sym or -1
+int find_transition(const int* trans_start, const int* trans_sym, int state, int sym) {
+    int lo = trans_start[state], hi = trans_start[state + 1] - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (trans_sym[mid] == sym) return mid;
+        if (trans_sym[mid] < sym) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Copies a scratch array into the arena that outlives the construction
+int* arena_copy_ints(Arena* arena, const int* src, int count) {
+    int* dst = arena_alloc(arena, (count > 0 ? count : 1) * sizeof(int));
+    memcpy(dst, src, count * sizeof(int));
+    return dst;
+}
+
+// The table lives in arena; everything else is scratch
+LalrTable construct_lalr_table(Production* productions, int prod_count, const SymbolTable* st, const int* terminals, const int* term_column, int term_count, const int* nullable, Arena* arena, Arena* scratch) {
+    int nt_count = st->nt_count;
+    int end_column = term_column[find_symbol(st, "$")];
+
+    // Rules are the alternatives numbered globally from 1. Items are positions in
+    // ritem, where each rule's symbols (columns, or term_count + nonterminal
+    // index) are followed by -(rule + 1)
+    int rule_count = 1, item_count = 2, max_len = 1;
+    for (int i = 0; i < prod_count; i++) {
+        rule_count += productions[i].rhs_count;
+        item_count += productions[i].alt_start[productions[i].rhs_count] + productions[i].rhs_count;
+        for (int j = 0; j < productions[i].rhs_count; j++) {
+            if (alt_len(&productions[i], j) > max_len) max_len = alt_len(&productions[i], j);
+        }
+    }
+    int symbol_count = term_count + nt_count;
+    int* rule_lhs = arena_alloc(scratch, rule_count * sizeof(int));
+    int* rule_len = arena_alloc(scratch, rule_count * sizeof(int));
+    int* rule_item = arena_alloc(scratch, rule_count * sizeof(int));
+    int* ritem = arena_alloc(scratch, item_count * sizeof(int));
+    rule_lhs[0] = nt_count;
+    rule_len[0] = 1;
+    rule_item[0] = 0;
+    ritem[0] = term_count;
+    ritem[1] = -1;
+    for (int i = 0, r = 1, n = 2; i < prod_count; i++) {
+        Production* p = &productions[i];
+        for (int j = 0; j < p->rhs_count; j++, r++) {
+            int* syms = alt_syms(p, j);
+            rule_lhs[r] = st->nt_index[p->lhs];
+            rule_len[r] = alt_len(p, j);
+            rule_item[r] = n;
+            for (int k = 0; k < alt_len(p, j); k++) {
+                ritem[n++] = is_terminal(syms[k], st) ? term_column[syms[k]] : term_count + st->nt_index[syms[k]];
+            }
+            ritem[n++] = -(r + 1);
+        }
+    }
+    int* nt_rule_start = arena_calloc(scratch, nt_count + 2, sizeof(int));
+    int* nt_rules = arena_alloc(scratch, rule_count * sizeof(int));
+    for (int r = 0; r < rule_count; r++) nt_rule_start[rule_lhs[r] + 1]++;
+    for (int a = 0; a <= nt_count; a++) nt_rule_start[a + 1] += nt_rule_start[a];
+    int* fill = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    memcpy(fill, nt_rule_start, (nt_count + 1) * sizeof(int));
+    for (int r = 0; r < rule_count; r++) nt_rules[fill[rule_lhs[r]]++] = r;
+
+    // LR(0) states, identified by their sorted kernels. The closure adds the
+    // first item of every rule of a nonterminal after a dot, once per state
+    VectorSet kernels;
+    vector_set_init(&kernels);
+    int added;
+    int start_item = 0;
+    vector_set_intern(&kernels, &start_item, 1, &added);
+    int* closure = arena_alloc(scratch, item_count * sizeof(int));
+    int* next_kernel = arena_alloc(scratch, item_count * sizeof(int));
+    int* nt_mark = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    int* sym_mark = arena_calloc(scratch, symbol_count, sizeof(int));
+    int* sym_fill = arena_alloc(scratch, symbol_count * sizeof(int));
+    int* syms = arena_alloc(scratch, symbol_count * sizeof(int));
+    int state_capacity = 64, trans_capacity = 256, red_capacity = 64;
+    int trans_count = 0, red_count = 0;
+    int* trans_start = arena_alloc(scratch, (state_capacity + 1) * sizeof(int));
+    int* red_start = arena_alloc(scratch, (state_capacity + 1) * sizeof(int));
+    int* trans_sym = arena_alloc(scratch, trans_capacity * sizeof(int));
+    int* trans_to = arena_alloc(scratch, trans_capacity * sizeof(int));
+    int* red_rule = arena_alloc(scratch, red_capacity * sizeof(int));
+    for (int d = 0; d < kernels.count; d++) {
+        if (d + 1 >= state_capacity) {
+            trans_start = arena_realloc(scratch, trans_start, (state_capacity + 1) * sizeof(int), (state_capacity * 2 + 1) * sizeof(int));
+            red_start = arena_realloc(scratch, red_start, (state_capacity + 1) * sizeof(int), (state_capacity * 2 + 1) * sizeof(int));
+            state_capacity *= 2;
+        }
+        trans_start[d] = trans_count;
+        red_start[d] = red_count;
+        int n = kernels.length[d];
+        memcpy(closure, kernels.data + kernels.start[d], n * sizeof(int));
+        for (int i = 0; i < n; i++) {
+            int X = ritem[closure[i]];
+            if (X < term_count || nt_mark[X - term_count] == d + 1) continue;
+            nt_mark[X - term_count] = d + 1;
+            for (int e = nt_rule_start[X - term_count]; e < nt_rule_start[X - term_count + 1]; e++) closure[n++] = rule_item[nt_rules[e]];
+        }
+
+        // Complete items are reductions; the rest are grouped by the symbol after the dot
+        int sym_count = 0;
+        for (int i = 0; i < n; i++) {
+            int X = ritem[closure[i]];
+            if (X < 0) {
+                if (red_count >= red_capacity) {
+                    red_rule = arena_realloc(scratch, red_rule, red_capacity * sizeof(int), red_capacity * 2 * sizeof(int));
+                    red_capacity *= 2;
+                }
+                red_rule[red_count++] = -X - 1;
+                continue;
+            }
+            if (sym_mark[X] != d + 1) {
+                sym_mark[X] = d + 1;
+                sym_fill[X] = 0;
+                syms[sym_count++] = X;
+            }
+            sym_fill[X]++;
+        }
+        qsort(syms, sym_count, sizeof(int), compare_ints);
+        for (int s = 0, offset = 0; s < sym_count; s++) {
+            int c = sym_fill[syms[s]];
+            sym_fill[syms[s]] = offset;
+            offset += c;
+        }
+        for (int i = 0; i < n; i++) {
+            int X = ritem[closure[i]];
+            if (X >= 0) next_kernel[sym_fill[X]++] = closure[i] + 1;
+        }
+        if (trans_count + sym_count > trans_capacity) {
+            int old = trans_capacity;
+            while (trans_count + sym_count > trans_capacity) trans_capacity *= 2;
+            trans_sym = arena_realloc(scratch, trans_sym, old * sizeof(int), trans_capacity * sizeof(int));
+            trans_to = arena_realloc(scratch, trans_to, old * sizeof(int), trans_capacity * sizeof(int));
+        }
+        for (int s = 0, from = 0; s < sym_count; s++) {
+            int to = sym_fill[syms[s]];
+            qsort(next_kernel + from, to - from, sizeof(int), compare_ints);
+            trans_sym[trans_count] = syms[s];
+            trans_to[trans_count] = vector_set_intern(&kernels, next_kernel + from, to - from, &added);
+            trans_count++;
+            from = to;
+        }
+    }
+    int state_count = kernels.count;
+    trans_start[state_count] = trans_count;
+    red_start[state_count] = red_count;
+    vector_set_free(&kernels);
+
+    // Nonterminal transitions are the nodes of the reads and includes relations
+    int* trans_nt = arena_alloc(scratch, (trans_count > 0 ? trans_count : 1) * sizeof(int));
+    int* ntr_from = arena_alloc(scratch, (trans_count > 0 ? trans_count : 1) * sizeof(int));
+    int* ntr_trans = arena_alloc(scratch, (trans_count > 0 ? trans_count : 1) * sizeof(int));
+    int ntr_count = 0;
+    for (int d = 0; d < state_count; d++) {
+        for (int tr = trans_start[d]; tr < trans_start[d + 1]; tr++) {
+            trans_nt[tr] = -1;
+            if (trans_sym[tr] < term_count) continue;
+            trans_nt[tr] = ntr_count;
+            ntr_from[ntr_count] = d;
+            ntr_trans[ntr_count] = tr;
+            ntr_count++;
+        }
+    }
+
+    // Direct reads seed the sets; the end marker follows the start symbol
+    BitMatrix follow = bitmatrix_new(scratch, ntr_count, term_count);
+    EdgeList reads = {scratch, NULL, NULL, 0, 0};
+    for (int k = 0; k < ntr_count; k++) {
+        int q = trans_to[ntr_trans[k]];
+        uint64_t* set = bitset_row(&follow, k);
+        if (ntr_from[k] == 0 && trans_sym[ntr_trans[k]] == term_count) bitset_add(set, end_column);
+        for (int tr = trans_start[q]; tr < trans_start[q + 1]; tr++) {
+            if (trans_sym[tr] < term_count) bitset_add(set, trans_sym[tr]);
+            else if (nullable[trans_sym[tr] - term_count]) add_edge(&reads, k, trans_nt[tr]);
+        }
+    }
+    DepGraph read_graph = build_graph(ntr_count, &reads);
+    int scc_count;
+    long visits = 0;
+    solve_set_equations(&read_graph, &follow, scratch, &scc_count, &visits);
+
+    // Walking each rule of B from p gives both relations: (q, A) includes (p, B)
+    // where the rest of the rule is nullable, and the reduction at the end of the
+    // walk looks back to (p, B)
+    EdgeList includes = {scratch, NULL, NULL, 0, 0};
+    EdgeList lookback = {scratch, NULL, NULL, 0, 0};
+    int* path = arena_alloc(scratch, max_len * sizeof(int));
+    for (int k = 0; k < ntr_count; k++) {
+        int B = trans_sym[ntr_trans[k]] - term_count;
+        for (int e = nt_rule_start[B]; e < nt_rule_start[B + 1]; e++) {
+            int r = nt_rules[e];
+            const int* rhs = ritem + rule_item[r];
+            int q = ntr_from[k];
+            for (int pos = 0; pos < rule_len[r]; pos++) {
+                int tr = find_transition(trans_start, trans_sym, q, rhs[pos]);
+                path[pos] = trans_nt[tr];
+                q = trans_to[tr];
+            }
+            for (int pos = rule_len[r] - 1; pos >= 0 && rhs[pos] >= term_count; pos--) {
+                add_edge(&includes, path[pos], k);
+                if (!nullable[rhs[pos] - term_count]) break;
+            }
+            int red = red_start[q];
+            while (red_rule[red] != r) red++;
+            add_edge(&lookback, red, k);
+        }
+    }
+    DepGraph include_graph = build_graph(ntr_count, &includes);
+    solve_set_equations(&include_graph, &follow, scratch, &scc_count, &visits);
+    BitMatrix lookahead = bitmatrix_new(scratch, red_count, term_count);
+    for (int e = 0; e < lookback.count; e++) {
+        bitset_union(bitset_row(&lookahead, lookback.src[e]), bitset_row(&follow, lookback.dst[e]), follow.words);
+    }
+    for (int red = 0; red < red_count; red++) {
+        if (red_rule[red] == 0) bitset_add(bitset_row(&lookahead, red), end_column);
+    }
+
+    // ACTION rows. Conflicts go to the shift, or to the earlier rule
+    int* row = arena_alloc(scratch, (term_count > 0 ? term_count : 1) * sizeof(int));
+    for (int t = 0; t < term_count; t++) row[t] = INT_MIN;
+    int* touched = arena_alloc(scratch, (term_count > 0 ? term_count : 1) * sizeof(int));
+    int* default_reduce = arena_alloc(scratch, state_count * sizeof(int));
+    int* row_start = arena_alloc(scratch, (state_count + 1) * sizeof(int));
+    int entry_capacity = 64, entry_count = 0;
+    int* entry_col = arena_alloc(scratch, entry_capacity * sizeof(int));
+    int* entry_value = arena_alloc(scratch, entry_capacity * sizeof(int));
+    int conflicts = 0;
+    for (int d = 0; d < state_count; d++) {
+        int touched_count = 0;
+        for (int tr = trans_start[d]; tr < trans_start[d + 1] && trans_sym[tr] < term_count; tr++) {
+            row[trans_sym[tr]] = trans_to[tr];
+            touched[touched_count++] = trans_sym[tr];
+        }
+        for (int red = red_start[d]; red < red_start[d + 1]; red++) {
+            int r = red_rule[red];
+            const uint64_t* set = bitset_row(&lookahead, red);
+            for (int t = bitset_next(set, lookahead.words, 0); t != -1; t = bitset_next(set, lookahead.words, t + 1)) {
+                if (row[t] == INT_MIN) {
+                    row[t] = -(r + 1);
+                    touched[touched_count++] = t;
+                } else if (row[t] >= 0) {
+                    fprintf(messages, "Conflict in state %d on %s: shift or reduce by rule %d\n", d, st->names[terminals[t]], r);
+                    conflicts++;
+                } else {
+                    fprintf(messages, "Conflict in state %d on %s: reduce by rule %d or %d\n", d, st->names[terminals[t]], -row[t] - 1, r);
+                    if (-(r + 1) > row[t]) row[t] = -(r + 1);
+                    conflicts++;
+                }
+            }
+        }
+        default_reduce[d] = -1;
+        int best = 0;
+        for (int red = red_start[d]; red < red_start[d + 1]; red++) {
+            int r = red_rule[red];
+            if (r == 0) continue;
+            int uses = 0;
+            for (int i = 0; i < touched_count; i++) uses += row[touched[i]] == -(r + 1);
+            if (uses > best) {
+                best = uses;
+                default_reduce[d] = r;
+            }
+        }
+        row_start[d] = entry_count;
+        for (int i = 0; i < touched_count; i++) {
+            int t = touched[i];
+            if (default_reduce[d] == -1 || row[t] != -(default_reduce[d] + 1)) {
+                if (entry_count >= entry_capacity) {
+                    entry_col = arena_realloc(scratch, entry_col, entry_capacity * sizeof(int), entry_capacity * 2 * sizeof(int));
+                    entry_value = arena_realloc(scratch, entry_value, entry_capacity * sizeof(int), entry_capacity * 2 * sizeof(int));
+                    entry_capacity *= 2;
+                }
+                entry_col[entry_count] = t;
+                entry_value[entry_count] = row[t];
+                entry_count++;
+            }
+            row[t] = INT_MIN;
+        }
+    }
+    row_start[state_count] = entry_count;
+    if (conflicts) {
+        fprintf(messages, "Warning: Grammar is not LALR(1) due to %d conflicts.\n", conflicts);
+    }
+    int* action_base = arena_alloc(scratch, state_count * sizeof(int));
+    int *action_check, *action_value;
+    int action_slots = pack_rows(state_count, term_count, row_start, entry_col, entry_value, action_base, &action_check, &action_value, scratch);
+
+    // GOTO columns, one packed row per nonterminal indexed by source state
+    int* goto_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    for (int k = 0; k < ntr_count; k++) goto_start[trans_sym[ntr_trans[k]] - term_count + 1]++;
+    for (int a = 0; a < nt_count; a++) goto_start[a + 1] += goto_start[a];
+    int* goto_state = arena_alloc(scratch, (ntr_count > 0 ? ntr_count : 1) * sizeof(int));
+    int* goto_target = arena_alloc(scratch, (ntr_count > 0 ? ntr_count : 1) * sizeof(int));
+    memcpy(fill, goto_start, nt_count * sizeof(int));
+    for (int k = 0; k < ntr_count; k++) {
+        int a = trans_sym[ntr_trans[k]] - term_count;
+        goto_state[fill[a]] = ntr_from[k];
+        goto_target[fill[a]] = trans_to[ntr_trans[k]];
+        fill[a]++;
+    }
+    int* target_uses = arena_calloc(scratch, state_count, sizeof(int));
+    int* default_goto = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * sizeof(int));
+    int* goto_row_start = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    int goto_entries = 0;
+    for (int a = 0; a < nt_count; a++) {
+        int best = 0;
+        default_goto[a] = -1;
+        for (int e = goto_start[a]; e < goto_start[a + 1]; e++) {
+            if (++target_uses[goto_target[e]] > best) {
+                best = target_uses[goto_target[e]];
+                default_goto[a] = goto_target[e];
+            }
+        }
+        goto_row_start[a] = goto_entries;
+        for (int e = goto_start[a]; e < goto_start[a + 1]; e++) {
+            target_uses[goto_target[e]] = 0;
+            if (goto_target[e] == default_goto[a]) continue;
+            goto_state[goto_entries] = goto_state[e];
+            goto_target[goto_entries] = goto_target[e];
+            goto_entries++;
+        }
+    }
+    goto_row_start[nt_count] = goto_entries;
+    int* goto_base = arena_alloc(scratch, (nt_count > 0 ? nt_count : 1) * sizeof(int));
+    int *goto_check, *goto_value;
+    int goto_slots = pack_rows(nt_count, state_count, goto_row_start, goto_state, goto_target, goto_base, &goto_check, &goto_value, scratch);
+
+    LalrTable table;
+    table.state_count = state_count;
+    table.term_count = term_count;
+    table.nt_count = nt_count;
+    table.rule_count = rule_count;
+    table.end_column = end_column;
+    table.action_slots = action_slots;
+    table.goto_slots = goto_slots;
+    table.conflicts = conflicts;
+    table.action_base = arena_copy_ints(arena, action_base, state_count);
+    table.action_check = arena_copy_ints(arena, action_check, action_slots);
+    table.action_value = arena_copy_ints(arena, action_value, action_slots);
+    table.default_reduce = arena_copy_ints(arena, default_reduce, state_count);
+    table.goto_base = arena_copy_ints(arena, goto_base, nt_count);
+    table.goto_check = arena_copy_ints(arena, goto_check, goto_slots);
+    table.goto_value = arena_copy_ints(arena, goto_value, goto_slots);
+    table.default_goto = arena_copy_ints(arena, default_goto, nt_count);
+    table.rule_lhs = arena_copy_ints(arena, rule_lhs, rule_count);
+    table.rule_len = arena_copy_ints(arena, rule_len, rule_count);
+    table.names = arena_alloc(arena, (term_count > 0 ? term_count : 1) * sizeof(char*));
+    table.patterns = arena_alloc(arena, (term_count > 0 ? term_count : 1) * sizeof(char*));
+    for (int t = 0; t < term_count; t++) {
+        table.names[t] = st->names[terminals[t]];
+        table.patterns[t] = st->patterns[terminals[t]];
+    }
+    return table;
+}
+
+int lalr_action(const LalrTable* t, int state, int column) {
+    int idx = t->action_base[state] + column;
+    if (t->action_check[idx] == state) return t->action_value[idx];
+    return t->default_reduce[state] == -1 ? INT_MIN : -(t->default_reduce[state] + 1);
+}
+
+int lalr_goto(const LalrTable* t, int state, int nt) {
+    int idx = t->goto_base[nt] + state;
+    return t->goto_check[idx] == nt ? t->goto_value[idx] : t->default_goto[nt];
+}
+
+// The explicit entry of state d in column c, ACTION for c < term_count and
+// GOTO after: 'a' accept, 's' shift or 'r' reduce with value, 'g' a goto
+// target, or 0 when the cell is empty
+int lalr_entry(const LalrTable* t, int d, int c, int* value) {
+    if (c < t->term_count) {
+        int idx = t->action_base[d] + c;
+        if (t->action_check[idx] != d) return 0;
+        *value = t->action_value[idx] >= 0 ? t->action_value[idx] : -t->action_value[idx] - 1;
+        return t->action_value[idx] == -1 ? 'a' : t->action_value[idx] >= 0 ? 's' : 'r';
+    }
+    int a = c - t->term_count;
+    int idx = t->goto_base[a] + d;
+    if (t->goto_check[idx] != a) return 0;
+    *value = t->goto_value[idx];
+    return 'g';
+}
+
+int decimal_width(long v) {
+    int width = 1;
+    while (v >= 10) {
+        v /= 10;
+        width++;
+    }
+    return width;
+}
+
+int lalr_entry_width(int kind, int value) {
+    return kind == 'a' ? 3 : (kind != 'g') + decimal_width(value);
+}
+
+void log_lalr_entry(LogWriter* w, int kind, int value) {
+    if (kind == 'a') {
+        log_str(w, "acc");
+        return;
+    }
+    if (kind != 'g') log_char(w, kind);
+    log_int(w, value);
+}
+
+// Column names: the terminals, then the nonterminals
+const char* lalr_column_name(const LalrTable* t, int c, const SymbolTable* st) {
+    return c < t->term_count ? t->names[c] : st->names[st->nts[c - t->term_count]];
+}
+
+// The numbered rules, rule 0 being the augmented S' -> S
+void log_lalr_rules(LogWriter* w, const Production* productions, int prod_count, const SymbolTable* st) {
+    const char* start = st->names[st->nts[0]];
+    int rule_count = 1;
+    for (int i = 0; i < prod_count; i++) rule_count += productions[i].rhs_count;
+    int number_width = decimal_width(rule_count - 1) > 4 ? decimal_width(rule_count - 1) : 4;
+    log_str(w, "LALR(1) Rules:\n");
+    log_spaces(w, number_width - 1);
+    log_str(w, "0: ");
+    log_str(w, start);
+    log_str(w, "' -> ");
+    log_str(w, start);
+    log_char(w, '\n');
+    for (int i = 0, r = 1; i < prod_count; i++) {
+        for (int j = 0; j < productions[i].rhs_count; j++, r++) {
+            log_spaces(w, number_width - decimal_width(r));
+            log_int(w, r);
+            log_str(w, ": ");
+            log_str(w, st->names[productions[i].lhs]);
+            log_str(w, " -> ");
+            log_alternative(w, &productions[i], j, st);
+            log_char(w, '\n');
+        }
+    }
+    log_char(w, '\n');
+}
+
+void log_default_gotos(LogWriter* w, const LalrTable* t, const SymbolTable* st) {
+    log_str(w, "Default gotos:");
+    for (int a = 0; a < t->nt_count; a++) {
+        if (t->default_goto[a] == -1) continue;
+        log_char(w, ' ');
+        log_str(w, st->names[st->nts[a]]);
+        log_char(w, '=');
+        log_int(w, t->default_goto[a]);
+    }
+    log_str(w, "\n\n");
+}
+
+// ACTION and GOTO as one matrix, each column as wide as its widest entry, with
+// the default reduction of each state last
+void human_lalr(LogWriter* w, const LalrTable* t, const Production* productions, int prod_count, const SymbolTable* st) {
+    int column_count = t->term_count + t->nt_count;
+    int* column_width = malloc((column_count + 1) * sizeof(int));
+    for (int c = 0; c < column_count; c++) column_width[c] = display_width(lalr_column_name(t, c, st));
+    for (int d = 0; d < t->state_count; d++) {
+        for (int c = 0; c < column_count; c++) {
+            int value;
+            int kind = lalr_entry(t, d, c, &value);
+            if (kind && lalr_entry_width(kind, value) > column_width[c]) column_width[c] = lalr_entry_width(kind, value);
+        }
+    }
+    int label_width = decimal_width(t->state_count > 0 ? t->state_count - 1 : 0) > 5 ? decimal_width(t->state_count - 1) : 5;
+
+    log_lalr_rules(w, productions, prod_count, st);
+    log_str(w, "LALR(1) Parsing Table:\nState");
+    int pending = label_width - 5 + 2;
+    for (int c = 0; c < column_count; c++) {
+        if (c == t->term_count) {
+            log_spaces(w, pending);
+            log_char(w, '|');
+            pending = 2;
+        }
+        log_spaces(w, pending);
+        log_str(w, lalr_column_name(t, c, st));
+        pending = column_width[c] - display_width(lalr_column_name(t, c, st)) + 2;
+    }
+    log_spaces(w, pending);
+    log_str(w, "default\n");
+    for (int d = 0; d < t->state_count; d++) {
+        log_int(w, d);
+        pending = label_width - decimal_width(d) + 2;
+        for (int c = 0; c < column_count; c++) {
+            if (c == t->term_count) {
+                log_spaces(w, pending);
+                log_char(w, '|');
+                pending = 2;
+            }
+            int value;
+            int kind = lalr_entry(t, d, c, &value);
+            if (!kind) {
+                pending += column_width[c] + 2;
+                continue;
+            }
+            log_spaces(w, pending);
+            log_lalr_entry(w, kind, value);
+            pending = column_width[c] - lalr_entry_width(kind, value) + 2;
+        }
+        if (t->default_reduce[d] != -1) {
+            log_spaces(w, pending);
+            log_lalr_entry(w, 'r', t->default_reduce[d]);
+        }
+        log_char(w, '\n');
+    }
+    log_default_gotos(w, t, st);
+    free(column_width);
+}
+
+// Only the explicit entries and default reductions, one per line
+void sparse_lalr(LogWriter* w, const LalrTable* t, const Production* productions, int prod_count, const SymbolTable* st) {
+    int column_count = t->term_count + t->nt_count;
+    long entries = 0;
+    for (int d = 0; d < t->state_count; d++) {
+        int value;
+        for (int c = 0; c < column_count; c++) entries += lalr_entry(t, d, c, &value) != 0;
+        entries += t->default_reduce[d] != -1;
+    }
+    log_lalr_rules(w, productions, prod_count, st);
+    log_str(w, "LALR(1) Parsing Table (");
+    log_int(w, entries);
+    log_str(w, " entries):\n");
+    for (int d = 0; d < t->state_count; d++) {
+        for (int c = 0; c < column_count; c++) {
+            int value;
+            int kind = lalr_entry(t, d, c, &value);
+            if (!kind) continue;
+            log_char(w, '[');
+            log_int(w, d);
+            log_str(w, ", ");
+            log_str(w, lalr_column_name(t, c, st));
+            log_str(w, "] ");
+            log_lalr_entry(w, kind, value);
+            log_char(w, '\n');
+        }
+        if (t->default_reduce[d] == -1) continue;
+        log_char(w, '[');
+        log_int(w, d);
+        log_str(w, "] default ");
+        log_lalr_entry(w, 'r', t->default_reduce[d]);
+        log_char(w, '\n');
+    }
+    log_default_gotos(w, t, st);
+}
+
+// Table-driven predictive parser. The stack holds nonterminal indices (>= 0) and
+// terminals encoded as -(column + 1); tokens are fed one at a time so the input
+// never has to be held in memory.
+typedef struct {
+    const LL1Table* table;
+    int end_column;
+    int* stack;
+    int sp;
+    int stack_capacity;
+    long position;
+    int status;
+    long expansion_factor;
+} LL1Parser;
+
+// Starts a new input on an initialized parser, keeping its stack allocation
+void ll1_parser_reset(LL1Parser* parser) {
+    parser->sp = 0;
+    parser->position = 0;
+    parser->status = PARSE_RUNNING;
+    // Without productions there is no start row, so every input is rejected
+    if (parser->table->header->nt_count == 0) parser->status = PARSE_ERROR;
+    else parser->stack[parser->sp++] = parser->table->header->start;
+}
+
+void ll1_parser_init(LL1Parser* parser, const LL1Table* table) {
+    parser->table = table;
+    parser->end_column = table->header->end_column;
+    parser->stack_capacity = 64;
+    parser->stack = malloc(parser->stack_capacity * sizeof(int));
+    ll1_parser_reset(parser);
+    // Without left recursion a token is matched after at most nt_count expansions
+    // per stacked symbol; more than that means a conflicted table is cycling
+    int max_len = 0;
+    for (int a = 0; a < (int)table->header->alt_count; a++) {
+        int len = table->code_start[a + 1] - table->code_start[a];
+        if (len > max_len) max_len = len;
+    }
+    parser->expansion_factor = (long)(table->header->nt_count + 1) * (max_len + 1);
+}
+
+void ll1_parser_free(LL1Parser* parser) {
+    free(parser->stack);
+}
+
+// Consumes one token given by its table column (-1 for a token outside the grammar)
+int ll1_parser_feed(LL1Parser* parser, int column) {
+    if (parser->status != PARSE_RUNNING) return parser->status;
+    if (column < 0) return parser->status = PARSE_ERROR;
+    const LL1Table* t = parser->table;
+    int* stack = parser->stack;
+    int sp = parser->sp;
+    long expansions = 0;
+    long limit = (sp + 1) * parser->expansion_factor;
+    while (sp > 0) {
+        int top = stack[sp - 1];
+        if (top < 0) {
+            if (-top - 1 != column) break;
+            parser->sp = sp - 1;
+            if (column == parser->end_column) return parser->status = PARSE_ACCEPT;
+            parser->position++;
+            return PARSE_RUNNING;
+        }
+        int idx = t->base[top] + column;
+        if (t->check[idx] != top) break;
+        if (++expansions > limit) break;
+        int alt = t->value[idx];
+        int from = t->code_start[alt];
+        int len = t->code_start[alt + 1] - from;
+        sp--;
+        if (sp + len > parser->stack_capacity) {
+            while (sp + len > parser->stack_capacity) parser->stack_capacity *= 2;
+            stack = parser->stack = realloc(parser->stack, parser->stack_capacity * sizeof(int));
+        }
+        memcpy(stack + sp, t->code + from, len * sizeof(int));
+        sp += len;
+    }
+    parser->sp = sp;
+    if (sp == 0 && column == parser->end_column) return parser->status = PARSE_ACCEPT;
+    return parser->status = PARSE_ERROR;
+}
+
+int ll1_parser_finish(LL1Parser* parser) {
+    return ll1_parser_feed(parser, parser->end_column);
+}
+
+// Shift-reduce parser over the LALR(1) tables; the stack holds states
+typedef struct {
+    const LalrTable* table;
+    int* stack;
+    int sp;
+    int stack_capacity;
+    long position;
+    int status;
+    long reduction_factor;
+} LalrParser;
+
+void lalr_parser_init(LalrParser* parser, const LalrTable* table) {
+    parser->table = table;
+    parser->stack_capacity = 64;
+    parser->stack = malloc(parser->stack_capacity * sizeof(int));
+    parser->sp = 0;
+    parser->position = 0;
+    parser->status = PARSE_RUNNING;
+    parser->stack[parser->sp++] = 0;
+    // Reductions between two shifts are bounded unless the grammar is cyclic
+    // (A -> A, or unit chains that come back); the limit catches those
+    int max_len = 0;
+    for (int r = 0; r < table->rule_count; r++) {
+        if (table->rule_len[r] > max_len) max_len = table->rule_len[r];
+    }
+    parser->reduction_factor = (long)(table->nt_count + 1) * (max_len + 1);
+}
+
+void lalr_parser_free(LalrParser* parser) {
+    free(parser->stack);
+}
+
+// Consumes one token given by its table column (-1 for a token outside the grammar)
+int lalr_parser_feed(LalrParser* parser, int column) {
+    if (parser->status != PARSE_RUNNING) return parser->status;
+    if (column < 0) return parser->status = PARSE_ERROR;
+    const LalrTable* t = parser->table;
+    int* stack = parser->stack;
+    int sp = parser->sp;
+    long reductions = 0;
+    long limit = (sp + 1) * parser->reduction_factor;
+    while (1) {
+        int action = lalr_action(t, stack[sp - 1], column);
+        if (action == INT_MIN) break;
+        int next;
+        if (action >= 0) {
+            next = action;
+        } else {
+            int r = -action - 1;
+            if (r == 0) {
+                parser->sp = sp;
+                return parser->status = PARSE_ACCEPT;
+            }
+            if (++reductions > limit) break;
+            sp -= t->rule_len[r];
+            next = lalr_goto(t, stack[sp - 1], t->rule_lhs[r]);
+        }
+        if (sp + 1 > parser->stack_capacity) {
+            parser->stack_capacity *= 2;
+            stack = parser->stack = realloc(parser->stack, parser->stack_capacity * sizeof(int));
+        }
+        stack[sp++] = next;
+        if (action >= 0) {
+            parser->sp = sp;
+            parser->position++;
+            return PARSE_RUNNING;
+        }
+    }
+    parser->sp = sp;
+    return parser->status = PARSE_ERROR;
+}
+
+// General parser for tables with conflicts: Earley's algorithm over the table's
+// alternatives, building a binarised shared packed parse forest the way Scott's
+// "SPPF-style parsing from Earley recognisers" does. An item is a slot (an
+// alternative with a dot), the set it started in, and the forest node of what
+// the dot has passed. Nonterminals are predicted through the table: a cell
+// without a conflict predicts its one alternative and an empty cell none, and
+// only conflicted cells predict all of their alternatives. Completions are
+// filtered by the next token too: an item is completed only when the token is
+// in FOLLOW of its left-hand side. On mostly LL(1) grammars the sets stay small,
+// and right-recursive chains do not complete again at every token. Tokens are fed one at a
+// time like the other parsers, and set i is closed when token i + 1 arrives,
+// since its predictions and scans depend on it.
+//
+// Forest nodes are symbol nodes (nonterminal index, or -(column + 1) for a
+// terminal) and intermediate nodes for slots, labelled nt_count + slot, each
+// over a span of tokens. A node has a list of packed families (left, right)
+// with the slot that made them; left is -1 for the first symbol of an
+// alternative, and both are -1 for an ε alternative.
+
+// Open-addressing map from three ints to an int, cleared through the slots in use
+typedef struct {
+    int* keys;
+    int* values;
+    int* used;
+    int count;
+    int capacity;
+} TripleMap;
+
+void triple_map_init(TripleMap* m, int capacity) {
+    m->capacity = capacity;
+    m->count = 0;
+    m->keys = malloc(3 * capacity * sizeof(int));
+    m->values = malloc(capacity * sizeof(int));
+    m->used = malloc(capacity * sizeof(int));
+    memset(m->values, -1, capacity * sizeof(int));
+}
+
+void triple_map_free(TripleMap* m) {
+    free(m->keys);
+    free(m->values);
+    free(m->used);
+}
+
+void triple_map_clear(TripleMap* m) {
+    for (int i = 0; i < m->count; i++) m->values[m->used[i]] = -1;
+    m->count = 0;
+}
+
+unsigned int triple_map_probe(const TripleMap* m, int a, int b, int c) {
+    unsigned int h = (unsigned int)a * 0x9E3779B1u ^ (unsigned int)b * 0x85EBCA77u ^ (unsigned int)c * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    unsigned int mask = m->capacity - 1;
+    unsigned int i = h & mask;
+    while (m->values[i] != -1 && (m->keys[3 * i] != a || m->keys[3 * i + 1] != b || m->keys[3 * i + 2] != c)) i = (i + 1) & mask;
+    return i;
+}
+
+int triple_map_get(const TripleMap* m, int a, int b, int c) {
+    return m->values[triple_map_probe(m, a, b, c)];
+}
+
+// Stores value under (a, b, c) and returns what was stored there before, or -1
+int triple_map_put(TripleMap* m, int a, int b, int c, int value) {
+    if ((m->count + 1) * 2 > m->capacity) {
+        TripleMap grown;
+        triple_map_init(&grown, m->capacity * 2);
+        for (int i = 0; i < m->count; i++) {
+            int* k = m->keys + 3 * m->used[i];
+            triple_map_put(&grown, k[0], k[1], k[2], m->values[m->used[i]]);
+        }
+        triple_map_free(m);
+        *m = grown;
+    }
+    unsigned int i = triple_map_probe(m, a, b, c);
+    int old = m->values[i];
+    if (old == -1) {
+        m->keys[3 * i] = a;
+        m->keys[3 * i + 1] = b;
+        m->keys[3 * i + 2] = c;
+        m->used[m->count++] = i;
+    }
+    m->values[i] = value;
+    return old;
+}
+
+typedef struct {
+    int slot;
+    int origin;
+    int node;
+    int wait;
+} EarleyItem;
+
+typedef struct {
+    int label;
+    int start;
+    int end;
+    int family;
+} ForestNode;
+
+typedef struct {
+    int left;
+    int right;
+    int slot;
+    int next;
+} ForestFamily;
+
+typedef struct {
+    const LL1Table* table;
+    int end_column;
+    int nt_count;
+    int* slot_base;
+    int* slot_alt;
+    // Items of every set; set i is set_start[i] .. set_start[i + 1] - 1, and
+    // wait chains the items of a set that wait on the same nonterminal
+    EarleyItem* items;
+    int item_count;
+    int item_capacity;
+    int* set_start;
+    int set_capacity;
+    TripleMap seen;
+    TripleMap waiting;
+    TripleMap nodes;
+    // FOLLOW of every nonterminal, words words per row
+    uint64_t* follow;
+    int words;
+    int* predicted;
+    int* empty_at;
+    int* empty_node;
+    int* scan;
+    int scan_count;
+    int scan_capacity;
+    ForestNode* forest;
+    int node_count;
+    int node_capacity;
+    ForestFamily* families;
+    int family_count;
+    int family_capacity;
+    long position;
+    int status;
+    int root;
+} EarleyParser;
+
+// Starts a new input on an initialized parser, keeping its allocations
+void earley_parser_reset(EarleyParser* p) {
+    triple_map_clear(&p->seen);
+    triple_map_clear(&p->waiting);
+    triple_map_clear(&p->nodes);
+    memset(p->predicted, 0, p->nt_count * sizeof(int));
+    memset(p->empty_at, 0, p->nt_count * sizeof(int));
+    p->item_count = 0;
+    p->set_start[0] = 0;
+    p->node_count = 0;
+    p->family_count = 0;
+    p->position = 0;
+    p->status = PARSE_RUNNING;
+    p->root = -1;
+}
+
+// FOLLOW sets solved again from the table's alternatives, since a saved table
+// carries none. Alternatives are stored reversed, so a walk from code_start
+// goes right to left and rest holds FIRST of what follows the current symbol.
+void earley_follow_sets(EarleyParser* p) {
+    const LL1Table* t = p->table;
+    int nt_count = p->nt_count, alt_count = t->header->alt_count, words = p->words;
+    Arena scratch;
+    arena_init(&scratch, 1 << 16);
+    char* nullable = arena_calloc(&scratch, nt_count > 0 ? nt_count : 1, 1);
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int g = 0; g < alt_count; g++) {
+            int a = t->alt_lhs[g], k = t->code_start[g];
+            if (nullable[a]) continue;
+            while (k < t->code_start[g + 1] && t->code[k] >= 0 && nullable[t->code[k]]) k++;
+            if (k == t->code_start[g + 1]) nullable[a] = changed = 1;
+        }
+    }
+    int scc_count;
+    long visits = 0;
+    BitMatrix first = bitmatrix_new(&scratch, nt_count, t->header->term_count);
+    EdgeList first_deps = {&scratch, NULL, NULL, 0, 0};
+    for (int g = 0; g < alt_count; g++) {
+        int a = t->alt_lhs[g];
+        for (int k = t->code_start[g + 1] - 1; k >= t->code_start[g]; k--) {
+            int sym = t->code[k];
+            if (sym < 0) {
+                bitset_add(bitset_row(&first, a), -sym - 1);
+                break;
+            }
+            if (sym != a) add_edge(&first_deps, a, sym);
+            if (!nullable[sym]) break;
+        }
+    }
+    DepGraph graph = build_graph(nt_count, &first_deps);
+    solve_set_equations(&graph, &first, &scratch, &scc_count, &visits);
+
+    BitMatrix follow = {p->follow, nt_count, words};
+    if (nt_count > 0) bitset_add(bitset_row(&follow, t->header->start), p->end_column);
+    EdgeList follow_deps = {&scratch, NULL, NULL, 0, 0};
+    uint64_t* rest = arena_alloc(&scratch, words * sizeof(uint64_t));
+    for (int g = 0; g < alt_count; g++) {
+        int b = t->alt_lhs[g], rest_nullable = 1;
+        memset(rest, 0, words * sizeof(uint64_t));
+        for (int k = t->code_start[g]; k < t->code_start[g + 1]; k++) {
+            int sym = t->code[k];
+            if (sym < 0) {
+                memset(rest, 0, words * sizeof(uint64_t));
+                bitset_add(rest, -sym - 1);
+                rest_nullable = 0;
+                continue;
+            }
+            bitset_union(bitset_row(&follow, sym), rest, words);
+            if (rest_nullable && sym != b) add_edge(&follow_deps, sym, b);
+            if (!nullable[sym]) {
+                memset(rest, 0, words * sizeof(uint64_t));
+                rest_nullable = 0;
+            }
+            bitset_union(rest, bitset_row(&first, sym), words);
+        }
+    }
+    graph = build_graph(nt_count, &follow_deps);
+    solve_set_equations(&graph, &follow, &scratch, &scc_count, &visits);
+    arena_free(&scratch);
+}
+
+void earley_parser_init(EarleyParser* p, const LL1Table* table) {
+    const LL1TableHeader* h = table->header;
+    p->table = table;
+    p->end_column = h->end_column;
+    p->nt_count = h->nt_count;
+    int slot_count = h->code_count + h->alt_count;
+    p->slot_base = malloc((h->alt_count + 1) * sizeof(int));
+    p->slot_alt = malloc((slot_count > 0 ? slot_count : 1) * sizeof(int));
+    for (int g = 0, s = 0; g < (int)h->alt_count; g++) {
+        p->slot_base[g] = s;
+        for (int k = table->code_start[g]; k <= table->code_start[g + 1]; k++) p->slot_alt[s++] = g;
+    }
+    p->words = bitset_words(h->term_count);
+    p->follow = calloc((size_t)(p->nt_count > 0 ? p->nt_count : 1) * p->words, sizeof(uint64_t));
+    earley_follow_sets(p);
+    p->item_capacity = 1024;
+    p->items = malloc(p->item_capacity * sizeof(EarleyItem));
+    p->set_capacity = 1024;
+    p->set_start = malloc(p->set_capacity * sizeof(int));
+    triple_map_init(&p->seen, 256);
+    triple_map_init(&p->waiting, 1024);
+    triple_map_init(&p->nodes, 256);
+    p->predicted = malloc((p->nt_count + 1) * sizeof(int));
+    p->empty_at = malloc((p->nt_count + 1) * sizeof(int));
+    p->empty_node = malloc((p->nt_count + 1) * sizeof(int));
+    p->scan_capacity = 64;
+    p->scan = malloc(p->scan_capacity * sizeof(int));
+    p->node_capacity = 1024;
+    p->forest = malloc(p->node_capacity * sizeof(ForestNode));
+    p->family_capacity = 1024;
+    p->families = malloc(p->family_capacity * sizeof(ForestFamily));
+    earley_parser_reset(p);
+}
+
+void earley_parser_free(EarleyParser* p) {
+    free(p->slot_base);
+    free(p->slot_alt);
+    free(p->items);
+    free(p->set_start);
+    triple_map_free(&p->seen);
+    triple_map_free(&p->waiting);
+    triple_map_free(&p->nodes);
+    free(p->follow);
+    free(p->predicted);
+    free(p->empty_at);
+    free(p->empty_node);
+    free(p->scan);
+    free(p->forest);
+    free(p->families);
+}
+
+// Length of the alternative of slot, and how far its dot has gone
+int slot_length(const EarleyParser* p, int slot, int* dot) {
+    int g = p->slot_alt[slot];
+    *dot = slot - p->slot_base[g];
+    return p->table->code_start[g + 1] - p->table->code_start[g];
+}
+
+// The symbol after the dot in the table's encoding; the caller checks the dot is not at the end
+int slot_next_symbol(const EarleyParser* p, int slot, int dot) {
+    return p->table->code[p->table->code_start[p->slot_alt[slot] + 1] - 1 - dot];
+}
+
+// The node labelled label over start .. the current position, made when missing
+int forest_node(EarleyParser* p, int label, int start, int end) {
+    int y = triple_map_get(&p->nodes, label, start, 0);
+    if (y != -1) return y;
+    if (p->node_count >= p->node_capacity) {
+        p->node_capacity *= 2;
+        p->forest = realloc(p->forest, p->node_capacity * sizeof(ForestNode));
+    }
+    y = p->node_count++;
+    p->forest[y] = (ForestNode){label, start, end, -1};
+    triple_map_put(&p->nodes, label, start, 0, y);
+    return y;
+}
+
+void forest_family(EarleyParser* p, int y, int left, int right, int slot) {
+    for (int f = p->forest[y].family; f != -1; f = p->families[f].next) {
+        if (p->families[f].left == left && p->families[f].right == right && p->families[f].slot == slot) return;
+    }
+    if (p->family_count >= p->family_capacity) {
+        p->family_capacity *= 2;
+        p->families = realloc(p->families, p->family_capacity * sizeof(ForestFamily));
+    }
+    p->families[p->family_count] = (ForestFamily){left, right, slot, p->forest[y].family};
+    p->forest[y].family = p->family_count++;
+}
+
+// Scott's MAKE_NODE: the node for slot, whose dot has just passed the symbol
+// derived by v, over start .. end, where w is the node of what came before.
+// After the first of several symbols that is v itself.
+int earley_node(EarleyParser* p, int slot, int start, int end, int w, int v) {
+    int dot;
+    int len = slot_length(p, slot, &dot);
+    if (dot == 1 && len > 1) return v;
+    int label = dot == len ? (int)p->table->alt_lhs[p->slot_alt[slot]] : p->nt_count + slot;
+    int y = forest_node(p, label, start, end);
+    forest_family(p, y, w, v, slot);
+    return y;
+}
+
+// Adds an item to the set at the current position unless it is there already
+void earley_add(EarleyParser* p, int slot, int origin, int node) {
+    int id = p->item_count;
+    if (triple_map_get(&p->seen, slot, origin, node) != -1) return;
+    triple_map_put(&p->seen, slot, origin, node, id);
+    if (p->item_count >= p->item_capacity) {
+        p->item_capacity *= 2;
+        p->items = realloc(p->items, p->item_capacity * sizeof(EarleyItem));
+    }
+    p->items[id] = (EarleyItem){slot, origin, node, -1};
+    p->item_count++;
+    int dot;
+    int len = slot_length(p, slot, &dot);
+    if (dot < len) {
+        int sym = slot_next_symbol(p, slot, dot);
+        if (sym >= 0) p->items[id].wait = triple_map_put(&p->waiting, (int)p->position, sym, 0, id);
+    }
+}
+
+// Predicts nonterminal a before the token in column: the cell's alternative
+// and, when the cell is conflicted, the others it lists
+void earley_predict(EarleyParser* p, int a, int column) {
+    const LL1Table* t = p->table;
+    int alt = ll1_table_lookup(t, a, column);
+    if (alt == -1) return;
+    earley_add(p, p->slot_base[alt], (int)p->position, -1);
+    if (t->conflict_start[a] == t->conflict_start[a + 1]) return;
+    int count;
+    int from = ll1_table_conflicts(t, a, column, &count);
+    for (int e = from; e < from + count; e++) earley_add(p, p->slot_base[t->conflict_alt[e]], (int)p->position, -1);
+}
+
+// Predicts and completes the items of the current set until nothing is added;
+// the items that can shift the token in column are collected in scan
+void earley_close(EarleyParser* p, int column) {
+    const LL1Table* t = p->table;
+    int i = (int)p->position;
+    p->scan_count = 0;
+    if (i == 0 && p->nt_count > 0) earley_predict(p, t->header->start, column);
+    for (int k = p->set_start[i]; k < p->item_count; k++) {
+        EarleyItem it = p->items[k];
+        int dot;
+        int len = slot_length(p, it.slot, &dot);
+        if (dot < len) {
+            int sym = slot_next_symbol(p, it.slot, dot);
+            if (sym < 0) {
+                if (-sym - 1 != column) continue;
+                if (p->scan_count >= p->scan_capacity) {
+                    p->scan_capacity *= 2;
+                    p->scan = realloc(p->scan, p->scan_capacity * sizeof(int));
+                }
+                p->scan[p->scan_count++] = k;
+                continue;
+            }
+            if (p->predicted[sym] != i + 1) {
+                p->predicted[sym] = i + 1;
+                earley_predict(p, sym, column);
+            }
+            // A nonterminal that already completed empty here is passed at once
+            if (p->empty_at[sym] == i + 1) earley_add(p, it.slot + 1, it.origin, earley_node(p, it.slot + 1, it.origin, i, it.node, p->empty_node[sym]));
+            continue;
+        }
+        // A completion the next token cannot follow leads nowhere. Skipping it
+        // keeps a right-recursive chain from completing again at every token.
+        int lhs = t->alt_lhs[p->slot_alt[it.slot]];
+        if (!bitset_test(p->follow + (size_t)lhs * p->words, column)) continue;
+        int w = it.node;
+        if (w == -1) {
+            w = forest_node(p, lhs, i, i);
+            forest_family(p, w, -1, -1, it.slot);
+        }
+        if (it.origin == i) {
+            p->empty_at[lhs] = i + 1;
+            p->empty_node[lhs] = w;
+        }
+        for (int up = triple_map_get(&p->waiting, it.origin, lhs, 0); up != -1; up = p->items[up].wait) {
+            EarleyItem u = p->items[up];
+            earley_add(p, u.slot + 1, u.origin, earley_node(p, u.slot + 1, u.origin, i, u.node, w));
+        }
+    }
+}
+
+// Consumes one token given by its table column (-1 for a token outside the grammar)
+int earley_parser_feed(EarleyParser* p, int column) {
+    if (p->status != PARSE_RUNNING) return p->status;
+    if (column < 0) return p->status = PARSE_ERROR;
+    earley_close(p, column);
+    if (column == p->end_column) {
+        p->root = triple_map_get(&p->nodes, p->table->header->start, 0, 0);
+        return p->status = p->root != -1 ? PARSE_ACCEPT : PARSE_ERROR;
+    }
+    if (p->scan_count == 0) return p->status = PARSE_ERROR;
+    // The next set starts with the items that shift the token
+    triple_map_clear(&p->seen);
+    triple_map_clear(&p->nodes);
+    int i = (int)p->position++;
+    if (i + 2 > p->set_capacity) {
+        p->set_capacity *= 2;
+        p->set_start = realloc(p->set_start, p->set_capacity * sizeof(int));
+    }
+    p->set_start[i + 1] = p->item_count;
+    int v = forest_node(p, -(column + 1), i, i + 1);
+    for (int s = 0; s < p->scan_count; s++) {
+        EarleyItem it = p->items[p->scan[s]];
+        earley_add(p, it.slot + 1, it.origin, earley_node(p, it.slot + 1, it.origin, i + 1, it.node, v));
+    }
+    return PARSE_RUNNING;
+}
+
+int earley_parser_finish(EarleyParser* p) {
+    return earley_parser_feed(p, p->end_column);
+}
+
+// What the forest under the root holds: its nodes, families, nodes with more
+// than one family, and the number of parse trees (FOREST_MANY_TREES or more,
+// or -1 when a cycle makes it infinite)
+#define FOREST_MANY_TREES 1000000000000000000LL
+
+typedef struct {
+    long nodes;
+    long families;
+    long ambiguous;
+    long long trees;
+} ForestSummary;
+
+// Walks the forest depth first with an explicit stack, since a right-recursive
+// parse nests as deep as the input is long
+ForestSummary summarize_forest(const EarleyParser* p) {
+    ForestSummary s = {0, 0, 0, 0};
+    if (p->root == -1) return s;
+    long long* trees = malloc(p->node_count * sizeof(long long));
+    char* state = calloc(p->node_count, 1);
+    int* stack = malloc(p->node_count * sizeof(int));
+    int* next_family = malloc(p->node_count * sizeof(int));
+    int sp = 0, cyclic = 0;
+    stack[sp++] = p->root;
+    state[p->root] = 1;
+    next_family[p->root] = p->forest[p->root].family;
+    trees[p->root] = p->forest[p->root].family == -1;
+    while (sp > 0) {
+        int y = stack[sp - 1];
+        int f = next_family[y];
+        if (f == -1) {
+            state[y] = 2;
+            sp--;
+            continue;
+        }
+        const ForestFamily* fam = &p->families[f];
+        int child = -1;
+        int kids[2] = {fam->left, fam->right};
+        for (int c = 0; c < 2 && child == -1; c++) {
+            if (kids[c] == -1 || state[kids[c]] == 2) continue;
+            if (state[kids[c]] == 1) cyclic = 1;
+            else child = kids[c];
+        }
+        if (child != -1) {
+            state[child] = 1;
+            next_family[child] = p->forest[child].family;
+            trees[child] = p->forest[child].family == -1;
+            stack[sp++] = child;
+            continue;
+        }
+        // Both children are done (or on the stack, in a cycle): count the family
+        long long left = fam->left == -1 ? 1 : state[fam->left] == 2 ? trees[fam->left] : 1;
+        long long right = fam->right == -1 ? 1 : state[fam->right] == 2 ? trees[fam->right] : 1;
+        long long product = left > FOREST_MANY_TREES / (right > 0 ? right : 1) ? FOREST_MANY_TREES : left * right;
+        trees[y] = trees[y] + product > FOREST_MANY_TREES ? FOREST_MANY_TREES : trees[y] + product;
+        next_family[y] = fam->next;
+    }
+    for (int y = 0; y < p->node_count; y++) {
+        if (state[y] != 2) continue;
+        s.nodes++;
+        int count = 0;
+        for (int f = p->forest[y].family; f != -1; f = p->families[f].next) count++;
+        s.families += count;
+        s.ambiguous += count > 1;
+    }
+    s.trees = cyclic ? -1 : trees[p->root];
+    free(trees);
+    free(state);
+    free(stack);
+    free(next_family);
+    return s;
+}
+
+void write_dot_text(FILE* out, const char* s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+}
+
+// Writes the forest under the root as a Graphviz digraph. Symbol nodes are
+// ellipses, intermediate nodes boxes showing their slot, and a node with more
+// than one family gets a point per family
+void write_forest_dot(const EarleyParser* p, const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        printf("Error opening %s\n", filename);
+        exit(1);
+    }
+    const LL1Table* t = p->table;
+    int term_count = t->header->term_count;
+    fprintf(out, "digraph forest {\n    node [fontname=\"monospace\"];\n");
+    char* reached = calloc(p->node_count > 0 ? p->node_count : 1, 1);
+    int* stack = malloc((p->node_count > 0 ? p->node_count : 1) * sizeof(int));
+    int sp = 0;
+    if (p->root != -1) {
+        stack[sp++] = p->root;
+        reached[p->root] = 1;
+    }
+    while (sp > 0) {
+        int y = stack[--sp];
+        const ForestNode* n = &p->forest[y];
+        fprintf(out, "    n%d [label=\"", y);
+        if (n->label < 0) {
+            write_dot_text(out, ll1_table_name(t, -n->label - 1));
+        } else if (n->label < p->nt_count) {
+            write_dot_text(out, ll1_table_name(t, term_count + n->label));
+        } else {
+            int slot = n->label - p->nt_count, g = p->slot_alt[slot];
+            int from = t->code_start[g], to = t->code_start[g + 1], dot = slot - p->slot_base[g];
+            write_dot_text(out, ll1_table_name(t, term_count + t->alt_lhs[g]));
+            fprintf(out, " ->");
+            for (int k = to - 1; k >= from; k--) {
+                if (to - 1 - k == dot) fprintf(out, " .");
+                fputc(' ', out);
+                int sym = t->code[k];
+                write_dot_text(out, sym < 0 ? ll1_table_name(t, -sym - 1) : ll1_table_name(t, term_count + sym));
+            }
+            if (dot == to - from) fprintf(out, " .");
+        }
+        fprintf(out, ", %d, %d\"%s];\n", n->start, n->end, n->label >= p->nt_count ? ", shape=box" : n->label < 0 ? ", shape=plaintext" : "");
+        int ambiguous = n->family != -1 && p->families[n->family].next != -1;
+        for (int f = n->family; f != -1; f = p->families[f].next) {
+            const ForestFamily* fam = &p->families[f];
+            const char* from_node = "n";
+            if (ambiguous) {
+                fprintf(out, "    p%d [shape=point];\n    n%d -> p%d;\n", f, y, f);
+                from_node = "p";
+            }
+            int children[2] = {fam->left, fam->right};
+            for (int c = 0; c < 2; c++) {
+                if (children[c] == -1) continue;
+                fprintf(out, "    %s%d -> n%d;\n", from_node, ambiguous ? f : y, children[c]);
+                if (!reached[children[c]]) {
+                    reached[children[c]] = 1;
+                    stack[sp++] = children[c];
+                }
+            }
+        }
+    }
+    fprintf(out, "}\n");
+    free(reached);
+    free(stack);
+    fclose(out);
+}
+
+// Receives one token column and returns the parser's PARSE_* status
+typedef int (*TokenSink)(void* parser, int column);
+
+int ll1_sink(void* parser, int column) {
+    return ll1_parser_feed(parser, column);
+}
+
+int lalr_sink(void* parser, int column) {
+    return lalr_parser_feed(parser, column);
+}
+
+int earley_sink(void* parser, int column) {
+    return earley_parser_feed(parser, column);
+}
+
+// Scans tokens with the lexer and feeds them to the parser. Input is read in
+// chunks; an unfinished token at the end of a chunk is moved to the front of
+// the buffer and the rest is refilled behind it.
+int parse_token_stream(FILE* in, TokenSink feed, void* parser, int end_column, const Lexer* lexer, char* bad_token, size_t bad_size) {
+    size_t capacity = 1 << 16;
+    char* buf = malloc(capacity);
+    size_t len = 0;
+    size_t pos = 0;
+    int eof = 0;
+    int status = PARSE_RUNNING;
+    bad_token[0] = '\0';
+    while (status == PARSE_RUNNING) {
+        const char* tok_start;
+        const char* tok_end;
+        int column;
+        int result = lexer_next(lexer, buf + pos, buf + len, eof, &tok_start, &tok_end, &column);
+        if (result == LEX_NEED_MORE) {
+            len -= tok_start - buf;
+            memmove(buf, tok_start, len);
+            pos = 0;
+            if (len == capacity) {
+                capacity *= 2;
+                buf = realloc(buf, capacity);
+            }
+            size_t n = fread(buf + len, 1, capacity - len, in);
+            if (n == 0) eof = 1;
+            len += n;
+            continue;
+        }
+        if (result == LEX_END) break;
+        if (result == LEX_ERROR) {
+            snprintf(bad_token, bad_size, "%.*s", (int)(tok_end - tok_start), tok_start);
+            status = feed(parser, -1);
+            break;
+        }
+        status = feed(parser, column);
+        if (status == PARSE_ERROR) snprintf(bad_token, bad_size, "%.*s", (int)(tok_end - tok_start), tok_start);
+        pos = tok_end - buf;
+    }
+    if (status == PARSE_RUNNING) {
+        status = feed(parser, end_column);
+        if (status == PARSE_ERROR) snprintf(bad_token, bad_size, "end of input");
+    }
+    free(buf);
+    return status;
+}
+
+// Productions and names belong to the run arena, so only the index arrays are freed here
+void free_grammar(Production* productions, SymbolTable* st) {
+    free(productions);
+    symtab_free(st);
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Peak arena usage of one pipeline stage: the run arena as the stage leaves it
+// plus the most the stage held in scratch at once. end is when the stage ended.
+typedef struct {
+    const char* name;
+    size_t bytes;
+    double end;
+#ifdef CFG_METRICS
+    Metrics counters;
+#endif
+} StageMemory;
+
+void end_stage(StageMemory* stages, int* stage_count, const char* name, const Arena* run_arena, Arena* scratch) {
+    stages[*stage_count].name = name;
+    stages[*stage_count].bytes = run_arena->used + scratch->peak;
+    stages[*stage_count].end = now_seconds();
+#ifdef CFG_METRICS
+    stages[*stage_count].counters = metrics;
+#endif
+    (*stage_count)++;
+    arena_reset(scratch);
+}
+
+void print_stage_memory(FILE* out, const StageMemory* stages, int stage_count) {
+    fprintf(out, "Arena peak:");
+    for (int i = 0; i < stage_count; i++) {
+        fprintf(out, "%s %s %.1f KiB", i ? "," : "", stages[i].name, stages[i].bytes / 1024.0);
+    }
+    fprintf(out, "\n");
+}
+
+#ifdef CFG_METRICS
+void write_json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+        else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+        else fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+void write_metrics_counters(FILE* out, const Metrics* m, const Metrics* before) {
+    Metrics zero = {0};
+    if (!before) before = &zero;
+    fprintf(out, "{\"arena_allocs\": %ld, \"arena_bytes\": %ld, \"arena_blocks\": %ld, \"symbol_lookups\": %ld, "
+                 "\"symbol_probes\": %ld, \"symbols_added\": %ld, \"productions_built\": %ld, \"alternatives_built\": %ld, "
+                 "\"bitset_unions\": %ld}",
+            m->arena_allocs - before->arena_allocs, m->arena_bytes - before->arena_bytes, m->arena_blocks - before->arena_blocks,
+            m->symbol_lookups - before->symbol_lookups, m->symbol_probes - before->symbol_probes, m->symbols_added - before->symbols_added,
+            m->productions_built - before->productions_built, m->alternatives_built - before->alternatives_built,
+            m->bitset_unions - before->bitset_unions);
+}
+
+// Writes <log file without extension>.metrics.json: per-stage time, arena
+// peak and counters, then the grammar, solver, set and table sizes. The sets
+// and the LL(1) table are NULL in LALR mode, and the LALR table otherwise.
+void write_metrics_report(const char* log_file, const char* grammar_file, double start, const StageMemory* stages, int stage_count,
+                          const Production* productions, int prod_count, const SymbolTable* st, const SolverStats* stats, const int* nullable,
+                          const BitMatrix* first_sets, const BitMatrix* follow_sets, const LL1Table* ll1, const LalrTable* lalr) {
+    size_t len = strlen(log_file);
+    const char* dot = strrchr(log_file, '.');
+    const char* slash = strrchr(log_file, '/');
+    if (dot && (!slash || dot > slash)) len = dot - log_file;
+    char* path = malloc(len + sizeof(".metrics.json"));
+    memcpy(path, log_file, len);
+    strcpy(path + len, ".metrics.json");
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        printf("Error opening %s\n", path);
+        exit(1);
+    }
+
+    fprintf(out, "{\n  \"grammar\": ");
+    write_json_string(out, grammar_file);
+    fprintf(out, ",\n  \"mode\": \"%s\",\n  \"total_seconds\": %.6f,\n  \"stages\": [\n", lalr ? "lalr" : "ll1",
+            stage_count ? stages[stage_count - 1].end - start : 0.0);
+    for (int i = 0; i < stage_count; i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"seconds\": %.6f, \"arena_peak_bytes\": %zu, \"counters\": ", stages[i].name,
+                stages[i].end - (i ? stages[i - 1].end : start), stages[i].bytes);
+        write_metrics_counters(out, &stages[i].counters, i ? &stages[i - 1].counters : NULL);
+        fprintf(out, "}%s\n", i + 1 < stage_count ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"counters\": ");
+    write_metrics_counters(out, &metrics, NULL);
+
+    long alternatives = 0, symbols = 0;
+    for (int i = 0; i < prod_count; i++) {
+        alternatives += productions[i].rhs_count;
+        for (int j = 0; j < productions[i].rhs_count; j++) symbols += alt_len(&productions[i], j);
+    }
+    int nt_count = st->nt_count;
+    int nullable_count = 0;
+    for (int i = 0; i < nt_count; i++) nullable_count += nullable[i] != 0;
+    int term_count = ll1 ? (int)ll1->header->term_count : lalr->term_count;
+    fprintf(out, ",\n  \"grammar_size\": {\"nonterminals\": %d, \"terminals\": %d, \"alternatives\": %ld, \"rhs_symbols\": %ld},\n",
+            nt_count, term_count, alternatives, symbols);
+    fprintf(out, "  \"solver\": {\"nullable_visits\": %ld, \"first_sccs\": %d, \"first_visits\": %ld, \"follow_sccs\": %d, \"follow_visits\": %ld},\n",
+            stats->nullable_visits, stats->first_sccs, stats->first_visits, stats->follow_sccs, stats->follow_visits);
+
+    fprintf(out, "  \"sets\": {\"nullable\": %d", nullable_count);
+    const BitMatrix* sets[2] = {first_sets, follow_sets};
+    const char* set_names[2] = {"first", "follow"};
+    for (int k = 0; k < 2; k++) {
+        if (!sets[k]) continue;
+        long total = 0;
+        int largest = 0;
+        for (int r = 0; r < sets[k]->rows; r++) {
+            int size = bitset_count(sets[k]->bits + (size_t)r * sets[k]->words, sets[k]->words);
+            total += size;
+            if (size > largest) largest = size;
+        }
+        fprintf(out, ", \"%s_total\": %ld, \"%s_max\": %d", set_names[k], total, set_names[k], largest);
+    }
+    fprintf(out, "},\n");
+
+    if (ll1) {
+        const LL1TableHeader* h = ll1->header;
+        long cells = (long)h->nt_count * h->term_count, filled = 0;
+        for (uint32_t s = 0; s < h->slot_count; s++) filled += ll1->check[s] != -1;
+        fprintf(out, "  \"table\": {\"kind\": \"ll1\", \"cells\": %ld, \"filled\": %ld, \"fill_ratio\": %.4f, \"slots\": %u, "
+                     "\"slot_fill_ratio\": %.4f, \"conflicts\": %d}\n",
+                cells, filled, cells ? (double)filled / cells : 0.0, h->slot_count, h->slot_count ? (double)filled / h->slot_count : 0.0,
+                ll1->conflicts);
+    } else {
+        long action_filled = 0, goto_filled = 0;
+        for (int s = 0; s < lalr->action_slots; s++) action_filled += lalr->action_check[s] != -1;
+        for (int s = 0; s < lalr->goto_slots; s++) goto_filled += lalr->goto_check[s] != -1;
+        long action_cells = (long)lalr->state_count * lalr->term_count;
+        long goto_cells = (long)lalr->nt_count * lalr->state_count;
+        fprintf(out, "  \"table\": {\"kind\": \"lalr\", \"states\": %d, \"rules\": %d, \"action_cells\": %ld, \"action_filled\": %ld, "
+                     "\"action_slots\": %d, \"goto_cells\": %ld, \"goto_filled\": %ld, \"goto_slots\": %d, \"fill_ratio\": %.4f, "
+                     "\"slot_fill_ratio\": %.4f, \"conflicts\": %d}\n",
+                lalr->state_count, lalr->rule_count, action_cells, action_filled, lalr->action_slots, goto_cells, goto_filled,
+                lalr->goto_slots, action_cells + goto_cells ? (double)(action_filled + goto_filled) / (action_cells + goto_cells) : 0.0,
+                lalr->action_slots + lalr->goto_slots ? (double)(action_filled + goto_filled) / (lalr->action_slots + lalr->goto_slots) : 0.0,
+                lalr->conflicts);
+    }
+    fprintf(out, "}\n");
+    fclose(out);
+    fprintf(messages, "Metrics written to %s\n", path);
+    free(path);
+}
+#endif
+
+// Writes a C string literal for a grammar name
+void write_c_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// Writes a name for use inside a comment; "*/" must not end the comment early
+void write_comment_text(FILE* out, const char* s) {
+    for (; *s; s++) {
+        fputc(*s, out);
+        if (*s == '*' && s[1] == '/') fputc(' ', out);
+    }
+}
+
+// Emits the statements for one alternative of nonterminal a. Symbols are the
+// table's encoded code reversed back into source order. A trailing a itself is
+// turned into a loop iteration so right recursion does not grow the C++ stack.
+void generate_cpp_alternative(FILE* out, const LL1Table* t, int a, int alt, int known_first, const char* indent) {
+    int from = t->code_start[alt];
+    int to = t->code_start[alt + 1];
+    int len = to - from;
+    if (len == 0) {
+        fprintf(out, "%s        return true;\n", indent);
+        return;
+    }
+    for (int k = 0; k < len; k++) {
+        int sym = t->code[to - 1 - k];
+        int last = k == len - 1;
+        if (sym < 0) {
+            int column = -sym - 1;
+            if (k == 0 && known_first) {
+                fprintf(out, "%s        ++pos_;\n", indent);
+            } else {
+                fprintf(out, "%s        if (!expect(%d)) return false;\n", indent, column);
+            }
+            if (last) fprintf(out, "%s        return true;\n", indent);
+        } else if (last && sym == a) {
+            fprintf(out, "%s        continue;\n", indent);
+        } else if (last) {
+            fprintf(out, "%s        return parse_n%d();\n", indent, sym);
+        } else {
+            fprintf(out, "%s        if (!parse_n%d()) return false;\n", indent, sym);
+        }
+    }
+}
+
+// Emits the lexer's DFA as constant tables and a scanner over them that takes
+// the longest match after skipping blanks, as lexer_next does
+void generate_cpp_lexer(FILE* out, const Lexer* lx) {
+    fprintf(out, "// Lexer DFA over byte classes, the one --parse scans with\n");
+    fprintf(out, "constexpr int kLexStart = %d;\nconstexpr int kClassCount = %d;\n", lx->start, lx->class_count);
+    fprintf(out, "constexpr unsigned char kByteClass[256] = {");
+    for (int b = 0; b < 256; b++) fprintf(out, "%s%s%d", b ? "," : "", b % 32 ? " " : "\n    ", lx->byte_class[b]);
+    fprintf(out, "};\n// Next state by state * kClassCount + class, or -1\nconstexpr int kLexNext[] = {");
+    int cells = lx->state_count * lx->class_count;
+    for (int i = 0; i < cells; i++) fprintf(out, "%s%s%d", i ? "," : "", i % 32 ? " " : "\n    ", lx->next[i]);
+    fprintf(out, "};\n// Column accepted in each state, or -1\nconstexpr int kLexAccept[] = {");
+    for (int s = 0; s < lx->state_count; s++) fprintf(out, "%s%s%d", s ? "," : "", s % 32 ? " " : "\n    ", lx->accept[s]);
+    fprintf(out, "};\n\n");
+    fprintf(out, "// Scans the token at p after any blanks and moves p past it; false at the end of\n");
+    fprintf(out, "// the input. A byte that starts no token comes back alone with column -1.\n");
+    fprintf(out, "inline bool next_token(const char*& p, const char* end, std::string_view& token, int& column) {\n");
+    fprintf(out, "    while (p < end && (*p == ' ' || (*p >= '\\t' && *p <= '\\r'))) ++p;\n");
+    fprintf(out, "    if (p == end) return false;\n");
+    fprintf(out, "    int s = kLexStart;\n    const char* last_end = p + 1;\n    column = -1;\n");
+    fprintf(out, "    for (const char* q = p; q < end;) {\n");
+    fprintf(out, "        s = kLexNext[s * kClassCount + kByteClass[static_cast<unsigned char>(*q++)]];\n");
+    fprintf(out, "        if (s < 0) break;\n");
+    fprintf(out, "        if (kLexAccept[s] >= 0) {\n            column = kLexAccept[s];\n            last_end = q;\n        }\n    }\n");
+    fprintf(out, "    token = std::string_view(p, last_end - p);\n    p = last_end;\n    return true;\n}\n\n");
+}
+
+// Generates a standalone recursive-descent parser with one function per
+// nonterminal; each function switches on the lookahead column, so dispatch
+// compiles to a jump table instead of a table lookup
+void generate_cpp_parser(FILE* out, const LL1Table* t) {
+    const LL1TableHeader* h = t->header;
+    int nt_count = h->nt_count;
+    int term_count = h->term_count;
+    int* column_alt = malloc((term_count > 0 ? term_count : 1) * sizeof(int));
+    Lexer lexer;
+    build_table_lexer_or_exit(&lexer, t);
+
+    fprintf(out, "// Generated by cfg_processor from the LL(1) table. Do not edit.\n");
+    fprintf(out, "// Build with -DCFG_PARSER_MAIN for a driver that scans and parses a file the way --parse does.\n");
+    fprintf(out, "#include <cstddef>\n#include <cstring>\n#include <string_view>\n\n");
+    fprintf(out, "namespace generated_parser {\n\n");
+    fprintf(out, "constexpr int kTerminalCount = %d;\n", term_count);
+    fprintf(out, "constexpr int kEndColumn = %d;\n", h->end_column);
+    fprintf(out, "constexpr const char* kTerminalNames[kTerminalCount] = {");
+    for (int c = 0; c < term_count; c++) {
+        fprintf(out, c ? ", " : "");
+        write_c_string(out, ll1_table_name(t, c));
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "// Maps a token spelling to its terminal column, or -1 if it is not a terminal\n");
+    fprintf(out, "inline int terminal_column(std::string_view token) {\n");
+    fprintf(out, "    for (int c = 0; c < kTerminalCount; c++) {\n");
+    fprintf(out, "        if (token == kTerminalNames[c]) return c;\n");
+    fprintf(out, "    }\n    return -1;\n}\n\n");
+    generate_cpp_lexer(out, &lexer);
+    free_lexer(&lexer);
+
+    fprintf(out, "class Parser {\npublic:\n");
+    fprintf(out, "    Parser(const int* tokens, std::size_t count) : tokens_(tokens), count_(count) {}\n\n");
+    fprintf(out, "    // Returns true when the whole token sequence derives from the start symbol\n");
+    fprintf(out, "    bool parse() {\n        pos_ = 0;\n        return parse_n%u() && peek() == kEndColumn;\n    }\n\n", h->start);
+    fprintf(out, "    // Number of tokens consumed; on failure this is the index of the offending token\n");
+    fprintf(out, "    std::size_t position() const { return pos_; }\n\n");
+    fprintf(out, "private:\n");
+    fprintf(out, "    const int* tokens_;\n    std::size_t count_;\n    std::size_t pos_ = 0;\n\n");
+    fprintf(out, "    int peek() const { return pos_ < count_ ? tokens_[pos_] : kEndColumn; }\n\n");
+    fprintf(out, "    bool expect(int column) {\n        if (peek() != column) return false;\n        ++pos_;\n        return true;\n    }\n\n");
+    for (int a = 0; a < nt_count; a++) {
+        fprintf(out, "    bool parse_n%d();  // ", a);
+        write_comment_text(out, ll1_table_name(t, term_count + a));
+        fprintf(out, "\n");
+    }
+    fprintf(out, "};\n");
+
+    for (int a = 0; a < nt_count; a++) {
+        int loops = 0;
+        for (int c = 0; c < term_count; c++) {
+            column_alt[c] = ll1_table_lookup(t, a, c);
+            int alt = column_alt[c];
+            if (alt != -1 && t->code_start[alt + 1] > t->code_start[alt] && t->code[t->code_start[alt]] == a) loops = 1;
+        }
+        fprintf(out, "\n// ");
+        write_comment_text(out, ll1_table_name(t, term_count + a));
+        fprintf(out, "\nbool Parser::parse_n%d() {\n", a);
+        const char* indent = loops ? "    " : "";
+        if (loops) fprintf(out, "    for (;;) {\n");
+        fprintf(out, "%s    switch (peek()) {\n", indent);
+        for (int c = 0; c < term_count; c++) {
+            int alt = column_alt[c];
+            if (alt == -1) continue;
+            // All columns predicting the same alternative share one case body
+            int first_col = c, cases = 0;
+            for (int d = c; d < term_count; d++) {
+                if (column_alt[d] != alt) continue;
+                fprintf(out, "%s    case %d:  // ", indent, d);
+                write_comment_text(out, ll1_table_name(t, d));
+                fprintf(out, "\n");
+                if (d != c) column_alt[d] = -1;
+                cases++;
+            }
+            int from = t->code_start[alt];
+            int to = t->code_start[alt + 1];
+            int known_first = cases == 1 && to > from && t->code[to - 1] == -(first_col + 1);
+            generate_cpp_alternative(out, t, a, alt, known_first, indent);
+        }
+        fprintf(out, "%s    default:\n%s        return false;\n%s    }\n", indent, indent, indent);
+        if (loops) fprintf(out, "    }\n");
+        fprintf(out, "}\n");
+    }
+    fprintf(out, "\n}  // namespace generated_parser\n");
+
+    fprintf(out, "\n#ifdef CFG_PARSER_MAIN\n#include <chrono>\n#include <cstdio>\n#include <fstream>\n#include <iostream>\n#include <iterator>\n#include <string>\n#include <vector>\n\n");
+    fprintf(out, "int main(int argc, char** argv) {\n");
+    fprintf(out, "    std::ifstream file;\n");
+    fprintf(out, "    if (argc > 1) file.open(argv[1]);\n");
+    fprintf(out, "    std::istream& in = argc > 1 ? static_cast<std::istream&>(file) : std::cin;\n");
+    fprintf(out, "    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());\n");
+    fprintf(out, "    std::vector<int> tokens;\n    std::vector<std::string> spellings;\n");
+    fprintf(out, "    const char* p = text.data();\n    std::string_view token;\n    int column;\n");
+    fprintf(out, "    // Scanning stops at the first byte no token starts with, where the parse fails\n");
+    fprintf(out, "    while (generated_parser::next_token(p, text.data() + text.size(), token, column)) {\n");
+    fprintf(out, "        tokens.push_back(column);\n        spellings.emplace_back(token);\n        if (column < 0) break;\n    }\n");
+    fprintf(out, "    auto t0 = std::chrono::steady_clock::now();\n");
+    fprintf(out, "    generated_parser::Parser parser(tokens.data(), tokens.size());\n");
+    fprintf(out, "    bool ok = parser.parse();\n");
+    fprintf(out, "    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();\n");
+    fprintf(out, "    if (ok) {\n");
+    fprintf(out, "        std::printf(\"Input accepted: %%zu tokens in %%.3f s (%%.2f M tokens/s)\\n\", tokens.size(), seconds, seconds > 0 ? tokens.size() / seconds / 1e6 : 0.0);\n");
+    fprintf(out, "    } else {\n");
+    fprintf(out, "        std::size_t pos = parser.position();\n");
+    fprintf(out, "        std::printf(\"Input rejected at token %%zu: unexpected %%s\\n\", pos + 1, pos < spellings.size() ? spellings[pos].c_str() : \"end of input\");\n");
+    fprintf(out, "    }\n    return ok ? 0 : 1;\n}\n#endif\n");
+    free(column_alt);
+}
+
+void write_generated_parser(const LL1Table* table, const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        printf("Error opening %s\n", filename);
+        exit(1);
+    }
+    generate_cpp_parser(out, table);
+    fclose(out);
+}
+
+// Runs the LALR(1) parser when lalr_table is given, the general parser when the
+// LL(1) table has conflicts or a forest is asked for, and the predictive parser
+// otherwise over a token file, and reports the outcome
+void run_token_parse(const LL1Table* table, const LalrTable* lalr_table, const char* token_file, const char* forest_file) {
+    FILE* in = strcmp(token_file, "-") == 0 ? stdin : fopen(token_file, "r");
+    if (!in) {
+        printf("Error opening %s\n", token_file);
+        exit(1);
+    }
+    Lexer lexer;
+    LL1Parser parser;
+    LalrParser lalr_parser;
+    EarleyParser general;
+    int use_general = !lalr_table && (table->conflicts > 0 || forest_file);
+    TokenSink feed;
+    void* sink_parser;
+    long* position;
+    int end_column;
+    if (lalr_table) {
+        build_lexer_or_exit(&lexer, lalr_table->term_count, lalr_table->end_column, lalr_table->names, lalr_table->patterns);
+        lalr_parser_init(&lalr_parser, lalr_table);
+        feed = lalr_sink;
+        sink_parser = &lalr_parser;
+        position = &lalr_parser.position;
+        end_column = lalr_table->end_column;
+    } else if (use_general) {
+        if (table->conflicts > 0) printf("The LL(1) table has %d conflicts; parsing with the general parser\n", table->conflicts);
+        build_table_lexer_or_exit(&lexer, table);
+        earley_parser_init(&general, table);
+        feed = earley_sink;
+        sink_parser = &general;
+        position = &general.position;
+        end_column = general.end_column;
+    } else {
+        build_table_lexer_or_exit(&lexer, table);
+        ll1_parser_init(&parser, table);
+        feed = ll1_sink;
+        sink_parser = &parser;
+        position = &parser.position;
+        end_column = parser.end_column;
+    }
+    char bad_token[64];
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int status = parse_token_stream(in, feed, sink_parser, end_column, &lexer, bad_token, sizeof(bad_token));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (status == PARSE_ACCEPT) {
+        printf("Input accepted: %ld tokens in %.3f s (%.2f M tokens/s)\n", *position, seconds, seconds > 0 ? *position / seconds / 1e6 : 0.0);
+    } else {
+        printf("Input rejected at token %ld: unexpected %s\n", *position + 1, bad_token);
+    }
+    if (use_general && status == PARSE_ACCEPT) {
+        ForestSummary f = summarize_forest(&general);
+        printf("Earley items: %d (%.1f per token)\n", general.item_count, (double)general.item_count / (general.position + 1));
+        printf("Parse forest: %ld nodes, %ld families, %ld ambiguous nodes, ", f.nodes, f.families, f.ambiguous);
+        if (f.trees < 0) printf("infinitely many trees (cyclic)\n");
+        else if (f.trees >= FOREST_MANY_TREES) printf("at least %lld trees\n", FOREST_MANY_TREES);
+        else printf("%lld tree%s\n", f.trees, f.trees == 1 ? "" : "s");
+        if (forest_file) {
+            write_forest_dot(&general, forest_file);
+            printf("Parse forest written to %s\n", forest_file);
+        }
+    }
+    if (lalr_table) lalr_parser_free(&lalr_parser);
+    else if (use_general) earley_parser_free(&general);
+    else ll1_parser_free(&parser);
+    free_lexer(&lexer);
+    if (in != stdin) fclose(in);
+}
+
+// Shape of a synthetic grammar. Nonterminal i only refers forward to the next
+// few nonterminals, so left recursion comes only from the alternatives chosen
+// to be recursive: directly (Ni -> Ni ...) or through its pair partner
+// (Ni -> N(i^1) ...), which keeps the components small the way real grammars do.
+// The first alternative is never recursive, so every nonterminal is productive.
+typedef struct {
+    int nonterminals;
+    int alternatives;
+    int rhs_length;
+    double recursion;
+    double nullable;
+    int terminals;
+    unsigned long seed;
+} GrammarShape;
+
+// Reads "key=value,..." over the defaults; keys are nts, alts, len, rec, null, terms and seed
+GrammarShape parse_grammar_shape(const char* spec) {
+    GrammarShape shape = {4000, 3, 4, 0.1, 0.1, 32, 1};
+    const char* p = spec;
+    while (p && *p) {
+        char key[16];
+        double value;
+        int used;
+        if (sscanf(p, "%15[^=]=%lf%n", key, &value, &used) != 2) {
+            printf("Error in grammar shape at '%s'\n", p);
+            exit(1);
+        }
+        if (strcmp(key, "nts") == 0) shape.nonterminals = (int)value;
+        else if (strcmp(key, "alts") == 0) shape.alternatives = (int)value;
+        else if (strcmp(key, "len") == 0) shape.rhs_length = (int)value;
+        else if (strcmp(key, "rec") == 0) shape.recursion = value;
+        else if (strcmp(key, "null") == 0) shape.nullable = value;
+        else if (strcmp(key, "terms") == 0) shape.terminals = (int)value;
+        else if (strcmp(key, "seed") == 0) shape.seed = (unsigned long)value;
+        else {
+            printf("Unknown grammar shape parameter %s\n", key);
+            exit(1);
+        }
+        p += used;
+        if (*p == ',') p++;
+    }
+    if (shape.nonterminals < 1 || shape.alternatives < 1 || shape.rhs_length < 1 || shape.terminals < 1) {
+        printf("Error: grammar shape needs nts, alts, len and terms of at least 1\n");
+        exit(1);
+    }
+    return shape;
+}
+
+// splitmix64
+uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double random_unit(uint64_t* state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform in 1 .. 2 * mean - 1, so the average is mean
+int random_count(uint64_t* state, int mean) {
+    return 1 + (int)(next_random(state) % (2 * mean - 1));
+}
+
+// A nonterminal in first position stays within the block of 16 around i, which
+// bounds the LR closures and left-corner chains the way precedence levels do;
+// later positions may refer up to 32 nonterminals ahead
+void write_body_symbol(FILE* out, uint64_t* rng, const GrammarShape* shape, int i, int first) {
+    int limit = first ? (i / 16 + 1) * 16 : i + 33;
+    if (limit > shape->nonterminals) limit = shape->nonterminals;
+    if (limit - i > 1 && next_random(rng) % 2) {
+        fprintf(out, " N%d", i + 1 + (int)(next_random(rng) % (limit - i - 1)));
+    } else {
+        fprintf(out, " t%d", (int)(next_random(rng) % shape->terminals));
+    }
+}
+
+void write_synthetic_grammar(FILE* out, const GrammarShape* shape) {
+    uint64_t rng = shape->seed;
+    for (int i = 0; i < shape->nonterminals; i++) {
+        fprintf(out, "N%d ->", i);
+        int alt_count = random_count(&rng, shape->alternatives);
+        for (int a = 0; a < alt_count; a++) {
+            if (a > 0) fprintf(out, " |");
+            int len = random_count(&rng, shape->rhs_length);
+            int k = 0;
+            if (a > 0 && random_unit(&rng) < shape->recursion) {
+                int partner = i ^ 1;
+                fprintf(out, " N%d", next_random(&rng) % 2 || partner >= shape->nonterminals ? i : partner);
+                if (len < 2) len = 2;
+                k = 1;
+            }
+            // The first alternative mentions N(i+1) after its first symbol, so N0
+            // reaches every nonterminal
+            int chain = -1;
+            if (a == 0 && i + 1 < shape->nonterminals) {
+                if (len < 2) len = 2;
+                chain = 1 + (int)(next_random(&rng) % (len - 1));
+            }
+            for (; k < len; k++) {
+                if (k == chain) fprintf(out, " N%d", i + 1);
+                else write_body_symbol(out, &rng, shape, i, k == 0);
+            }
+        }
+        if (random_unit(&rng) < shape->nullable) fprintf(out, " | ε");
+        fprintf(out, "\n");
+    }
+}
+
+void write_grammar_file(const GrammarShape* shape, const char* filename) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        printf("Error opening %s\n", filename);
+        exit(1);
+    }
+    write_synthetic_grammar(out, shape);
+    fclose(out);
+}
+
+// One measurement: the best time over the repetitions and the stage's arena peak
+#define BENCH_STAGES 8
+#define BENCH_REPEAT 3
+
+typedef struct {
+    int nonterminals;
+    long symbols;
+    const char* stage[BENCH_STAGES];
+    double seconds[BENCH_STAGES];
+    size_t bytes[BENCH_STAGES];
+    long max_rss_kib;
+} BenchResult;
+
+// Runs the pipeline of main once over a grammar file, timing every stage.
+// Logs are not written, and whatever the stages print goes to /dev/null
+void bench_pipeline(const char* grammar_file, BenchResult* result) {
+    Arena run_arena, scratch;
+    arena_init(&run_arena, 1 << 20);
+    arena_init(&scratch, 1 << 16);
+    StageMemory stages[BENCH_STAGES];
+    int stage_count = 0;
+    double t[BENCH_STAGES + 1];
+    int prod_count;
+    SymbolTable symbols;
+    symtab_init(&symbols, &run_arena);
+
+    t[0] = now_seconds();
+    Production* productions = parse_grammar_or_exit(grammar_file, &prod_count, &symbols, &scratch);
+    end_stage(stages, &stage_count, "parse", &run_arena, &scratch);
+    t[1] = now_seconds();
+    left_factoring(&productions, &prod_count, &symbols, &scratch);
+    end_stage(stages, &stage_count, "left factoring", &run_arena, &scratch);
+    t[2] = now_seconds();
+    remove_left_recursion(&productions, &prod_count, &symbols, &scratch);
+    end_stage(stages, &stage_count, "left recursion", &run_arena, &scratch);
+    t[3] = now_seconds();
+    int nt_count = symbols.nt_count;
+    int term_count;
+    int* term_column;
+    int* terminals = collect_terminals(productions, prod_count, &symbols, &term_count, &term_column);
+    SolverStats stats = {0};
+    int* nullable = compute_nullable(productions, prod_count, &symbols, &scratch, &stats);
+    end_stage(stages, &stage_count, "nullable", &run_arena, &scratch);
+    t[4] = now_seconds();
+    BitMatrix first_sets = bitmatrix_new(&run_arena, nt_count, term_count);
+    compute_first_sets(productions, prod_count, &symbols, term_column, nullable, &first_sets, &scratch, &stats);
+    end_stage(stages, &stage_count, "first", &run_arena, &scratch);
+    t[5] = now_seconds();
+    BitMatrix follow_sets = bitmatrix_new(&run_arena, nt_count, term_count);
+    compute_follow_sets(productions, prod_count, &symbols, term_column, nullable, &first_sets, &follow_sets, &scratch, &stats);
+    end_stage(stages, &stage_count, "follow", &run_arena, &scratch);
+    t[6] = now_seconds();
+    LL1Table ll1_table = construct_ll1_table(productions, prod_count, &symbols, terminals, term_column, term_count, nullable, &first_sets, &follow_sets, &scratch);
+    end_stage(stages, &stage_count, "ll1 table", &run_arena, &scratch);
+    t[7] = now_seconds();
+    free_ll1_table(&ll1_table);
+    free_grammar(productions, &symbols);
+    arena_free(&run_arena);
+
+    // The LALR(1) backend starts over from the grammar as written; loading it
+    // again is not part of the stage
+    arena_init(&run_arena, 1 << 20);
+    symtab_init(&symbols, &run_arena);
+    productions = parse_grammar_or_exit(grammar_file, &prod_count, &symbols, &scratch);
+    terminals = collect_terminals(productions, prod_count, &symbols, &term_count, &term_column);
+    nullable = compute_nullable(productions, prod_count, &symbols, &scratch, &stats);
+    size_t loaded = run_arena.used;
+    double lalr_start = now_seconds();
+    construct_lalr_table(productions, prod_count, &symbols, terminals, term_column, term_count, nullable, &run_arena, &scratch);
+    t[8] = t[7] + now_seconds() - lalr_start;
+    stages[stage_count].name = "lalr table";
+    stages[stage_count].bytes = run_arena.used - loaded + scratch.peak;
+    stage_count++;
+    free_grammar(productions, &symbols);
+    arena_free(&scratch);
+    arena_free(&run_arena);
+
+    for (int s = 0; s < BENCH_STAGES; s++) {
+        double seconds = t[s + 1] - t[s];
+        if (result->stage[s] == NULL || seconds < result->seconds[s]) result->seconds[s] = seconds;
+        result->stage[s] = stages[s].name;
+        if (stages[s].bytes > result->bytes[s]) result->bytes[s] = stages[s].bytes;
+    }
+}
+
+// Grammar size in right-hand-side symbols, ε counting as one
+long count_grammar_symbols(const char* grammar_file) {
+    Arena arena, scratch;
+    arena_init(&arena, 1 << 20);
+    arena_init(&scratch, 1 << 16);
+    SymbolTable symbols;
+    symtab_init(&symbols, &arena);
+    int prod_count;
+    Production* productions = parse_grammar_or_exit(grammar_file, &prod_count, &symbols, &scratch);
+    long count = 0;
+    for (int i = 0; i < prod_count; i++) {
+        for (int j = 0; j < productions[i].rhs_count; j++) {
+            count += alt_len(&productions[i], j) > 0 ? alt_len(&productions[i], j) : 1;
+        }
+    }
+    free_grammar(productions, &symbols);
+    arena_free(&scratch);
+    arena_free(&arena);
+    return count;
+}
+
+// Looks up a stage in a results file written by run_benchmark; -1 when absent.
+// Rows must match in size as well, so results of another shape are not compared
+double baseline_seconds(FILE* baseline, const BenchResult* result, const char* stage) {
+    char line[256];
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline)) {
+        int nts;
+        long symbols;
+        char name[64];
+        double seconds;
+        if (sscanf(line, "%d,%ld,%63[^,],%lf", &nts, &symbols, name, &seconds) == 4 && nts == result->nonterminals &&
+            symbols == result->symbols && strcmp(name, stage) == 0) {
+            return seconds;
+        }
+    }
+    return -1;
+}
+
+// Times every stage on synthetic grammars of shape->nonterminals / 16, / 4 and
+// the full size, and writes one CSV row per size and stage. With a baseline the
+// change against it is shown, and a stage more than 10% slower is flagged.
+void run_benchmark(const GrammarShape* shape, const char* results_file, const char* baseline_file) {
+    FILE* baseline = NULL;
+    if (baseline_file && !(baseline = fopen(baseline_file, "r"))) {
+        printf("Error opening %s\n", baseline_file);
+        exit(1);
+    }
+    FILE* out = fopen(results_file, "w");
+    if (!out) {
+        printf("Error opening %s\n", results_file);
+        exit(1);
+    }
+    fprintf(out, "nonterminals,symbols,stage,seconds,symbols_per_second,arena_bytes,max_rss_kib\n");
+    char grammar_file[] = "/tmp/cfg_bench_XXXXXX";
+    int fd = mkstemp(grammar_file);
+    if (fd < 0) {
+        printf("Error creating a temporary grammar file\n");
+        exit(1);
+    }
+    close(fd);
+    printf("%-8s %-10s %-15s %10s %12s %10s %s\n", "NTs", "symbols", "stage", "ms", "M sym/s", "arena KiB", baseline ? "vs baseline" : "");
+    int regressions = 0;
+    for (int step = 0; step < 3; step++) {
+        GrammarShape sized = *shape;
+        sized.nonterminals = shape->nonterminals >> (4 - 2 * step);
+        if (sized.nonterminals < 1) continue;
+        write_grammar_file(&sized, grammar_file);
+        BenchResult result = {0};
+        result.nonterminals = sized.nonterminals;
+        result.symbols = count_grammar_symbols(grammar_file);
+
+        // Conflicts and warnings are printed by the stages themselves
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        for (int rep = 0; rep < BENCH_REPEAT; rep++) bench_pipeline(grammar_file, &result);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        result.max_rss_kib = usage.ru_maxrss;
+        for (int s = 0; s < BENCH_STAGES; s++) {
+            double rate = result.seconds[s] > 0 ? result.symbols / result.seconds[s] : 0;
+            fprintf(out, "%d,%ld,%s,%.6f,%.0f,%zu,%ld\n", result.nonterminals, result.symbols, result.stage[s], result.seconds[s], rate, result.bytes[s], result.max_rss_kib);
+            printf("%-8d %-10ld %-15s %10.3f %12.2f %10.1f", result.nonterminals, result.symbols, result.stage[s], result.seconds[s] * 1e3, rate / 1e6, result.bytes[s] / 1024.0);
+            double old = baseline ? baseline_seconds(baseline, &result, result.stage[s]) : -1;
+            if (old > 0) {
+                double change = (result.seconds[s] - old) / old * 100;
+                printf(" %+7.1f%%%s", change, change > 10 ? "  slower" : "");
+                if (change > 10) regressions++;
+            }
+            printf("\n");
+        }
+        printf("%-8d max RSS %.1f MiB\n", result.nonterminals, result.max_rss_kib / 1024.0);
+    }
+    unlink(grammar_file);
+    fclose(out);
+    if (baseline) {
+        fclose(baseline);
+        printf("%d stage(s) more than 10%% slower than %s\n", regressions, baseline_file);
+    }
+    printf("Benchmark results written to %s\n", results_file);
+}
+
+// Incremental analysis (--incremental). The engine keeps the grammar as written
+// resident, with its nullable flags, FIRST and FOLLOW sets and LL(1) rows, and
+// applies edits to the alternatives of one nonterminal at a time. An edit only
+// revisits the nonterminals it can reach: sets that may shrink are cleared
+// and re-solved over the affected region, sets that can only grow are updated
+// by propagation, and only rows whose inputs changed are rebuilt. Like --lalr,
+// the rewriting passes are skipped, since they rename and reshape the grammar.
+typedef struct {
+    int* items;
+    int count;
+    int capacity;
+} IntVec;
+
+void intvec_push(IntVec* v, int x) {
+    if (v->count >= v->capacity) {
+        v->capacity = v->capacity ? v->capacity * 2 : 4;
+        v->items = realloc(v->items, v->capacity * sizeof(int));
+    }
+    v->items[v->count++] = x;
+}
+
+void intvec_remove(IntVec* v, int x) {
+    for (int i = 0; i < v->count; i++) {
+        if (v->items[i] == x) {
+            memmove(v->items + i, v->items + i + 1, (v->count - i - 1) * sizeof(int));
+            v->count--;
+            return;
+        }
+    }
+}
+
+// Nodes collected during one edit, in insertion order. Membership is a stamp
+// per node, so starting over costs nothing however large the grammar is.
+typedef struct {
+    int* stamp;
+    int epoch;
+    IntVec members;
+} NodeSet;
+
+void node_set_clear(NodeSet* s) {
+    s->epoch++;
+    s->members.count = 0;
+}
+
+int node_set_has(const NodeSet* s, int v) {
+    return s->stamp[v] == s->epoch;
+}
+
+int node_set_add(NodeSet* s, int v) {
+    if (s->stamp[v] == s->epoch) return 0;
+    s->stamp[v] = s->epoch;
+    intvec_push(&s->members, v);
+    return 1;
+}
+
+// sets[v] = direct[v] U sets[w] for every w in deps[v], kept with the reverse
+// edges so a change can be traced to the nodes that depend on it
+typedef struct {
+    BitMatrix sets;
+    BitMatrix direct;
+    IntVec* deps;
+    IntVec* rdeps;
+} SetEquations;
+
+typedef struct {
+    int lhs;
+    int* syms;
+    int len;
+    int live;
+} EditableAlt;
+
+typedef struct {
+    Arena arena;
+    Arena scratch;
+    SymbolTable st;
+    EditableAlt* alts;
+    int alt_count;
+    int alt_capacity;
+    int node_count;
+    int node_capacity;
+    IntVec* node_alts;
+    IntVec* occurrences;
+    int* term_column;
+    int column_capacity;
+    int* terminals;
+    int term_count;
+    int end_column;
+    int* nullable;
+    SetEquations first;
+    SetEquations follow;
+    IntVec* rows;
+    IntVec* row_conflicts;
+    int conflicts;
+    NodeSet edited;
+    NodeSet region;
+    NodeSet nullable_changed;
+    NodeSet first_local;
+    NodeSet first_changed;
+    NodeSet follow_local;
+    NodeSet follow_changed;
+    NodeSet dirty_rows;
+    uint64_t** lost;
+    int* slot_of;
+    IntVec work;
+    int* cell;
+} IncrementalAnalysis;
+
+// What one edit touched, for its report line
+typedef struct {
+    int added;
+    int removed;
+    int rebuilt;
+    int nullable_changed;
+    int first_changed;
+    int follow_changed;
+    int rows;
+    int cells;
+} EditReport;
+
+void resize_matrix(BitMatrix* m, int rows, int words) {
+    uint64_t* bits = calloc((size_t)rows * words, sizeof(uint64_t));
+    for (int r = 0; r < m->rows && r < rows; r++) memcpy(bits + (size_t)r * words, m->bits + (size_t)r * m->words, m->words * sizeof(uint64_t));
+    free(m->bits);
+    m->bits = bits;
+    m->rows = rows;
+    m->words = words;
+}
+
+void resize_node_set(NodeSet* s, int old_capacity, int capacity) {
+    s->stamp = realloc(s->stamp, capacity * sizeof(int));
+    memset(s->stamp + old_capacity, 0, (capacity - old_capacity) * sizeof(int));
+}
+
+void grow_nodes(IncrementalAnalysis* an, int needed) {
+    if (needed <= an->node_capacity) return;
+    int old = an->node_capacity;
+    int capacity = old ? old : 64;
+    while (capacity < needed) capacity *= 2;
+    size_t added = capacity - old;
+    an->node_alts = realloc(an->node_alts, capacity * sizeof(IntVec));
+    an->occurrences = realloc(an->occurrences, capacity * sizeof(IntVec));
+    an->first.deps = realloc(an->first.deps, capacity * sizeof(IntVec));
+    an->first.rdeps = realloc(an->first.rdeps, capacity * sizeof(IntVec));
+    an->follow.deps = realloc(an->follow.deps, capacity * sizeof(IntVec));
+    an->follow.rdeps = realloc(an->follow.rdeps, capacity * sizeof(IntVec));
+    an->rows = realloc(an->rows, capacity * sizeof(IntVec));
+    an->row_conflicts = realloc(an->row_conflicts, capacity * sizeof(IntVec));
+    IntVec* vecs[] = {an->node_alts, an->occurrences, an->first.deps, an->first.rdeps, an->follow.deps, an->follow.rdeps, an->rows, an->row_conflicts};
+    for (int k = 0; k < 8; k++) memset(vecs[k] + old, 0, added * sizeof(IntVec));
+    an->nullable = realloc(an->nullable, capacity * sizeof(int));
+    memset(an->nullable + old, 0, added * sizeof(int));
+    an->lost = realloc(an->lost, capacity * sizeof(uint64_t*));
+    an->slot_of = realloc(an->slot_of, capacity * sizeof(int));
+    NodeSet* sets[] = {&an->edited, &an->region, &an->nullable_changed, &an->first_local, &an->first_changed, &an->follow_local, &an->follow_changed, &an->dirty_rows};
+    for (int k = 0; k < 8; k++) resize_node_set(sets[k], old, capacity);
+    int words = an->first.sets.words;
+    resize_matrix(&an->first.sets, capacity, words);
+    resize_matrix(&an->first.direct, capacity, words);
+    resize_matrix(&an->follow.sets, capacity, words);
+    resize_matrix(&an->follow.direct, capacity, words);
+    an->node_capacity = capacity;
+}
+
+// Gives a terminal its column; bitsets double in width when they run out
+int terminal_column(IncrementalAnalysis* an, int sym) {
+    if (an->column_capacity < an->st.count) {
+        int capacity = an->column_capacity ? an->column_capacity : 64;
+        while (capacity < an->st.count) capacity *= 2;
+        an->term_column = realloc(an->term_column, capacity * sizeof(int));
+        an->terminals = realloc(an->terminals, capacity * sizeof(int));
+        for (int i = an->column_capacity; i < capacity; i++) an->term_column[i] = -1;
+        an->column_capacity = capacity;
+    }
+    if (an->term_column[sym] != -1) return an->term_column[sym];
+    int words = an->first.sets.words;
+    if (an->term_count >= words * 64) {
+        int new_words = bitset_words(words * 128);
+        resize_matrix(&an->first.sets, an->node_capacity, new_words);
+        resize_matrix(&an->first.direct, an->node_capacity, new_words);
+        resize_matrix(&an->follow.sets, an->node_capacity, new_words);
+        resize_matrix(&an->follow.direct, an->node_capacity, new_words);
+        an->cell = realloc(an->cell, new_words * 64 * sizeof(int));
+        for (int t = words * 64; t < new_words * 64; t++) an->cell[t] = -1;
+    }
+    an->term_column[sym] = an->term_count;
+    an->terminals[an->term_count] = sym;
+    return an->term_count++;
+}
+
+int add_node(IncrementalAnalysis* an, int sym) {
+    int v = add_nonterminal(&an->st, sym);
+    grow_nodes(an, v + 1);
+    if (v >= an->node_count) an->node_count = v + 1;
+    return v;
+}
+
+// Appends an alternative of node v; symbols not yet known become terminals
+int add_editable_alt(IncrementalAnalysis* an, int v, const int* syms, int len) {
+    if (an->alt_count >= an->alt_capacity) {
+        an->alt_capacity = an->alt_capacity ? an->alt_capacity * 2 : 64;
+        an->alts = realloc(an->alts, an->alt_capacity * sizeof(EditableAlt));
+    }
+    int id = an->alt_count++;
+    EditableAlt* alt = &an->alts[id];
+    alt->lhs = v;
+    alt->len = len;
+    alt->live = 1;
+    alt->syms = malloc((len > 0 ? len : 1) * sizeof(int));
+    if (len > 0) memcpy(alt->syms, syms, len * sizeof(int));
+    intvec_push(&an->node_alts[v], id);
+    for (int k = 0; k < len; k++) {
+        int w = an->st.nt_index[syms[k]];
+        if (w == -1) {
+            terminal_column(an, syms[k]);
+            continue;
+        }
+        int seen = 0;
+        for (int m = 0; m < k; m++) seen |= syms[m] == syms[k];
+        if (!seen) intvec_push(&an->occurrences[w], id);
+    }
+    return id;
+}
+
+void remove_editable_alt(IncrementalAnalysis* an, int id) {
+    EditableAlt* alt = &an->alts[id];
+    alt->live = 0;
+    intvec_remove(&an->node_alts[alt->lhs], id);
+    for (int k = 0; k < alt->len; k++) {
+        int w = an->st.nt_index[alt->syms[k]];
+        int seen = 0;
+        for (int m = 0; m < k; m++) seen |= alt->syms[m] == alt->syms[k];
+        if (w != -1 && !seen) intvec_remove(&an->occurrences[w], id);
+    }
+}
+
+// Brings eq up to date after the direct sets or dependencies of the nodes in
+// changed were replaced. loss row i holds the bits member i may have lost.
+// Losing a bit can only spread to dependents that hold it, so those nodes form
+// the region that is cleared and re-solved with solve_set_equations; every
+// other node can only grow and is updated by propagation. With full set, every
+// node is re-solved. Nodes whose set changed are added to out.
+void update_set_equations(IncrementalAnalysis* an, SetEquations* eq, const NodeSet* changed, const BitMatrix* loss, int full, NodeSet* out) {
+    Arena* scratch = &an->scratch;
+    int words = eq->sets.words;
+    NodeSet* region = &an->region;
+    node_set_clear(region);
+    IntVec* work = &an->work;
+    work->count = 0;
+    if (full) {
+        for (int v = 0; v < an->node_count; v++) node_set_add(region, v);
+    } else {
+        for (int i = 0; i < changed->members.count; i++) {
+            int v = changed->members.items[i];
+            uint64_t* candidate = arena_alloc(scratch, words * sizeof(uint64_t));
+            int any = 0;
+            for (int w = 0; w < words; w++) any |= (candidate[w] = bitset_row(loss, i)[w] & bitset_row(&eq->sets, v)[w]) != 0;
+            if (!any) continue;
+            if (node_set_add(region, v)) {
+                an->lost[v] = candidate;
+            } else {
+                bitset_union(an->lost[v], candidate, words);
+            }
+            intvec_push(work, v);
+        }
+        while (work->count > 0) {
+            int u = work->items[--work->count];
+            for (int e = 0; e < eq->rdeps[u].count; e++) {
+                int p = eq->rdeps[u].items[e];
+                uint64_t* candidate = arena_alloc(scratch, words * sizeof(uint64_t));
+                int any = 0;
+                for (int w = 0; w < words; w++) any |= (candidate[w] = an->lost[u][w] & bitset_row(&eq->sets, p)[w]) != 0;
+                if (!any) continue;
+                if (node_set_add(region, p)) {
+                    an->lost[p] = candidate;
+                } else if (!bitset_union(an->lost[p], candidate, words)) {
+                    continue;
+                }
+                intvec_push(work, p);
+            }
+        }
+    }
+
+    // Re-solve the region with everything outside it held fixed
+    int k = region->members.count;
+    if (k > 0) {
+        const int* slot = region->members.items;
+        BitMatrix local = bitmatrix_new(scratch, k, words * 64);
+        EdgeList edges = {scratch, NULL, NULL, 0, 0};
+        for (int i = 0; i < k; i++) an->slot_of[slot[i]] = i;
+        for (int i = 0; i < k; i++) {
+            int v = slot[i];
+            uint64_t* row = bitset_row(&local, i);
+            memcpy(row, bitset_row(&eq->direct, v), words * sizeof(uint64_t));
+            for (int e = 0; e < eq->deps[v].count; e++) {
+                int w = eq->deps[v].items[e];
+                if (node_set_has(region, w)) add_edge(&edges, i, an->slot_of[w]);
+                else bitset_union(row, bitset_row(&eq->sets, w), words);
+            }
+        }
+        DepGraph graph = build_graph(k, &edges);
+        int scc_count;
+        long visits = 0;
+        solve_set_equations(&graph, &local, scratch, &scc_count, &visits);
+        for (int i = 0; i < k; i++) {
+            uint64_t* row = bitset_row(&eq->sets, slot[i]);
+            if (memcmp(row, bitset_row(&local, i), words * sizeof(uint64_t)) == 0) continue;
+            memcpy(row, bitset_row(&local, i), words * sizeof(uint64_t));
+            node_set_add(out, slot[i]);
+            intvec_push(work, slot[i]);
+        }
+    }
+
+    // Changed nodes outside the region only gained; spread what they gained
+    for (int i = 0; !full && i < changed->members.count; i++) {
+        int v = changed->members.items[i];
+        if (node_set_has(region, v)) continue;
+        uint64_t* row = bitset_row(&eq->sets, v);
+        int gained = bitset_union(row, bitset_row(&eq->direct, v), words);
+        for (int e = 0; e < eq->deps[v].count; e++) gained |= bitset_union(row, bitset_row(&eq->sets, eq->deps[v].items[e]), words);
+        if (gained) {
+            node_set_add(out, v);
+            intvec_push(work, v);
+        }
+    }
+    while (work->count > 0) {
+        int v = work->items[--work->count];
+        for (int e = 0; e < eq->rdeps[v].count; e++) {
+            int p = eq->rdeps[v].items[e];
+            if (bitset_union(bitset_row(&eq->sets, p), bitset_row(&eq->sets, v), words)) {
+                node_set_add(out, p);
+                intvec_push(work, p);
+            }
+        }
+    }
+}
+
+// Replaces the direct set and dependencies of v in eq with the ones in
+// direct/deps, and writes into loss what v may have lost by it
+void replace_equation(SetEquations* eq, int v, const uint64_t* direct, IntVec* deps, uint64_t* loss) {
+    int words = eq->sets.words;
+    uint64_t* old_direct = bitset_row(&eq->direct, v);
+    for (int w = 0; w < words; w++) loss[w] = old_direct[w] & ~direct[w];
+    memcpy(old_direct, direct, words * sizeof(uint64_t));
+    if (deps->count > 1) qsort(deps->items, deps->count, sizeof(int), compare_ints);
+    int n = 0;
+    for (int i = 0; i < deps->count; i++) {
+        if (n == 0 || deps->items[i] != deps->items[n - 1]) deps->items[n++] = deps->items[i];
+    }
+    deps->count = n;
+    IntVec* old = &eq->deps[v];
+    int i = 0, j = 0;
+    while (i < old->count || j < n) {
+        if (j == n || (i < old->count && old->items[i] < deps->items[j])) {
+            bitset_union(loss, bitset_row(&eq->sets, old->items[i]), words);
+            intvec_remove(&eq->rdeps[old->items[i]], v);
+            i++;
+        } else if (i == old->count || deps->items[j] < old->items[i]) {
+            intvec_push(&eq->rdeps[deps->items[j]], v);
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    old->count = 0;
+    for (int k = 0; k < n; k++) intvec_push(old, deps->items[k]);
+}
+
+int has_nullable_alt(const IncrementalAnalysis* an, int v) {
+    for (int i = 0; i < an->node_alts[v].count; i++) {
+        const EditableAlt* alt = &an->alts[an->node_alts[v].items[i]];
+        int k = 0;
+        while (k < alt->len && an->st.nt_index[alt->syms[k]] != -1 && an->nullable[an->st.nt_index[alt->syms[k]]]) k++;
+        if (k == alt->len) return 1;
+    }
+    return 0;
+}
+
+// Nullable flags after the alternatives of the edited nodes changed. Nullable
+// nodes above an edited one may lose the flag, so they are cleared and
+// re-derived; then whatever became nullable spreads upwards.
+void update_nullable(IncrementalAnalysis* an, const NodeSet* edited, int full) {
+    NodeSet* region = &an->region;
+    NodeSet* out = &an->nullable_changed;
+    node_set_clear(region);
+    node_set_clear(out);
+    for (int i = 0; i < edited->members.count; i++) {
+        if (an->nullable[edited->members.items[i]]) node_set_add(region, edited->members.items[i]);
+    }
+    for (int i = 0; i < region->members.count; i++) {
+        const IntVec* occ = &an->occurrences[region->members.items[i]];
+        for (int e = 0; e < occ->count; e++) {
+            const EditableAlt* alt = &an->alts[occ->items[e]];
+            if (an->nullable[alt->lhs]) node_set_add(region, alt->lhs);
+        }
+    }
+    for (int i = 0; i < region->members.count; i++) an->nullable[region->members.items[i]] = 0;
+
+    IntVec* work = &an->work;
+    work->count = 0;
+    if (full) {
+        for (int v = an->node_count - 1; v >= 0; v--) intvec_push(work, v);
+    }
+    for (int i = 0; i < region->members.count; i++) intvec_push(work, region->members.items[i]);
+    for (int i = 0; i < edited->members.count; i++) intvec_push(work, edited->members.items[i]);
+    while (work->count > 0) {
+        int v = work->items[--work->count];
+        if (an->nullable[v] || !has_nullable_alt(an, v)) continue;
+        an->nullable[v] = 1;
+        if (!node_set_has(region, v)) node_set_add(out, v);
+        const IntVec* occ = &an->occurrences[v];
+        for (int e = 0; e < occ->count; e++) {
+            int p = an->alts[occ->items[e]].lhs;
+            if (!an->nullable[p]) intvec_push(work, p);
+        }
+    }
+    for (int i = 0; i < region->members.count; i++) {
+        if (!an->nullable[region->members.items[i]]) node_set_add(out, region->members.items[i]);
+    }
+}
+
+// The FIRST equation of v: terminals that start an alternative after a
+// nullable prefix, and the nonterminals in such prefixes
+void first_equation(const IncrementalAnalysis* an, int v, uint64_t* direct, IntVec* deps) {
+    for (int i = 0; i < an->node_alts[v].count; i++) {
+        const EditableAlt* alt = &an->alts[an->node_alts[v].items[i]];
+        for (int k = 0; k < alt->len; k++) {
+            int w = an->st.nt_index[alt->syms[k]];
+            if (w == -1) {
+                bitset_add(direct, an->term_column[alt->syms[k]]);
+                break;
+            }
+            if (w != v) intvec_push(deps, w);
+            if (!an->nullable[w]) break;
+        }
+    }
+}
+
+// The FOLLOW equation of v, read off its occurrences
+void follow_equation(const IncrementalAnalysis* an, int v, uint64_t* direct, IntVec* deps) {
+    int words = an->first.sets.words;
+    if (v == 0) bitset_add(direct, an->end_column);
+    const IntVec* occ = &an->occurrences[v];
+    for (int e = 0; e < occ->count; e++) {
+        const EditableAlt* alt = &an->alts[occ->items[e]];
+        for (int k = 0; k < alt->len; k++) {
+            if (an->st.nt_index[alt->syms[k]] != v) continue;
+            int beta_nullable = 1;
+            for (int m = k + 1; m < alt->len; m++) {
+                int w = an->st.nt_index[alt->syms[m]];
+                if (w == -1) {
+                    bitset_add(direct, an->term_column[alt->syms[m]]);
+                    beta_nullable = 0;
+                    break;
+                }
+                bitset_union(direct, bitset_row(&an->first.sets, w), words);
+                if (!an->nullable[w]) {
+                    beta_nullable = 0;
+                    break;
+                }
+            }
+            if (beta_nullable && alt->lhs != v) intvec_push(deps, alt->lhs);
+        }
+    }
+}
+
+// Re-derives the equations of the nodes in local and updates the sets
+void update_equations(IncrementalAnalysis* an, SetEquations* eq, const NodeSet* local, int full, NodeSet* out,
+                      void (*equation)(const IncrementalAnalysis*, int, uint64_t*, IntVec*)) {
+    int words = eq->sets.words;
+    BitMatrix loss = bitmatrix_new(&an->scratch, local->members.count, words * 64);
+    uint64_t* direct = arena_alloc(&an->scratch, words * sizeof(uint64_t));
+    IntVec deps = {0};
+    for (int i = 0; i < local->members.count; i++) {
+        int v = local->members.items[i];
+        memset(direct, 0, words * sizeof(uint64_t));
+        deps.count = 0;
+        equation(an, v, direct, &deps);
+        replace_equation(eq, v, direct, &deps, bitset_row(&loss, i));
+    }
+    free(deps.items);
+    node_set_clear(out);
+    update_set_equations(an, eq, local, &loss, full, out);
+}
+
+// Rebuilds the LL(1) row of v and returns how many cells changed
+int rebuild_row(IncrementalAnalysis* an, int v) {
+    int words = an->first.sets.words;
+    uint64_t* predict = arena_alloc(&an->scratch, words * sizeof(uint64_t));
+    IntVec* row = &an->rows[v];
+    int* old_value = arena_alloc(&an->scratch, (row->count / 2 + 1) * sizeof(int));
+    for (int e = 0; e < row->count; e += 2) {
+        old_value[e / 2] = row->items[e + 1];
+        an->cell[row->items[e]] = -2 - e / 2;
+    }
+    int old_count = row->count;
+    int changed = 0;
+    IntVec fresh = {0}, conflicts = {0};
+    for (int i = 0; i < an->node_alts[v].count; i++) {
+        int id = an->node_alts[v].items[i];
+        const EditableAlt* alt = &an->alts[id];
+        memset(predict, 0, words * sizeof(uint64_t));
+        int k = 0;
+        for (; k < alt->len; k++) {
+            int w = an->st.nt_index[alt->syms[k]];
+            if (w == -1) {
+                bitset_add(predict, an->term_column[alt->syms[k]]);
+                break;
+            }
+            bitset_union(predict, bitset_row(&an->first.sets, w), words);
+            if (!an->nullable[w]) break;
+        }
+        if (k == alt->len) bitset_union(predict, bitset_row(&an->follow.sets, v), words);
+        for (int t = bitset_next(predict, words, 0); t != -1; t = bitset_next(predict, words, t + 1)) {
+            if (an->cell[t] >= 0) {
+                intvec_push(&conflicts, t);
+                intvec_push(&conflicts, id);
+                continue;
+            }
+            if (an->cell[t] == -1 || old_value[-2 - an->cell[t]] != id) changed++;
+            an->cell[t] = id;
+            intvec_push(&fresh, t);
+            intvec_push(&fresh, id);
+        }
+    }
+    for (int e = 0; e < old_count; e += 2) {
+        if (an->cell[row->items[e]] < -1) changed++;
+        an->cell[row->items[e]] = -1;
+    }
+    for (int e = 0; e < fresh.count; e += 2) an->cell[fresh.items[e]] = -1;
+    free(row->items);
+    *row = fresh;
+    an->conflicts += conflicts.count / 2 - an->row_conflicts[v].count / 2;
+    free(an->row_conflicts[v].items);
+    an->row_conflicts[v] = conflicts;
+    return changed;
+}
+
+// Runs the analysis for the edited nodes (or all of them when full), filling
+// in the counts of report
+void reanalyze(IncrementalAnalysis* an, const NodeSet* edited, const IntVec* touched_alts, int full, EditReport* report) {
+    update_nullable(an, edited, full);
+
+    // FIRST of the edited nodes, and of every node with an alternative that
+    // mentions a node whose nullability flipped
+    NodeSet* local = &an->first_local;
+    node_set_clear(local);
+    if (full) {
+        for (int v = 0; v < an->node_count; v++) node_set_add(local, v);
+    }
+    for (int i = 0; i < edited->members.count; i++) node_set_add(local, edited->members.items[i]);
+    for (int i = 0; i < an->nullable_changed.members.count; i++) {
+        const IntVec* occ = &an->occurrences[an->nullable_changed.members.items[i]];
+        for (int e = 0; e < occ->count; e++) node_set_add(local, an->alts[occ->items[e]].lhs);
+    }
+    update_equations(an, &an->first, local, full, &an->first_changed, first_equation);
+
+    // FOLLOW of the edited nodes (a new start symbol gains $), of every node
+    // in an added or removed alternative, and of every node that precedes a
+    // node whose FIRST or nullability changed
+    local = &an->follow_local;
+    node_set_clear(local);
+    if (full) {
+        for (int v = 0; v < an->node_count; v++) node_set_add(local, v);
+    }
+    for (int i = 0; i < edited->members.count; i++) node_set_add(local, edited->members.items[i]);
+    for (int i = 0; i < touched_alts->count; i++) {
+        const EditableAlt* alt = &an->alts[touched_alts->items[i]];
+        for (int k = 0; k < alt->len; k++) {
+            if (an->st.nt_index[alt->syms[k]] != -1) node_set_add(local, an->st.nt_index[alt->syms[k]]);
+        }
+    }
+    const NodeSet* sources[2] = {&an->nullable_changed, &an->first_changed};
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < sources[s]->members.count; i++) {
+            int v = sources[s]->members.items[i];
+            const IntVec* occ = &an->occurrences[v];
+            for (int e = 0; e < occ->count; e++) {
+                const EditableAlt* alt = &an->alts[occ->items[e]];
+                int last = alt->len - 1;
+                while (an->st.nt_index[alt->syms[last]] != v) last--;
+                for (int k = 0; k < last; k++) {
+                    if (an->st.nt_index[alt->syms[k]] != -1) node_set_add(local, an->st.nt_index[alt->syms[k]]);
+                }
+            }
+        }
+    }
+    update_equations(an, &an->follow, local, full, &an->follow_changed, follow_equation);
+
+    // Rows of the edited nodes, of nodes whose alternatives mention a changed
+    // FIRST or nullable node, and of nodes whose FOLLOW changed
+    NodeSet* dirty = &an->dirty_rows;
+    node_set_clear(dirty);
+    if (full) {
+        for (int v = 0; v < an->node_count; v++) node_set_add(dirty, v);
+    }
+    for (int i = 0; i < edited->members.count; i++) node_set_add(dirty, edited->members.items[i]);
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < sources[s]->members.count; i++) {
+            const IntVec* occ = &an->occurrences[sources[s]->members.items[i]];
+            for (int e = 0; e < occ->count; e++) node_set_add(dirty, an->alts[occ->items[e]].lhs);
+        }
+    }
+    for (int i = 0; i < an->follow_changed.members.count; i++) node_set_add(dirty, an->follow_changed.members.items[i]);
+    for (int i = 0; i < dirty->members.count; i++) report->cells += rebuild_row(an, dirty->members.items[i]);
+    report->rows = dirty->members.count;
+    report->nullable_changed = an->nullable_changed.members.count;
+    report->first_changed = an->first_changed.members.count;
+    report->follow_changed = an->follow_changed.members.count;
+}
+
+// Builds the resident analysis of a grammar. Names are copied into the
+// engine's own symbol table, so the source table may go away afterwards.
+void incremental_init(IncrementalAnalysis* an, Production* productions, int prod_count, const SymbolTable* source) {
+    memset(an, 0, sizeof(*an));
+    arena_init(&an->arena, 1 << 16);
+    arena_init(&an->scratch, 1 << 16);
+    symtab_init(&an->st, &an->arena);
+    int words = bitset_words(64);
+    an->first.sets.words = an->first.direct.words = an->follow.sets.words = an->follow.direct.words = words;
+    an->cell = malloc(words * 64 * sizeof(int));
+    for (int t = 0; t < words * 64; t++) an->cell[t] = -1;
+    for (int i = 0; i < prod_count; i++) add_node(an, intern_symbol(&an->st, source->names[productions[i].lhs]));
+
+    // Columns in order of first occurrence, then $, as collect_terminals numbers them
+    int* syms = NULL;
+    int sym_capacity = 0;
+    for (int i = 0; i < prod_count; i++) {
+        Production* p = &productions[i];
+        int v = an->st.nt_index[find_symbol(&an->st, source->names[p->lhs])];
+        for (int j = 0; j < p->rhs_count; j++) {
+            int len = alt_len(p, j);
+            if (len > sym_capacity) syms = realloc(syms, (sym_capacity = len * 2) * sizeof(int));
+            for (int k = 0; k < len; k++) {
+                int src = alt_syms(p, j)[k];
+                syms[k] = intern_symbol(&an->st, source->names[src]);
+                if (source->patterns[src] && !an->st.patterns[syms[k]]) an->st.patterns[syms[k]] = arena_strndup(&an->arena, source->patterns[src], strlen(source->patterns[src]));
+            }
+            add_editable_alt(an, v, syms, len);
+        }
+    }
+    free(syms);
+    an->end_column = terminal_column(an, intern_symbol(&an->st, "$"));
+
+    node_set_clear(&an->edited);
+    for (int v = 0; v < an->node_count; v++) node_set_add(&an->edited, v);
+    IntVec none = {0};
+    EditReport report = {0};
+    reanalyze(an, &an->edited, &none, 1, &report);
+    arena_reset(&an->scratch);
+}
+
+void incremental_free(IncrementalAnalysis* an) {
+    for (int i = 0; i < an->alt_count; i++) free(an->alts[i].syms);
+    for (int v = 0; v < an->node_capacity; v++) {
+        IntVec* vecs[] = {&an->node_alts[v], &an->occurrences[v], &an->first.deps[v], &an->first.rdeps[v], &an->follow.deps[v], &an->follow.rdeps[v], &an->rows[v], &an->row_conflicts[v]};
+        for (int k = 0; k < 8; k++) free(vecs[k]->items);
+    }
+    NodeSet* sets[] = {&an->edited, &an->region, &an->nullable_changed, &an->first_local, &an->first_changed, &an->follow_local, &an->follow_changed, &an->dirty_rows};
+    for (int k = 0; k < 8; k++) {
+        free(sets[k]->stamp);
+        free(sets[k]->members.items);
+    }
+    free(an->alts);
+    free(an->node_alts);
+    free(an->occurrences);
+    free(an->first.deps);
+    free(an->first.rdeps);
+    free(an->follow.deps);
+    free(an->follow.rdeps);
+    free(an->rows);
+    free(an->row_conflicts);
+    free(an->nullable);
+    free(an->lost);
+    free(an->slot_of);
+    free(an->work.items);
+    free(an->term_column);
+    free(an->terminals);
+    free(an->cell);
+    free(an->first.sets.bits);
+    free(an->first.direct.bits);
+    free(an->follow.sets.bits);
+    free(an->follow.direct.bits);
+    symtab_free(&an->st);
+    arena_free(&an->scratch);
+    arena_free(&an->arena);
+}
+
+// The current grammar as productions, one per nonterminal in node order (so a
+// production's index is its nonterminal's), referring to the engine's symbols
+Production* incremental_productions(IncrementalAnalysis* an, int* prod_count, Arena* arena) {
+    Production* productions = arena_alloc(arena, (an->node_count > 0 ? an->node_count : 1) * sizeof(Production));
+    *prod_count = 0;
+    AltBuffer rhs;
+    alt_buffer_init(&rhs, &an->scratch);
+    for (int v = 0; v < an->node_count; v++) {
+        for (int i = 0; i < an->node_alts[v].count; i++) {
+            const EditableAlt* alt = &an->alts[an->node_alts[v].items[i]];
+            add_alternative(&rhs, alt->syms, alt->len, NULL, 0);
+        }
+        productions[(*prod_count)++] = make_production(arena, an->st.nts[v], &rhs);
+    }
+    return productions;
+}
+
+// Starts over from the current grammar, for an edit that turns a terminal
+// into a nonterminal
+void incremental_rebuild(IncrementalAnalysis* an) {
+    Arena arena;
+    arena_init(&arena, 1 << 16);
+    int prod_count;
+    Production* productions = incremental_productions(an, &prod_count, &arena);
+    IncrementalAnalysis fresh;
+    incremental_init(&fresh, productions, prod_count, &an->st);
+    incremental_free(an);
+    arena_free(&arena);
+    *an = fresh;
+    an->st.arena = &an->arena;
+}
+
+// Applies one edit line: "+ A -> alternatives" adds alternatives to A, "- A ->
+// alternatives" removes one matching alternative each, and "= A ->
+// alternatives" replaces all of A's. Alternatives are written as in a grammar
+// file. Returns 0 for blank and comment lines and 1 for an edit.
+int apply_edit(IncrementalAnalysis* an, const char* line, int line_number, EditReport* report) {
+    while (isspace((unsigned char)*line)) line++;
+    if (*line == '\0' || *line == '#') return 0;
+    char op = *line++;
+    if (op != '+' && op != '-' && op != '=') {
+        printf("Error at edit line %d: expected +, - or =\n", line_number);
+        exit(1);
+    }
+    memset(report, 0, sizeof(*report));
+    GrammarScanner gs = {line, line + strlen(line), line_number, 0};
+    GrammarWord name = next_grammar_word(&gs);
+    GrammarWord arrow = next_grammar_word(&gs);
+    if (name.len == 0 || word_is(name, "|") || word_is(name, "->") || !word_is(arrow, "->")) {
+        printf("Error at edit line %d: expected NAME -> alternatives\n", line_number);
+        exit(1);
+    }
+
+    // Alternatives as runs of symbols, each closed by -1
+    IntVec body = {0};
+    int pending = 0, explicit_eps = 0;
+    for (GrammarWord w = next_grammar_word(&gs); w.len > 0; w = next_grammar_word(&gs)) {
+        if (word_is(w, "|")) {
+            if (pending || explicit_eps) intvec_push(&body, -1);
+            pending = explicit_eps = 0;
+        } else if (word_is(w, "ε")) {
+            explicit_eps = 1;
+        } else if (word_is(w, "->")) {
+            printf("Error at edit line %d: unexpected '->'\n", line_number);
+            exit(1);
+        } else {
+            intvec_push(&body, intern_symbol_n(&an->st, w.text, w.len));
+            pending = 1;
+        }
+    }
+    if (pending || explicit_eps) intvec_push(&body, -1);
+
+    int sym = intern_symbol_n(&an->st, name.text, name.len);
+    int rebuild = 0;
+    if (an->st.nt_index[sym] == -1) {
+        if (op == '-') {
+            fprintf(messages, "Warning: edit line %d removes from %s, which has no alternatives\n", line_number, an->st.names[sym]);
+            free(body.items);
+            return 1;
+        }
+        rebuild = sym < an->column_capacity && an->term_column[sym] != -1;
+        add_node(an, sym);
+    }
+    int v = an->st.nt_index[sym];
+
+    IntVec touched = {0};
+    if (op == '=') {
+        while (an->node_alts[v].count > 0) {
+            int id = an->node_alts[v].items[0];
+            intvec_push(&touched, id);
+            remove_editable_alt(an, id);
+            report->removed++;
+        }
+    }
+    for (int start = 0, end = 0; end < body.count; start = ++end) {
+        while (body.items[end] != -1) end++;
+        int len = end - start;
+        if (op != '-') {
+            intvec_push(&touched, add_editable_alt(an, v, body.items + start, len));
+            report->added++;
+            continue;
+        }
+        int found = -1;
+        for (int i = 0; i < an->node_alts[v].count && found == -1; i++) {
+            const EditableAlt* alt = &an->alts[an->node_alts[v].items[i]];
+            if (alt->len == len && memcmp(alt->syms, body.items + start, len * sizeof(int)) == 0) found = an->node_alts[v].items[i];
+        }
+        if (found == -1) {
+            fprintf(messages, "Warning: edit line %d: %s has no such alternative\n", line_number, an->st.names[sym]);
+            continue;
+        }
+        intvec_push(&touched, found);
+        remove_editable_alt(an, found);
+        report->removed++;
+    }
+    free(body.items);
+
+    if (rebuild) {
+        incremental_rebuild(an);
+        report->rebuilt = 1;
+    } else {
+        node_set_clear(&an->edited);
+        node_set_add(&an->edited, v);
+        reanalyze(an, &an->edited, &touched, 0, report);
+    }
+    free(touched.items);
+    arena_reset(&an->scratch);
+    return 1;
+}
+
+// Logs the grammar, sets and table as they stand after the edits, in the
+// layout of a full run, and returns the table. Columns are renumbered the way
+// collect_terminals numbers them, so the result is what a fresh analysis of
+// the edited grammar gives.
+LL1Table export_incremental(LogWriter* log, IncrementalAnalysis* an, Arena* scratch) {
+    int prod_count;
+    Production* productions = incremental_productions(an, &prod_count, scratch);
+    const SymbolTable* st = &an->st;
+    log_grammar(log, productions, prod_count, st, "After Edits");
+    int term_count;
+    int* term_column;
+    int* terminals = collect_terminals(productions, prod_count, &an->st, &term_count, &term_column);
+    int* column = arena_alloc(scratch, an->term_count * sizeof(int));
+    for (int c = 0; c < an->term_count; c++) column[c] = term_column[an->terminals[c]];
+
+    const char* labels[2] = {"First", "Follow"};
+    const SetEquations* eqs[2] = {&an->first, &an->follow};
+    BitMatrix sets = bitmatrix_new(scratch, prod_count, term_count);
+    for (int s = 0; s < 2; s++) {
+        for (int v = 0; v < prod_count; v++) {
+            uint64_t* row = bitset_row(&sets, v);
+            memset(row, 0, sets.words * sizeof(uint64_t));
+            const uint64_t* source = bitset_row(&eqs[s]->sets, v);
+            for (int c = bitset_next(source, eqs[s]->sets.words, 0); c != -1; c = bitset_next(source, eqs[s]->sets.words, c + 1)) bitset_add(row, column[c]);
+        }
+        log_sets(log, labels[s], &sets, terminals, term_count, st);
+    }
+
+    // Alternatives are numbered production by production, as in a full run
+    int* global = arena_alloc(scratch, (an->alt_count > 0 ? an->alt_count : 1) * sizeof(int));
+    int entry_count = 0;
+    for (int v = 0, g = 0; v < prod_count; v++) {
+        for (int i = 0; i < an->node_alts[v].count; i++) global[an->node_alts[v].items[i]] = g++;
+        entry_count += an->rows[v].count / 2;
+    }
+    int* row_start = arena_alloc(scratch, (prod_count + 1) * sizeof(int));
+    int* entry_col = arena_alloc(scratch, (entry_count > 0 ? entry_count : 1) * sizeof(int));
+    int* entry_alt = arena_alloc(scratch, (entry_count > 0 ? entry_count : 1) * sizeof(int));
+    for (int v = 0, n = 0; v < prod_count; v++) {
+        row_start[v] = n;
+        for (int e = 0; e < an->rows[v].count; e += 2, n++) {
+            entry_col[n] = column[an->rows[v].items[e]];
+            entry_alt[n] = global[an->rows[v].items[e + 1]];
+        }
+    }
+    row_start[prod_count] = entry_count;
+    int* conflict_start = arena_alloc(scratch, (prod_count + 1) * sizeof(int));
+    int* conflict_pairs = arena_alloc(scratch, (an->conflicts > 0 ? 2 * an->conflicts : 1) * sizeof(int));
+    for (int v = 0, n = 0; v < prod_count; v++) {
+        conflict_start[v] = n / 2;
+        for (int e = 0; e < an->row_conflicts[v].count; e += 2, n += 2) {
+            conflict_pairs[n] = column[an->row_conflicts[v].items[e]];
+            conflict_pairs[n + 1] = global[an->row_conflicts[v].items[e + 1]];
+        }
+    }
+    conflict_start[prod_count] = an->conflicts;
+    if (an->conflicts) {
+        fprintf(messages, "Warning: Grammar is not LL(1) due to conflicts.\n");
+    }
+    LL1Table table = pack_ll1_table(productions, prod_count, st, terminals, term_column, term_count, row_start, entry_col, entry_alt, conflict_start, conflict_pairs, scratch);
+    log_table(log, &table);
+    return table;
+}
+
+// Loads the grammar into the engine, applies the edits of edit_file ("-" for
+// standard input) one line at a time and reports the cost of each
+LL1Table run_incremental(LogWriter* log, Production* productions, int prod_count, const SymbolTable* st, const char* edit_file, Arena* scratch, int* nt_count) {
+    IncrementalAnalysis an;
+    double start = now_seconds();
+    incremental_init(&an, productions, prod_count, st);
+    fprintf(messages, "Incremental analysis: %d nonterminals, %d alternatives, %d terminals in %.3f ms\n",
+            an.node_count, an.alt_count, an.term_count, (now_seconds() - start) * 1e3);
+
+    FILE* edits = strcmp(edit_file, "-") == 0 ? stdin : fopen(edit_file, "r");
+    if (!edits) {
+        printf("Error opening %s\n", edit_file);
+        exit(1);
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0, edit_count = 0;
+    double total = 0, slowest = 0;
+    while (getline(&line, &line_capacity, edits) != -1) {
+        line_number++;
+        EditReport report;
+        double begin = now_seconds();
+        if (!apply_edit(&an, line, line_number, &report)) continue;
+        double seconds = now_seconds() - begin;
+        edit_count++;
+        total += seconds;
+        if (seconds > slowest) slowest = seconds;
+        fprintf(messages, "Edit at line %d: +%d -%d alternatives%s, changed nullable %d, FIRST %d, FOLLOW %d; %d rows, %d cells patched; %d conflicts; %.1f us\n",
+                line_number, report.added, report.removed, report.rebuilt ? " (rebuilt)" : "", report.nullable_changed, report.first_changed,
+                report.follow_changed, report.rows, report.cells, an.conflicts, seconds * 1e6);
+    }
+    free(line);
+    if (edits != stdin) fclose(edits);
+    if (edit_count > 0) {
+        fprintf(messages, "Incremental: %d edits, mean %.1f us, max %.1f us\n", edit_count, total / edit_count * 1e6, slowest * 1e6);
+    }
+
+    LL1Table table = export_incremental(log, &an, scratch);
+    *nt_count = an.node_count;
+    incremental_free(&an);
+    return table;
+}
+
+// Analysis cache (--cache DIR). An entry holds everything a full LL(1) run logs
+// after the original grammar: the grammar after each rewriting pass, the final
+// symbols and terminal columns, the FIRST/FOLLOW sets, the messages the stages
+// printed and the table block. Entries are named by a 128-bit hash of the
+// normalized grammar, so formatting and comments do not matter, and bumping
+// CFG_CACHE_VERSION retires every entry when the analysis changes. A writer
+// fills a temporary file and renames it into place, so processes sharing a
+// directory only ever see complete entries; a damaged or foreign entry fails
+// its checksum and is treated as a miss.
+#define CFG_CACHE_MAGIC "CFGC"
+#define CFG_CACHE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t key[2];
+    uint64_t checksum;
+    uint64_t payload_size;
+} CacheHeader;
+
+// Finalizer of splitmix64, so the two halves of a key do not move together
+uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// The key of a grammar: its productions and %token patterns as text, one
+// production per line with single spaces, plus the cache and table versions
+void cache_key(const Production* productions, int prod_count, const SymbolTable* st, uint64_t key[2]) {
+    char* text;
+    size_t len;
+    FILE* out = open_memstream(&text, &len);
+    fprintf(out, "cfg cache %d table %d\n", CFG_CACHE_VERSION, LL1_TABLE_VERSION);
+    for (int s = 0; s < st->count; s++) {
+        if (st->patterns[s]) fprintf(out, "%%token %s %s\n", st->names[s], st->patterns[s]);
+    }
+    for (int i = 0; i < prod_count; i++) {
+        fprintf(out, "%s ->", st->names[productions[i].lhs]);
+        for (int j = 0; j < productions[i].rhs_count; j++) {
+            fprintf(out, j ? " |" : "");
+            if (alt_len(&productions[i], j) == 0) fprintf(out, " ε");
+            for (int k = 0; k < alt_len(&productions[i], j); k++) fprintf(out, " %s", st->names[alt_syms(&productions[i], j)[k]]);
+        }
+        fprintf(out, "\n");
+    }
+    fclose(out);
+    key[0] = mix64(hash_bytes64(14695981039346656037ULL, text, len));
+    key[1] = mix64(hash_bytes64(0x6a09e667f3bcc908ULL ^ len, text, len));
+    free(text);
+}
+
+char* cache_entry_path(const char* dir, const uint64_t key[2]) {
+    char* path = malloc(strlen(dir) + 40);
+    sprintf(path, "%s/%016llx%016llx.cfgc", dir, (unsigned long long)key[0], (unsigned long long)key[1]);
+    return path;
+}
+
+void cache_write_ints(FILE* out, const int* v, int n) {
+    int32_t buffer[256];
+    for (int i = 0; i < n; i += 256) {
+        int m = n - i < 256 ? n - i : 256;
+        for (int k = 0; k < m; k++) buffer[k] = v[i + k];
+        fwrite(buffer, sizeof(int32_t), m, out);
+    }
+}
+
+void cache_write_int(FILE* out, int v) {
+    cache_write_ints(out, &v, 1);
+}
+
+void cache_write_grammar(FILE* out, const Production* productions, int prod_count) {
+    cache_write_int(out, prod_count);
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        cache_write_int(out, p->lhs);
+        cache_write_int(out, p->rhs_count);
+        cache_write_ints(out, p->alt_start, p->rhs_count + 1);
+        cache_write_ints(out, p->syms, p->alt_start[p->rhs_count]);
+    }
+}
+
+// Adds the final symbols, columns, sets, messages and table after the two
+// grammars already in payload, and moves the entry into place
+int write_cache_entry(const char* path, const uint64_t key[2], FILE* payload, char** payload_data, size_t* payload_size, const SymbolTable* st,
+                       const int* terminals, int term_count, const BitMatrix* first_sets, const BitMatrix* follow_sets, const char* stage_messages,
+                       size_t message_len, const LL1Table* table) {
+    cache_write_int(payload, st->count);
+    for (int s = 0; s < st->count; s++) {
+        int len = strlen(st->names[s]);
+        cache_write_int(payload, len);
+        fwrite(st->names[s], 1, len, payload);
+        len = st->patterns[s] ? (int)strlen(st->patterns[s]) : -1;
+        cache_write_int(payload, len);
+        if (len > 0) fwrite(st->patterns[s], 1, len, payload);
+    }
+    cache_write_int(payload, st->nt_count);
+    cache_write_ints(payload, st->nts, st->nt_count);
+    cache_write_int(payload, term_count);
+    cache_write_ints(payload, terminals, term_count);
+    fwrite(first_sets->bits, sizeof(uint64_t), (size_t)st->nt_count * first_sets->words, payload);
+    fwrite(follow_sets->bits, sizeof(uint64_t), (size_t)st->nt_count * follow_sets->words, payload);
+    cache_write_int(payload, message_len);
+    fwrite(stage_messages, 1, message_len, payload);
+    cache_write_int(payload, table->conflicts);
+    fwrite(table->header, 1, table->header->total_size, payload);
+    fclose(payload);
+
+    CacheHeader h = {0};
+    memcpy(h.magic, CFG_CACHE_MAGIC, 4);
+    h.version = CFG_CACHE_VERSION;
+    h.key[0] = key[0];
+    h.key[1] = key[1];
+    h.payload_size = *payload_size;
+    h.checksum = hash_bytes64(14695981039346656037ULL, *payload_data, *payload_size);
+    char* temp = malloc(strlen(path) + 8);
+    sprintf(temp, "%s.XXXXXX", path);
+    int fd = mkstemp(temp);
+    if (fd >= 0) fchmod(fd, 0644);
+    FILE* out = fd < 0 ? NULL : fdopen(fd, "wb");
+    int ok = out && fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(*payload_data, 1, *payload_size, out) == *payload_size;
+    if (out && fclose(out) != 0) ok = 0;
+    if (ok && rename(temp, path) != 0) ok = 0;
+    if (!ok && fd >= 0) unlink(temp);
+    free(temp);
+    free(*payload_data);
+    return ok ? 0 : -1;
+}
+
+// Reads a cache entry back without ever leaving its bounds
+typedef struct {
+    const char* p;
+    const char* end;
+    int ok;
+} CacheReader;
+
+const void* cache_read_bytes(CacheReader* r, long len) {
+    if (!r->ok || len < 0 || r->end - r->p < len) {
+        r->ok = 0;
+        return NULL;
+    }
+    const void* bytes = r->p;
+    r->p += len;
+    return bytes;
+}
+
+int cache_read_int(CacheReader* r) {
+    const void* bytes = cache_read_bytes(r, sizeof(int32_t));
+    int32_t v = 0;
+    if (bytes) memcpy(&v, bytes, sizeof(v));
+    return v;
+}
+
+// Counts read from an entry are checked against what is left of it before
+// anything is allocated for them
+int* cache_read_ints(CacheReader* r, int n, Arena* arena) {
+    if (n < 0 || (size_t)(r->end - r->p) / sizeof(int32_t) < (size_t)n) r->ok = 0;
+    if (!r->ok) return NULL;
+    int* v = arena_alloc(arena, (n > 0 ? n : 1) * sizeof(int));
+    const char* bytes = cache_read_bytes(r, n * sizeof(int32_t));
+    for (int i = 0; i < n; i++) {
+        int32_t x;
+        memcpy(&x, bytes + i * sizeof(int32_t), sizeof(x));
+        v[i] = x;
+    }
+    return v;
+}
+
+Production* cache_read_grammar(CacheReader* r, int* prod_count, Arena* arena) {
+    *prod_count = cache_read_int(r);
+    if (*prod_count < 0 || (size_t)*prod_count > (size_t)(r->end - r->p)) r->ok = 0;
+    if (!r->ok) return NULL;
+    Production* productions = arena_alloc(arena, (*prod_count > 0 ? *prod_count : 1) * sizeof(Production));
+    for (int i = 0; i < *prod_count && r->ok; i++) {
+        Production* p = &productions[i];
+        p->lhs = cache_read_int(r);
+        p->rhs_count = cache_read_int(r);
+        p->alt_start = cache_read_ints(r, p->rhs_count + 1, arena);
+        if (!r->ok || p->alt_start[0] != 0) {
+            r->ok = 0;
+            break;
+        }
+        for (int j = 0; j < p->rhs_count; j++) {
+            if (p->alt_start[j + 1] < p->alt_start[j]) r->ok = 0;
+        }
+        p->syms = cache_read_ints(r, r->ok ? p->alt_start[p->rhs_count] : -1, arena);
+    }
+    return productions;
+}
+
+// A run's results as read from the cache, allocated from the run arena except
+// for the table, which owns its block
+typedef struct {
+    Production* factored;
+    int factored_count;
+    Production* productions;
+    int prod_count;
+    SymbolTable st;
+    int* terminals;
+    int term_count;
+    BitMatrix first_sets;
+    BitMatrix follow_sets;
+    char* messages;
+    int message_len;
+    LL1Table table;
+} CachedAnalysis;
+
+int grammar_symbols_valid(const Production* productions, int prod_count, const SymbolTable* st) {
+    for (int i = 0; i < prod_count; i++) {
+        const Production* p = &productions[i];
+        if (p->lhs < 0 || p->lhs >= st->count || st->nt_index[p->lhs] == -1) return 0;
+        for (int k = 0; k < p->alt_start[p->rhs_count]; k++) {
+            if (p->syms[k] < 0 || p->syms[k] >= st->count) return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns 0 on a hit. A missing, damaged or mismatching entry is a miss.
+int load_cache_entry(const char* path, const uint64_t key[2], CachedAnalysis* c, Arena* arena) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+    const CacheHeader* h = map;
+    const char* payload = (const char*)map + sizeof(CacheHeader);
+    if (memcmp(h->magic, CFG_CACHE_MAGIC, 4) != 0 || h->version != CFG_CACHE_VERSION || h->key[0] != key[0] || h->key[1] != key[1] ||
+        h->payload_size != sb.st_size - sizeof(CacheHeader) || h->checksum != hash_bytes64(14695981039346656037ULL, payload, h->payload_size)) {
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    CacheReader r = {payload, payload + h->payload_size, 1};
+    c->factored = cache_read_grammar(&r, &c->factored_count, arena);
+    c->productions = cache_read_grammar(&r, &c->prod_count, arena);
+    int symbol_count = cache_read_int(&r);
+    if (symbol_count < 0 || (size_t)symbol_count > (size_t)(r.end - r.p)) r.ok = 0;
+    symtab_init(&c->st, arena);
+    for (int s = 0; s < symbol_count && r.ok; s++) {
+        int len = cache_read_int(&r);
+        const char* name = cache_read_bytes(&r, len);
+        if (!r.ok || find_symbol_n(&c->st, name, len) != -1) {
+            r.ok = 0;
+            break;
+        }
+        intern_symbol_n(&c->st, name, len);
+        len = cache_read_int(&r);
+        if (len < 0) continue;
+        const char* pattern = cache_read_bytes(&r, len);
+        if (r.ok) c->st.patterns[s] = arena_strndup(arena, pattern, len);
+    }
+    int nt_count = cache_read_int(&r);
+    int* nts = cache_read_ints(&r, nt_count, arena);
+    for (int a = 0; a < nt_count && r.ok; a++) {
+        if (nts[a] < 0 || nts[a] >= c->st.count || c->st.nt_index[nts[a]] != -1) r.ok = 0;
+        else add_nonterminal(&c->st, nts[a]);
+    }
+    c->term_count = cache_read_int(&r);
+    c->terminals = cache_read_ints(&r, c->term_count, arena);
+    for (int t = 0; t < c->term_count && r.ok; t++) {
+        if (c->terminals[t] < 0 || c->terminals[t] >= c->st.count) r.ok = 0;
+    }
+    if (r.ok && (!grammar_symbols_valid(c->factored, c->factored_count, &c->st) || !grammar_symbols_valid(c->productions, c->prod_count, &c->st))) r.ok = 0;
+    if (r.ok) {
+        c->first_sets = bitmatrix_new(arena, nt_count, c->term_count);
+        c->follow_sets = bitmatrix_new(arena, nt_count, c->term_count);
+        size_t set_bytes = (size_t)nt_count * c->first_sets.words * sizeof(uint64_t);
+        const void* first = cache_read_bytes(&r, set_bytes);
+        const void* follow = cache_read_bytes(&r, set_bytes);
+        if (r.ok) {
+            memcpy(c->first_sets.bits, first, set_bytes);
+            memcpy(c->follow_sets.bits, follow, set_bytes);
+        }
+    }
+    c->message_len = cache_read_int(&r);
+    const char* text = cache_read_bytes(&r, c->message_len);
+    if (r.ok) c->messages = arena_strndup(arena, text, c->message_len);
+    int conflicts = cache_read_int(&r);
+    const void* table_block = cache_read_bytes(&r, sizeof(LL1TableHeader));
+    LL1TableHeader th;
+    if (r.ok) memcpy(&th, table_block, sizeof(th));
+    if (r.ok && (memcmp(th.magic, LL1_TABLE_MAGIC, 4) != 0 || th.version != LL1_TABLE_VERSION || th.total_size != (size_t)(r.end - r.p) + sizeof(LL1TableHeader) ||
+                 th.nt_count != (uint32_t)nt_count || th.term_count != (uint32_t)c->term_count)) {
+        r.ok = 0;
+    }
+    if (!r.ok) {
+        symtab_free(&c->st);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+    void* block = malloc(th.total_size);
+    memcpy(block, table_block, th.total_size);
+    if (!ll1_table_valid(block, th.total_size)) {
+        free(block);
+        symtab_free(&c->st);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+    ll1_table_bind(&c->table, block, 0);
+    c->table.conflicts = conflicts;
+    munmap(map, sb.st_size);
+    return 0;
+}
+
+// Logs a cached run the way a fresh one is logged
+void log_cached_analysis(LogWriter* log, CachedAnalysis* c) {
+    log_grammar(log, c->factored, c->factored_count, &c->st, "After Left Factoring");
+    log_grammar(log, c->productions, c->prod_count, &c->st, "After Left Recursion Removal");
+    log_sets(log, "First", &c->first_sets, c->terminals, c->term_count, &c->st);
+    log_sets(log, "Follow", &c->follow_sets, c->terminals, c->term_count, &c->st);
+    log_table(log, &c->table);
+}
+
+// What one run of the pipeline does besides writing the log; the table
+// outputs and the token parse are only offered for a single grammar
+typedef struct {
+    const char* grammar_file;
+    const char* log_file;
+    const LogFormat* log_format;
+    int use_lalr;
+    int reduce;
+    const char* emit_table;
+    const char* gen_parser;
+    const char* token_file;
+    const char* forest_file;
+    const char* edit_file;
+    const char* cache_dir;
+    int messages_in_log;
+} RunOptions;
+
+// Conflicts found and the wall time of one grammar, for the batch summary;
+// failed is set, with the message in error, when the grammar did not parse
+typedef struct {
+    int conflicts;
+    int nonterminals;
+    double seconds;
+    int failed;
+    char error[GRAMMAR_ERROR_SIZE];
+} RunResult;
+
+// Saves, compiles and runs the LL(1) table as the options ask
+void use_ll1_table(const RunOptions* opt, const LL1Table* table) {
+    if (opt->emit_table && save_ll1_table(table, opt->emit_table) != 0) {
+        printf("Error writing table %s\n", opt->emit_table);
+        exit(1);
+    }
+
+    if (opt->gen_parser) write_generated_parser(table, opt->gen_parser);
+
+    // Step 7: Optionally run the predictive parser over a token stream
+    if (opt->token_file) run_token_parse(table, NULL, opt->token_file, opt->forest_file);
+}
+
+// Runs the whole pipeline over one grammar. All state lives in the run's own
+// arenas and symbol table, so grammars can be processed on several threads
+RunResult process_grammar(const RunOptions* opt) {
+    RunResult result = {0};
+    double start = now_seconds();
+#ifdef CFG_METRICS
+    metrics = (Metrics){0};
+#endif
+    Arena run_arena, scratch;
+    arena_init(&run_arena, 1 << 20);
+    arena_init(&scratch, 1 << 16);
+    StageMemory stages[6];
+    int stage_count = 0;
+    int prod_count;
+    SymbolTable symbols;
+    symtab_init(&symbols, &run_arena);
+
+    // Open output log file
+    FILE* fp = fopen(opt->log_file, "w");
+    if (!fp) {
+        printf("Error opening %s\n", opt->log_file);
+        exit(1);
+    }
+    LogWriter log;
+    log_open(&log, fp, opt->log_format);
+    if (opt->messages_in_log) messages = log_messages_stream(&log);
+
+    // Step 1: Parse and log original grammar
+    Production* productions = parse_grammar(opt->grammar_file, &prod_count, &symbols, &scratch, result.error);
+    if (!productions) {
+        // The error ends this grammar's log; other grammars of a batch go on
+        fprintf(messages, "%s\n", result.error);
+        result.failed = 1;
+        symtab_free(&symbols);
+        arena_free(&scratch);
+        arena_free(&run_arena);
+        log_close(&log);
+        result.seconds = now_seconds() - start;
+        return result;
+    }
+    log_grammar(&log, productions, prod_count, &symbols, "Original Grammar");
+    end_stage(stages, &stage_count, "parse", &run_arena, &scratch);
+
+    // With --reduce useless symbols go and equivalent nonterminals merge
+    // before anything else looks at the grammar, the cache key included
+    if (opt->reduce) {
+        reduce_grammar(&productions, &prod_count, &symbols, &scratch);
+        log_grammar(&log, productions, prod_count, &symbols, "Reduced Grammar");
+        end_stage(stages, &stage_count, "reduce", &run_arena, &scratch);
+    }
+
+    // With --lalr the grammar is used as written: LALR(1) tables replace the
+    // rewriting passes, the sets and the LL(1) table
+    if (opt->use_lalr) {
+        // Without a start symbol there is no augmented rule, so an empty grammar gets no table
+        if (symbols.nt_count == 0) {
+            fprintf(messages, "Warning: %s has no productions; no LALR(1) table is built\n", opt->grammar_file);
+            free_grammar(productions, &symbols);
+            arena_free(&scratch);
+            arena_free(&run_arena);
+            log_close(&log);
+            result.seconds = now_seconds() - start;
+            return result;
+        }
+        int term_count;
+        int* term_column;
+        int* terminals = collect_terminals(productions, prod_count, &symbols, &term_count, &term_column);
+        SolverStats stats = {0};
+        int* nullable = compute_nullable(productions, prod_count, &symbols, &scratch, &stats);
+        LalrTable lalr_table = construct_lalr_table(productions, prod_count, &symbols, terminals, term_column, term_count, nullable, &run_arena, &scratch);
+        log_lalr(&log, &lalr_table, productions, prod_count, &symbols);
+        end_stage(stages, &stage_count, "lalr", &run_arena, &scratch);
+        fprintf(messages, "LALR(1) table: %d states, %d rules, ACTION %d slots, GOTO %d slots\n",
+                lalr_table.state_count, lalr_table.rule_count, lalr_table.action_slots, lalr_table.goto_slots);
+        print_stage_memory(messages, stages, stage_count);
+#ifdef CFG_METRICS
+        write_metrics_report(opt->log_file, opt->grammar_file, start, stages, stage_count, productions, prod_count, &symbols, &stats, nullable,
+                             NULL, NULL, NULL, &lalr_table);
+#endif
+        if (opt->token_file) run_token_parse(NULL, &lalr_table, opt->token_file, NULL);
+        result.conflicts = lalr_table.conflicts;
+        result.nonterminals = symbols.nt_count;
+        free_grammar(productions, &symbols);
+        arena_free(&scratch);
+        arena_free(&run_arena);
+        log_close(&log);
+        result.seconds = now_seconds() - start;
+        return result;
+    }
+
+    // With --incremental the grammar is used as written as well: the edits are
+    // applied to a resident analysis, and the final state is logged
+    if (opt->edit_file) {
+        LL1Table ll1_table = run_incremental(&log, productions, prod_count, &symbols, opt->edit_file, &scratch, &result.nonterminals);
+        end_stage(stages, &stage_count, "incremental", &run_arena, &scratch);
+        print_stage_memory(messages, stages, stage_count);
+        use_ll1_table(opt, &ll1_table);
+        result.conflicts = ll1_table.conflicts;
+        free_ll1_table(&ll1_table);
+        free_grammar(productions, &symbols);
+        arena_free(&scratch);
+        arena_free(&run_arena);
+        log_close(&log);
+        result.seconds = now_seconds() - start;
+        return result;
+    }
+
+    // With --cache a grammar analysed before is read back instead. On a miss,
+    // the stages' messages are held back until the entry has been written
+    char* cache_path = NULL;
+    uint64_t key[2];
+    FILE* stage_messages = messages;
+    FILE* payload = NULL;
+    char *captured = NULL, *payload_data = NULL;
+    size_t captured_len = 0, payload_size = 0;
+    if (opt->cache_dir) {
+        cache_key(productions, prod_count, &symbols, key);
+        cache_path = cache_entry_path(opt->cache_dir, key);
+        CachedAnalysis cached;
+        if (load_cache_entry(cache_path, key, &cached, &run_arena) == 0) {
+            log_cached_analysis(&log, &cached);
+            end_stage(stages, &stage_count, "cache", &run_arena, &scratch);
+            fputs(cached.messages, messages);
+            fprintf(messages, "Analysis read from cache %s\n", cache_path);
+            print_stage_memory(messages, stages, stage_count);
+            use_ll1_table(opt, &cached.table);
+            result.conflicts = cached.table.conflicts;
+            result.nonterminals = cached.st.nt_count;
+            free_ll1_table(&cached.table);
+            symtab_free(&cached.st);
+            free(cache_path);
+            free_grammar(productions, &symbols);
+            arena_free(&scratch);
+            arena_free(&run_arena);
+            log_close(&log);
+            result.seconds = now_seconds() - start;
+            return result;
+        }
+        messages = open_memstream(&captured, &captured_len);
+        payload = open_memstream(&payload_data, &payload_size);
+    }
+
+    // Step 2: Apply left factoring and log result
+    left_factoring(&productions, &prod_count, &symbols, &scratch);
+    log_grammar(&log, productions, prod_count, &symbols, "After Left Factoring");
+    if (payload) cache_write_grammar(payload, productions, prod_count);
+    end_stage(stages, &stage_count, "left factoring", &run_arena, &scratch);
+
+    // Step 3: Apply left recursion removal and log result
+    remove_left_recursion(&productions, &prod_count, &symbols, &scratch);
+    log_grammar(&log, productions, prod_count, &symbols, "After Left Recursion Removal");
+    if (payload) cache_write_grammar(payload, productions, prod_count);
+    end_stage(stages, &stage_count, "left recursion", &run_arena, &scratch);
+
+    // Step 4: Compute and log First Sets; sets are bitsets over the table's terminal columns
+    int nt_count = symbols.nt_count;
+    int term_count;
+    int* term_column;
+    int* terminals = collect_terminals(productions, prod_count, &symbols, &term_count, &term_column);
+    SolverStats stats = {0};
+    int* nullable = compute_nullable(productions, prod_count, &symbols, &scratch, &stats);
+    BitMatrix first_sets = bitmatrix_new(&run_arena, nt_count, term_count);
+    compute_first_sets(productions, prod_count, &symbols, term_column, nullable, &first_sets, &scratch, &stats);
+    log_sets(&log, "First", &first_sets, terminals, term_count, &symbols);
+
+    // Step 5: Compute and log Follow Sets
+    BitMatrix follow_sets = bitmatrix_new(&run_arena, nt_count, term_count);
+    compute_follow_sets(productions, prod_count, &symbols, term_column, nullable, &first_sets, &follow_sets, &scratch, &stats);
+    log_sets(&log, "Follow", &follow_sets, terminals, term_count, &symbols);
+    end_stage(stages, &stage_count, "sets", &run_arena, &scratch);
+
+    // Step 6: Construct and log LL(1) Parsing Table
+    LL1Table ll1_table = construct_ll1_table(productions, prod_count, &symbols, terminals, term_column, term_count, nullable, &first_sets, &follow_sets, &scratch);
+    log_table(&log, &ll1_table);
+    end_stage(stages, &stage_count, "table", &run_arena, &scratch);
+    if (payload) {
+        fclose(messages);
+        messages = stage_messages;
+        fwrite(captured, 1, captured_len, messages);
+        if (write_cache_entry(cache_path, key, payload, &payload_data, &payload_size, &symbols, terminals, term_count, &first_sets, &follow_sets,
+                              captured, captured_len, &ll1_table) == 0) {
+            fprintf(messages, "Analysis written to cache %s\n", cache_path);
+        } else {
+            fprintf(messages, "Warning: could not write cache entry %s\n", cache_path);
+        }
+        free(captured);
+        free(cache_path);
+    }
+    fprintf(messages, "Solver work: nullable %ld visits, FIRST %d SCCs / %ld visits, FOLLOW %d SCCs / %ld visits\n",
+            stats.nullable_visits, stats.first_sccs, stats.first_visits, stats.follow_sccs, stats.follow_visits);
+    print_stage_memory(messages, stages, stage_count);
+#ifdef CFG_METRICS
+    write_metrics_report(opt->log_file, opt->grammar_file, start, stages, stage_count, productions, prod_count, &symbols, &stats, nullable,
+                         &first_sets, &follow_sets, &ll1_table, NULL);
+#endif
+    use_ll1_table(opt, &ll1_table);
+
+    // Clean up
+    result.conflicts = ll1_table.conflicts;
+    result.nonterminals = nt_count;
+    free_ll1_table(&ll1_table);
+    free_grammar(productions, &symbols);
+    arena_free(&scratch);
+    arena_free(&run_arena);
+
+    log_close(&log);
+    result.seconds = now_seconds() - start;
+    return result;
+}
+
+// Batch mode runs the pipeline once per grammar file on a pool of threads.
+// Jobs are sorted largest file first and dealt round-robin onto one deque per
+// worker. A worker takes its next job from the front of its own deque, and
+// when that is empty steals from the back of another's, so a few large
+// grammars never leave the other workers idle. No job is added once the
+// workers start, so a worker that finds every deque empty is done.
+typedef struct {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head;
+    int tail;
+} WorkDeque;
+
+typedef struct {
+    const char** grammar_files;
+    char** log_files;
+    RunResult* results;
+    const LogFormat* log_format;
+    int use_lalr;
+    int reduce;
+    const char* cache_dir;
+    WorkDeque* deques;
+    int worker_count;
+} BatchPool;
+
+typedef struct {
+    BatchPool* pool;
+    int id;
+} BatchWorker;
+
+typedef struct {
+    off_t size;
+    int index;
+} BatchJob;
+
+int take_job(WorkDeque* q, int steal) {
+    int job = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) job = steal ? q->jobs[--q->tail] : q->jobs[q->head++];
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+void* batch_worker(void* arg) {
+    BatchWorker* w = arg;
+    BatchPool* pool = w->pool;
+    for (;;) {
+        int job = take_job(&pool->deques[w->id], 0);
+        for (int k = 1; job == -1 && k < pool->worker_count; k++) {
+            job = take_job(&pool->deques[(w->id + k) % pool->worker_count], 1);
+        }
+        if (job == -1) return NULL;
+        RunOptions opt = {pool->grammar_files[job], pool->log_files[job], pool->log_format, pool->use_lalr, pool->reduce, NULL, NULL, NULL, NULL, NULL, pool->cache_dir, 1};
+        pool->results[job] = process_grammar(&opt);
+    }
+}
+
+int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+int compare_jobs_by_size(const void* a, const void* b) {
+    const BatchJob* x = a;
+    const BatchJob* y = b;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return x->index - y->index;
+}
+
+// Grammar files of a batch: the regular files of a directory in name order, or
+// the paths listed one per line in a file, where # starts a comment
+char** collect_batch_files(const char* source, int* count) {
+    int capacity = 64;
+    char** files = malloc(capacity * sizeof(char*));
+    *count = 0;
+    struct stat info;
+    if (stat(source, &info) != 0) {
+        printf("Error opening %s\n", source);
+        exit(1);
+    }
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(source);
+        if (!dir) {
+            printf("Error opening %s\n", source);
+            exit(1);
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] == '.') continue;
+            char* path = malloc(strlen(source) + strlen(entry->d_name) + 2);
+            sprintf(path, "%s/%s", source, entry->d_name);
+            if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+                free(path);
+                continue;
+            }
+            if (*count == capacity) files = realloc(files, (capacity *= 2) * sizeof(char*));
+            files[(*count)++] = path;
+        }
+        closedir(dir);
+        qsort(files, *count, sizeof(char*), compare_names);
+        return files;
+    }
+    FILE* list = fopen(source, "r");
+    if (!list) {
+        printf("Error opening %s\n", source);
+        exit(1);
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), list)) {
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char* begin = line;
+        while (isspace((unsigned char)*begin)) begin++;
+        char* end = begin + strlen(begin);
+        while (end > begin && isspace((unsigned char)end[-1])) end--;
+        if (end == begin) continue;
+        *end = '\0';
+        if (*count == capacity) files = realloc(files, (capacity *= 2) * sizeof(char*));
+        files[(*count)++] = strdup(begin);
+    }
+    fclose(list);
+    return files;
+}
+
+// Each grammar is logged to <out_dir>/<file name without extension>.log, and
+// its warnings, conflicts and summary lines go into the log where the stages
+// report them. A line per grammar is printed in input order once all are done.
+// Returns the number of grammars that failed to parse.
+int run_batch(const char* source, const char* out_dir, int worker_count, const LogFormat* log_format, int use_lalr, int reduce, const char* cache_dir) {
+    int file_count;
+    char** files = collect_batch_files(source, &file_count);
+    if (file_count == 0) {
+        printf("No grammar files in %s\n", source);
+        exit(1);
+    }
+    if (mkdir(out_dir, 0777) != 0 && errno != EEXIST) {
+        printf("Error creating %s\n", out_dir);
+        exit(1);
+    }
+    char** log_files = malloc(file_count * sizeof(char*));
+    BatchJob* jobs = malloc(file_count * sizeof(BatchJob));
+    for (int i = 0; i < file_count; i++) {
+        const char* name = strrchr(files[i], '/');
+        name = name ? name + 1 : files[i];
+        const char* dot = strrchr(name, '.');
+        int len = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+        log_files[i] = malloc(strlen(out_dir) + len + 6);
+        sprintf(log_files[i], "%s/%.*s.log", out_dir, len, name);
+        for (int j = 0; j < i; j++) {
+            if (strcmp(log_files[i], log_files[j]) == 0) {
+                printf("Error: %s and %s would both be logged to %s\n", files[j], files[i], log_files[i]);
+                exit(1);
+            }
+        }
+        struct stat info;
+        jobs[i].size = stat(files[i], &info) == 0 ? info.st_size : 0;
+        jobs[i].index = i;
+    }
+    qsort(jobs, file_count, sizeof(BatchJob), compare_jobs_by_size);
+
+    if (worker_count > file_count) worker_count = file_count;
+    BatchPool pool = {(const char**)files, log_files, calloc(file_count, sizeof(RunResult)), log_format, use_lalr, reduce, cache_dir,
+                      malloc(worker_count * sizeof(WorkDeque)), worker_count};
+    for (int w = 0; w < worker_count; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].jobs = malloc((file_count / worker_count + 1) * sizeof(int));
+        pool.deques[w].head = pool.deques[w].tail = 0;
+    }
+    for (int i = 0; i < file_count; i++) {
+        WorkDeque* q = &pool.deques[i % worker_count];
+        q->jobs[q->tail++] = jobs[i].index;
+    }
+
+    double start = now_seconds();
+    pthread_t* threads = malloc(worker_count * sizeof(pthread_t));
+    BatchWorker* workers = malloc(worker_count * sizeof(BatchWorker));
+    for (int w = 0; w < worker_count; w++) {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        if (pthread_create(&threads[w], NULL, batch_worker, &workers[w]) != 0) {
+            printf("Error starting worker thread\n");
+            exit(1);
+        }
+    }
+    for (int w = 0; w < worker_count; w++) pthread_join(threads[w], NULL);
+    double seconds = now_seconds() - start;
+
+    int with_conflicts = 0, failed = 0;
+    for (int i = 0; i < file_count; i++) {
+        const RunResult* r = &pool.results[i];
+        if (r->failed) {
+            printf("%s: %s -> %s\n", files[i], r->error, log_files[i]);
+            failed++;
+            continue;
+        }
+        printf("%s: %d nonterminals, %d conflicts, %.1f ms -> %s\n", files[i], r->nonterminals, r->conflicts, r->seconds * 1e3, log_files[i]);
+        with_conflicts += r->conflicts > 0;
+    }
+    printf("Batch: %d grammars on %d threads in %.3f s, %d with conflicts, %d failed\n", file_count, worker_count, seconds, with_conflicts, failed);
+
+    for (int w = 0; w < worker_count; w++) {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].jobs);
+    }
+    for (int i = 0; i < file_count; i++) {
+        free(files[i]);
+        free(log_files[i]);
+    }
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    free(pool.results);
+    free(jobs);
+    free(log_files);
+    free(files);
+    return failed;
+}
+
+// Server mode keeps the analyses of a set of grammars resident and answers
+// requests on a Unix domain socket. One thread runs an epoll loop over
+// non-blocking connections; requests are single lines, answered in order with
+// a single line each, and a client may pipeline as many as it likes:
+//   GRAMMARS                    names of the loaded grammars
+//   PARSE <grammar> <tokens>    runs the LL(1) parser over the rest of the line
+//   FIRST <grammar> <nt>        FIRST set of a nonterminal
+//   FOLLOW <grammar> <nt>       FOLLOW set of a nonterminal
+//   ROW <grammar> <nt>          the nonterminal's LL(1) table row
+//   RELOAD <grammar>            rebuilds the grammar from its file
+// Replies start with OK or ERROR.
+#define SERVE_MAX_REQUEST (1 << 20)
+#define SERVE_READ_CHUNK (1 << 16)
+
+// What requests read of one grammar. A snapshot is never changed once it is
+// published, and each build gets a new version number.
+typedef struct {
+    Arena arena;
+    SymbolTable st;
+    BitMatrix first;
+    BitMatrix follow;
+    LL1Table table;
+    Lexer lexer;
+    long version;
+} GrammarSnapshot;
+
+// A grammar as served: its current snapshot, swapped atomically on reload,
+// and the event loop's parsers, which are rebuilt for a snapshot of a newer
+// version the first time they parse with it
+typedef struct {
+    char* name;
+    char* file;
+    GrammarSnapshot* current;
+    int reload_pending;
+    LL1Parser parser;
+    EarleyParser general;
+    long parser_version;
+    int has_general;
+} ServedGrammar;
+
+typedef struct {
+    char* in;
+    size_t in_len;
+    size_t in_capacity;
+    char* out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_capacity;
+    uint32_t events;
+    int closing;
+} Connection;
+
+volatile sig_atomic_t serve_stopping;
+volatile sig_atomic_t serve_reload_all;
+
+void stop_serving(int sig) {
+    (void)sig;
+    serve_stopping = 1;
+}
+
+void reload_all_grammars(int sig) {
+    (void)sig;
+    serve_reload_all = 1;
+}
+
+long snapshot_versions;
+
+// Runs the LL(1) pipeline without a log and keeps what requests need: the
+// symbols, the sets, the table and its lexer. The file is read once, and a
+// grammar that does not load returns NULL with the message in
+// error[GRAMMAR_ERROR_SIZE], so a bad reload leaves the server running.
+GrammarSnapshot* load_grammar_snapshot(const char* grammar_file, char* error) {
+    size_t size;
+    char* text = read_grammar_file(grammar_file, &size, error);
+    if (!text) return NULL;
+    GrammarSnapshot* g = calloc(1, sizeof(GrammarSnapshot));
+    Arena scratch;
+    arena_init(&g->arena, 1 << 20);
+    arena_init(&scratch, 1 << 16);
+    symtab_init(&g->st, &g->arena);
+    int prod_count;
+    Production* productions = parse_grammar_text(text, size, &prod_count, &g->st, &scratch, error);
+    free(text);
+    if (!productions) {
+        symtab_free(&g->st);
+        arena_free(&g->arena);
+        arena_free(&scratch);
+        free(g);
+        return NULL;
+    }
+    left_factoring(&productions, &prod_count, &g->st, &scratch);
+    remove_left_recursion(&productions, &prod_count, &g->st, &scratch);
+    int term_count;
+    int* term_column;
+    int* terminals = collect_terminals(productions, prod_count, &g->st, &term_count, &term_column);
+    SolverStats stats = {0};
+    int* nullable = compute_nullable(productions, prod_count, &g->st, &scratch, &stats);
+    g->first = bitmatrix_new(&g->arena, g->st.nt_count, term_count);
+    compute_first_sets(productions, prod_count, &g->st, term_column, nullable, &g->first, &scratch, &stats);
+    g->follow = bitmatrix_new(&g->arena, g->st.nt_count, term_count);
+    compute_follow_sets(productions, prod_count, &g->st, term_column, nullable, &g->first, &g->follow, &scratch, &stats);
+    g->table = construct_ll1_table(productions, prod_count, &g->st, terminals, term_column, term_count, nullable, &g->first, &g->follow, &scratch);
+    free(productions);
+    arena_free(&scratch);
+    if (!build_table_lexer(&g->lexer, &g->table, error)) {
+        free_ll1_table(&g->table);
+        symtab_free(&g->st);
+        arena_free(&g->arena);
+        free(g);
+        return NULL;
+    }
+    g->version = __atomic_add_fetch(&snapshot_versions, 1, __ATOMIC_RELAXED);
+    return g;
+}
+
+void free_grammar_snapshot(GrammarSnapshot* g) {
+    free_lexer(&g->lexer);
+    free_ll1_table(&g->table);
+    symtab_free(&g->st);
+    arena_free(&g->arena);
+    free(g);
+}
 
-char* trim(char* str) {
-    while (isspace((unsigned char)*str)) str++;
-    if (*str == '\0') return str;
-    char* end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-    *(end + 1) = '\0';
-    return str;
+void release_served_parsers(ServedGrammar* g) {
+    if (g->parser_version == 0) return;
+    ll1_parser_free(&g->parser);
+    if (g->has_general) earley_parser_free(&g->general);
+    g->parser_version = 0;
 }
 
-char** split_string(char* str, const char* delimiter, int* count) {
-    char** parts = malloc(10 * sizeof(char*));
-    int capacity = 10;
-    int i = 0;
-    char* copy = strdup(str);
-    char* token = strtok(copy, delimiter);
-    while (token != NULL) {
-        if (i >= capacity) {
-            capacity *= 2;
-            parts = realloc(parts, capacity * sizeof(char*));
+void free_served_grammar(ServedGrammar* g) {
+    release_served_parsers(g);
+    free_grammar_snapshot(g->current);
+    free(g->name);
+    free(g->file);
+}
+
+// Snapshots are published RCU-style. Readers load a grammar's current
+// snapshot without locks or counters, and between batches of events announce
+// a quiescent state, in which they hold no snapshot, by copying the global
+// epoch. While blocked waiting for events they are offline (epoch 0). A writer
+// swaps the pointer, advances the epoch and waits until every online reader
+// has announced the new epoch; after that no reader can still see the old
+// snapshot, and it is freed.
+typedef struct {
+    uint64_t epoch;
+} RcuReader;
+
+uint64_t rcu_epoch = 1;
+
+void rcu_quiescent(RcuReader* r) {
+    __atomic_store_n(&r->epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void rcu_offline(RcuReader* r) {
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_SEQ_CST);
+}
+
+void rcu_synchronize(RcuReader* readers, int reader_count) {
+    uint64_t target = __atomic_add_fetch(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < reader_count; i++) {
+        uint64_t seen;
+        while ((seen = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST)) != 0 && seen < target) {
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
         }
-        parts[i++] = strdup(trim(token));
-        token = strtok(NULL, delimiter);
     }
-    *count = i;
-    free(copy);
-    return parts;
 }
 
-char** split_alternative(char* alt, int* count) {
-    return split_string(alt, " ", count);
+// Reloads run on their own thread, one grammar at a time, so the event loop
+// keeps answering with the old snapshot while the new one is built. A grammar
+// that fails to load is reported and the old snapshot stays published.
+typedef struct {
+    ServedGrammar* grammars;
+    int grammar_count;
+    RcuReader* readers;
+    int reader_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stopping;
+} Reloader;
+
+void request_reload(Reloader* r, ServedGrammar* g) {
+    pthread_mutex_lock(&r->lock);
+    g->reload_pending = 1;
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
 }
 
-char* join_symbols(char** symbols, int start, int end) {
-    if (start >= end) return strdup("");
-    int len = 0;
-    for (int i = start; i < end; i++) len += strlen(symbols[i]) + 1;
-    char* result = malloc(len);
-    result[0] = '\0';
-    for (int i = start; i < end; i++) {
-        strcat(result, symbols[i]);
-        if (i < end - 1) strcat(result, " ");
+void* reload_grammars(void* arg) {
+    Reloader* r = arg;
+    messages = stdout;
+    pthread_mutex_lock(&r->lock);
+    while (!r->stopping) {
+        ServedGrammar* g = NULL;
+        for (int i = 0; i < r->grammar_count && !g; i++) {
+            if (r->grammars[i].reload_pending) g = &r->grammars[i];
+        }
+        if (!g) {
+            pthread_cond_wait(&r->wake, &r->lock);
+            continue;
+        }
+        g->reload_pending = 0;
+        pthread_mutex_unlock(&r->lock);
+
+        double start = now_seconds();
+        char error[GRAMMAR_ERROR_SIZE];
+        GrammarSnapshot* fresh = load_grammar_snapshot(g->file, error);
+        if (!fresh) {
+            printf("Reload of %s failed: %s; still serving version %ld\n", g->name, error, g->current->version);
+        } else {
+            GrammarSnapshot* old = __atomic_exchange_n(&g->current, fresh, __ATOMIC_SEQ_CST);
+            double built = now_seconds();
+            rcu_synchronize(r->readers, r->reader_count);
+            printf("Reloaded %s as %s version %ld: %d nonterminals, %d terminals, %d conflicts, %.1f ms; version %ld freed after %.1f ms\n", g->file, g->name,
+                   fresh->version, fresh->st.nt_count, (int)fresh->table.header->term_count, fresh->table.conflicts, (built - start) * 1e3, old->version,
+                   (now_seconds() - built) * 1e3);
+            free_grammar_snapshot(old);
+        }
+        fflush(stdout);
+        pthread_mutex_lock(&r->lock);
     }
-    return result;
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
 }
 
-int is_used(char** used_nt, int used_count, char* name) {
-    for (int i = 0; i < used_count; i++) {
-        if (strcmp(used_nt[i], name) == 0) return 1;
-    }
-    return 0;
+void reserve_bytes(char** buf, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) return;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 4096;
+    *buf = realloc(*buf, *capacity);
 }
 
-char* generate_new_nt(char* base, char** used_nt, int* used_count) {
-    char* candidate = malloc(strlen(base) + 2);
-    sprintf(candidate, "%s'", base);
-    int primes = 1;
-    while (is_used(used_nt, *used_count, candidate)) {
-        free(candidate);
-        candidate = malloc(strlen(base) + primes + 2);
-        sprintf(candidate, "%s", base);
-        for (int i = 0; i <= primes; i++) strcat(candidate, "'");
-        primes++;
-    }
-    used_nt[*used_count] = strdup(candidate);
-    (*used_count)++;
-    return candidate;
+void reply(Connection* c, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    reserve_bytes(&c->out, &c->out_capacity, c->out_len + n + 1);
+    va_start(args, format);
+    vsnprintf(c->out + c->out_len, n + 1, format, args);
+    va_end(args);
+    c->out_len += n;
 }
 
-typedef struct {
-    char** nt_list;
-    int size;
-    int capacity;
-} Queue;
+// Splits the next space-separated word off a request
+const char* request_word(const char** p, const char* end, size_t* len) {
+    while (*p < end && **p == ' ') (*p)++;
+    const char* word = *p;
+    while (*p < end && **p != ' ') (*p)++;
+    *len = *p - word;
+    return word;
+}
 
-void enqueue(Queue* q, char* nt) {
-    if (q->size == q->capacity) {
-        q->capacity *= 2;
-        q->nt_list = realloc(q->nt_list, q->capacity * sizeof(char*));
+void reply_set(Connection* c, const char* label, const GrammarSnapshot* g, const BitMatrix* sets, int a) {
+    const uint64_t* set = bitset_row(sets, a);
+    reply(c, "OK %s(%s) = { ", label, g->st.names[g->st.nts[a]]);
+    int first = 1;
+    for (int t = bitset_next(set, sets->words, 0); t != -1; t = bitset_next(set, sets->words, t + 1)) {
+        reply(c, first ? "%s" : ", %s", ll1_table_name(&g->table, t));
+        first = 0;
     }
-    q->nt_list[q->size++] = strdup(nt);
+    reply(c, " }\n");
 }
 
-char* dequeue(Queue* q) {
-    if (q->size == 0) return NULL;
-    char* nt = q->nt_list[0];
-    for (int i = 0; i < q->size - 1; i++) {
-        q->nt_list[i] = q->nt_list[i + 1];
+void reply_row(Connection* c, const GrammarSnapshot* g, int a) {
+    const LL1Table* t = &g->table;
+    int term_count = t->header->term_count;
+    reply(c, "OK ROW(%s) = { ", ll1_table_name(t, term_count + a));
+    int first = 1;
+    for (int column = 0; column < term_count; column++) {
+        int alt = ll1_table_lookup(t, a, column);
+        if (alt == -1) continue;
+        reply(c, first ? "%s:" : ", %s:", ll1_table_name(t, column));
+        first = 0;
+        int from = t->code_start[alt];
+        int to = t->code_start[alt + 1];
+        if (from == to) reply(c, " ε");
+        for (int k = to - 1; k >= from; k--) {
+            int sym = t->code[k];
+            reply(c, " %s", sym < 0 ? ll1_table_name(t, -sym - 1) : ll1_table_name(t, term_count + sym));
+        }
     }
-    q->size--;
-    return nt;
+    reply(c, " }\n");
 }
 
-Production* parse_grammar(const char* filename, int* prod_count, char*** used_nt, int* used_count) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        printf("Error opening %s\n", filename);
-        exit(1);
+// Parses with the predictive parser, or with the general parser when the
+// grammar's table has conflicts
+void reply_parse(Connection* c, ServedGrammar* served, const GrammarSnapshot* g, const char* p, const char* end) {
+    if (served->parser_version != g->version) {
+        release_served_parsers(served);
+        ll1_parser_init(&served->parser, &g->table);
+        served->has_general = g->table.conflicts > 0;
+        if (served->has_general) earley_parser_init(&served->general, &g->table);
+        served->parser_version = g->version;
     }
-    char line[256];
-    Production* productions = malloc(100 * sizeof(Production));
-    int capacity = 100;
-    *prod_count = 0;
-    *used_nt = malloc(100 * sizeof(char*));
-    int nt_capacity = 100;
-    *used_count = 0;
-    while (fgets(line, sizeof(line), file)) {
-        char* trimmed = trim(line);
-        if (strlen(trimmed) == 0) continue;
-        char* arrow = strstr(trimmed, "->");
-        if (arrow) {
-            *arrow = '\0';
-            char* lhs = strdup(trim(trimmed));
-            char* rhs_str = trim(arrow + 2);
-            int rhs_count;
-            char** rhs = split_string(rhs_str, "|", &rhs_count);
-            if (*prod_count >= capacity) {
-                capacity *= 2;
-                productions = realloc(productions, capacity * sizeof(Production));
-            }
-            productions[*prod_count].lhs = lhs;
-            productions[*prod_count].rhs = rhs;
-            productions[*prod_count].rhs_count = rhs_count;
-            (*prod_count)++;
-            if (!is_used(*used_nt, *used_count, lhs)) {
-                if (*used_count >= nt_capacity) {
-                    nt_capacity *= 2;
-                    *used_nt = realloc(*used_nt, nt_capacity * sizeof(char*));
-                }
-                (*used_nt)[*used_count] = strdup(lhs);
-                (*used_count)++;
-            }
+    int general = served->has_general;
+    TokenSink feed = general ? earley_sink : ll1_sink;
+    void* parser = general ? (void*)&served->general : (void*)&served->parser;
+    if (general) earley_parser_reset(&served->general);
+    else ll1_parser_reset(&served->parser);
+    int status = PARSE_RUNNING;
+    const char* bad = "end of input";
+    int bad_len = (int)strlen(bad);
+    while (status == PARSE_RUNNING) {
+        const char* tok_start;
+        const char* tok_end;
+        int column;
+        int result = lexer_next(&g->lexer, p, end, 1, &tok_start, &tok_end, &column);
+        if (result == LEX_END) break;
+        if (result == LEX_ERROR) column = -1;
+        status = feed(parser, column);
+        if (status == PARSE_ERROR) {
+            bad = tok_start;
+            bad_len = (int)(tok_end - tok_start);
         }
+        p = tok_end;
+    }
+    if (status == PARSE_RUNNING) status = general ? earley_parser_finish(&served->general) : ll1_parser_finish(&served->parser);
+    long position = general ? served->general.position : served->parser.position;
+    if (status == PARSE_ACCEPT) {
+        reply(c, "OK accepted %ld tokens\n", position);
+    } else {
+        reply(c, "OK rejected at token %ld: unexpected %.*s\n", position + 1, bad_len > 64 ? 64 : bad_len, bad);
     }
-    fclose(file);
-    return productions;
 }
 
-void print_grammar(FILE* fp, Production* productions, int prod_count, const char* stage) {
-    fprintf(fp, "%s:\n", stage);
-    for (int i = 0; i < prod_count; i++) {
-        fprintf(fp, "%s -> ", productions[i].lhs);
-        for (int j = 0; j < productions[i].rhs_count; j++) {
-            fprintf(fp, "%s", productions[i].rhs[j]);
-            if (j < productions[i].rhs_count - 1) fprintf(fp, " | ");
-        }
-        fprintf(fp, "\n");
+void serve_request(Connection* c, ServedGrammar* grammars, int grammar_count, Reloader* reloader, const char* p, const char* end) {
+    size_t len;
+    const char* command = request_word(&p, end, &len);
+    if (len == 8 && strncmp(command, "GRAMMARS", len) == 0) {
+        reply(c, "OK");
+        for (int i = 0; i < grammar_count; i++) reply(c, " %s", grammars[i].name);
+        reply(c, "\n");
+        return;
+    }
+    int kind = len == 5 && strncmp(command, "PARSE", len) == 0    ? 0
+               : len == 5 && strncmp(command, "FIRST", len) == 0  ? 1
+               : len == 6 && strncmp(command, "FOLLOW", len) == 0 ? 2
+               : len == 3 && strncmp(command, "ROW", len) == 0    ? 3
+               : len == 6 && strncmp(command, "RELOAD", len) == 0 ? 4
+                                                                  : -1;
+    if (kind == -1) {
+        reply(c, "ERROR unknown request %.*s\n", (int)(len > 64 ? 64 : len), command);
+        return;
+    }
+    const char* name = request_word(&p, end, &len);
+    ServedGrammar* served = NULL;
+    for (int i = 0; i < grammar_count && !served; i++) {
+        if (strlen(grammars[i].name) == len && strncmp(grammars[i].name, name, len) == 0) served = &grammars[i];
+    }
+    if (!served) {
+        reply(c, "ERROR unknown grammar %.*s\n", (int)(len > 64 ? 64 : len), name);
+        return;
+    }
+    if (kind == 4) {
+        request_reload(reloader, served);
+        reply(c, "OK reloading %s\n", served->name);
+        return;
     }
-    fprintf(fp, "\n");
+    // The snapshot stays valid until this thread's next quiescent state
+    const GrammarSnapshot* g = __atomic_load_n(&served->current, __ATOMIC_ACQUIRE);
+    if (kind == 0) {
+        reply_parse(c, served, g, p, end);
+        return;
+    }
+    const char* nt = request_word(&p, end, &len);
+    int sym = find_symbol_n(&g->st, nt, len);
+    if (sym == -1 || is_terminal(sym, &g->st)) {
+        reply(c, "ERROR %.*s is not a nonterminal of %s\n", (int)(len > 64 ? 64 : len), nt, served->name);
+        return;
+    }
+    int a = g->st.nt_index[sym];
+    if (kind == 1) reply_set(c, "FIRST", g, &g->first, a);
+    else if (kind == 2) reply_set(c, "FOLLOW", g, &g->follow, a);
+    else reply_row(c, g, a);
 }
 
-void left_factoring(Production** productions, int* prod_count, char** used_nt, int* used_count) {
-    Queue q = {malloc(100 * sizeof(char*)), 0, 100};
-    for (int i = 0; i < *prod_count; i++) {
-        enqueue(&q, (*productions)[i].lhs);
+// Answers every complete line in the input buffer and keeps the partial tail
+void serve_lines(Connection* c, ServedGrammar* grammars, int grammar_count, Reloader* reloader, long* served) {
+    size_t start = 0;
+    for (;;) {
+        char* newline = memchr(c->in + start, '\n', c->in_len - start);
+        if (!newline) break;
+        const char* end = newline;
+        if (end > c->in + start && end[-1] == '\r') end--;
+        serve_request(c, grammars, grammar_count, reloader, c->in + start, end);
+        (*served)++;
+        start = newline + 1 - c->in;
     }
-    while (q.size > 0) {
-        char* A = dequeue(&q);
-        int idx = -1;
-        for (int i = 0; i < *prod_count; i++) {
-            if (strcmp((*productions)[i].lhs, A) == 0) {
-                idx = i;
-                break;
-            }
-        }
-        if (idx == -1) {
-            free(A);
-            continue;
-        }
-        Production* p = &(*productions)[idx];
-        char** first_symbols = malloc(p->rhs_count * sizeof(char*));
-        int fs_count = 0;
-        for (int j = 0; j < p->rhs_count; j++) {
-            int sym_count;
-            char** symbols = split_alternative(p->rhs[j], &sym_count);
-            if (sym_count > 0) {
-                char* first = symbols[0];
-                if (!is_used(first_symbols, fs_count, first)) {
-                    first_symbols[fs_count++] = strdup(first);
-                }
-            }
-            for (int k = 0; k < sym_count; k++) free(symbols[k]);
-            free(symbols);
-        }
-        char** new_rhs = malloc(p->rhs_count * sizeof(char*));
-        int new_rhs_count = 0;
-        for (int k = 0; k < fs_count; k++) {
-            char* first_symbol = first_symbols[k];
-            char** group_alts = malloc(p->rhs_count * sizeof(char*));
-            int group_count = 0;
-            for (int j = 0; j < p->rhs_count; j++) {
-                int sym_count;
-                char** symbols = split_alternative(p->rhs[j], &sym_count);
-                if (sym_count > 0 && strcmp(symbols[0], first_symbol) == 0) {
-                    group_alts[group_count++] = strdup(p->rhs[j]);
-                }
-                for (int m = 0; m < sym_count; m++) free(symbols[m]);
-                free(symbols);
-            }
-            if (group_count > 1) {
-                char* A_prime = generate_new_nt(A, used_nt, used_count);
-                char** suffixes = malloc(group_count * sizeof(char*));
-                for (int j = 0; j < group_count; j++) {
-                    int sym_count;
-                    char** symbols = split_alternative(group_alts[j], &sym_count);
-                    suffixes[j] = join_symbols(symbols, 1, sym_count);
-                    for (int m = 0; m < sym_count; m++) free(symbols[m]);
-                    free(symbols);
-                }
-                *productions = realloc(*productions, (*prod_count + 1) * sizeof(Production));
-                (*productions)[*prod_count].lhs = strdup(A_prime);
-                (*productions)[*prod_count].rhs = suffixes;
-                (*productions)[*prod_count].rhs_count = group_count;
-                (*prod_count)++;
-                enqueue(&q, A_prime);
-                char* new_alt = malloc(strlen(first_symbol) + strlen(A_prime) + 2);
-                sprintf(new_alt, "%s %s", first_symbol, A_prime);
-                new_rhs[new_rhs_count++] = new_alt;
-            } else if (group_count == 1) {
-                new_rhs[new_rhs_count++] = strdup(group_alts[0]);
-            }
-            for (int j = 0; j < group_count; j++) free(group_alts[j]);
-            free(group_alts);
-        }
-        for (int j = 0; j < p->rhs_count; j++) free(p->rhs[j]);
-        free(p->rhs);
-        p->rhs = new_rhs;
-        p->rhs_count = new_rhs_count;
-        for (int k = 0; k < fs_count; k++) free(first_symbols[k]);
-        free(first_symbols);
-        free(A);
-    }
-    free(q.nt_list);
-}
-
-void remove_left_recursion(Production** productions, int* prod_count, char** used_nt, int* used_count) {
-    for (int i = 0; i < *prod_count; i++) {
-        Production* p = &(*productions)[i];
-        char* A = p->lhs;
-        char** alpha = malloc(p->rhs_count * sizeof(char*));
-        int alpha_count = 0;
-        char** beta = malloc(p->rhs_count * sizeof(char*));
-        int beta_count = 0;
-        for (int j = 0; j < p->rhs_count; j++) {
-            int sym_count;
-            char** symbols = split_alternative(p->rhs[j], &sym_count);
-            if (sym_count > 0 && strcmp(symbols[0], A) == 0) {
-                alpha[alpha_count++] = join_symbols(symbols, 1, sym_count);
-            } else {
-                beta[beta_count++] = strdup(p->rhs[j]);
-            }
-            for (int k = 0; k < sym_count; k++) free(symbols[k]);
-            free(symbols);
-        }
-        if (alpha_count > 0) {
-            char* A_prime = generate_new_nt(A, used_nt, used_count);
-            char** new_A_rhs = malloc(beta_count * sizeof(char*));
-            for (int j = 0; j < beta_count; j++) {
-                new_A_rhs[j] = malloc(strlen(beta[j]) + strlen(A_prime) + 2);
-                sprintf(new_A_rhs[j], "%s %s", beta[j], A_prime);
-            }
-            char** new_A_prime_rhs = malloc((alpha_count + 1) * sizeof(char*));
-            for (int j = 0; j < alpha_count; j++) {
-                new_A_prime_rhs[j] = malloc(strlen(alpha[j]) + strlen(A_prime) + 2);
-                sprintf(new_A_prime_rhs[j], "%s %s", alpha[j], A_prime);
-            }
-            new_A_prime_rhs[alpha_count] = strdup("ε");
-            for (int j = 0; j < p->rhs_count; j++) free(p->rhs[j]);
-            free(p->rhs);
-            p->rhs = new_A_rhs;
-            p->rhs_count = beta_count;
-            *productions = realloc(*productions, (*prod_count + 1) * sizeof(Production));
-            (*productions)[*prod_count].lhs = strdup(A_prime);
-            (*productions)[*prod_count].rhs = new_A_prime_rhs;
-            (*productions)[*prod_count].rhs_count = alpha_count + 1;
-            (*prod_count)++;
-        }
-        for (int j = 0; j < alpha_count; j++) free(alpha[j]);
-        free(alpha);
-        for (int j = 0; j < beta_count; j++) free(beta[j]);
-        free(beta);
+    c->in_len -= start;
+    memmove(c->in, c->in + start, c->in_len);
+    if (c->in_len > SERVE_MAX_REQUEST) {
+        reply(c, "ERROR request longer than %d bytes\n", SERVE_MAX_REQUEST);
+        c->in_len = 0;
+        c->closing = 1;
     }
 }
 
-int get_nt_index(char* nt, char** non_terminals, int nt_count) {
-    for (int i = 0; i < nt_count; i++) {
-        if (strcmp(non_terminals[i], nt) == 0) return i;
+// Returns -1 when the peer has gone away
+int flush_connection(int fd, Connection* c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
     }
-    return -1;
+    c->out_len = c->out_sent = 0;
+    return 0;
 }
 
-int is_nonterminal(char* symbol, char** non_terminals, int nt_count) {
-    return get_nt_index(symbol, non_terminals, nt_count) != -1;
+// A connection stops being read while a reply backlog of a full request size
+// is waiting, so a client that never reads cannot make the server buffer
+// without bound
+int update_interest(int ep, int fd, Connection* c) {
+    size_t pending = c->out_len - c->out_sent;
+    uint32_t events = (!c->closing && pending < SERVE_MAX_REQUEST ? EPOLLIN : 0) | (pending ? EPOLLOUT : 0);
+    if (events == c->events) return 0;
+    struct epoll_event ev = {events, {.fd = fd}};
+    c->events = events;
+    return epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
 }
 
-int is_terminal(char* symbol, char** non_terminals, int nt_count) {
-    return strcmp(symbol, "ε") != 0 && !is_nonterminal(symbol, non_terminals, nt_count);
+void close_connection(int ep, int fd, Connection* c, int* open_count) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    free(c->in);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    (*open_count)--;
 }
 
-void add_to_set(char*** set, int* size, char* element, int capacity) {
-    for (int i = 0; i < *size; i++) {
-        if (strcmp((*set)[i], element) == 0) return;
+int open_server_socket(const char* path) {
+    struct sockaddr_un addr = {0};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        exit(1);
     }
-    if (*size < capacity) {
-        (*set)[*size] = strdup(element);
-        (*size)++;
-    } else {
-        printf("Warning: Set capacity exceeded for element %s\n", element);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // A socket file left by a server that is gone is replaced; a live one is not
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        printf("A server is already listening on %s\n", path);
+        exit(1);
+    }
+    if (probe >= 0) close(probe);
+    unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        printf("Error listening on %s\n", path);
+        exit(1);
     }
+    return fd;
 }
 
-int* compute_nullable(Production* productions, int prod_count, char** non_terminals, int nt_count) {
-    int* nullable = calloc(nt_count, sizeof(int));
-    int changes;
-    do {
-        changes = 0;
-        for (int i = 0; i < prod_count; i++) {
-            Production* p = &productions[i];
-            int A_idx = get_nt_index(p->lhs, non_terminals, nt_count);
-            for (int j = 0; j < p->rhs_count; j++) {
-                char* rhs = p->rhs[j];
-                if (strcmp(rhs, "ε") == 0) {
-                    if (!nullable[A_idx]) {
-                        nullable[A_idx] = 1;
-                        changes = 1;
-                    }
-                } else {
-                    int sym_count;
-                    char** symbols = split_alternative(rhs, &sym_count);
-                    int all_nullable = 1;
-                    for (int k = 0; k < sym_count; k++) {
-                        char* symbol = symbols[k];
-                        if (is_terminal(symbol, non_terminals, nt_count)) {
-                            all_nullable = 0;
-                            break;
-                        } else {
-                            int sym_idx = get_nt_index(symbol, non_terminals, nt_count);
-                            if (!nullable[sym_idx]) {
-                                all_nullable = 0;
-                                break;
-                            }
-                        }
+// Each grammar is served under its file name without extension
+void run_server(const char* socket_path, const char** grammar_files, int grammar_count) {
+    ServedGrammar* grammars = calloc(grammar_count, sizeof(ServedGrammar));
+    for (int i = 0; i < grammar_count; i++) {
+        const char* name = strrchr(grammar_files[i], '/');
+        name = name ? name + 1 : grammar_files[i];
+        const char* dot = strrchr(name, '.');
+        int len = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+        for (int j = 0; j < i; j++) {
+            if ((int)strlen(grammars[j].name) == len && strncmp(grammars[j].name, name, len) == 0) {
+                printf("Error: %s and %s would both be served as %.*s\n", grammar_files[j], grammar_files[i], len, name);
+                exit(1);
+            }
+        }
+        double start = now_seconds();
+        char error[GRAMMAR_ERROR_SIZE];
+        GrammarSnapshot* g = load_grammar_snapshot(grammar_files[i], error);
+        if (!g) {
+            printf("%s\n", error);
+            exit(1);
+        }
+        grammars[i].current = g;
+        grammars[i].name = strndup(name, len);
+        grammars[i].file = strdup(grammar_files[i]);
+        printf("Loaded %s as %s: %d nonterminals, %d terminals, %d conflicts, %.1f ms\n", grammar_files[i], grammars[i].name, g->st.nt_count,
+               (int)g->table.header->term_count, g->table.conflicts, (now_seconds() - start) * 1e3);
+    }
+
+    // The reload thread takes no signals, so they interrupt the event loop
+    RcuReader reader = {0};
+    Reloader reloader = {grammars, grammar_count, &reader, 1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+    pthread_t reload_thread;
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    if (pthread_create(&reload_thread, NULL, reload_grammars, &reloader) != 0) {
+        printf("Error starting the reload thread\n");
+        exit(1);
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    int listener = open_server_socket(socket_path);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {EPOLLIN, {.fd = listener}};
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev) != 0) {
+        printf("Error setting up the event loop\n");
+        exit(1);
+    }
+    struct sigaction action = {0};
+    action.sa_handler = stop_serving;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = reload_all_grammars;
+    sigaction(SIGHUP, &action, NULL);
+    printf("Serving %d grammars on %s\n", grammar_count, socket_path);
+    fflush(stdout);
+
+    int connection_capacity = 64;
+    Connection* connections = calloc(connection_capacity, sizeof(Connection));
+    int open_count = 0;
+    long accepted = 0;
+    long served = 0;
+    struct epoll_event events[256];
+    while (!serve_stopping) {
+        rcu_offline(&reader);
+        int ready = epoll_wait(ep, events, 256, -1);
+        rcu_quiescent(&reader);
+        if (serve_reload_all) {
+            serve_reload_all = 0;
+            for (int i = 0; i < grammar_count; i++) request_reload(&reloader, &grammars[i]);
+        }
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            printf("Error waiting for events\n");
+            exit(1);
+        }
+        for (int e = 0; e < ready; e++) {
+            int fd = events[e].data.fd;
+            if (fd == listener) {
+                int client;
+                while ((client = accept(listener, NULL, NULL)) >= 0) {
+                    fcntl(client, F_SETFL, O_NONBLOCK);
+                    fcntl(client, F_SETFD, FD_CLOEXEC);
+                    if (client >= connection_capacity) {
+                        int old_capacity = connection_capacity;
+                        while (client >= connection_capacity) connection_capacity *= 2;
+                        connections = realloc(connections, connection_capacity * sizeof(Connection));
+                        memset(connections + old_capacity, 0, (connection_capacity - old_capacity) * sizeof(Connection));
                     }
-                    if (all_nullable && !nullable[A_idx]) {
-                        nullable[A_idx] = 1;
-                        changes = 1;
+                    Connection* c = &connections[client];
+                    c->events = EPOLLIN;
+                    struct epoll_event client_ev = {EPOLLIN, {.fd = client}};
+                    if (epoll_ctl(ep, EPOLL_CTL_ADD, client, &client_ev) != 0) {
+                        close(client);
+                        continue;
                     }
-                    for (int k = 0; k < sym_count; k++) free(symbols[k]);
-                    free(symbols);
+                    open_count++;
+                    accepted++;
+                }
+                continue;
+            }
+            Connection* c = &connections[fd];
+            if (!c->events) continue;
+            int gone = (events[e].events & EPOLLERR) != 0;
+            // One read per wakeup: a client sending a long pipeline takes turns
+            // with the others instead of holding the loop
+            if (!gone && (events[e].events & (EPOLLIN | EPOLLHUP)) && !c->closing) {
+                reserve_bytes(&c->in, &c->in_capacity, c->in_len + SERVE_READ_CHUNK);
+                ssize_t n = read(fd, c->in + c->in_len, SERVE_READ_CHUNK);
+                if (n > 0) {
+                    c->in_len += n;
+                    serve_lines(c, grammars, grammar_count, &reloader, &served);
+                } else if (n == 0) {
+                    c->closing = 1;
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    gone = 1;
                 }
             }
+            if (!gone) gone = flush_connection(fd, c) != 0;
+            if (!gone && c->closing && c->out_len == 0) gone = 1;
+            if (!gone) gone = update_interest(ep, fd, c) != 0;
+            if (gone) close_connection(ep, fd, c, &open_count);
         }
-    } while (changes);
-    return nullable;
+    }
+
+    for (int fd = 0; fd < connection_capacity; fd++) {
+        if (connections[fd].events) close_connection(ep, fd, &connections[fd], &open_count);
+    }
+    close(listener);
+    close(ep);
+    unlink(socket_path);
+    rcu_offline(&reader);
+    pthread_mutex_lock(&reloader.lock);
+    reloader.stopping = 1;
+    pthread_cond_signal(&reloader.wake);
+    pthread_mutex_unlock(&reloader.lock);
+    pthread_join(reload_thread, NULL);
+    printf("Server stopped: %ld connections, %ld requests\n", accepted, served);
+    for (int i = 0; i < grammar_count; i++) free_served_grammar(&grammars[i]);
+    free(grammars);
+    free(connections);
 }
 
-void compute_first_sets(FILE* fp, Production* productions, int prod_count, char** non_terminals, int nt_count, int* nullable, char*** first_sets, int* first_sizes, int first_capacity) {
-    int changes;
-    do {
-        changes = 0;
-        for (int i = 0; i < prod_count; i++) {
-            Production* p = &productions[i];
-            int A_idx = get_nt_index(p->lhs, non_terminals, nt_count);
-            for (int j = 0; j < p->rhs_count; j++) {
-                char* rhs = p->rhs[j];
-                if (strcmp(rhs, "ε") == 0) continue;
-                int sym_count;
-                char** symbols = split_alternative(rhs, &sym_count);
-                for (int k = 0; k < sym_count; k++) {
-                    char* symbol = symbols[k];
-                    if (is_terminal(symbol, non_terminals, nt_count)) {
-                        int initial_size = first_sizes[A_idx];
-                        add_to_set(&first_sets[A_idx], &first_sizes[A_idx], symbol, first_capacity);
-                        if (first_sizes[A_idx] > initial_size) changes = 1;
-                        break;
-                    } else {
-                        int sym_idx = get_nt_index(symbol, non_terminals, nt_count);
-                        for (int m = 0; m < first_sizes[sym_idx]; m++) {
-                            int initial_size = first_sizes[A_idx];
-                            add_to_set(&first_sets[A_idx], &first_sizes[A_idx], first_sets[sym_idx][m], first_capacity);
-                            if (first_sizes[A_idx] > initial_size) changes = 1;
-                        }
-                        if (!nullable[sym_idx]) break;
-                    }
-                }
-                for (int k = 0; k < sym_count; k++) free(symbols[k]);
-                free(symbols);
+// Load generator: each client thread holds one connection and sends requests
+// one at a time, waiting for each reply, so the latencies measured are what a
+// client sees from write to reply while all the others are busy too
+typedef struct {
+    const char* socket_path;
+    char** requests;
+    int request_count;
+    int id;
+    long count;
+    double* latencies;
+    long errors;
+} LoadClient;
+
+void* load_client(void* arg) {
+    LoadClient* lc = arg;
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", lc->socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        printf("Error connecting to %s\n", lc->socket_path);
+        exit(1);
+    }
+    size_t capacity = 1 << 16;
+    char* buf = malloc(capacity);
+    size_t len = 0;
+    for (long i = 0; i < lc->count; i++) {
+        const char* request = lc->requests[(lc->id + i) % lc->request_count];
+        size_t request_len = strlen(request);
+        double start = now_seconds();
+        for (size_t sent = 0; sent < request_len;) {
+            ssize_t n = send(fd, request + sent, request_len - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                printf("Error sending to %s\n", lc->socket_path);
+                exit(1);
             }
+            sent += n;
         }
-    } while (changes);
-
-    fprintf(fp, "First Sets:\n");
-    for (int i = 0; i < nt_count; i++) {
-        fprintf(fp, "First(%s) = { ", non_terminals[i]);
-        for (int j = 0; j < first_sizes[i]; j++) {
-            fprintf(fp, "%s", first_sets[i][j]);
-            if (j < first_sizes[i] - 1) fprintf(fp, ", ");
+        char* newline;
+        while (!(newline = memchr(buf, '\n', len))) {
+            if (len == capacity) buf = realloc(buf, capacity *= 2);
+            ssize_t n = read(fd, buf + len, capacity - len);
+            if (n <= 0) {
+                printf("Connection to %s closed\n", lc->socket_path);
+                exit(1);
+            }
+            len += n;
         }
-        fprintf(fp, " }\n");
+        lc->latencies[i] = now_seconds() - start;
+        if (strncmp(buf, "ERROR", 5) == 0) lc->errors++;
+        len -= newline + 1 - buf;
+        memmove(buf, newline + 1, len);
     }
-    fprintf(fp, "\n");
+    free(buf);
+    close(fd);
+    return NULL;
 }
 
-void compute_follow_sets(FILE* fp, Production* productions, int prod_count, char** non_terminals, int nt_count, int* nullable, char*** first_sets, int* first_sizes, char*** follow_sets, int* follow_sizes, int follow_capacity) {
-    int start_idx = 0;
-    add_to_set(&follow_sets[start_idx], &follow_sizes[start_idx], "$", follow_capacity);
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-    int changes;
-    do {
-        changes = 0;
-        for (int i = 0; i < prod_count; i++) {
-            Production* p = &productions[i];
-            int B_idx = get_nt_index(p->lhs, non_terminals, nt_count);
-            for (int j = 0; j < p->rhs_count; j++) {
-                char* rhs = p->rhs[j];
-                if (strcmp(rhs, "ε") == 0) continue;
-                int sym_count;
-                char** symbols = split_alternative(rhs, &sym_count);
-                for (int k = 0; k < sym_count; k++) {
-                    if (is_nonterminal(symbols[k], non_terminals, nt_count)) {
-                        int A_idx = get_nt_index(symbols[k], non_terminals, nt_count);
-                        int beta_nullable = 1;
-                        for (int m = k + 1; m < sym_count; m++) {
-                            char* beta_symbol = symbols[m];
-                            if (is_terminal(beta_symbol, non_terminals, nt_count)) {
-                                int initial_size = follow_sizes[A_idx];
-                                add_to_set(&follow_sets[A_idx], &follow_sizes[A_idx], beta_symbol, follow_capacity);
-                                if (follow_sizes[A_idx] > initial_size) changes = 1;
-                                beta_nullable = 0;
-                                break;
-                            } else {
-                                int beta_idx = get_nt_index(beta_symbol, non_terminals, nt_count);
-                                for (int n = 0; n < first_sizes[beta_idx]; n++) {
-                                    int initial_size = follow_sizes[A_idx];
-                                    add_to_set(&follow_sets[A_idx], &follow_sizes[A_idx], first_sets[beta_idx][n], follow_capacity);
-                                    if (follow_sizes[A_idx] > initial_size) changes = 1;
-                                }
-                                if (!nullable[beta_idx]) {
-                                    beta_nullable = 0;
-                                    break;
-                                }
-                            }
-                        }
-                        if (beta_nullable) {
-                            for (int n = 0; n < follow_sizes[B_idx]; n++) {
-                                int initial_size = follow_sizes[A_idx];
-                                add_to_set(&follow_sets[A_idx], &follow_sizes[A_idx], follow_sets[B_idx][n], follow_capacity);
-                                if (follow_sizes[A_idx] > initial_size) changes = 1;
-                            }
-                        }
-                    }
-                }
-                for (int k = 0; k < sym_count; k++) free(symbols[k]);
-                free(symbols);
-            }
+// Requests are the non-empty lines of the request file, sent round-robin, or
+// GRAMMARS when there is none
+void run_load_test(const char* socket_path, const char* request_file, int client_count, long total) {
+    int request_count = 0;
+    int capacity = 64;
+    char** requests = malloc(capacity * sizeof(char*));
+    if (request_file) {
+        FILE* in = fopen(request_file, "r");
+        if (!in) {
+            printf("Error opening %s\n", request_file);
+            exit(1);
+        }
+        char* line = NULL;
+        size_t line_capacity = 0;
+        ssize_t n;
+        while ((n = getline(&line, &line_capacity, in)) > 0) {
+            while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) n--;
+            if (n == 0) continue;
+            line[n] = '\0';
+            if (request_count == capacity) requests = realloc(requests, (capacity *= 2) * sizeof(char*));
+            requests[request_count] = malloc(n + 2);
+            sprintf(requests[request_count++], "%s\n", line);
         }
-    } while (changes);
+        free(line);
+        fclose(in);
+    }
+    if (request_count == 0) requests[request_count++] = strdup("GRAMMARS\n");
+    if (client_count < 1) client_count = 1;
+    if (total < client_count) total = client_count;
 
-    fprintf(fp, "Follow Sets:\n");
-    for (int i = 0; i < nt_count; i++) {
-        fprintf(fp, "Follow(%s) = { ", non_terminals[i]);
-        for (int j = 0; j < follow_sizes[i]; j++) {
-            fprintf(fp, "%s", follow_sets[i][j]);
-            if (j < follow_sizes[i] - 1) fprintf(fp, ", ");
+    pthread_t* threads = malloc(client_count * sizeof(pthread_t));
+    LoadClient* clients = calloc(client_count, sizeof(LoadClient));
+    double* latencies = malloc(total * sizeof(double));
+    long offset = 0;
+    for (int i = 0; i < client_count; i++) {
+        clients[i] = (LoadClient){socket_path, requests, request_count, i, total / client_count + (i < total % client_count), latencies + offset, 0};
+        offset += clients[i].count;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < client_count; i++) {
+        if (pthread_create(&threads[i], NULL, load_client, &clients[i]) != 0) {
+            printf("Error starting client thread\n");
+            exit(1);
         }
-        fprintf(fp, " }\n");
     }
-    fprintf(fp, "\n");
+    long errors = 0;
+    for (int i = 0; i < client_count; i++) {
+        pthread_join(threads[i], NULL);
+        errors += clients[i].errors;
+    }
+    double seconds = now_seconds() - start;
+
+    qsort(latencies, total, sizeof(double), compare_doubles);
+    printf("Load test: %ld requests from %d clients in %.3f s, %.0f requests/s, %ld errors\n", total, client_count, seconds, total / seconds, errors);
+    printf("Latency (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", latencies[(long)(total * 0.5)] * 1e6, latencies[(long)(total * 0.9)] * 1e6,
+           latencies[(long)(total * 0.99)] * 1e6, latencies[(long)(total * 0.999)] * 1e6, latencies[total - 1] * 1e6);
+
+    for (int i = 0; i < request_count; i++) free(requests[i]);
+    free(requests);
+    free(threads);
+    free(clients);
+    free(latencies);
 }
 
-char** collect_terminals(Production* productions, int prod_count, char** non_terminals, int nt_count, int* term_count) {
-    char** terminals = malloc(100 * sizeof(char*));
-    int capacity = 100;
-    *term_count = 0;
+// Random sentences for load tests (--generate), derived from the grammar as
+// written. The size of a derivation is its tokens plus its expansions, and the
+// smallest size of every nonterminal is computed first (Knuth's generalization
+// of Dijkstra's algorithm). An alternative is chosen only while the smallest
+// completion of the sentence still fits the size limit, so every derivation
+// ends within it; among those, alternatives are picked by weight. %token
+// terminals are written as sample lexemes drawn from the lexer's DFA.
+// Sentences are made in blocks with one seed each, so the output depends on the
+// seed and not on the number of threads.
+#define GENERATE_BLOCK 1024
+#define GENERATE_SAMPLES 64
+#define GENERATE_LEXEME_MAX 16
+#define GENERATE_SIZE_CAP (1LL << 60)
+
+// Alternative id of nonterminal a runs alt_start[a] .. alt_start[a + 1] - 1 and
+// holds code[code_start[id]] .. code[code_start[id + 1] - 1], nonterminals as
+// their index and terminals as -(column + 1). The lexemes of column c are
+// sample[sample_start[c]] .. sample[sample_start[c + 1] - 1].
+typedef struct {
+    int nt_count;
+    int* alt_start;
+    int* code_start;
+    int* code;
+    double* weight;
+    long long* min_size;
+    long long* alt_size;
+    int* sample_start;
+    char** sample;
+    int* sample_len;
+    long sentences;
+    long long max_size;
+    uint64_t seed;
+} SentenceGenerator;
+
+void build_sentence_generator(SentenceGenerator* g, const Production* productions, int prod_count, const SymbolTable* st, const int* term_column, Arena* arena) {
+    int nt_count = st->nt_count;
+    int alt_count = 0, code_count = 0;
+    for (int i = 0; i < prod_count; i++) {
+        alt_count += productions[i].rhs_count;
+        code_count += productions[i].alt_start[productions[i].rhs_count];
+    }
+    g->nt_count = nt_count;
+    g->alt_start = arena_calloc(arena, nt_count + 1, sizeof(int));
+    g->code_start = arena_alloc(arena, (alt_count + 1) * sizeof(int));
+    g->code = arena_alloc(arena, (code_count > 0 ? code_count : 1) * sizeof(int));
+    g->weight = arena_alloc(arena, (alt_count > 0 ? alt_count : 1) * sizeof(double));
+    for (int i = 0; i < prod_count; i++) g->alt_start[st->nt_index[productions[i].lhs] + 1] += productions[i].rhs_count;
+    for (int a = 0; a < nt_count; a++) g->alt_start[a + 1] += g->alt_start[a];
+
+    // Alternatives grouped by nonterminal, in the order they are written
+    int* fill = arena_alloc(arena, (nt_count + 1) * sizeof(int));
+    memcpy(fill, g->alt_start, nt_count * sizeof(int));
+    int* alt_prod = arena_alloc(arena, (alt_count + 1) * sizeof(int));
+    int* alt_index = arena_alloc(arena, (alt_count + 1) * sizeof(int));
     for (int i = 0; i < prod_count; i++) {
         for (int j = 0; j < productions[i].rhs_count; j++) {
-            int sym_count;
-            char** symbols = split_alternative(productions[i].rhs[j], &sym_count);
-            for (int k = 0; k < sym_count; k++) {
-                char* symbol = symbols[k];
-                if (is_terminal(symbol, non_terminals, nt_count)) {
-                    if (!is_used(terminals, *term_count, symbol)) {
-                        if (*term_count >= capacity) {
-                            capacity *= 2;
-                            terminals = realloc(terminals, capacity * sizeof(char*));
-                        }
-                        terminals[*term_count] = strdup(symbol);
-                        (*term_count)++;
-                    }
-                }
-            }
-            for (int k = 0; k < sym_count; k++) free(symbols[k]);
-            free(symbols);
+            int id = fill[st->nt_index[productions[i].lhs]]++;
+            alt_prod[id] = i;
+            alt_index[id] = j;
         }
     }
-    if (!is_used(terminals, *term_count, "$")) {
-        if (*term_count >= capacity) {
-            terminals = realloc(terminals, (capacity + 1) * sizeof(char*));
+    int pos = 0;
+    for (int id = 0; id < alt_count; id++) {
+        const Production* p = &productions[alt_prod[id]];
+        const int* syms = alt_syms(p, alt_index[id]);
+        g->code_start[id] = pos;
+        for (int k = 0; k < alt_len(p, alt_index[id]); k++) {
+            g->code[pos++] = is_terminal(syms[k], st) ? -(term_column[syms[k]] + 1) : st->nt_index[syms[k]];
         }
-        terminals[*term_count] = strdup("$");
-        (*term_count)++;
+        g->weight[id] = 1;
     }
-    return terminals;
+    g->code_start[alt_count] = pos;
 }
 
-void compute_first_alpha(char* alpha, char** non_terminals, int nt_count, int* nullable, char*** first_sets, int* first_sizes, char** first_alpha, int* first_alpha_size, int capacity) {
-    *first_alpha_size = 0;
-    if (strcmp(alpha, "ε") == 0) return;
-    int sym_count;
-    char** symbols = split_alternative(alpha, &sym_count);
-    for (int k = 0; k < sym_count; k++) {
-        char* symbol = symbols[k];
-        if (is_terminal(symbol, non_terminals, nt_count)) {
-            add_to_set(&first_alpha, first_alpha_size, symbol, capacity);
-            break;
-        } else {
-            int sym_idx = get_nt_index(symbol, non_terminals, nt_count);
-            for (int m = 0; m < first_sizes[sym_idx]; m++) {
-                add_to_set(&first_alpha, first_alpha_size, first_sets[sym_idx][m], capacity);
-            }
-            if (!nullable[sym_idx]) break;
-        }
+// Binary heap of (size, nonterminal) pairs, smallest size on top
+typedef struct {
+    long long* size;
+    int* nt;
+    int count;
+} SizeHeap;
+
+void size_heap_push(SizeHeap* h, long long size, int nt) {
+    int i = h->count++;
+    while (i > 0 && h->size[(i - 1) / 2] > size) {
+        h->size[i] = h->size[(i - 1) / 2];
+        h->nt[i] = h->nt[(i - 1) / 2];
+        i = (i - 1) / 2;
     }
-    for (int k = 0; k < sym_count; k++) free(symbols[k]);
-    free(symbols);
+    h->size[i] = size;
+    h->nt[i] = nt;
 }
 
-int is_alpha_nullable(char* alpha, char** non_terminals, int nt_count, int* nullable) {
-    if (strcmp(alpha, "ε") == 0) return 1;
-    int sym_count;
-    char** symbols = split_alternative(alpha, &sym_count);
-    int all_nullable = 1;
-    for (int k = 0; k < sym_count; k++) {
-        if (is_terminal(symbols[k], non_terminals, nt_count)) {
-            all_nullable = 0;
-            break;
-        } else {
-            int sym_idx = get_nt_index(symbols[k], non_terminals, nt_count);
-            if (!nullable[sym_idx]) {
-                all_nullable = 0;
-                break;
+int size_heap_pop(SizeHeap* h, long long* size) {
+    int top = h->nt[0];
+    *size = h->size[0];
+    long long last_size = h->size[--h->count];
+    int last_nt = h->nt[h->count];
+    int i = 0;
+    while (2 * i + 1 < h->count) {
+        int child = 2 * i + 1;
+        if (child + 1 < h->count && h->size[child + 1] < h->size[child]) child++;
+        if (h->size[child] >= last_size) break;
+        h->size[i] = h->size[child];
+        h->nt[i] = h->nt[child];
+        i = child;
+    }
+    h->size[i] = last_size;
+    h->nt[i] = last_nt;
+    return top;
+}
+
+// Smallest derivation size of every nonterminal and alternative; a nonterminal
+// that derives no terminal string keeps GENERATE_SIZE_CAP. Nonterminals are
+// settled in order of size, and each settled one adds its size to the
+// alternatives that use it. A size only enters the heap when it improves on
+// the last, so there are at most as many entries as alternatives.
+void compute_min_sizes(SentenceGenerator* g, Arena* arena, Arena* scratch) {
+    int nt_count = g->nt_count;
+    int alt_count = g->alt_start[nt_count];
+    g->min_size = arena_alloc(arena, (nt_count > 0 ? nt_count : 1) * sizeof(long long));
+    g->alt_size = arena_alloc(arena, (alt_count > 0 ? alt_count : 1) * sizeof(long long));
+    int* alt_lhs = arena_alloc(scratch, (alt_count + 1) * sizeof(int));
+    int* pending = arena_calloc(scratch, alt_count + 1, sizeof(int));
+    int* occ_start = arena_calloc(scratch, nt_count + 1, sizeof(int));
+    for (int a = 0; a < nt_count; a++) {
+        g->min_size[a] = GENERATE_SIZE_CAP;
+        for (int id = g->alt_start[a]; id < g->alt_start[a + 1]; id++) {
+            alt_lhs[id] = a;
+            for (int k = g->code_start[id]; k < g->code_start[id + 1]; k++) {
+                if (g->code[k] >= 0) occ_start[g->code[k] + 1]++;
+            }
+        }
+    }
+    for (int a = 0; a < nt_count; a++) occ_start[a + 1] += occ_start[a];
+    int* occ_alt = arena_alloc(scratch, (occ_start[nt_count] + 1) * sizeof(int));
+    int* occ_fill = arena_alloc(scratch, (nt_count + 1) * sizeof(int));
+    memcpy(occ_fill, occ_start, nt_count * sizeof(int));
+    SizeHeap heap = {arena_alloc(scratch, (alt_count + 1) * sizeof(long long)), arena_alloc(scratch, (alt_count + 1) * sizeof(int)), 0};
+    for (int id = 0; id < alt_count; id++) {
+        g->alt_size[id] = 1;
+        for (int k = g->code_start[id]; k < g->code_start[id + 1]; k++) {
+            if (g->code[k] >= 0) {
+                occ_alt[occ_fill[g->code[k]]++] = id;
+                pending[id]++;
+            } else {
+                g->alt_size[id]++;
+            }
+        }
+        if (pending[id] == 0 && g->alt_size[id] < g->min_size[alt_lhs[id]]) {
+            g->min_size[alt_lhs[id]] = g->alt_size[id];
+            size_heap_push(&heap, g->alt_size[id], alt_lhs[id]);
+        }
+    }
+    char* settled = arena_calloc(scratch, nt_count + 1, 1);
+    while (heap.count > 0) {
+        long long size;
+        int a = size_heap_pop(&heap, &size);
+        if (settled[a] || size != g->min_size[a]) continue;
+        settled[a] = 1;
+        for (int o = occ_start[a]; o < occ_start[a + 1]; o++) {
+            int id = occ_alt[o];
+            g->alt_size[id] += size;
+            if (g->alt_size[id] > GENERATE_SIZE_CAP) g->alt_size[id] = GENERATE_SIZE_CAP;
+            if (--pending[id] == 0 && g->alt_size[id] < g->min_size[alt_lhs[id]]) {
+                g->min_size[alt_lhs[id]] = g->alt_size[id];
+                size_heap_push(&heap, g->alt_size[id], alt_lhs[id]);
             }
         }
     }
-    for (int k = 0; k < sym_count; k++) free(symbols[k]);
-    free(symbols);
-    return all_nullable;
+    for (int id = 0; id < alt_count; id++) {
+        if (pending[id] > 0) g->alt_size[id] = GENERATE_SIZE_CAP;
+    }
 }
 
-int** construct_ll1_table(Production* productions, int prod_count, char** non_terminals, int nt_count, char** terminals, int term_count, int* nullable, char*** first_sets, int* first_sizes, char*** follow_sets, int* follow_sizes) {
-    int** table = malloc(nt_count * sizeof(int*));
-    for (int i = 0; i < nt_count; i++) {
-        table[i] = malloc(term_count * sizeof(int));
-        for (int j = 0; j < term_count; j++) {
-            table[i][j] = -1;
+// Weights are lines "NAME w1 w2 ...", one number per alternative of NAME in
+// the order they are written; missing ones stay 1 and '#' starts a comment
+void read_generator_weights(SentenceGenerator* g, const SymbolTable* st, const char* filename) {
+    FILE* in = fopen(filename, "r");
+    if (!in) {
+        printf("Error opening %s\n", filename);
+        exit(1);
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+    while (getline(&line, &line_capacity, in) > 0) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0') continue;
+        char* name_end = p;
+        while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
+        int sym = find_symbol_n(st, p, name_end - p);
+        if (sym == -1 || is_terminal(sym, st)) {
+            printf("Error at line %d of %s: %.*s is not a nonterminal of the grammar\n", line_number, filename, (int)(name_end - p), p);
+            exit(1);
+        }
+        int a = st->nt_index[sym];
+        int id = g->alt_start[a];
+        p = name_end;
+        while (1) {
+            while (isspace((unsigned char)*p)) p++;
+            if (*p == '\0') break;
+            char* number_end;
+            double w = strtod(p, &number_end);
+            if (number_end == p || !(w >= 0 && w < 1e300)) {
+                printf("Error at line %d of %s: bad weight '%s'\n", line_number, filename, strtok(p, " \t\r\n"));
+                exit(1);
+            }
+            if (id == g->alt_start[a + 1]) {
+                printf("Error at line %d of %s: %s has only %d alternatives\n", line_number, filename, st->names[sym], g->alt_start[a + 1] - g->alt_start[a]);
+                exit(1);
+            }
+            g->weight[id++] = w;
+            p = number_end;
         }
     }
+    free(line);
+    fclose(in);
+}
 
-    int conflict = 0;
-    for (int i = 0; i < prod_count; i++) {
-        Production* p = &productions[i];
-        int A_idx = get_nt_index(p->lhs, non_terminals, nt_count);
-        for (int j = 0; j < p->rhs_count; j++) {
-            char* alpha = p->rhs[j];
-            char* first_alpha[10];
-            int first_alpha_size = 0;
-            compute_first_alpha(alpha, non_terminals, nt_count, nullable, first_sets, first_sizes, first_alpha, &first_alpha_size, 10);
-
-            for (int k = 0; k < first_alpha_size; k++) {
-                int t_idx = get_nt_index(first_alpha[k], terminals, term_count);
-                if (t_idx != -1) {
-                    if (table[A_idx][t_idx] != -1) {
-                        printf("Conflict at [%s, %s]: Multiple productions (%d and %d)\n", non_terminals[A_idx], terminals[t_idx], table[A_idx][t_idx], i * 100 + j);
-                        conflict = 1;
-                    } else {
-                        table[A_idx][t_idx] = i * 100 + j;
+// State of the lexer after scanning text from the start, or -1
+int lexer_walk(const Lexer* lx, const char* text, int len) {
+    int s = lx->start;
+    for (int i = 0; i < len && s >= 0; i++) s = lx->next[s * lx->class_count + lx->byte_class[(unsigned char)text[i]]];
+    return s;
+}
+
+// A lexeme ending in state s is scanned as itself when a blank or a line
+// break follows it
+int lexeme_ends_cleanly(const Lexer* lx, int s, int column) {
+    return s >= 0 && lx->accept[s] == column && lx->next[s * lx->class_count + lx->byte_class[' ']] < 0 && lx->next[s * lx->class_count + lx->byte_class['\n']] < 0;
+}
+
+// Lexemes for every terminal column: a literal is its own spelling, and a
+// %token terminal gets up to GENERATE_SAMPLES printable strings from random
+// walks over the DFA. A walk steps only to states that can still reach one
+// accepting the column, and past GENERATE_LEXEME_MAX bytes only closer to one.
+void collect_lexemes(SentenceGenerator* g, const Lexer* lx, int term_count, int end_column, const char* const* names, const char* const* patterns, Arena* arena, uint64_t* rng) {
+    g->sample_start = arena_alloc(arena, (term_count + 1) * sizeof(int));
+    g->sample = arena_alloc(arena, (term_count * GENERATE_SAMPLES + 1) * sizeof(char*));
+    g->sample_len = arena_alloc(arena, (term_count * GENERATE_SAMPLES + 1) * sizeof(int));
+    int* dist = malloc((lx->state_count > 0 ? lx->state_count : 1) * sizeof(int));
+    char text[4 * GENERATE_LEXEME_MAX];
+    int count = 0;
+    for (int c = 0; c < term_count; c++) {
+        g->sample_start[c] = count;
+        if (c == end_column) continue;
+        if (!patterns[c]) {
+            int len = (int)strlen(names[c]);
+            if (!lexeme_ends_cleanly(lx, lexer_walk(lx, names[c], len), c)) {
+                printf("Error: terminal %s is not scanned as itself, so sentences using it cannot be written\n", names[c]);
+                exit(1);
+            }
+            g->sample[count] = (char*)names[c];
+            g->sample_len[count++] = len;
+            continue;
+        }
+        for (int s = 0; s < lx->state_count; s++) dist[s] = lx->accept[s] == c ? 0 : INT_MAX;
+        for (int changed = 1; changed;) {
+            changed = 0;
+            for (int s = 0; s < lx->state_count; s++) {
+                for (int b = ' '; b <= '~'; b++) {
+                    int t = lx->next[s * lx->class_count + lx->byte_class[b]];
+                    if (t >= 0 && dist[t] != INT_MAX && dist[t] + 1 < dist[s]) {
+                        dist[s] = dist[t] + 1;
+                        changed = 1;
                     }
                 }
             }
-            for (int k = 0; k < first_alpha_size; k++) free(first_alpha[k]);
-
-            if (is_alpha_nullable(alpha, non_terminals, nt_count, nullable)) {
-                for (int k = 0; k < follow_sizes[A_idx]; k++) {
-                    int t_idx = get_nt_index(follow_sets[A_idx][k], terminals, term_count);
-                    if (t_idx != -1) {
-                        if (table[A_idx][t_idx] != -1) {
-                            printf("Conflict at [%s, %s]: Multiple productions (%d and %d)\n", non_terminals[A_idx], terminals[t_idx], table[A_idx][t_idx], i * 100 + j);
-                            conflict = 1;
-                        } else {
-                            table[A_idx][t_idx] = i * 100 + j;
-                        }
-                    }
+        }
+        for (int attempt = 0; attempt < 4 * GENERATE_SAMPLES && count - g->sample_start[c] < GENERATE_SAMPLES; attempt++) {
+            int s = lx->start;
+            int len = 0;
+            while (dist[s] != INT_MAX && len < (int)sizeof(text)) {
+                if (lexeme_ends_cleanly(lx, s, c) && len > 0 && (len >= GENERATE_LEXEME_MAX || random_unit(rng) < 0.25)) break;
+                int choices[95];
+                int choice_count = 0;
+                for (int b = len == 0 ? '!' : ' '; b <= '~'; b++) {
+                    int t = lx->next[s * lx->class_count + lx->byte_class[b]];
+                    if (t >= 0 && dist[t] != INT_MAX && (len < GENERATE_LEXEME_MAX || dist[t] < dist[s])) choices[choice_count++] = b;
                 }
+                if (choice_count == 0) {
+                    s = -1;
+                    break;
+                }
+                int b = choices[next_random(rng) % choice_count];
+                text[len++] = (char)b;
+                s = lx->next[s * lx->class_count + lx->byte_class[b]];
             }
+            if (len == 0 || len >= (int)sizeof(text) || !lexeme_ends_cleanly(lx, s, c)) continue;
+            g->sample[count] = arena_alloc(arena, len);
+            memcpy(g->sample[count], text, len);
+            g->sample_len[count++] = len;
+        }
+        if (count == g->sample_start[c]) {
+            printf("Error: no lexeme of %%token %s can be written on one line and scanned back\n", names[c]);
+            exit(1);
         }
     }
-    if (conflict) {
-        printf("Warning: Grammar is not LL(1) due to conflicts.\n");
-    }
-    return table;
+    g->sample_start[term_count] = count;
+    free(dist);
 }
 
-void print_ll1_table(FILE* fp, int** table, Production* productions, int prod_count, char** non_terminals, int nt_count, char** terminals, int term_count) {
-    fprintf(fp, "LL(1) Parsing Table:\n");
-    fprintf(fp, "NT\\T ");
-    for (int j = 0; j < term_count; j++) {
-        fprintf(fp, "%-8s", terminals[j]);
-    }
-    fprintf(fp, "\n");
-    for (int i = 0; i < nt_count; i++) {
-        fprintf(fp, "%-4s ", non_terminals[i]);
-        for (int j = 0; j < term_count; j++) {
-            int entry = table[i][j];
-            if (entry == -1) {
-                fprintf(fp, "%-8s", "");
-            } else {
-                int prod_idx = entry / 100;
-                int alt_idx = entry % 100;
-                fprintf(fp, "%s->%-4s", productions[prod_idx].lhs, productions[prod_idx].rhs[alt_idx]);
+typedef struct {
+    char* text;
+    size_t len;
+    size_t capacity;
+    int* stack;
+    long long stack_capacity;
+} SentenceBuffer;
+
+// Appends one sentence, tokens separated by blanks and ended by a line break,
+// and returns its number of tokens. slack is how far the derivation may still
+// grow past the smallest completion of what is pending.
+long generate_sentence(const SentenceGenerator* g, uint64_t* rng, SentenceBuffer* b) {
+    long long slack = g->max_size - g->min_size[0];
+    if (slack < 0) slack = 0;
+    long long depth = 0;
+    b->stack[depth++] = 0;
+    long tokens = 0;
+    while (depth > 0) {
+        int sym = b->stack[--depth];
+        if (sym < 0) {
+            int c = -sym - 1;
+            int k = g->sample_start[c];
+            if (g->sample_start[c + 1] - k > 1) k += (int)(next_random(rng) % (g->sample_start[c + 1] - k));
+            reserve_bytes(&b->text, &b->capacity, b->len + g->sample_len[k] + 1);
+            memcpy(b->text + b->len, g->sample[k], g->sample_len[k]);
+            b->len += g->sample_len[k];
+            b->text[b->len++] = ' ';
+            tokens++;
+            continue;
+        }
+        // Weighted choice among the alternatives that fit; the smallest always
+        // does, and is taken when none of those that fit has any weight
+        double total = 0;
+        int smallest = g->alt_start[sym];
+        for (int id = g->alt_start[sym]; id < g->alt_start[sym + 1]; id++) {
+            if (g->alt_size[id] < g->alt_size[smallest]) smallest = id;
+            if (g->alt_size[id] - g->min_size[sym] <= slack) total += g->weight[id];
+        }
+        int chosen = smallest;
+        if (total > 0) {
+            double r = random_unit(rng) * total;
+            for (int id = g->alt_start[sym]; id < g->alt_start[sym + 1]; id++) {
+                if (g->alt_size[id] - g->min_size[sym] > slack || g->weight[id] == 0) continue;
+                chosen = id;
+                if ((r -= g->weight[id]) < 0) break;
             }
         }
-        fprintf(fp, "\n");
+        slack -= g->alt_size[chosen] - g->min_size[sym];
+        int from = g->code_start[chosen];
+        int len = g->code_start[chosen + 1] - from;
+        if (depth + len > b->stack_capacity) {
+            while (depth + len > b->stack_capacity) b->stack_capacity *= 2;
+            b->stack = realloc(b->stack, b->stack_capacity * sizeof(int));
+        }
+        for (int k = len - 1; k >= 0; k--) b->stack[depth++] = g->code[from + k];
     }
-    fprintf(fp, "\n");
+    if (tokens > 0) b->len--;
+    reserve_bytes(&b->text, &b->capacity, b->len + 1);
+    b->text[b->len++] = '\n';
+    return tokens;
 }
 
-void free_grammar(Production* productions, int prod_count, char** used_nt, int used_count) {
-    for (int i = 0; i < prod_count; i++) {
-        free(productions[i].lhs);
-        for (int j = 0; j < productions[i].rhs_count; j++) {
-            free(productions[i].rhs[j]);
+// Blocks are claimed in order, filled into the worker's own buffer, and
+// written when every earlier block has been
+typedef struct {
+    const SentenceGenerator* gen;
+    FILE* out;
+    long block_count;
+    long next_block;
+    long next_write;
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    long tokens;
+    size_t bytes;
+} GenerateShared;
+
+typedef struct {
+    GenerateShared* shared;
+} GenerateWorker;
+
+void generate_blocks(void* arg) {
+    GenerateShared* s = ((GenerateWorker*)arg)->shared;
+    const SentenceGenerator* g = s->gen;
+    SentenceBuffer b = {NULL, 0, 0, malloc(1024 * sizeof(int)), 1024};
+    long block;
+    while ((block = __atomic_fetch_add(&s->next_block, 1, __ATOMIC_RELAXED)) < s->block_count) {
+        uint64_t rng = g->seed ^ (uint64_t)block * 0xD6E8FEB86659FD93ull;
+        next_random(&rng);
+        b.len = 0;
+        long tokens = 0;
+        long first = block * GENERATE_BLOCK;
+        long last = first + GENERATE_BLOCK < g->sentences ? first + GENERATE_BLOCK : g->sentences;
+        for (long i = first; i < last; i++) tokens += generate_sentence(g, &rng, &b);
+        pthread_mutex_lock(&s->lock);
+        while (s->next_write != block) pthread_cond_wait(&s->turn, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        if (fwrite(b.text, 1, b.len, s->out) != b.len) {
+            printf("Error writing sentences\n");
+            exit(1);
         }
-        free(productions[i].rhs);
+        pthread_mutex_lock(&s->lock);
+        s->next_write++;
+        s->tokens += tokens;
+        s->bytes += b.len;
+        pthread_cond_broadcast(&s->turn);
+        pthread_mutex_unlock(&s->lock);
     }
-    free(productions);
-    for (int i = 0; i < used_count; i++) free(used_nt[i]);
-    free(used_nt);
+    free(b.text);
+    free(b.stack);
 }
 
-int main() {
-    int prod_count, used_count;
-    char** used_nt;
+void run_generate(const char* grammar_file, const char* out_file, long sentences, long long max_size, uint64_t seed, const char* weights_file, int thread_count) {
+    Arena arena, scratch;
+    arena_init(&arena, 1 << 20);
+    arena_init(&scratch, 1 << 16);
+    SymbolTable st;
+    symtab_init(&st, &arena);
+    int prod_count;
+    Production* productions = parse_grammar_or_exit(grammar_file, &prod_count, &st, &scratch);
+    if (st.nt_count == 0) {
+        printf("Error: %s has no productions\n", grammar_file);
+        exit(1);
+    }
+    int term_count;
+    int* term_column;
+    int* terminals = collect_terminals(productions, prod_count, &st, &term_count, &term_column);
+    SentenceGenerator g;
+    build_sentence_generator(&g, productions, prod_count, &st, term_column, &arena);
+    compute_min_sizes(&g, &arena, &scratch);
+    if (g.min_size[0] >= GENERATE_SIZE_CAP) {
+        printf("Error: %s derives no terminal string, so no sentence can be generated\n", st.names[st.nts[0]]);
+        exit(1);
+    }
+    if (weights_file) read_generator_weights(&g, &st, weights_file);
+    const char** names = arena_alloc(&arena, term_count * sizeof(char*));
+    const char** patterns = arena_alloc(&arena, term_count * sizeof(char*));
+    for (int c = 0; c < term_count; c++) {
+        names[c] = st.names[terminals[c]];
+        patterns[c] = st.patterns[terminals[c]];
+    }
+    Lexer lexer;
+    int end_column = term_column[find_symbol(&st, "$")];
+    build_lexer_or_exit(&lexer, term_count, end_column, names, patterns);
+    uint64_t rng = seed;
+    collect_lexemes(&g, &lexer, term_count, end_column, names, patterns, &arena, &rng);
+    free_lexer(&lexer);
+    g.sentences = sentences;
+    g.max_size = max_size;
+    g.seed = seed;
+    printf("Minimum derivation size of %s: %lld (size limit %lld)\n", st.names[st.nts[0]], g.min_size[0], max_size > g.min_size[0] ? max_size : g.min_size[0]);
 
-    // Open output log file
-    FILE* fp = fopen("output_log.txt", "w");
-    if (!fp) {
-        printf("Error opening output_log.txt\n");
+    FILE* out = fopen(out_file, "w");
+    if (!out) {
+        printf("Error opening %s\n", out_file);
+        exit(1);
+    }
+    GenerateShared shared = {&g, out, (sentences + GENERATE_BLOCK - 1) / GENERATE_BLOCK, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+    if (thread_count > shared.block_count) thread_count = shared.block_count > 0 ? (int)shared.block_count : 1;
+    GenerateWorker* workers = malloc(thread_count * sizeof(GenerateWorker));
+    for (int i = 0; i < thread_count; i++) workers[i].shared = &shared;
+    double start = now_seconds();
+    run_threads(thread_count, generate_blocks, workers, sizeof(GenerateWorker));
+    if (fclose(out) != 0) {
+        printf("Error writing %s\n", out_file);
         exit(1);
     }
+    double seconds = now_seconds() - start;
+    printf("Generated %ld sentences, %ld tokens, %.1f MiB in %.3f s (%.1f MiB/s) on %d threads\n", sentences, shared.tokens, shared.bytes / 1048576.0, seconds,
+           seconds > 0 ? shared.bytes / 1048576.0 / seconds : 0.0, thread_count);
+    printf("Sentences written to %s\n", out_file);
+    free(workers);
+    free(productions);
+    symtab_free(&st);
+    arena_free(&scratch);
+    arena_free(&arena);
+}
 
-    // Step 1: Parse and log original grammar
-    Production* productions = parse_grammar("input.txt", &prod_count, &used_nt, &used_count);
-    print_grammar(fp, productions, prod_count, "Original Grammar");
+int main(int argc, char** argv) {
+    const char* token_file = NULL;
+    const char* forest_file = NULL;
+    const char* emit_table = NULL;
+    const char* load_table = NULL;
+    const char* gen_parser = NULL;
+    const char* grammar_file = "input.txt";
+    const char* log_file = "output_log.txt";
+    const char* synth_spec = NULL;
+    const char* gen_grammar = NULL;
+    const char* bench_file = NULL;
+    const char* baseline_file = NULL;
+    const char* batch_source = NULL;
+    const char* batch_out = "batch_output";
+    const char* edit_file = NULL;
+    const char* cache_dir = NULL;
+    const char* serve_socket = NULL;
+    const char* load_socket = NULL;
+    const char* request_file = NULL;
+    const char* generate_file = NULL;
+    const char* weights_file = NULL;
+    long sentences = 1000;
+    long long max_size = 1000;
+    uint64_t seed = 1;
+    const LogFormat* log_format = &log_formats[0];
+    int clients = 16;
+    long requests = 100000;
+    const char* grammar_files[argc];
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int use_lalr = 0;
+    int reduce = 0;
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--parse") == 0 && i + 1 < argc) {
+            token_file = argv[++i];
+        } else if (strcmp(argv[i], "--forest") == 0 && i + 1 < argc) {
+            forest_file = argv[++i];
+        } else if (strcmp(argv[i], "--emit-table") == 0 && i + 1 < argc) {
+            emit_table = argv[++i];
+        } else if (strcmp(argv[i], "--load-table") == 0 && i + 1 < argc) {
+            load_table = argv[++i];
+        } else if (strcmp(argv[i], "--gen-parser") == 0 && i + 1 < argc) {
+            gen_parser = argv[++i];
+        } else if (strcmp(argv[i], "--synth") == 0 && i + 1 < argc) {
+            synth_spec = argv[++i];
+        } else if (strcmp(argv[i], "--gen-grammar") == 0 && i + 1 < argc) {
+            gen_grammar = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench_file = argv[++i];
+        } else if (strcmp(argv[i], "--bench-baseline") == 0 && i + 1 < argc) {
+            baseline_file = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_source = argv[++i];
+        } else if (strcmp(argv[i], "--batch-out") == 0 && i + 1 < argc) {
+            batch_out = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            stage_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc) {
+            edit_file = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_socket = argv[++i];
+        } else if (strcmp(argv[i], "--load-test") == 0 && i + 1 < argc) {
+            load_socket = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            requests = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--request-file") == 0 && i + 1 < argc) {
+            request_file = argv[++i];
+        } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generate_file = argv[++i];
+        } else if (strcmp(argv[i], "--sentences") == 0 && i + 1 < argc) {
+            sentences = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc) {
+            weights_file = argv[++i];
+        } else if (strcmp(argv[i], "--log-format") == 0 && i + 1 < argc) {
+            log_format = find_log_format(argv[++i]);
+            if (!log_format) {
+                printf("Unknown log format %s; use human, sparse, json or binary\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--lalr") == 0) {
+            use_lalr = 1;
+        } else if (strcmp(argv[i], "--reduce") == 0) {
+            reduce = 1;
+        } else if (argv[i][0] != '-') {
+            grammar_files[positional++] = argv[i];
+        } else {
+            positional = -1;
+            break;
+        }
+    }
+    // A server takes any number of grammar files, everything else a grammar and a log
+    if (positional == -1 || (!serve_socket && positional > 2)) {
+        printf("Usage: %s [grammar file] [output log] [--parse <token file> [--forest <file.dot>]] [--emit-table <file>] [--load-table <file>] [--gen-parser <file.cpp>] [--lalr | --incremental <edit file> | --cache <directory>] [--reduce] [--threads <n>] [--log-format <format>]\n"
+               "       %s --batch <directory | list file> [--batch-out <directory>] [--jobs <n>] [--lalr | --cache <directory>] [--reduce] [--log-format <format>]\n"
+               "       %s --serve <socket> <grammar file>...\n"
+               "       %s --load-test <socket> [--clients <n>] [--requests <n>] [--request-file <file>]\n"
+               "       %s --generate <file> [grammar file] [--sentences <n>] [--max-size <n>] [--seed <n>] [--weights <file>] [--jobs <n>]\n"
+               "       %s [--synth <shape>] --gen-grammar <file> | --bench <results.csv> [--bench-baseline <results.csv>]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+    if (positional > 0) grammar_file = grammar_files[0];
+    if (positional > 1) log_file = grammar_files[1];
+    if (use_lalr && (emit_table || load_table || gen_parser)) {
+        printf("--emit-table, --load-table and --gen-parser work on the LL(1) table and cannot be used with --lalr\n");
+        exit(1);
+    }
+    if (use_lalr && !log_format->lalr) {
+        printf("--lalr logs its table as text and cannot be combined with --log-format %s\n", log_format->name);
+        exit(1);
+    }
+    if (forest_file && (!token_file || use_lalr)) {
+        printf("--forest writes the forest of an LL(1) table's general parse and needs --parse without --lalr\n");
+        exit(1);
+    }
+    if (batch_source && (emit_table || load_table || gen_parser || token_file)) {
+        printf("--batch only writes logs and cannot be combined with --emit-table, --load-table, --gen-parser or --parse\n");
+        exit(1);
+    }
+    if (edit_file && (use_lalr || batch_source || load_table)) {
+        printf("--incremental builds its own LL(1) analysis and cannot be combined with --lalr, --batch or --load-table\n");
+        exit(1);
+    }
+    if (cache_dir && (use_lalr || edit_file || load_table)) {
+        printf("--cache stores the LL(1) pipeline's results and cannot be combined with --lalr, --incremental or --load-table\n");
+        exit(1);
+    }
+    if (reduce && (edit_file || load_table)) {
+        printf("--reduce rewrites the grammar file's productions and cannot be combined with --incremental or --load-table\n");
+        exit(1);
+    }
+    if (serve_socket && (use_lalr || reduce || batch_source || load_table || edit_file || cache_dir || emit_table || gen_parser || token_file)) {
+        printf("--serve keeps LL(1) analyses in memory and takes only grammar files\n");
+        exit(1);
+    }
+    if (generate_file && (use_lalr || reduce || batch_source || load_table || edit_file || cache_dir || emit_table || gen_parser || token_file || serve_socket)) {
+        printf("--generate writes sentences of a grammar file and takes only --sentences, --max-size, --seed, --weights and --jobs\n");
+        exit(1);
+    }
+    if (cache_dir && mkdir(cache_dir, 0777) != 0 && errno != EEXIST) {
+        printf("Error creating %s\n", cache_dir);
+        exit(1);
+    }
+    if (jobs < 1) jobs = 1;
+    if (stage_threads < 1) stage_threads = 1;
+    messages = stdout;
 
-    // Step 2: Apply left factoring and log result
-    left_factoring(&productions, &prod_count, used_nt, &used_count);
-    print_grammar(fp, productions, prod_count, "After Left Factoring");
+    // Synthetic grammars: written out, or generated and timed stage by stage
+    GrammarShape shape = parse_grammar_shape(synth_spec);
+    if (gen_grammar) {
+        write_grammar_file(&shape, gen_grammar);
+        printf("Synthetic grammar written to %s\n", gen_grammar);
+        return 0;
+    }
+    if (bench_file) {
+        run_benchmark(&shape, bench_file, baseline_file);
+        return 0;
+    }
 
-    // Step 3: Apply left recursion removal and log result
-    remove_left_recursion(&productions, &prod_count, used_nt, &used_count);
-    print_grammar(fp, productions, prod_count, "After Left Recursion Removal");
+    // A resident server for many clients, and a client to load it with
+    if (serve_socket) {
+        if (positional == 0) grammar_files[positional++] = grammar_file;
+        run_server(serve_socket, grammar_files, positional);
+        return 0;
+    }
+    if (load_socket) {
+        run_load_test(load_socket, request_file, clients, requests);
+        return 0;
+    }
 
-    // Step 4: Compute and log First Sets
-    int nt_count = used_count;
-    char** non_terminals = used_nt;
-    int* nullable = compute_nullable(productions, prod_count, non_terminals, nt_count);
-    char*** first_sets = malloc(nt_count * sizeof(char**));
-    int* first_sizes = calloc(nt_count, sizeof(int));
-    int first_capacity = 10;
-    for (int i = 0; i < nt_count; i++) {
-        first_sets[i] = malloc(first_capacity * sizeof(char*));
+    // Random sentences of the grammar, written on worker threads
+    if (generate_file) {
+        if (sentences < 0) sentences = 0;
+        run_generate(grammar_file, generate_file, sentences, max_size, seed, weights_file, jobs);
+        return 0;
     }
-    compute_first_sets(fp, productions, prod_count, non_terminals, nt_count, nullable, first_sets, first_sizes, first_capacity);
 
-    // Step 5: Compute and log Follow Sets
-    char*** follow_sets = malloc(nt_count * sizeof(char**));
-    int* follow_sizes = calloc(nt_count, sizeof(int));
-    int follow_capacity = 10;
-    for (int i = 0; i < nt_count; i++) {
-        follow_sets[i] = malloc(follow_capacity * sizeof(char*));
+    // Many grammars at once on worker threads, each with its own log
+    if (batch_source) {
+        return run_batch(batch_source, batch_out, jobs, log_format, use_lalr, reduce, cache_dir) > 0;
     }
-    compute_follow_sets(fp, productions, prod_count, non_terminals, nt_count, nullable, first_sets, first_sizes, follow_sets, follow_sizes, follow_capacity);
 
-    // Step 6: Construct and log LL(1) Parsing Table
-    int term_count;
-    char** terminals = collect_terminals(productions, prod_count, non_terminals, nt_count, &term_count);
-    int** ll1_table = construct_ll1_table(productions, prod_count, non_terminals, nt_count, terminals, term_count, nullable, first_sets, first_sizes, follow_sets, follow_sizes);
-    print_ll1_table(fp, ll1_table, productions, prod_count, non_terminals, nt_count, terminals, term_count);
+    // A saved table is mapped and used directly, without touching the grammar
+    if (load_table) {
+        LL1Table table;
+        if (load_ll1_table(&table, load_table) != 0) {
+            printf("Error loading table %s\n", load_table);
+            exit(1);
+        }
+        if (gen_parser) write_generated_parser(&table, gen_parser);
+        if (token_file) run_token_parse(&table, NULL, token_file, forest_file);
+        free_ll1_table(&table);
+        return 0;
+    }
 
-    // Clean up
-    for (int i = 0; i < nt_count; i++) {
-        for (int j = 0; j < first_sizes[i]; j++) free(first_sets[i][j]);
-        free(first_sets[i]);
-        for (int j = 0; j < follow_sizes[i]; j++) free(follow_sets[i][j]);
-        free(follow_sets[i]);
-        free(ll1_table[i]);
-    }
-    free(first_sets);
-    free(first_sizes);
-    free(follow_sets);
-    free(follow_sizes);
-    free(nullable);
-    for (int i = 0; i < term_count; i++) free(terminals[i]);
-    free(terminals);
-    free(ll1_table);
-    free_grammar(productions, prod_count, used_nt, used_count);
-
-    fclose(fp);
-    printf("Processing complete. Output written to output_log.txt\n");
+    RunOptions opt = {grammar_file, log_file, log_format, use_lalr, reduce, emit_table, gen_parser, token_file, forest_file, edit_file, cache_dir, 0};
+    if (process_grammar(&opt).failed) exit(1);
+    printf("Processing complete. Output written to %s\n", log_file);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1099 @@
+// Compile-time LL(1) analysis for grammars that are fixed at build time.
+//
+// A grammar is declared as a string in the format of the grammar files Code.c
+// reads and goes through the same pipeline, evaluated by the compiler: left
+// factoring, left recursion removal, nullable, FIRST, FOLLOW and the LL(1)
+// table. The finished table is a constexpr object, so it sits in read-only data
+// and a parser starts without any work. A grammar that is not LL(1) does not
+// compile; the error names the first conflicted cell.
+//
+//     using Expr = cfg::Grammar<R"(
+//         E -> E + T | T
+//         T -> T * F | F
+//         F -> ( E ) | id
+//     )">;
+//     cfg::Parser<Expr> parser;
+//     parser.feed("id");
+//     parser.finish();    // cfg::PARSE_ACCEPT
+//
+// Needs C++20 (constexpr std::vector and std::string).
+#ifndef CFG_CONSTEXPR_HPP
+#define CFG_CONSTEXPR_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cfg {
+
+enum { PARSE_RUNNING, PARSE_ACCEPT, PARSE_ERROR };
+
+// A string literal usable as a template argument
+template <std::size_t N>
+struct FixedString {
+    char text[N] = {};
+
+    constexpr FixedString() = default;
+    constexpr FixedString(const char (&s)[N]) {
+        for (std::size_t i = 0; i < N; i++) text[i] = s[i];
+    }
+    constexpr std::string_view view() const {
+        return {text, N - 1};
+    }
+};
+
+// Array extents of a finished table, found by a first run of the analysis
+struct TableSizes {
+    int nt_count;
+    int term_count;
+    int alt_count;
+    int code_count;
+    int words;
+    int hash_size;
+    int name_bytes;
+};
+
+// A conflicted cell: row, column and the two alternatives that predict it
+struct Conflict {
+    int nt;
+    int column;
+    int first;
+    int second;
+};
+
+// The layout follows the table block of Code.c, except that the cells form a
+// dense nt_count x term_count matrix: grammars small enough to be analysed by
+// the compiler gain nothing from row displacement. Cells hold global
+// alternative ids or -1, and alternatives are stored encoded (nonterminal
+// index, or -(column + 1) for a terminal) and reversed.
+template <TableSizes S>
+struct Table {
+    static constexpr int nt_count = S.nt_count;
+    static constexpr int term_count = S.term_count;
+    static constexpr int alt_count = S.alt_count;
+
+    int start;
+    int end_column;
+    int conflict_count;
+    Conflict conflict;
+    std::array<int, (std::size_t)S.nt_count * S.term_count> cell;
+    std::array<int, S.alt_count + 1> code_start;
+    std::array<int, S.code_count> code;
+    std::array<int, S.alt_count> alt_lhs;
+    std::array<bool, S.nt_count> nullable;
+    std::array<std::uint64_t, (std::size_t)S.nt_count * S.words> first;
+    std::array<std::uint64_t, (std::size_t)S.nt_count * S.words> follow;
+    std::array<int, S.term_count + S.nt_count + 1> name_start;
+    std::array<int, S.term_count> pattern_start;
+    std::array<int, S.hash_size> term_hash;
+    std::array<char, S.name_bytes> names;
+
+    constexpr int lookup(int nt, int column) const {
+        return cell[(std::size_t)nt * S.term_count + column];
+    }
+
+    constexpr bool in_first(int nt, int column) const {
+        return (first[(std::size_t)nt * S.words + column / 64] >> (column % 64)) & 1;
+    }
+
+    constexpr bool in_follow(int nt, int column) const {
+        return (follow[(std::size_t)nt * S.words + column / 64] >> (column % 64)) & 1;
+    }
+
+    // Names are stored terminals first (by column), then nonterminals (by index)
+    constexpr std::string_view name(int i) const {
+        return {names.data() + name_start[i], (std::size_t)(name_start[i + 1] - name_start[i] - 1)};
+    }
+
+    // The %token pattern of a terminal column, or an empty view when it is scanned literally
+    constexpr std::string_view pattern(int column) const {
+        if (pattern_start[column] == -1) return {};
+        std::string_view rest(names.data() + pattern_start[column], S.name_bytes - pattern_start[column]);
+        return rest.substr(0, rest.find('\0'));
+    }
+
+    // Maps a token spelling to its column, or -1 when it is not a terminal
+    constexpr int column(std::string_view spelling) const;
+
+    constexpr int nonterminal(std::string_view spelling) const {
+        for (int a = 0; a < S.nt_count; a++) {
+            if (name(S.term_count + a) == spelling) return a;
+        }
+        return -1;
+    }
+};
+
+namespace detail {
+
+constexpr unsigned int hash_symbol(std::string_view name) {
+    unsigned int h = 2166136261u;
+    for (char c : name) {
+        h ^= (unsigned char)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Errors in a grammar stop constant evaluation at a call to one of these, so
+// the compiler's diagnostic names the error; at run time they print and exit
+inline void grammar_error_unexpected_symbol(int line, std::string_view word) {
+    std::printf("Error at line %d: unexpected '%.*s'\n", line, (int)word.size(), word.data());
+    std::exit(1);
+}
+
+inline void grammar_error_token_needs_name_and_pattern(int line) {
+    std::printf("Error at line %d: %%token needs a name and a pattern\n", line);
+    std::exit(1);
+}
+
+using Alt = std::vector<int>;
+using Bitset = std::vector<std::uint64_t>;
+// Adjacency lists; successors keep the order in which edges were added
+using Graph = std::vector<std::vector<int>>;
+
+struct Production {
+    int lhs;
+    std::vector<Alt> alts;
+};
+
+// Names are found through an open-addressing hash on FNV-1a, as in Code.c
+struct SymbolTable {
+    std::vector<std::string> names;
+    std::vector<std::string> patterns;
+    std::vector<int> nt_index;
+    std::vector<int> derived;
+    std::vector<int> nts;
+    std::vector<int> buckets = std::vector<int>(128, -1);
+
+    constexpr int find(std::string_view name) const {
+        unsigned int mask = (unsigned int)buckets.size() - 1;
+        for (unsigned int b = hash_symbol(name) & mask; buckets[b] != -1; b = (b + 1) & mask) {
+            if (names[buckets[b]] == name) return buckets[b];
+        }
+        return -1;
+    }
+
+    constexpr void insert(int id) {
+        unsigned int mask = (unsigned int)buckets.size() - 1;
+        unsigned int b = hash_symbol(names[id]) & mask;
+        while (buckets[b] != -1) b = (b + 1) & mask;
+        buckets[b] = id;
+    }
+
+    constexpr int add(std::string_view name) {
+        names.emplace_back(name);
+        patterns.emplace_back();
+        nt_index.push_back(-1);
+        derived.push_back(0);
+        int id = (int)names.size() - 1;
+        insert(id);
+        if (names.size() * 2 > buckets.size()) {
+            buckets.assign(buckets.size() * 2, -1);
+            for (int i = 0; i < (int)names.size(); i++) insert(i);
+        }
+        return id;
+    }
+
+    constexpr int intern(std::string_view name) {
+        int id = find(name);
+        return id != -1 ? id : add(name);
+    }
+
+    constexpr int add_nonterminal(int sym) {
+        if (nt_index[sym] != -1) return nt_index[sym];
+        nts.push_back(sym);
+        nt_index[sym] = (int)nts.size() - 1;
+        return nt_index[sym];
+    }
+
+    constexpr bool is_terminal(int sym) const {
+        return nt_index[sym] == -1;
+    }
+
+    // A', A'', A''' and then A'4, A'5, ... as in generate_new_nt
+    constexpr int generate_new_nt(int base) {
+        std::string candidate;
+        do {
+            int k = ++derived[base];
+            candidate = names[base];
+            if (k <= 3) {
+                candidate.append(k, '\'');
+            } else {
+                std::string digits;
+                for (; k > 0; k /= 10) digits.insert(digits.begin(), (char)('0' + k % 10));
+                candidate += '\'';
+                candidate += digits;
+            }
+        } while (find(candidate) != -1);
+        int sym = add(candidate);
+        add_nonterminal(sym);
+        return sym;
+    }
+};
+
+constexpr bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// The scanner of parse_grammar: symbols are runs of non-blank characters, with
+// '|' and '->' always standing alone, and '#' comments out the rest of a line
+struct GrammarWord {
+    std::string_view text;
+    int line;
+    bool line_start;
+};
+
+struct GrammarScanner {
+    std::string_view s;
+    std::size_t p = 0;
+    int line = 1;
+    bool line_start = true;
+
+    constexpr bool arrow_at(std::size_t i) const {
+        return s[i] == '-' && i + 1 < s.size() && s[i + 1] == '>';
+    }
+
+    constexpr GrammarWord next() {
+        while (p < s.size()) {
+            if (s[p] == '\n') {
+                line++;
+                line_start = true;
+                p++;
+            } else if (is_space(s[p])) {
+                p++;
+            } else if (s[p] == '#') {
+                while (p < s.size() && s[p] != '\n') p++;
+            } else {
+                break;
+            }
+        }
+        std::size_t from = p;
+        GrammarWord w{{}, line, line_start};
+        line_start = false;
+        if (p < s.size() && (s[p] == '|' || arrow_at(p))) {
+            p += s[p] == '|' ? 1 : 2;
+        } else {
+            while (p < s.size() && !is_space(s[p]) && s[p] != '|' && !arrow_at(p)) p++;
+        }
+        w.text = s.substr(from, p - from);
+        return w;
+    }
+};
+
+constexpr std::vector<Production> parse_grammar(std::string_view text, SymbolTable& st) {
+    std::vector<Production> productions;
+    GrammarScanner gs{text};
+    GrammarWord cur = gs.next();
+    GrammarWord next = gs.next();
+    int lhs = -1;
+    bool explicit_eps = false;
+    std::vector<Alt> alts;
+    Alt alt;
+    auto end_alternative = [&] {
+        if (!alt.empty() || explicit_eps) alts.push_back(std::move(alt));
+        alt.clear();
+        explicit_eps = false;
+    };
+    auto finish_production = [&] {
+        end_alternative();
+        productions.push_back({lhs, std::move(alts)});
+        alts.clear();
+    };
+    while (!cur.text.empty()) {
+        // "%token NAME PATTERN"; the pattern is the rest of the line
+        if (cur.line_start && cur.text == "%token") {
+            if (lhs != -1) finish_production();
+            lhs = -1;
+            std::size_t line_end = text.find('\n', gs.p);
+            if (line_end == std::string_view::npos) line_end = text.size();
+            std::size_t pattern = gs.p < line_end ? gs.p : line_end;
+            while (pattern < line_end && is_space(text[pattern])) pattern++;
+            std::size_t pattern_end = line_end;
+            while (pattern_end > pattern && is_space(text[pattern_end - 1])) pattern_end--;
+            if (next.text.empty() || next.line != cur.line || pattern == pattern_end) grammar_error_token_needs_name_and_pattern(cur.line);
+            int sym = st.intern(next.text);
+            st.patterns[sym] = text.substr(pattern, pattern_end - pattern);
+            gs.p = line_end;
+            cur = gs.next();
+            next = gs.next();
+            continue;
+        }
+        if (next.text == "->" && cur.text != "->" && cur.text != "|") {
+            if (lhs != -1) finish_production();
+            lhs = st.intern(cur.text);
+            st.add_nonterminal(lhs);
+            explicit_eps = false;
+            cur = gs.next();
+            next = gs.next();
+            continue;
+        }
+        if (lhs == -1 || cur.text == "->") grammar_error_unexpected_symbol(cur.line, cur.text);
+        if (cur.text == "|") {
+            end_alternative();
+        } else if (cur.text == "ε") {
+            explicit_eps = true;
+        } else {
+            alt.push_back(st.intern(cur.text));
+        }
+        cur = next;
+        next = gs.next();
+    }
+    if (lhs != -1) finish_production();
+    return productions;
+}
+
+// Prefix trie over the alternatives of one production, as in left_factoring:
+// children keep the order in which alternatives first reach them and symbol -1
+// ends an alternative
+struct TrieNode {
+    int symbol;
+    std::vector<int> children;
+};
+
+// As factor_productions: only the productions flagged in selected are factored
+// when it is not empty
+constexpr void factor_productions(std::vector<Production>& productions, const std::vector<int>& selected, SymbolTable& st) {
+    std::size_t original_count = productions.size();
+    std::vector<Production> added;
+    for (std::size_t i = 0; i < original_count; i++) {
+        if (!selected.empty() && !selected[i]) continue;
+        int A = productions[i].lhs;
+        std::vector<TrieNode> trie;
+        trie.push_back({-1, {}});
+        auto child = [&](int parent, int symbol) {
+            for (int c : trie[parent].children) {
+                if (trie[c].symbol == symbol) return c;
+            }
+            trie.push_back({symbol, {}});
+            int id = (int)trie.size() - 1;
+            trie[parent].children.push_back(id);
+            return id;
+        };
+        for (const Alt& alt : productions[i].alts) {
+            int node = 0;
+            for (int sym : alt) node = child(node, sym);
+            child(node, -1);
+        }
+
+        // pending holds (trie node, nonterminal) pairs still to be emitted
+        std::vector<std::pair<int, int>> pending;
+        pending.push_back({0, A});
+        for (std::size_t head = 0; head < pending.size(); head++) {
+            auto [node, X] = pending[head];
+            std::vector<Alt> alts;
+            for (int c : trie[node].children) {
+                int n = c;
+                Alt path;
+                while (trie[n].symbol != -1) {
+                    path.push_back(trie[n].symbol);
+                    if (trie[n].children.size() != 1) break;
+                    n = trie[n].children[0];
+                }
+                if (trie[n].symbol != -1) {
+                    int X_prime = st.generate_new_nt(A);
+                    path.push_back(X_prime);
+                    pending.push_back({n, X_prime});
+                }
+                alts.push_back(std::move(path));
+            }
+            if (X == A) productions[i].alts = std::move(alts);
+            else added.push_back({X, std::move(alts)});
+        }
+    }
+    for (Production& p : added) productions.push_back(std::move(p));
+}
+
+constexpr void left_factoring(std::vector<Production>& productions, SymbolTable& st) {
+    factor_productions(productions, {}, st);
+}
+
+// Worklist nullable, as in compute_nullable: each alternative counts its
+// symbols not yet known to be nullable
+constexpr std::vector<int> compute_nullable(const std::vector<Production>& productions, const SymbolTable& st) {
+    int nt_count = (int)st.nts.size();
+    std::vector<int> nullable(nt_count), remaining, alt_lhs, worklist;
+    Graph occurrences(nt_count);
+    for (const Production& p : productions) {
+        int A_idx = st.nt_index[p.lhs];
+        for (const Alt& alt : p.alts) {
+            int a = (int)remaining.size();
+            alt_lhs.push_back(A_idx);
+            remaining.push_back((int)alt.size());
+            for (int sym : alt) {
+                if (st.is_terminal(sym)) remaining[a] = -1;
+            }
+            if (remaining[a] > 0) {
+                for (int sym : alt) occurrences[st.nt_index[sym]].push_back(a);
+            } else if (remaining[a] == 0 && !nullable[A_idx]) {
+                nullable[A_idx] = 1;
+                worklist.push_back(A_idx);
+            }
+        }
+    }
+    for (std::size_t head = 0; head < worklist.size(); head++) {
+        for (int alt : occurrences[worklist[head]]) {
+            if (--remaining[alt] == 0 && !nullable[alt_lhs[alt]]) {
+                nullable[alt_lhs[alt]] = 1;
+                worklist.push_back(alt_lhs[alt]);
+            }
+        }
+    }
+    return nullable;
+}
+
+// Strongly connected components in reverse topological order
+struct SccList {
+    std::vector<int> scc_start;
+    std::vector<int> members;
+    std::vector<int> scc_of;
+
+    constexpr int count() const {
+        return (int)scc_start.size() - 1;
+    }
+};
+
+// Iterative Tarjan as in find_sccs; call is the DFS path and next_edge its resume points
+constexpr SccList find_sccs(const Graph& g) {
+    int n = (int)g.size();
+    SccList s;
+    s.scc_start.push_back(0);
+    s.scc_of.assign(n, -1);
+    std::vector<int> index(n, -1), low(n), stack, call, next_edge(n);
+    int counter = 0;
+    for (int root = 0; root < n; root++) {
+        if (index[root] != -1) continue;
+        call.push_back(root);
+        index[root] = low[root] = counter++;
+        next_edge[root] = 0;
+        stack.push_back(root);
+        while (!call.empty()) {
+            int v = call.back();
+            if (next_edge[v] < (int)g[v].size()) {
+                int w = g[v][next_edge[v]++];
+                if (index[w] == -1) {
+                    index[w] = low[w] = counter++;
+                    next_edge[w] = 0;
+                    stack.push_back(w);
+                    call.push_back(w);
+                } else if (s.scc_of[w] == -1 && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+            call.pop_back();
+            if (!call.empty() && low[v] < low[call.back()]) low[call.back()] = low[v];
+            if (low[v] == index[v]) {
+                int w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    s.scc_of[w] = s.count();
+                    s.members.push_back(w);
+                } while (w != v);
+                s.scc_start.push_back((int)s.members.size());
+            }
+        }
+    }
+    return s;
+}
+
+// Edge A -> B when B can begin an alternative of A, i.e. follows only nullable symbols
+constexpr Graph left_corner_graph(const std::vector<Production>& productions, const SymbolTable& st, const std::vector<int>& nullable) {
+    Graph corners(st.nts.size());
+    for (const Production& p : productions) {
+        int A_idx = st.nt_index[p.lhs];
+        for (const Alt& alt : p.alts) {
+            for (std::size_t k = 0; k < alt.size() && !st.is_terminal(alt[k]); k++) {
+                corners[A_idx].push_back(st.nt_index[alt[k]]);
+                if (!nullable[st.nt_index[alt[k]]]) break;
+            }
+        }
+    }
+    return corners;
+}
+
+// A component is cyclic if it has several members or a self edge
+constexpr std::vector<int> cyclic_components(const Graph& g, const SccList& sccs) {
+    std::vector<int> cyclic(sccs.count());
+    for (int c = 0; c < sccs.count(); c++) {
+        int v = sccs.members[sccs.scc_start[c]];
+        cyclic[c] = sccs.scc_start[c + 1] - sccs.scc_start[c] > 1;
+        for (int w : g[v]) {
+            if (w == v) cyclic[c] = 1;
+        }
+    }
+    return cyclic;
+}
+
+// Bounds the alternatives one nonterminal may grow to during substitution
+constexpr std::size_t MAX_SUBSTITUTED_SYMBOLS = 1 << 22;
+
+constexpr std::size_t symbol_count(const std::vector<Alt>& alts) {
+    std::size_t n = 0;
+    for (const Alt& alt : alts) n += alt.size();
+    return n;
+}
+
+// remove_left_recursion: within each cyclic component of the left-corner
+// graph, inner members first and entries (the start symbol and members used
+// outside the component) last, each by production, alternatives starting with
+// an earlier member are substituted away (Paull's algorithm) and direct
+// recursion moves to a fresh A'. Inner members no longer used afterwards are
+// dropped with their tails, and the rewritten members are factored again.
+// Recursion left behind nullable symbols, which Code.c warns about, is not
+// LL(1) wherever it derives a sentence, so it ends in a conflict here.
+constexpr void remove_left_recursion(std::vector<Production>& productions, SymbolTable& st) {
+    int nt_count = (int)st.nts.size();
+    int prod_count = (int)productions.size();
+    std::vector<int> nullable = compute_nullable(productions, st);
+    std::vector<int> first_prod(nt_count, -1), last_prod(nt_count, -1), next_prod(prod_count, -1);
+    for (int i = 0; i < prod_count; i++) {
+        int A_idx = st.nt_index[productions[i].lhs];
+        if (last_prod[A_idx] == -1) first_prod[A_idx] = i;
+        else next_prod[last_prod[A_idx]] = i;
+        last_prod[A_idx] = i;
+    }
+    Graph graph = left_corner_graph(productions, st, nullable);
+    SccList sccs = find_sccs(graph);
+    std::vector<int> recursive = cyclic_components(graph, sccs);
+    std::vector<int> entry(nt_count);
+    if (nt_count > 0) entry[0] = 1;
+    for (const Production& p : productions) {
+        int c = sccs.scc_of[st.nt_index[p.lhs]];
+        for (const Alt& alt : p.alts) {
+            for (int sym : alt) {
+                if (!st.is_terminal(sym) && sccs.scc_of[st.nt_index[sym]] != c) entry[st.nt_index[sym]] = 1;
+            }
+        }
+    }
+
+    // order lists a component's inner members, then its entries, each by first
+    // production; rank is the position there
+    std::vector<int> order, rank(nt_count), removed(prod_count), done(sccs.count());
+    std::vector<int> rewritten(nt_count), inner(nt_count), prime_of(nt_count, -1);
+    std::vector<Production> added;
+    for (int i = 0; i < prod_count; i++) {
+        int c = sccs.scc_of[st.nt_index[productions[i].lhs]];
+        if (!recursive[c] || done[c]) continue;
+        done[c] = 1;
+        order.clear();
+        for (int e = 0; e < 2; e++) {
+            for (int n = i; n < prod_count; n++) {
+                int a = st.nt_index[productions[n].lhs];
+                if (sccs.scc_of[a] == c && first_prod[a] == n && entry[a] == e) order.push_back(a);
+            }
+        }
+        int k = (int)order.size();
+        for (int r = 0; r < k; r++) {
+            rank[order[r]] = r;
+            rewritten[order[r]] = 1;
+            inner[order[r]] = !entry[order[r]] && entry[order[k - 1]];
+        }
+
+        for (int r = 0; r < k; r++) {
+            int a = order[r];
+            int A = st.nts[a];
+            std::vector<Alt> cur;
+            for (int n = first_prod[a]; n != -1; n = next_prod[n]) {
+                for (const Alt& alt : productions[n].alts) cur.push_back(alt);
+            }
+            bool substituted = true;
+            for (int pass = 0; substituted && pass < k && symbol_count(cur) <= MAX_SUBSTITUTED_SYMBOLS; pass++) {
+                substituted = false;
+                std::vector<Alt> next;
+                for (const Alt& alt : cur) {
+                    int b = !alt.empty() && !st.is_terminal(alt[0]) ? st.nt_index[alt[0]] : -1;
+                    if (b == -1 || b >= nt_count || sccs.scc_of[b] != c || rank[b] >= r) {
+                        next.push_back(alt);
+                        continue;
+                    }
+                    for (const Alt& head : productions[first_prod[b]].alts) {
+                        Alt s = head;
+                        s.insert(s.end(), alt.begin() + 1, alt.end());
+                        next.push_back(std::move(s));
+                    }
+                    substituted = true;
+                }
+                cur = std::move(next);
+            }
+
+            // A -> A alpha | beta becomes A -> beta A', A' -> alpha A' | ε; A -> A alone is dropped
+            int alpha_count = 0;
+            for (const Alt& alt : cur) {
+                if (alt.size() > 1 && alt[0] == A) alpha_count++;
+            }
+            int A_prime = alpha_count > 0 ? st.generate_new_nt(A) : -1;
+            prime_of[a] = A_prime;
+            std::vector<Alt> beta, alpha;
+            for (const Alt& alt : cur) {
+                if (!alt.empty() && alt[0] == A) {
+                    if (alt.size() == 1) continue;
+                    Alt s(alt.begin() + 1, alt.end());
+                    s.push_back(A_prime);
+                    alpha.push_back(std::move(s));
+                } else {
+                    Alt s = alt;
+                    if (alpha_count > 0) s.push_back(A_prime);
+                    beta.push_back(std::move(s));
+                }
+            }
+            productions[first_prod[a]] = {A, std::move(beta)};
+            for (int n = next_prod[first_prod[a]]; n != -1; n = next_prod[n]) removed[n] = 1;
+            next_prod[first_prod[a]] = -1;
+            if (alpha_count == 0) continue;
+            alpha.push_back({});
+            added.push_back({A_prime, std::move(alpha)});
+        }
+    }
+
+    // Merged duplicates leave gaps; close them and append the fresh productions
+    std::vector<Production> kept;
+    for (int i = 0; i < prod_count; i++) {
+        if (!removed[i]) kept.push_back(std::move(productions[i]));
+    }
+    for (Production& p : added) kept.push_back(std::move(p));
+    productions = std::move(kept);
+
+    // Drop inner members, and then their tails, once no other production refers to them
+    int sym_count = (int)st.names.size();
+    std::vector<int> candidate(sym_count), refactor(sym_count), refs(sym_count), prod_of(sym_count), dropped(sym_count), worklist;
+    for (int a = 0; a < nt_count; a++) {
+        if (!rewritten[a]) continue;
+        for (int sym : {st.nts[a], prime_of[a]}) {
+            if (sym == -1) continue;
+            refactor[sym] = 1;
+            candidate[sym] = inner[a];
+        }
+    }
+    for (int i = 0; i < (int)productions.size(); i++) {
+        prod_of[productions[i].lhs] = i;
+        for (const Alt& alt : productions[i].alts) {
+            for (int sym : alt) {
+                if (candidate[sym] && sym != productions[i].lhs) refs[sym]++;
+            }
+        }
+    }
+    for (int sym = 0; sym < sym_count; sym++) {
+        if (candidate[sym] && refs[sym] == 0) worklist.push_back(sym);
+    }
+    for (std::size_t head = 0; head < worklist.size(); head++) {
+        int X = worklist[head];
+        dropped[X] = 1;
+        for (const Alt& alt : productions[prod_of[X]].alts) {
+            for (int sym : alt) {
+                if (candidate[sym] && sym != X && --refs[sym] == 0) worklist.push_back(sym);
+            }
+        }
+    }
+    if (!worklist.empty()) {
+        std::vector<Production> live;
+        for (Production& p : productions) {
+            if (!dropped[p.lhs]) live.push_back(std::move(p));
+        }
+        productions = std::move(live);
+        std::vector<int> nts;
+        for (int sym : st.nts) {
+            st.nt_index[sym] = -1;
+            if (dropped[sym]) continue;
+            st.nt_index[sym] = (int)nts.size();
+            nts.push_back(sym);
+        }
+        st.nts = std::move(nts);
+    }
+    std::vector<int> selected;
+    for (const Production& p : productions) selected.push_back(refactor[p.lhs]);
+    factor_productions(productions, selected, st);
+}
+
+// Columns in order of first appearance, with $ last unless the grammar uses it
+constexpr std::vector<int> collect_terminals(const std::vector<Production>& productions, SymbolTable& st, std::vector<int>& term_column) {
+    int end_marker = st.intern("$");
+    term_column.assign(st.names.size(), -1);
+    std::vector<int> terminals;
+    for (const Production& p : productions) {
+        for (const Alt& alt : p.alts) {
+            for (int sym : alt) {
+                if (st.is_terminal(sym) && term_column[sym] == -1) {
+                    term_column[sym] = (int)terminals.size();
+                    terminals.push_back(sym);
+                }
+            }
+        }
+    }
+    if (term_column[end_marker] == -1) {
+        term_column[end_marker] = (int)terminals.size();
+        terminals.push_back(end_marker);
+    }
+    return terminals;
+}
+
+constexpr bool bitset_add(Bitset& set, int bit) {
+    std::uint64_t mask = std::uint64_t(1) << (bit & 63);
+    if (set[bit >> 6] & mask) return false;
+    set[bit >> 6] |= mask;
+    return true;
+}
+
+constexpr void bitset_union(Bitset& dst, const Bitset& src) {
+    for (std::size_t w = 0; w < dst.size(); w++) dst[w] |= src[w];
+}
+
+constexpr bool bitset_test(const Bitset& set, int bit) {
+    return (set[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// solve_set_equations: each component, settled after its successors, gets the
+// union of its members' sets and of everything they point to outside it
+constexpr void solve_set_equations(const Graph& g, std::vector<Bitset>& sets, int words) {
+    SccList sccs = find_sccs(g);
+    for (int c = 0; c < sccs.count(); c++) {
+        Bitset acc(words);
+        for (int m = sccs.scc_start[c]; m < sccs.scc_start[c + 1]; m++) {
+            int v = sccs.members[m];
+            bitset_union(acc, sets[v]);
+            for (int w : g[v]) {
+                if (sccs.scc_of[w] != c) bitset_union(acc, sets[w]);
+            }
+        }
+        for (int m = sccs.scc_start[c]; m < sccs.scc_start[c + 1]; m++) sets[sccs.members[m]] = acc;
+    }
+}
+
+constexpr std::vector<Bitset> compute_first_sets(const std::vector<Production>& productions, const SymbolTable& st, const std::vector<int>& term_column, const std::vector<int>& nullable, int words) {
+    std::vector<Bitset> first(st.nts.size(), Bitset(words));
+    Graph deps(st.nts.size());
+    for (const Production& p : productions) {
+        int A_idx = st.nt_index[p.lhs];
+        for (const Alt& alt : p.alts) {
+            for (int symbol : alt) {
+                if (st.is_terminal(symbol)) {
+                    bitset_add(first[A_idx], term_column[symbol]);
+                    break;
+                }
+                int sym_idx = st.nt_index[symbol];
+                if (sym_idx != A_idx) deps[A_idx].push_back(sym_idx);
+                if (!nullable[sym_idx]) break;
+            }
+        }
+    }
+    solve_set_equations(deps, first, words);
+    return first;
+}
+
+constexpr std::vector<Bitset> compute_follow_sets(const std::vector<Production>& productions, const SymbolTable& st, const std::vector<int>& term_column, const std::vector<int>& nullable,
+                                                  const std::vector<Bitset>& first, int words) {
+    std::vector<Bitset> follow(st.nts.size(), Bitset(words));
+    int start_idx = 0;
+    if (!follow.empty()) bitset_add(follow[start_idx], term_column[st.find("$")]);
+    Graph deps(st.nts.size());
+    for (const Production& p : productions) {
+        int B_idx = st.nt_index[p.lhs];
+        for (const Alt& alt : p.alts) {
+            for (std::size_t k = 0; k < alt.size(); k++) {
+                if (st.is_terminal(alt[k])) continue;
+                int A_idx = st.nt_index[alt[k]];
+                bool beta_nullable = true;
+                for (std::size_t m = k + 1; m < alt.size(); m++) {
+                    if (st.is_terminal(alt[m])) {
+                        bitset_add(follow[A_idx], term_column[alt[m]]);
+                        beta_nullable = false;
+                        break;
+                    }
+                    int beta_idx = st.nt_index[alt[m]];
+                    bitset_union(follow[A_idx], first[beta_idx]);
+                    if (!nullable[beta_idx]) {
+                        beta_nullable = false;
+                        break;
+                    }
+                }
+                if (beta_nullable && A_idx != B_idx) deps[A_idx].push_back(B_idx);
+            }
+        }
+    }
+    solve_set_equations(deps, follow, words);
+    return follow;
+}
+
+// Everything main computes for the LL(1) table, in one value
+struct Analysis {
+    SymbolTable st;
+    std::vector<Production> productions;
+    std::vector<int> terminals;
+    std::vector<int> term_column;
+    std::vector<int> nullable;
+    int words;
+    std::vector<Bitset> first;
+    std::vector<Bitset> follow;
+    // Alternatives numbered globally, production by production
+    std::vector<Alt> alts;
+    std::vector<int> alt_lhs;
+    std::vector<int> cell;
+    std::vector<Conflict> conflicts;
+};
+
+// construct_ll1_table: predict = FIRST(alpha), plus FOLLOW(A) when alpha is
+// nullable; the first alternative to predict a cell keeps it
+constexpr void fill_ll1_table(Analysis& an) {
+    const SymbolTable& st = an.st;
+    int nt_count = (int)st.nts.size();
+    int term_count = (int)an.terminals.size();
+    std::vector<std::vector<int>> nt_alts(nt_count);
+    for (const Production& p : an.productions) {
+        for (const Alt& alt : p.alts) {
+            nt_alts[st.nt_index[p.lhs]].push_back((int)an.alts.size());
+            an.alts.push_back(alt);
+            an.alt_lhs.push_back(st.nt_index[p.lhs]);
+        }
+    }
+    an.cell.assign((std::size_t)nt_count * term_count, -1);
+    for (int a = 0; a < nt_count; a++) {
+        for (int g : nt_alts[a]) {
+            const Alt& alt = an.alts[g];
+            Bitset predict(an.words);
+            bool alpha_nullable = true;
+            for (int symbol : alt) {
+                if (st.is_terminal(symbol)) {
+                    bitset_add(predict, an.term_column[symbol]);
+                    alpha_nullable = false;
+                    break;
+                }
+                int sym_idx = st.nt_index[symbol];
+                bitset_union(predict, an.first[sym_idx]);
+                if (!an.nullable[sym_idx]) {
+                    alpha_nullable = false;
+                    break;
+                }
+            }
+            if (alpha_nullable) bitset_union(predict, an.follow[a]);
+            for (int t = 0; t < term_count; t++) {
+                if (!bitset_test(predict, t)) continue;
+                int& cell = an.cell[(std::size_t)a * term_count + t];
+                if (cell != -1) {
+                    an.conflicts.push_back({a, t, cell, g});
+                    continue;
+                }
+                cell = g;
+            }
+        }
+    }
+}
+
+constexpr Analysis analyze(std::string_view text) {
+    Analysis an;
+    an.productions = parse_grammar(text, an.st);
+    left_factoring(an.productions, an.st);
+    remove_left_recursion(an.productions, an.st);
+    an.terminals = collect_terminals(an.productions, an.st, an.term_column);
+    an.nullable = compute_nullable(an.productions, an.st);
+    an.words = ((int)an.terminals.size() + 63) / 64;
+    an.first = compute_first_sets(an.productions, an.st, an.term_column, an.nullable, an.words);
+    an.follow = compute_follow_sets(an.productions, an.st, an.term_column, an.nullable, an.first, an.words);
+    fill_ll1_table(an);
+    return an;
+}
+
+constexpr TableSizes measure(std::string_view text) {
+    Analysis an = analyze(text);
+    TableSizes s{};
+    s.nt_count = (int)an.st.nts.size();
+    s.term_count = (int)an.terminals.size();
+    s.alt_count = (int)an.alts.size();
+    for (const Alt& alt : an.alts) s.code_count += (int)alt.size();
+    s.words = an.words;
+    s.hash_size = 16;
+    while (s.hash_size < s.term_count * 2) s.hash_size *= 2;
+    for (int t = 0; t < s.term_count; t++) {
+        s.name_bytes += (int)an.st.names[an.terminals[t]].size() + 1;
+        if (!an.st.patterns[an.terminals[t]].empty()) s.name_bytes += (int)an.st.patterns[an.terminals[t]].size() + 1;
+    }
+    for (int a = 0; a < s.nt_count; a++) s.name_bytes += (int)an.st.names[an.st.nts[a]].size() + 1;
+    return s;
+}
+
+template <class T>
+constexpr T build_table(std::string_view text) {
+    Analysis an = analyze(text);
+    const SymbolTable& st = an.st;
+    T t{};
+    t.start = 0;
+    t.end_column = an.term_column[st.find("$")];
+    t.conflict_count = (int)an.conflicts.size();
+    t.conflict = an.conflicts.empty() ? Conflict{-1, -1, -1, -1} : an.conflicts[0];
+    for (std::size_t i = 0; i < an.cell.size(); i++) t.cell[i] = an.cell[i];
+    int c = 0;
+    for (int g = 0; g < T::alt_count; g++) {
+        const Alt& alt = an.alts[g];
+        t.code_start[g] = c;
+        t.alt_lhs[g] = an.alt_lhs[g];
+        for (std::size_t k = alt.size(); k-- > 0;) {
+            int sym = alt[k];
+            t.code[c++] = st.is_terminal(sym) ? -(an.term_column[sym] + 1) : st.nt_index[sym];
+        }
+    }
+    t.code_start[T::alt_count] = c;
+    for (int a = 0; a < T::nt_count; a++) {
+        t.nullable[a] = an.nullable[a];
+        for (int w = 0; w < an.words; w++) {
+            t.first[(std::size_t)a * an.words + w] = an.first[a][w];
+            t.follow[(std::size_t)a * an.words + w] = an.follow[a][w];
+        }
+    }
+    int n = 0;
+    auto put = [&](const std::string& s) {
+        for (char ch : s) t.names[n++] = ch;
+        t.names[n++] = '\0';
+    };
+    for (int i = 0; i < T::term_count + T::nt_count; i++) {
+        t.name_start[i] = n;
+        put(i < T::term_count ? st.names[an.terminals[i]] : st.names[st.nts[i - T::term_count]]);
+    }
+    t.name_start[T::term_count + T::nt_count] = n;
+    for (int col = 0; col < T::term_count; col++) {
+        const std::string& pattern = st.patterns[an.terminals[col]];
+        t.pattern_start[col] = pattern.empty() ? -1 : n;
+        if (!pattern.empty()) put(pattern);
+    }
+    unsigned int mask = (unsigned int)t.term_hash.size() - 1;
+    for (int& b : t.term_hash) b = -1;
+    for (int col = 0; col < T::term_count; col++) {
+        unsigned int b = hash_symbol(t.name(col)) & mask;
+        while (t.term_hash[b] != -1) b = (b + 1) & mask;
+        t.term_hash[b] = col;
+    }
+    return t;
+}
+
+template <const auto& table, int index>
+constexpr auto name_string() {
+    constexpr std::string_view name = table.name(index);
+    FixedString<name.size() + 1> s;
+    for (std::size_t i = 0; i < name.size(); i++) s.text[i] = name[i];
+    return s;
+}
+
+} // namespace detail
+
+template <TableSizes S>
+constexpr int Table<S>::column(std::string_view spelling) const {
+    unsigned int mask = S.hash_size - 1;
+    unsigned int b = detail::hash_symbol(spelling) & mask;
+    while (term_hash[b] != -1) {
+        if (name(term_hash[b]) == spelling) return term_hash[b];
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+// Instantiated only for a conflicted table, so that the compiler's error shows
+// the cell and the two alternatives (numbered as in Code.c's conflict messages)
+template <FixedString Nonterminal, FixedString Terminal, int First, int Second>
+struct ll1_conflict {
+    static_assert(First < 0, "LL(1) conflict: the cell [Nonterminal, Terminal] is predicted by alternatives First and Second");
+    static constexpr bool value = false;
+};
+
+namespace detail {
+
+template <const auto& table>
+constexpr bool check_ll1() {
+    if constexpr (table.conflict_count > 0) {
+        constexpr Conflict c = table.conflict;
+        return ll1_conflict<name_string<table, table.term_count + c.nt>(), name_string<table, c.column>(), c.first, c.second>::value;
+    } else {
+        return true;
+    }
+}
+
+} // namespace detail
+
+template <FixedString Text>
+struct Grammar {
+    static constexpr TableSizes sizes = detail::measure(Text.view());
+    static_assert(sizes.nt_count > 0, "the grammar has no productions");
+    static constexpr Table<sizes> table = detail::build_table<Table<sizes>>(Text.view());
+    static_assert(detail::check_ll1<table>(), "the grammar is not LL(1)");
+
+    static constexpr int column(std::string_view spelling) {
+        return table.column(spelling);
+    }
+
+    static constexpr int nonterminal(std::string_view name) {
+        return table.nonterminal(name);
+    }
+};
+
+// Predictive parser over a compile-time table, as ll1_parser_feed: the stack
+// holds nonterminal indices (>= 0) and terminals encoded as -(column + 1), and
+// tokens are fed one at a time. A conflict-free table cannot expand without
+// end, so there is no expansion limit.
+template <class G>
+class Parser {
+public:
+    Parser() {
+        reset();
+    }
+
+    void reset() {
+        stack_.clear();
+        stack_.push_back(table().start);
+        position_ = 0;
+        status_ = PARSE_RUNNING;
+    }
+
+    // Consumes one token given by its table column (-1 for a token outside the grammar)
+    int feed(int column) {
+        if (status_ != PARSE_RUNNING) return status_;
+        if (column < 0) return status_ = PARSE_ERROR;
+        while (!stack_.empty()) {
+            int top = stack_.back();
+            if (top < 0) {
+                if (-top - 1 != column) break;
+                stack_.pop_back();
+                if (column == table().end_column) return status_ = PARSE_ACCEPT;
+                position_++;
+                return PARSE_RUNNING;
+            }
+            int alt = table().lookup(top, column);
+            if (alt == -1) break;
+            stack_.pop_back();
+            stack_.insert(stack_.end(), table().code.begin() + table().code_start[alt], table().code.begin() + table().code_start[alt + 1]);
+        }
+        if (stack_.empty() && column == table().end_column) return status_ = PARSE_ACCEPT;
+        return status_ = PARSE_ERROR;
+    }
+
+    int feed(std::string_view spelling) {
+        return feed(table().column(spelling));
+    }
+
+    int finish() {
+        return feed(table().end_column);
+    }
+
+    int status() const {
+        return status_;
+    }
+
+    // Tokens matched so far; on an error, the index of the offending token
+    long position() const {
+        return position_;
+    }
+
+private:
+    static constexpr const auto& table() {
+        return G::table;
+    }
+
+    std::vector<int> stack_;
+    long position_;
+    int status_;
+};
+
+} // namespace cfg
+
+#endif
@@ -0,0 +1,173 @@
+// Checks cfg_constexpr.hpp: parses with the README grammar, and compares the
+// tables the compiler builds with the ones cfg_processor saves with --emit-table.
+// tests/constexpr_check.sh builds and runs everything; by hand:
+//
+//     g++ -std=c++20 -Wall -I. -o constexpr_check tests/constexpr_check.cpp
+//     ./constexpr_check                          parse checks
+//     ./constexpr_check --grammar N > g.txt      writes grammar N
+//     ./cfg_processor g.txt g_log.txt --emit-table g.ll1
+//     ./constexpr_check --table N g.ll1          compares grammar N with the saved table
+#include "cfg_constexpr.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr cfg::FixedString expr_text = R"(E -> E + T | T
+T -> T * F | F
+F -> ( E ) | id
+)";
+
+// Indirect left recursion through an inner member, which is dropped afterwards
+constexpr cfg::FixedString indirect_text = R"(A -> B x | c
+B -> A y | d
+)";
+
+constexpr cfg::FixedString token_text = R"(%token num [0-9]+
+%token id [a-z]+
+S -> id = E ; S | ε
+E -> num | id | ( E ) | E + num
+)";
+
+using Expr = cfg::Grammar<expr_text>;
+using Indirect = cfg::Grammar<indirect_text>;
+using Tokens = cfg::Grammar<token_text>;
+
+static_assert(Expr::table.conflict_count == 0 && Indirect::table.conflict_count == 0 && Tokens::table.conflict_count == 0);
+static_assert(Expr::table.name(Expr::table.term_count + Expr::table.start) == "E");
+static_assert(Expr::column("id") != -1 && Expr::column("x") == -1);
+
+// Mirrors LL1TableHeader in Code.c
+struct SavedHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t total_size;
+    std::uint32_t nt_count;
+    std::uint32_t term_count;
+    std::uint32_t alt_count;
+    std::uint32_t start;
+    std::uint32_t end_column;
+    std::uint32_t slot_count;
+    std::uint32_t code_count;
+    std::uint32_t hash_size;
+    std::uint32_t name_bytes;
+    std::uint32_t base_off;
+    std::uint32_t check_off;
+    std::uint32_t value_off;
+    std::uint32_t code_start_off;
+    std::uint32_t code_off;
+    std::uint32_t alt_lhs_off;
+    std::uint32_t name_start_off;
+    std::uint32_t hash_off;
+    std::uint32_t pattern_start_off;
+    std::uint32_t conflict_count;
+    std::uint32_t conflict_start_off;
+    std::uint32_t conflict_col_off;
+    std::uint32_t conflict_alt_off;
+    std::uint32_t names_off;
+    std::uint64_t checksum;
+};
+static_assert(sizeof(SavedHeader) == 112);
+
+int failures = 0;
+
+void expect(bool ok, const char* what, int a, int b) {
+    if (!ok) {
+        std::printf("mismatch: %s (%d, %d)\n", what, a, b);
+        failures++;
+    }
+}
+
+int parse(std::initializer_list<std::string_view> tokens) {
+    cfg::Parser<Expr> parser;
+    for (std::string_view token : tokens) parser.feed(token);
+    return parser.finish();
+}
+
+void check_parses() {
+    expect(parse({"id", "+", "id", "*", "id"}) == cfg::PARSE_ACCEPT, "id + id * id accepted", 0, 0);
+    expect(parse({"(", "id", "+", "id", ")", "*", "id"}) == cfg::PARSE_ACCEPT, "( id + id ) * id accepted", 0, 0);
+    expect(parse({"id", "+"}) == cfg::PARSE_ERROR, "id + rejected", 0, 0);
+    expect(parse({"id", "id"}) == cfg::PARSE_ERROR, "id id rejected", 0, 0);
+    expect(parse({"id", "-", "id"}) == cfg::PARSE_ERROR, "unknown token rejected", 0, 0);
+    expect(parse({}) == cfg::PARSE_ERROR, "empty input rejected", 0, 0);
+}
+
+template <class G>
+void compare_with_saved(const char* path) {
+    constexpr const auto& t = G::table;
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> block((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    SavedHeader h;
+    if (block.size() < sizeof h) {
+        std::printf("%s: not a saved table\n", path);
+        std::exit(1);
+    }
+    std::memcpy(&h, block.data(), sizeof h);
+    if (std::memcmp(h.magic, "LL1T", 4) != 0 || h.total_size != block.size()) {
+        std::printf("%s: not a saved table\n", path);
+        std::exit(1);
+    }
+    auto at = [&](std::uint32_t off, int i) {
+        std::int32_t v;
+        std::memcpy(&v, block.data() + off + 4 * (std::size_t)i, 4);
+        return (int)v;
+    };
+
+    expect(h.nt_count == (std::uint32_t)t.nt_count, "nt_count", h.nt_count, t.nt_count);
+    expect(h.term_count == (std::uint32_t)t.term_count, "term_count", h.term_count, t.term_count);
+    expect(h.alt_count == (std::uint32_t)t.alt_count, "alt_count", h.alt_count, t.alt_count);
+    if (failures) return;
+    expect(h.start == (std::uint32_t)t.start, "start", h.start, t.start);
+    expect(h.end_column == (std::uint32_t)t.end_column, "end_column", h.end_column, t.end_column);
+    expect(h.conflict_count == (std::uint32_t)t.conflict_count, "conflict_count", h.conflict_count, t.conflict_count);
+    for (int i = 0; i < t.term_count + t.nt_count; i++) {
+        expect(std::string_view(block.data() + h.names_off + at(h.name_start_off, i)) == t.name(i), "name", i, 0);
+    }
+    for (int c = 0; c < t.term_count; c++) {
+        int p = at(h.pattern_start_off, c);
+        expect((p == -1 ? std::string_view() : std::string_view(block.data() + h.names_off + p)) == t.pattern(c), "pattern", c, 0);
+    }
+    for (int a = 0; a < t.nt_count; a++) {
+        for (int c = 0; c < t.term_count; c++) {
+            int slot = at(h.base_off, a) + c;
+            int saved = slot >= 0 && slot < (int)h.slot_count && at(h.check_off, slot) == a ? at(h.value_off, slot) : -1;
+            expect(saved == t.lookup(a, c), "cell", a, c);
+        }
+    }
+    for (int i = 0; i <= t.alt_count; i++) expect(at(h.code_start_off, i) == t.code_start[i], "code_start", i, 0);
+    expect((int)h.code_count == t.code_start[t.alt_count], "code_count", h.code_count, t.code_start[t.alt_count]);
+    for (int i = 0; i < t.code_start[t.alt_count] && i < (int)h.code_count; i++) expect(at(h.code_off, i) == t.code[i], "code", i, 0);
+    for (int i = 0; i < t.alt_count; i++) expect(at(h.alt_lhs_off, i) == t.alt_lhs[i], "alt_lhs", i, 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::string_view texts[] = {expr_text.view(), indirect_text.view(), token_text.view()};
+    void (*compares[])(const char*) = {compare_with_saved<Expr>, compare_with_saved<Indirect>, compare_with_saved<Tokens>};
+    int n = argc > 2 ? std::atoi(argv[2]) : -1;
+    if (argc == 3 && std::strcmp(argv[1], "--grammar") == 0 && n >= 0 && n < 3) {
+        std::fwrite(texts[n].data(), 1, texts[n].size(), stdout);
+        return 0;
+    }
+    if (argc == 4 && std::strcmp(argv[1], "--table") == 0 && n >= 0 && n < 3) {
+        compares[n](argv[3]);
+    } else if (argc == 1) {
+        check_parses();
+    } else {
+        std::printf("Usage: %s [--grammar N | --table N file.ll1]\n", argv[0]);
+        return 1;
+    }
+    if (failures) std::printf("%d mismatches\n", failures);
+    return failures ? 1 : 0;
+}
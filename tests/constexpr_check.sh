@@ -0,0 +1,33 @@
+#!/bin/sh
+# Checks cfg_constexpr.hpp against the program. Run from the repository root
+# after building cfg_processor:
+#
+#     sh tests/constexpr_check.sh ./cfg_processor
+#
+# Builds tests/constexpr_check.cpp, runs its parse checks, compares each of its
+# grammars with the table cfg_processor saves for it, and checks that
+# tests/constexpr_conflict.cpp fails to compile with the conflicted cell named.
+set -e
+processor=${1:-./cfg_processor}
+CXX=${CXX:-g++}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+$CXX -std=c++20 -Wall -I. -o "$dir/constexpr_check" tests/constexpr_check.cpp
+"$dir/constexpr_check"
+for n in 0 1 2; do
+    "$dir/constexpr_check" --grammar $n > "$dir/g$n.txt"
+    "$processor" "$dir/g$n.txt" "$dir/g$n.log" --emit-table "$dir/g$n.ll1" > /dev/null
+    "$dir/constexpr_check" --table $n "$dir/g$n.ll1"
+done
+
+if $CXX -std=c++20 -I. -fsyntax-only tests/constexpr_conflict.cpp 2> "$dir/conflict.txt"; then
+    echo "tests/constexpr_conflict.cpp compiled, but its grammar is not LL(1)"
+    exit 1
+fi
+if ! grep -q "ll1_conflict<cfg::FixedString<3>{\"S\\\\\\?'\"}, cfg::FixedString<5>{\"else\"}, 3, 4>" "$dir/conflict.txt"; then
+    echo "tests/constexpr_conflict.cpp failed without naming the [S', else] conflict:"
+    cat "$dir/conflict.txt"
+    exit 1
+fi
+echo "cfg_constexpr.hpp matches $processor"
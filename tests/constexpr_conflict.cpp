@@ -0,0 +1,13 @@
+// Must not compile: the dangling else is not LL(1). tests/constexpr_check.sh
+// checks that the error names the conflicted cell, as shown in the README:
+//
+//     g++ -std=c++20 -I. -fsyntax-only tests/constexpr_conflict.cpp 2>&1 | grep ll1_conflict
+#include "cfg_constexpr.hpp"
+
+using DanglingElse = cfg::Grammar<R"(
+S -> if E then S | if E then S else S | other
+E -> cond
+)">;
+
+// Naming the table instantiates the analysis
+constexpr const auto& table = DanglingElse::table;
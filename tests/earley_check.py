@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""Checks that the general parser stays linear on right recursion.
+
+S -> a S | B, B -> a is unambiguous but not LL(1), so --parse goes through the
+Earley parser. Without the FOLLOW filter on completions every token re-completes
+the whole right-recursive chain, giving a quadratic number of items. The check
+parses n tokens for growing n and fails when the items per token grow, or when
+the largest input takes more than a few times the time per token of the smallest.
+
+    python3 tests/earley_check.py ./cfg_processor
+"""
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+SIZES = [1000, 4000, 16000]
+
+
+def parse(binary, d, n):
+    grammar = os.path.join(d, 'g.txt')
+    tokens = os.path.join(d, 'tokens.txt')
+    open(grammar, 'w').write('S -> a S | B\nB -> a\n')
+    open(tokens, 'w').write(' '.join(['a'] * n) + '\n')
+    run = subprocess.run([binary, grammar, os.path.join(d, 'log.txt'), '--parse', tokens], capture_output=True, text=True)
+    accepted = re.search(r'Input accepted: (\d+) tokens in ([\d.]+) s', run.stdout)
+    items = re.search(r'Earley items: (\d+)', run.stdout)
+    if run.returncode != 0 or not accepted or not items or int(accepted.group(1)) != n:
+        print('n=%d: parse failed\n%s%s' % (n, run.stdout[-2000:], run.stderr[-2000:]))
+        sys.exit(1)
+    return int(items.group(1)), float(accepted.group(2))
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1])
+    with tempfile.TemporaryDirectory() as d:
+        results = [parse(binary, d, n) for n in SIZES]
+    failed = False
+    for n, (items, seconds) in zip(SIZES, results):
+        print('n=%d: %d items (%.1f per token), %.3f s' % (n, items, items / n, seconds))
+    per_token = [items / n for n, (items, _) in zip(SIZES, results)]
+    if per_token[-1] > per_token[0] * 1.1:
+        print('items per token grow with the input')
+        failed = True
+    # Timer resolution makes small inputs noisy, so only gross growth fails
+    small, large = max(results[0][1], 0.001) / SIZES[0], results[-1][1] / SIZES[-1]
+    if large > small * 4:
+        print('time per token grows with the input')
+        failed = True
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
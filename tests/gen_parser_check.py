@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Checks the parser from --gen-parser against --parse on the same inputs.
+
+For each seed a random grammar is written over terminals that share prefixes
+(a, ab, b, +, ++, (, ), id). Grammars whose table has conflicts are skipped,
+since --parse uses the general parser for them. The generated parser is built
+with -DCFG_PARSER_MAIN, and for a few random sentences the two accept/reject
+lines must be the same. Each sentence is tried with blanks between its tokens,
+without any blanks, and with one token left out.
+
+    python3 tests/gen_parser_check.py ./cfg_processor [count] [first_seed]
+"""
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+TERMINALS = ['a', 'ab', 'b', '+', '++', '(', ')', 'id']
+
+
+def random_grammar(r):
+    nts = ['N%d' % i for i in range(r.randint(1, 6))]
+    terms = r.sample(TERMINALS, r.randint(2, len(TERMINALS)))
+
+    def alt():
+        syms = [r.choice(terms)] + [r.choice(nts + terms) for _ in range(r.choice([0, 1, 1, 2, 3]))]
+        return ' '.join(syms)
+
+    rules = ['%s -> %s' % (a, ' | '.join([alt() for _ in range(r.randint(1, 3))] + (['ε'] if r.random() < 0.3 else []))) for a in nts]
+    return '\n'.join(rules) + '\n'
+
+
+def outcome(text):
+    line = next((l for l in text.split('\n') if l.startswith('Input ')), text.strip()[-200:])
+    return re.sub(r' in [\d.]+ s .*', '', line)
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+    first_seed = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    failures = compared = skipped = 0
+    with tempfile.TemporaryDirectory() as d:
+        path = lambda name: os.path.join(d, name)
+        for seed in range(first_seed, first_seed + count):
+            r = random.Random(seed)
+            open(path('g.txt'), 'w', encoding='utf-8').write(random_grammar(r))
+            run = subprocess.run([binary, path('g.txt'), path('log.txt'), '--gen-parser', path('p.cpp')], capture_output=True, text=True)
+            if run.returncode != 0 or 'not LL(1)' in run.stdout:
+                skipped += 1
+                continue
+            build = subprocess.run(['g++', '-O1', '-std=c++17', '-DCFG_PARSER_MAIN', '-o', path('p'), path('p.cpp')], capture_output=True, text=True)
+            if build.returncode != 0:
+                print('seed %d: the generated parser does not compile\n%s' % (seed, build.stderr[-2000:]))
+                failures += 1
+                continue
+            sentences = subprocess.run([binary, '--generate', path('s.txt'), path('g.txt'), '--sentences', '4', '--max-size', '40', '--seed', str(seed)],
+                                       capture_output=True, text=True)
+            if sentences.returncode != 0:
+                skipped += 1
+                continue
+            for sentence in open(path('s.txt'), encoding='utf-8').read().split('\n')[:4]:
+                tokens = sentence.split()
+                dropped = list(tokens)
+                if dropped:
+                    del dropped[r.randrange(len(dropped))]
+                for text in [' '.join(tokens), ''.join(tokens), ' '.join(dropped)]:
+                    open(path('t.txt'), 'w', encoding='utf-8').write(text + '\n')
+                    table = outcome(subprocess.run([binary, path('g.txt'), path('log.txt'), '--parse', path('t.txt')], capture_output=True, text=True).stdout)
+                    generated = outcome(subprocess.run([path('p'), path('t.txt')], capture_output=True, text=True).stdout)
+                    compared += 1
+                    if table != generated:
+                        print('seed %d: %r\n  --parse:    %s\n  generated:  %s' % (seed, text, table, generated))
+                        failures += 1
+    print('%d inputs compared, %d grammars skipped, %d differences' % (compared, skipped, failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Checks --incremental against a from-scratch analysis.
+
+For each seed a random grammar and a random edit file are written. The edits
+are applied with --incremental, and the grammar after the edits is analysed
+again with --incremental /dev/null; the two "After Edits" sections (grammar,
+FIRST, FOLLOW and table) must be identical. FIRST and FOLLOW are also checked
+against a plain fixed-point computation here.
+
+    python3 tests/incremental_check.py ./cfg_processor [count] [first_seed]
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+
+def random_case(r):
+    n = r.randint(1, 10)
+    nts = ['N%d' % i for i in range(n)]
+    terms = ['t%d' % i for i in range(r.randint(1, 6))]
+    extra = ['N%d' % i for i in range(n, n + 3)]
+
+    def alt():
+        length = r.choice([0, 0, 1, 1, 2, 3, 4])
+        return ' '.join(r.choice(nts + terms + extra[:1]) for _ in range(length)) or 'ε'
+
+    rules = {a: [alt() for _ in range(r.randint(1, 3))] for a in nts}
+    grammar = ''.join('%s -> %s\n' % (a, ' | '.join(rules[a])) for a in nts)
+    edits = []
+    for _ in range(r.randint(1, 25)):
+        # Now and then a terminal gets alternatives, which reloads the grammar
+        a = r.choice(nts + extra + terms[:1] if r.random() < 0.1 else nts + extra[:2])
+        op = r.choice('++--=')
+        if op == '-' and rules.get(a) and r.random() < 0.8:
+            edits.append('- %s -> %s' % (a, r.choice(rules[a])))
+        else:
+            alts = [alt() for _ in range(r.randint(0 if op == '=' else 1, 2))]
+            edits.append('%s %s -> %s' % (op, a, ' | '.join(alts)))
+    return grammar, '\n'.join(edits) + '\n'
+
+
+def after_edits(log_file):
+    log = open(log_file, encoding='utf-8').read()
+    return log[log.index('After Edits:\n'):]
+
+
+def section(text, title):
+    body = text[text.index(title + '\n') + len(title) + 1:]
+    return body[:body.index('\n\n')].split('\n') if not body.startswith('\n') else []
+
+
+def reference_sets(grammar_lines):
+    rules, order = [], []
+    for line in grammar_lines:
+        lhs, rhs = line.split(' ->', 1)
+        alts = [[] if x.strip() == 'ε' else x.split() for x in rhs.split(' | ')] if rhs.strip() else []
+        order.append(lhs)
+        rules.append((lhs, alts))
+    nts = set(order)
+    nullable = {a: False for a in nts}
+    first = {a: set() for a in nts}
+    follow = {a: set() for a in nts}
+    changed = True
+    while changed:
+        changed = False
+        for a, alts in rules:
+            for syms in alts:
+                if not nullable[a] and all(s in nts and nullable[s] for s in syms):
+                    nullable[a] = changed = True
+                for s in syms:
+                    add = first[s] if s in nts else {s}
+                    if not add <= first[a]:
+                        first[a] |= add
+                        changed = True
+                    if s not in nts or not nullable[s]:
+                        break
+    if order:
+        follow[order[0]].add('$')
+    changed = True
+    while changed:
+        changed = False
+        for a, alts in rules:
+            for syms in alts:
+                for k, s in enumerate(syms):
+                    if s not in nts:
+                        continue
+                    add, rest_nullable = set(), True
+                    for t in syms[k + 1:]:
+                        add |= first[t] if t in nts else {t}
+                        if t not in nts or not nullable[t]:
+                            rest_nullable = False
+                            break
+                    if rest_nullable:
+                        add |= follow[a]
+                    if not add <= follow[s]:
+                        follow[s] |= add
+                        changed = True
+    return first, follow
+
+
+def logged_sets(lines, label):
+    sets = {}
+    for line in lines:
+        name = line[len(label) + 1:line.index(') = {')]
+        body = line[line.index('{') + 1:line.rindex('}')].strip()
+        sets[name] = set(x.strip() for x in body.split(', ')) if body else set()
+    return sets
+
+
+def run_ok(seed, command):
+    run = subprocess.run(command, capture_output=True, text=True)
+    if run.returncode != 0:
+        print('seed %d: %s exited with status %d\n%s' % (seed, ' '.join(command[3:]), run.returncode, run.stderr[-2000:]))
+    return run.returncode == 0
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    first_seed = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    failures = 0
+    with tempfile.TemporaryDirectory() as d:
+        path = lambda name: os.path.join(d, name)
+        for seed in range(first_seed, first_seed + count):
+            grammar, edits = random_case(random.Random(seed))
+            open(path('g.txt'), 'w', encoding='utf-8').write(grammar)
+            open(path('e.txt'), 'w', encoding='utf-8').write(edits)
+            if not run_ok(seed, [binary, path('g.txt'), path('edited.log'), '--incremental', path('e.txt')]):
+                failures += 1
+                continue
+            edited = after_edits(path('edited.log'))
+            grammar_lines = section(edited, 'After Edits:')
+            open(path('g2.txt'), 'w', encoding='utf-8').write('\n'.join(grammar_lines) + '\n')
+            if not run_ok(seed, [binary, path('g2.txt'), path('scratch.log'), '--incremental', '/dev/null']):
+                failures += 1
+                continue
+            if edited != after_edits(path('scratch.log')):
+                print('seed %d: incremental result differs from a fresh analysis' % seed)
+                failures += 1
+                continue
+            first, follow = reference_sets(grammar_lines)
+            if logged_sets(section(edited, 'First Sets:'), 'First') != first or logged_sets(section(edited, 'Follow Sets:'), 'Follow') != follow:
+                print('seed %d: FIRST or FOLLOW differs from the reference' % seed)
+                failures += 1
+    print('%d of %d edit sequences failed' % (failures, count))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
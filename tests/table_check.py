@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""Checks that every table --emit-table writes can be loaded back.
+
+Each grammar is saved with --emit-table, and its inputs are parsed both in
+process (--parse) and from the saved table (--load-table ... --parse). The
+accept/reject lines must be the same. The grammars include one without any
+productions, whose table has no rows and start 0.
+
+    python3 tests/table_check.py ./cfg_processor
+"""
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+GRAMMARS = [
+    ('', ['', 'x', 'x y']),
+    ('S -> a S | b\n', ['b', 'a a b', 'a', '', 'b b']),
+    ('E -> T + E | T\nT -> id | ( E )\n', ['id', 'id + ( id + id )', '( id', 'id +']),
+]
+
+
+def outcome(text):
+    line = next((l for l in text.split('\n') if l.startswith('Input ')), text.strip()[-200:])
+    return re.sub(r' in [\d.]+ s .*', '', line)
+
+
+def main():
+    binary = os.path.abspath(sys.argv[1])
+    failures = compared = 0
+    with tempfile.TemporaryDirectory() as d:
+        path = lambda name: os.path.join(d, name)
+        for n, (grammar, inputs) in enumerate(GRAMMARS):
+            open(path('g.txt'), 'w', encoding='utf-8').write(grammar)
+            emit = subprocess.run([binary, path('g.txt'), path('log.txt'), '--emit-table', path('g.ll1')], capture_output=True, text=True)
+            if emit.returncode != 0:
+                print('grammar %d: --emit-table failed\n%s%s' % (n, emit.stdout[-2000:], emit.stderr[-2000:]))
+                failures += 1
+                continue
+            for text in inputs:
+                open(path('t.txt'), 'w', encoding='utf-8').write(text + '\n')
+                built = subprocess.run([binary, path('g.txt'), path('log.txt'), '--parse', path('t.txt')], capture_output=True, text=True)
+                loaded = subprocess.run([binary, '--load-table', path('g.ll1'), '--parse', path('t.txt')], capture_output=True, text=True)
+                compared += 1
+                if loaded.returncode != 0 or outcome(built.stdout) != outcome(loaded.stdout):
+                    print('grammar %d: %r\n  --parse:      %s\n  --load-table: %s%s' % (n, text, outcome(built.stdout), outcome(loaded.stdout), loaded.stderr[-2000:]))
+                    failures += 1
+    print('%d inputs compared, %d differences' % (compared, failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()